@@ -0,0 +1,407 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Provisioning for the credential provider, run from an elevated prompt:
+//
+//   AbsoluteIDAdmin pair
+//       Creates a new pairing key and shows it, to be entered in the phone app.
+//       Requests signed with the previous key are refused from then on.
+//
+//   AbsoluteIDAdmin vault init [records]
+//       Creates a new vault key and an empty vault with room for that many users,
+//       a power of two, 64 if not given. Any passwords stored before are lost.
+//
+//   AbsoluteIDAdmin vault set <SID>
+//       Asks for the user's password and seals it into the vault, raising the
+//       version the credential provider caches it by.
+//
+// Every vault written gets a higher generation, which is then recorded in the
+// registry; the credential provider refuses a vault below it, so putting back an
+// old copy of the file does not bring back an old password.
+
+#include <windows.h>
+#include <bcrypt.h>
+#include <sddl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "RequestAuth.h"
+#include "SealedKey.h"
+#include "SealedVault.h"
+#include "SecretProvider.h"
+
+#pragma comment(lib, "Bcrypt.lib")
+
+static const WCHAR c_szSettingsKey[] = L"SOFTWARE\\AbsoluteID";
+
+// The vault is written here first and then renamed over the old one, so that
+// the credential provider never maps half a vault.
+static const WCHAR c_szNewVaultFile[] = L"SecretVault.new";
+
+static const DWORD c_cDefaultVaultRecords = 64;
+static const DWORD c_cMaxVaultRecords = 65536;
+
+static int _Fail(PCWSTR pszWhat, HRESULT hr)
+{
+    fwprintf(stderr, L"%s failed: 0x%08X\n", pszWhat, static_cast<unsigned int>(hr));
+    return 1;
+}
+
+// Replaces the pairing key and starts the phone's counter again.
+static int _Pair()
+{
+    BYTE rgbKey[c_cbChaChaKey];
+    HRESULT hr = SealedKeyCreate(c_szPairingKeyFile, rgbKey, sizeof(rgbKey));
+    if (FAILED(hr))
+    {
+        return _Fail(L"Creating the pairing key", hr);
+    }
+
+    HKEY hKey = nullptr;
+    LSTATUS status = RegCreateKeyExW(HKEY_LOCAL_MACHINE, c_szSettingsKey, 0, nullptr, REG_OPTION_NON_VOLATILE, KEY_SET_VALUE, nullptr, &hKey, nullptr);
+    if (status == ERROR_SUCCESS)
+    {
+        ULONGLONG ullCounter = 0;
+        status = RegSetValueExW(hKey, c_szPairingCounterValue, 0, REG_QWORD, reinterpret_cast<const BYTE*>(&ullCounter), sizeof(ullCounter));
+        RegCloseKey(hKey);
+    }
+    if (status != ERROR_SUCCESS)
+    {
+        SecureZeroMemory(rgbKey, sizeof(rgbKey));
+        return _Fail(L"Resetting the pairing counter", HRESULT_FROM_WIN32(status));
+    }
+
+    wprintf(L"Enter this pairing key in the phone app:\n\n    ");
+    for (size_t i = 0; i < sizeof(rgbKey); i++)
+    {
+        wprintf(L"%02x", rgbKey[i]);
+    }
+    wprintf(L"\n");
+    SecureZeroMemory(rgbKey, sizeof(rgbKey));
+    return 0;
+}
+
+static HRESULT _GenerateRandom(_Out_writes_bytes_(cb) BYTE *pb, size_t cb)
+{
+    NTSTATUS status = BCryptGenRandom(nullptr, pb, static_cast<ULONG>(cb), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+    return BCRYPT_SUCCESS(status) ? S_OK : HRESULT_FROM_NT(status);
+}
+
+// Returns the generation of the last vault written; 0 if none was.
+static DWORD _VaultGenerationFloor()
+{
+    DWORD dwGeneration = 0;
+    DWORD cbData = sizeof(dwGeneration);
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, c_szSettingsKey, c_szVaultGenerationValue, RRF_RT_REG_DWORD, nullptr, &dwGeneration, &cbData) != ERROR_SUCCESS)
+    {
+        dwGeneration = 0;
+    }
+    return dwGeneration;
+}
+
+// Returns the generation for the next vault: above both the registry's and that
+// of the vault on disk, which is ahead if recording its generation failed.
+static DWORD _NextVaultGeneration(const std::vector<BYTE> &rgbVault)
+{
+    DWORD dwGeneration = _VaultGenerationFloor();
+    DWORD dwVaultGeneration = SealedVaultGeneration(rgbVault.data(), rgbVault.size());
+    return ((dwVaultGeneration > dwGeneration) ? dwVaultGeneration : dwGeneration) + 1;
+}
+
+// Reads the whole vault into *prgbVault, failing if it is not a vault.
+static HRESULT _ReadVault(_Out_ std::vector<BYTE> *prgbVault)
+{
+    prgbVault->clear();
+    WCHAR szPath[MAX_PATH];
+    HRESULT hr = SealedKeyGetPath(c_szVaultFile, szPath, ARRAYSIZE(szPath));
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    HANDLE hFile = CreateFileW(szPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    LARGE_INTEGER liSize = {};
+    if (!GetFileSizeEx(hFile, &liSize))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (liSize.QuadPart > static_cast<LONGLONG>(SealedVaultSize(c_cMaxVaultRecords)))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    if (SUCCEEDED(hr))
+    {
+        prgbVault->resize(static_cast<size_t>(liSize.QuadPart));
+        DWORD cbRead = 0;
+        if (!ReadFile(hFile, prgbVault->data(), static_cast<DWORD>(prgbVault->size()), &cbRead, nullptr))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        else if (cbRead != prgbVault->size() || !SealedVaultIsValid(prgbVault->data(), prgbVault->size()))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+    }
+    CloseHandle(hFile);
+
+    if (FAILED(hr))
+    {
+        prgbVault->clear();
+    }
+    return hr;
+}
+
+// Replaces the vault with rgbVault and records its generation as the lowest the
+// credential provider accepts.
+static HRESULT _WriteVault(const std::vector<BYTE> &rgbVault)
+{
+    WCHAR szPath[MAX_PATH];
+    WCHAR szNewPath[MAX_PATH];
+    HRESULT hr = SealedKeyGetPath(c_szVaultFile, szPath, ARRAYSIZE(szPath));
+    if (SUCCEEDED(hr))
+    {
+        hr = SealedKeyGetPath(c_szNewVaultFile, szNewPath, ARRAYSIZE(szNewPath));
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // The file inherits the directory's access list.
+    HANDLE hFile = CreateFileW(szNewPath, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    DWORD cbWritten = 0;
+    if (!WriteFile(hFile, rgbVault.data(), static_cast<DWORD>(rgbVault.size()), &cbWritten, nullptr) || !FlushFileBuffers(hFile))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr) && !MoveFileExW(szNewPath, szPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    if (FAILED(hr))
+    {
+        DeleteFileW(szNewPath);
+        return hr;
+    }
+
+    HKEY hKey = nullptr;
+    LSTATUS status = RegCreateKeyExW(HKEY_LOCAL_MACHINE, c_szSettingsKey, 0, nullptr, REG_OPTION_NON_VOLATILE, KEY_SET_VALUE, nullptr, &hKey, nullptr);
+    if (status == ERROR_SUCCESS)
+    {
+        DWORD dwGeneration = SealedVaultGeneration(rgbVault.data(), rgbVault.size());
+        status = RegSetValueExW(hKey, c_szVaultGenerationValue, 0, REG_DWORD, reinterpret_cast<const BYTE*>(&dwGeneration), sizeof(dwGeneration));
+        RegCloseKey(hKey);
+    }
+    return HRESULT_FROM_WIN32(status);
+}
+
+// Reads a line from the console without echoing it, dropping the line break.
+static HRESULT _ReadPassword(_In_ PCWSTR pszPrompt, _Out_writes_(cch) PWSTR psz, size_t cch)
+{
+    HANDLE hInput = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD dwMode = 0;
+    bool fConsole = (GetConsoleMode(hInput, &dwMode) != FALSE);
+    if (fConsole)
+    {
+        SetConsoleMode(hInput, dwMode & ~ENABLE_ECHO_INPUT);
+    }
+
+    wprintf(L"%s: ", pszPrompt);
+    fflush(stdout);
+    HRESULT hr = (fgetws(psz, static_cast<int>(cch), stdin) != nullptr) ? S_OK : HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    if (fConsole)
+    {
+        SetConsoleMode(hInput, dwMode);
+        wprintf(L"\n");
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        size_t cchRead = wcslen(psz);
+        if (cchRead == 0 || psz[cchRead - 1] != L'\n')
+        {
+            // Longer than the buffer, or cut short.
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_PASSWORD);
+        }
+        else
+        {
+            psz[--cchRead] = L'\0';
+            if (cchRead != 0 && psz[cchRead - 1] == L'\r')
+            {
+                psz[--cchRead] = L'\0';
+            }
+        }
+    }
+    return hr;
+}
+
+// Replaces the vault key and the vault with an empty one of cRecords records.
+static int _VaultInit(DWORD cRecords)
+{
+    std::vector<BYTE> rgbOldVault;
+    _ReadVault(&rgbOldVault);
+
+    std::vector<BYTE> rgbVault(SealedVaultSize(cRecords));
+    if (!SealedVaultInitialize(rgbVault.data(), rgbVault.size(), cRecords, _NextVaultGeneration(rgbOldVault)))
+    {
+        return _Fail(L"Creating the vault", E_INVALIDARG);
+    }
+
+    BYTE rgbKey[c_cbChaChaKey];
+    HRESULT hr = SealedKeyCreate(c_szVaultKeyFile, rgbKey, sizeof(rgbKey));
+    SecureZeroMemory(rgbKey, sizeof(rgbKey));
+    if (FAILED(hr))
+    {
+        return _Fail(L"Creating the vault key", hr);
+    }
+
+    hr = _WriteVault(rgbVault);
+    if (FAILED(hr))
+    {
+        return _Fail(L"Writing the vault", hr);
+    }
+    wprintf(L"Created a vault for %u users.\n", cRecords);
+    return 0;
+}
+
+// Seals the SID's password into a new generation of the vault.
+static int _VaultSet(_In_ PCWSTR pszSid)
+{
+    // Stored in the canonical form, which is also what the credential provider looks up.
+    PSID pSid = nullptr;
+    PWSTR pszCanonicalSid = nullptr;
+    if (!ConvertStringSidToSidW(pszSid, &pSid))
+    {
+        return _Fail(L"Reading the SID", HRESULT_FROM_WIN32(GetLastError()));
+    }
+    BOOL fConverted = ConvertSidToStringSidW(pSid, &pszCanonicalSid);
+    LocalFree(pSid);
+    if (!fConverted)
+    {
+        return _Fail(L"Reading the SID", HRESULT_FROM_WIN32(GetLastError()));
+    }
+    const char16_t *pchSid = reinterpret_cast<const char16_t*>(pszCanonicalSid);
+    size_t cchSid = wcslen(pszCanonicalSid);
+
+    PCWSTR pszWhat = L"Reading the vault";
+    std::vector<BYTE> rgbVault;
+    HRESULT hr = _ReadVault(&rgbVault);
+
+    BYTE rgbKey[c_cbChaChaKey];
+    if (SUCCEEDED(hr))
+    {
+        pszWhat = L"Reading the vault key";
+        hr = SealedKeyLoad(c_szVaultKeyFile, rgbKey, sizeof(rgbKey));
+    }
+
+    // Room for the line break, so that a password too long to store is noticed.
+    WCHAR szPassword[c_cchVaultSecret + 1];
+    WCHAR szConfirm[ARRAYSIZE(szPassword)];
+    if (SUCCEEDED(hr))
+    {
+        pszWhat = L"Reading the password";
+        hr = _ReadPassword(L"Password", szPassword, ARRAYSIZE(szPassword));
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = _ReadPassword(L"Confirm password", szConfirm, ARRAYSIZE(szConfirm));
+    }
+    if (SUCCEEDED(hr) && wcscmp(szPassword, szConfirm) != 0)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_PASSWORD);
+    }
+
+    // One nonce for each record resealed, and one for the password.
+    std::vector<BYTE> rgbNonces;
+    if (SUCCEEDED(hr))
+    {
+        pszWhat = L"Generating nonces";
+        size_t cRecords = (rgbVault.size() - sizeof(SEALED_VAULT_HEADER)) / sizeof(SEALED_VAULT_RECORD);
+        rgbNonces.resize((cRecords + 1) * c_cbChaChaNonce);
+        hr = _GenerateRandom(rgbNonces.data(), rgbNonces.size());
+    }
+
+    DWORD dwSecretVersion = 1;
+    if (SUCCEEDED(hr))
+    {
+        const SEALED_VAULT_RECORD *pRecord = SealedVaultFind(rgbVault.data(), rgbVault.size(), pchSid, cchSid);
+        if (pRecord != nullptr)
+        {
+            dwSecretVersion = SealedVaultRecordVersion(*pRecord) + 1;
+        }
+
+        // Sealed with another key, or changed since it was written.
+        pszWhat = L"Resealing the vault";
+        if (!SealedVaultReseal(rgbVault.data(), rgbVault.size(), rgbKey, _NextVaultGeneration(rgbVault), rgbNonces.data()))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+    }
+    if (SUCCEEDED(hr))
+    {
+        pszWhat = L"Storing the password";
+        if (!SealedVaultStore(rgbVault.data(), rgbVault.size(), rgbKey, &rgbNonces[rgbNonces.size() - c_cbChaChaNonce],
+                              pchSid, cchSid, dwSecretVersion,
+                              reinterpret_cast<const char16_t*>(szPassword), wcslen(szPassword)))
+        {
+            // The vault is full; it has to be created again with more records.
+            hr = HRESULT_FROM_WIN32(ERROR_DISK_FULL);
+        }
+    }
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    SecureZeroMemory(szConfirm, sizeof(szConfirm));
+    SecureZeroMemory(rgbKey, sizeof(rgbKey));
+
+    if (SUCCEEDED(hr))
+    {
+        pszWhat = L"Writing the vault";
+        hr = _WriteVault(rgbVault);
+    }
+    if (SUCCEEDED(hr))
+    {
+        wprintf(L"Stored version %u of the password for %s.\n", dwSecretVersion, pszCanonicalSid);
+    }
+    LocalFree(pszCanonicalSid);
+    return SUCCEEDED(hr) ? 0 : _Fail(pszWhat, hr);
+}
+
+int __cdecl wmain(int argc, _In_reads_(argc) PWSTR argv[])
+{
+    if (argc == 2 && _wcsicmp(argv[1], L"pair") == 0)
+    {
+        return _Pair();
+    }
+    if ((argc == 3 || argc == 4) && _wcsicmp(argv[1], L"vault") == 0 && _wcsicmp(argv[2], L"init") == 0)
+    {
+        DWORD cRecords = (argc == 4) ? wcstoul(argv[3], nullptr, 10) : c_cDefaultVaultRecords;
+        if (cRecords <= c_cMaxVaultRecords && SealedVaultSize(cRecords) != 0)
+        {
+            return _VaultInit(cRecords);
+        }
+    }
+    if (argc == 4 && _wcsicmp(argv[1], L"vault") == 0 && _wcsicmp(argv[2], L"set") == 0)
+    {
+        return _VaultSet(argv[3]);
+    }
+
+    fwprintf(stderr, L"usage: AbsoluteIDAdmin pair\n"
+                     L"       AbsoluteIDAdmin vault init [records]\n"
+                     L"       AbsoluteIDAdmin vault set <SID>\n");
+    return 2;
+}
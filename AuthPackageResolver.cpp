@@ -0,0 +1,78 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The package id is published in one 64-bit word, so readers never see a torn
+// value. A package id is a ULONG, which leaves -1 free to mean there is none.
+// CLsaAuthPackageSource is implemented in helpers.cpp with the other LSA calls,
+// which keeps this file free of the LSA headers.
+
+#include "AuthPackageResolver.h"
+
+static const LONGLONG c_llUnresolved = -1;
+
+CAuthPackageResolver::CAuthPackageResolver(_In_ IAuthPackageSource *pSource) :
+    _pSource(pSource),
+    _llPackage(c_llUnresolved),
+    _cResolves(0),
+    _cLookups(0)
+{
+    InitializeSRWLock(&_lockLookup);
+}
+
+CAuthPackageResolver &CAuthPackageResolver::Instance()
+{
+    static CLsaAuthPackageSource s_source;
+    static CAuthPackageResolver s_resolver(&s_source);
+    return s_resolver;
+}
+
+HRESULT CAuthPackageResolver::Resolve(_Out_ ULONG *pulAuthPackage)
+{
+    InterlockedIncrement64(&_cResolves);
+
+    LONGLONG llPackage = ReadAcquire64(&_llPackage);
+    if (llPackage != c_llUnresolved)
+    {
+        *pulAuthPackage = static_cast<ULONG>(llPackage);
+        return S_OK;
+    }
+
+    // Callers that miss together wait for one lookup instead of each making their own.
+    HRESULT hr = S_OK;
+    AcquireSRWLockExclusive(&_lockLookup);
+    llPackage = ReadAcquire64(&_llPackage);
+    if (llPackage == c_llUnresolved)
+    {
+        ULONG ulAuthPackage;
+        InterlockedIncrement64(&_cLookups);
+        hr = _pSource->LookupNegotiatePackage(&ulAuthPackage);
+        if (SUCCEEDED(hr))
+        {
+            llPackage = ulAuthPackage;
+            InterlockedExchange64(&_llPackage, llPackage);
+        }
+    }
+    ReleaseSRWLockExclusive(&_lockLookup);
+
+    if (SUCCEEDED(hr))
+    {
+        *pulAuthPackage = static_cast<ULONG>(llPackage);
+    }
+    return hr;
+}
+
+void CAuthPackageResolver::Invalidate()
+{
+    InterlockedExchange64(&_llPackage, c_llUnresolved);
+}
+
+void CAuthPackageResolver::GetStats(_Out_ AUTH_PACKAGE_STATS *pStats)
+{
+    pStats->cResolves = static_cast<ULONGLONG>(_cResolves);
+    pStats->cLookups = static_cast<ULONGLONG>(_cLookups);
+}
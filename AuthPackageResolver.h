@@ -0,0 +1,65 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CAuthPackageResolver caches the negotiate authentication package id, which
+// stays the same for the life of the process but costs three LSA calls to look
+// up. The first caller looks it up, later callers read the published value
+// without locking, and a caller that sees the package fail drops it so the next
+// one looks it up again.
+
+#pragma once
+
+#include <windows.h>
+
+// Looks up the authentication package id. CLsaAuthPackageSource asks LSA; the
+// resolver only depends on this interface, so another source can stand in for it.
+class IAuthPackageSource
+{
+public:
+    virtual HRESULT LookupNegotiatePackage(_Out_ ULONG *pulAuthPackage) = 0;
+};
+
+class CLsaAuthPackageSource : public IAuthPackageSource
+{
+public:
+    HRESULT LookupNegotiatePackage(_Out_ ULONG *pulAuthPackage);
+};
+
+struct AUTH_PACKAGE_STATS
+{
+    ULONGLONG   cResolves;      // Calls to Resolve
+    ULONGLONG   cLookups;       // Calls that went to the source
+};
+
+class CAuthPackageResolver
+{
+public:
+    explicit CAuthPackageResolver(_In_ IAuthPackageSource *pSource);
+
+    // The resolver GetSerialization uses, backed by LSA.
+    static CAuthPackageResolver &Instance();
+
+    // Returns the cached package id, looking it up first if there is none. A
+    // failed lookup is not cached.
+    HRESULT Resolve(_Out_ ULONG *pulAuthPackage);
+
+    // Drops the cached id, for when a logon with it failed.
+    void Invalidate();
+
+    void GetStats(_Out_ AUTH_PACKAGE_STATS *pStats);
+
+private:
+    CAuthPackageResolver(const CAuthPackageResolver &);
+    CAuthPackageResolver &operator=(const CAuthPackageResolver &);
+
+    IAuthPackageSource      *_pSource;
+    volatile LONGLONG       _llPackage;     // The package id, or c_llUnresolved
+    SRWLOCK                 _lockLookup;    // Keeps concurrent misses to one lookup
+    volatile LONGLONG       _cResolves;
+    volatile LONGLONG       _cLookups;
+};
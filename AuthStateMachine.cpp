@@ -0,0 +1,202 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Transition, lifetime and auto-logon tables for CAuthStateMachine.
+
+#include "AuthStateMachine.h"
+
+static const LONGLONG c_llStateMask = 0xF;
+static const int c_cStateBits = 4;
+
+// Marks an event that leaves the state alone.
+static const BYTE c_bIgnore = 0xFF;
+
+#define I   c_bIgnore
+#define S0  AUTH_STATE_IDLE
+#define S1  AUTH_STATE_DEVICE_PRESENT
+#define S2  AUTH_STATE_APP_APPROVED
+#define S3  AUTH_STATE_SERIALIZED
+#define S4  AUTH_STATE_SUBMITTED
+#define S5  AUTH_STATE_SUCCEEDED
+#define S6  AUTH_STATE_FAILED
+
+// Next state by current state and event. A departure ends everything except a
+// logon that is already in flight; approvals only count while the phone is near.
+// Once the buffer is packed a repeated approval changes nothing, so the logon can
+// still be submitted. A finished logon expires back to the phone being present,
+// not to Idle: the scanner only reports arrivals, so Idle would ignore every later
+// approval until the phone left and came back.
+static const BYTE c_rgbTransitions[AUTH_STATE_COUNT][AUTH_EVENT_COUNT] =
+{
+    //              Arrived Departed Approved Serialized Submitted Succeeded Failed Expired
+    /* Idle */      { S1,   I,       I,       I,         I,        I,        I,     I  },
+    /* Present */   { I,    S0,      S2,      I,         I,        I,        I,     I  },
+    /* Approved */  { I,    S0,      S2,      S3,        I,        I,        I,     S1 },
+    /* Serialized */{ I,    S0,      I,       S3,        S4,       I,        S6,    S1 },
+    /* Submitted */ { I,    I,       I,       I,         I,        S5,       S6,    S6 },
+    /* Succeeded */ { I,    S0,      I,       I,         I,        I,        I,     S1 },
+    /* Failed */    { I,    S0,      S2,      I,         I,        I,        I,     S1 },
+};
+
+#undef I
+#undef S0
+#undef S1
+#undef S2
+#undef S3
+#undef S4
+#undef S5
+#undef S6
+
+// How long each state lasts before AUTH_EVENT_EXPIRED applies, in milliseconds.
+// Zero means the state lasts until another event. An approval that LogonUI does
+// not act on within a minute has to be given again.
+static const DWORD c_rgdwLifetimeMs[AUTH_STATE_COUNT] =
+{
+    0,          // Idle
+    0,          // Device present, until the scanner reports a departure
+    60 * 1000,  // App approved
+    30 * 1000,  // Serialized
+    60 * 1000,  // Submitted
+    10 * 1000,  // Succeeded
+    10 * 1000,  // Failed
+};
+
+static const bool c_rgfAutoLogon[AUTH_STATE_COUNT] =
+{
+    false,      // Idle
+    false,      // Device present
+    true,       // App approved
+    true,       // Serialized
+    false,      // Submitted
+    false,      // Succeeded
+    false,      // Failed
+};
+
+// States in which the logon buffer may be handed to LogonUI.
+static const bool c_rgfSerialize[AUTH_STATE_COUNT] =
+{
+    false,      // Idle
+    false,      // Device present
+    true,       // App approved
+    true,       // Serialized
+    false,      // Submitted
+    false,      // Succeeded
+    false,      // Failed
+};
+
+static const PCWSTR c_rgpszStateNames[AUTH_STATE_COUNT] =
+{
+    L"Idle",
+    L"DevicePresent",
+    L"AppApproved",
+    L"Serialized",
+    L"Submitted",
+    L"Succeeded",
+    L"Failed",
+};
+
+static LONGLONG _GetTicks()
+{
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    return li.QuadPart;
+}
+
+static LONGLONG _GetTicksPerSecond()
+{
+    static LONGLONG s_llFrequency = 0;
+    if (s_llFrequency == 0)
+    {
+        LARGE_INTEGER li;
+        QueryPerformanceFrequency(&li);
+        s_llFrequency = li.QuadPart;
+    }
+    return s_llFrequency;
+}
+
+CAuthStateMachine::CAuthStateMachine() :
+    _llState((_GetTicks() << c_cStateBits) | AUTH_STATE_IDLE)
+{
+}
+
+bool CAuthStateMachine::OnEvent(AUTH_EVENT event, _Out_ AUTH_TRANSITION *pTransition)
+{
+    for (;;)
+    {
+        LONGLONG llCurrent = _llState;
+        BYTE bNext = c_rgbTransitions[llCurrent & c_llStateMask][event];
+        if (bNext == c_bIgnore)
+        {
+            ZeroMemory(pTransition, sizeof(*pTransition));
+            return false;
+        }
+        if (_Transition(llCurrent, static_cast<AUTH_STATE>(bNext), _GetTicks(), pTransition))
+        {
+            return true;
+        }
+    }
+}
+
+bool CAuthStateMachine::Expire(_Out_ AUTH_TRANSITION *pTransition)
+{
+    for (;;)
+    {
+        LONGLONG llCurrent = _llState;
+        AUTH_STATE state = static_cast<AUTH_STATE>(llCurrent & c_llStateMask);
+        LONGLONG llNow = _GetTicks();
+        LONGLONG llEntered = llCurrent >> c_cStateBits;
+        BYTE bNext = c_rgbTransitions[state][AUTH_EVENT_EXPIRED];
+        if (bNext == c_bIgnore || c_rgdwLifetimeMs[state] == 0 ||
+            (llNow - llEntered) * 1000 < static_cast<LONGLONG>(c_rgdwLifetimeMs[state]) * _GetTicksPerSecond())
+        {
+            ZeroMemory(pTransition, sizeof(*pTransition));
+            return false;
+        }
+        if (_Transition(llCurrent, static_cast<AUTH_STATE>(bNext), llNow, pTransition))
+        {
+            return true;
+        }
+    }
+}
+
+AUTH_STATE CAuthStateMachine::GetState() const
+{
+    return static_cast<AUTH_STATE>(_llState & c_llStateMask);
+}
+
+bool CAuthStateMachine::IsAutoLogonState(AUTH_STATE state)
+{
+    return state < AUTH_STATE_COUNT && c_rgfAutoLogon[state];
+}
+
+bool CAuthStateMachine::IsSerializeState(AUTH_STATE state)
+{
+    return state < AUTH_STATE_COUNT && c_rgfSerialize[state];
+}
+
+PCWSTR CAuthStateMachine::GetStateName(AUTH_STATE state)
+{
+    return (state < AUTH_STATE_COUNT) ? c_rgpszStateNames[state] : L"Unknown";
+}
+
+// Moves from the state in llCurrent to stateTo, unless another thread changed the
+// state first, in which case the caller looks up the transition again.
+bool CAuthStateMachine::_Transition(LONGLONG llCurrent, AUTH_STATE stateTo, LONGLONG llNow, _Out_ AUTH_TRANSITION *pTransition)
+{
+    LONGLONG llNext = (llNow << c_cStateBits) | stateTo;
+    if (InterlockedCompareExchange64(&_llState, llNext, llCurrent) != llCurrent)
+    {
+        return false;
+    }
+
+    LONGLONG llElapsed = llNow - (llCurrent >> c_cStateBits);
+    pTransition->stateFrom = static_cast<AUTH_STATE>(llCurrent & c_llStateMask);
+    pTransition->stateTo = stateTo;
+    pTransition->ullMicroseconds = (llElapsed > 0) ? static_cast<ULONGLONG>(llElapsed) * 1000000 / _GetTicksPerSecond() : 0;
+    return true;
+}
@@ -0,0 +1,80 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CAuthStateMachine tracks where one user is in the phone-approved logon: the
+// phone coming into range, the app approving, the credential being serialized
+// and submitted, and the result. Transitions come from a table, each state is
+// entered with a monotonic timestamp so the time spent in it can be reported,
+// and states that are only meaningful for a while expire back to an earlier one.
+
+#pragma once
+
+#include <windows.h>
+
+enum AUTH_STATE
+{
+    AUTH_STATE_IDLE,
+    AUTH_STATE_DEVICE_PRESENT,      // The phone is in Bluetooth range
+    AUTH_STATE_APP_APPROVED,        // The user approved the logon in the phone app
+    AUTH_STATE_SERIALIZED,          // The logon buffer has been packed
+    AUTH_STATE_SUBMITTED,           // The logon buffer was handed to LogonUI
+    AUTH_STATE_SUCCEEDED,
+    AUTH_STATE_FAILED,
+    AUTH_STATE_COUNT,
+};
+
+enum AUTH_EVENT
+{
+    AUTH_EVENT_DEVICE_ARRIVED,
+    AUTH_EVENT_DEVICE_DEPARTED,
+    AUTH_EVENT_APP_APPROVED,
+    AUTH_EVENT_SERIALIZED,
+    AUTH_EVENT_SUBMITTED,
+    AUTH_EVENT_LOGON_SUCCEEDED,
+    AUTH_EVENT_LOGON_FAILED,
+    AUTH_EVENT_EXPIRED,             // The current state outlived its lifetime
+    AUTH_EVENT_COUNT,
+};
+
+// A state change and how long the machine was in the state it left.
+struct AUTH_TRANSITION
+{
+    AUTH_STATE  stateFrom;
+    AUTH_STATE  stateTo;
+    ULONGLONG   ullMicroseconds;
+};
+
+class CAuthStateMachine
+{
+public:
+    CAuthStateMachine();
+
+    // Applies event. Returns false, leaving the state alone, if the event means
+    // nothing in the current state. Entering a state again restarts its lifetime.
+    bool OnEvent(AUTH_EVENT event, _Out_ AUTH_TRANSITION *pTransition);
+
+    // Applies AUTH_EVENT_EXPIRED if the current state has outlived its lifetime.
+    bool Expire(_Out_ AUTH_TRANSITION *pTransition);
+
+    AUTH_STATE GetState() const;
+
+    // Whether a tile in state should log on by itself, from a table.
+    static bool IsAutoLogonState(AUTH_STATE state);
+
+    // Whether GetSerialization may hand out a logon buffer in state, from a table.
+    static bool IsSerializeState(AUTH_STATE state);
+
+    static PCWSTR GetStateName(AUTH_STATE state);
+
+private:
+    bool _Transition(LONGLONG llCurrent, AUTH_STATE stateTo, LONGLONG llNow, _Out_ AUTH_TRANSITION *pTransition);
+
+    // The state in the low bits and the QueryPerformanceCounter value when it was
+    // entered above them, so both change together with one compare-exchange.
+    volatile LONGLONG   _llState;
+};
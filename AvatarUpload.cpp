@@ -0,0 +1,335 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Reading avatar uploads: request headers, then the body in fixed-size blocks,
+// undoing chunked transfer encoding as the blocks pass through to the decoder
+// and the request's MAC.
+
+#include <algorithm>
+#include "AvatarUpload.h"
+#include "RequestAuth.h"
+#include "TileBitmapCache.h"
+
+static const char c_szAvatarRequest[] = "POST /avatar";
+
+// Size of the blocks the body is read in, and a cap on the request headers.
+static const size_t c_cbUploadBlock = 4096;
+static const size_t c_cbMaxUploadHeaders = 8192;
+
+// The largest .bmp the decoder takes. The whole body is read for its tag to be
+// checked, so this also bounds how long an upload can keep the server busy.
+static const ULONGLONG c_cbMaxUploadBody = c_cbMaxBmpHeaders + 4ULL * c_cMaxImageDimension * c_cMaxImageDimension;
+
+// The server handles one connection at a time, so a stalled upload is dropped.
+static const DWORD c_dwUploadTimeout = 10000;
+
+// Longest SID string, SECURITY_MAX_SID_STRING_CHARACTERS.
+static const size_t c_cchMaxSid = 187;
+
+// Where the body decoder is in the chunked encoding.
+enum CHUNK_STATE
+{
+    CHUNK_SIZE,         // Reading the hex chunk size
+    CHUNK_SIZE_END,     // Skipping spaces after the chunk size
+    CHUNK_EXTENSION,    // Skipping chunk extensions up to the end of the size line
+    CHUNK_DATA,         // Passing chunk data to the decoder
+    CHUNK_DATA_END,     // Skipping the CRLF after the chunk data
+};
+
+struct UPLOAD_BODY
+{
+    bool            fChunked;
+    bool            fDone;          // The whole body has been read
+    CHUNK_STATE     chunkState;
+    ULONGLONG       cbRemaining;    // Body bytes left with Content-Length, or chunk bytes left
+    UINT            cchSize;        // Hex digits of the chunk size read so far
+    ULONGLONG       cbBody;         // Body bytes read so far, without the chunk framing
+};
+
+static bool _IsEqualNoCase(const char *pch, const char *pszLower, size_t cch)
+{
+    for (size_t i = 0; i < cch; i++)
+    {
+        char ch = (pch[i] >= 'A' && pch[i] <= 'Z') ? static_cast<char>(pch[i] - 'A' + 'a') : pch[i];
+        if (ch != pszLower[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int _HexDigitValue(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+    {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f')
+    {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F')
+    {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+bool AvatarUploadIsRequest(_In_reads_bytes_(cb) const char *pb, size_t cb)
+{
+    const size_t cchRequest = ARRAYSIZE(c_szAvatarRequest) - 1;
+    return cb > cchRequest && memcmp(pb, c_szAvatarRequest, cchRequest) == 0 &&
+           (pb[cchRequest] == '?' || pb[cchRequest] == ' ');
+}
+
+// Reads the "sid=" parameter from the request line and how the body is framed from the headers.
+static HRESULT _ParseUploadHeaders(const std::string &strHeaders, _Out_ std::wstring *pstrSid, _Out_ UPLOAD_BODY *pBody)
+{
+    pBody->fChunked = false;
+    pBody->fDone = false;
+    pBody->chunkState = CHUNK_SIZE;
+    pBody->cbRemaining = 0;
+    pBody->cchSize = 0;
+    pBody->cbBody = 0;
+
+    size_t ichLineEnd = strHeaders.find("\r\n");
+    size_t ichSid = strHeaders.find("sid=");
+    if (ichSid == std::string::npos || ichSid > ichLineEnd)
+    {
+        return E_INVALIDARG;
+    }
+
+    // SIDs are plain ASCII, so anything else ends the parameter.
+    pstrSid->clear();
+    for (size_t ich = ichSid + 4; ich < ichLineEnd; ich++)
+    {
+        char ch = strHeaders[ich];
+        if (!((ch >= '0' && ch <= '9') || ch == '-' || ch == 'S' || ch == 's'))
+        {
+            break;
+        }
+        pstrSid->push_back(static_cast<WCHAR>(ch));
+    }
+    if (pstrSid->size() < 3 || pstrSid->size() > c_cchMaxSid)
+    {
+        return E_INVALIDARG;
+    }
+
+    bool fHasLength = false;
+    static const char c_szContentLength[] = "content-length:";
+    static const char c_szTransferEncoding[] = "transfer-encoding:";
+    for (size_t ichLine = ichLineEnd + 2; ichLine < strHeaders.size(); )
+    {
+        size_t ichEnd = strHeaders.find("\r\n", ichLine);
+        if (ichEnd == std::string::npos)
+        {
+            ichEnd = strHeaders.size();
+        }
+        const char *pchLine = strHeaders.data() + ichLine;
+        size_t cchLine = ichEnd - ichLine;
+
+        if (cchLine > ARRAYSIZE(c_szContentLength) - 1 && _IsEqualNoCase(pchLine, c_szContentLength, ARRAYSIZE(c_szContentLength) - 1))
+        {
+            std::string strValue(pchLine + ARRAYSIZE(c_szContentLength) - 1, cchLine - (ARRAYSIZE(c_szContentLength) - 1));
+            pBody->cbRemaining = _strtoui64(strValue.c_str(), nullptr, 10);
+            fHasLength = true;
+        }
+        else if (cchLine > ARRAYSIZE(c_szTransferEncoding) - 1 && _IsEqualNoCase(pchLine, c_szTransferEncoding, ARRAYSIZE(c_szTransferEncoding) - 1))
+        {
+            for (size_t ich = ARRAYSIZE(c_szTransferEncoding) - 1; ich + 7 <= cchLine; ich++)
+            {
+                if (_IsEqualNoCase(pchLine + ich, "chunked", 7))
+                {
+                    pBody->fChunked = true;
+                    break;
+                }
+            }
+        }
+        ichLine = ichEnd + 2;
+    }
+
+    // Chunked encoding takes precedence over Content-Length, as in RFC 7230.
+    if (pBody->fChunked)
+    {
+        pBody->cbRemaining = 0;
+    }
+    else
+    {
+        if (!fHasLength || pBody->cbRemaining > c_cbMaxUploadBody)
+        {
+            return E_INVALIDARG;
+        }
+        pBody->fDone = (pBody->cbRemaining == 0);
+    }
+    return S_OK;
+}
+
+// Passes the body bytes in the cb bytes at pb to the decoder and the MAC, removing
+// the chunk framing if the body is chunked. Returns false if the body is malformed
+// or too large.
+static bool _ConsumeBody(_Inout_ UPLOAD_BODY *pBody, _Inout_ CBmpStreamDecoder *pDecoder, _Inout_ REQUEST_MAC *pMac,
+                         _In_reads_bytes_(cb) const char *pb, size_t cb)
+{
+    const uint8_t *pbBody = reinterpret_cast<const uint8_t*>(pb);
+    while (cb > 0 && !pBody->fDone)
+    {
+        if (!pBody->fChunked || pBody->chunkState == CHUNK_DATA)
+        {
+            size_t cbData = static_cast<size_t>((std::min)(static_cast<ULONGLONG>(cb), pBody->cbRemaining));
+            pBody->cbBody += cbData;
+            if (pBody->cbBody > c_cbMaxUploadBody || !pDecoder->Write(pbBody, cbData))
+            {
+                return false;
+            }
+            CRequestAuthenticator::Update(pMac, pbBody, cbData);
+            pbBody += cbData;
+            cb -= cbData;
+            pBody->cbRemaining -= cbData;
+            if (pBody->cbRemaining == 0)
+            {
+                pBody->fDone = !pBody->fChunked;
+                pBody->chunkState = CHUNK_DATA_END;
+            }
+            continue;
+        }
+
+        char ch = static_cast<char>(*pbBody++);
+        cb--;
+        switch (pBody->chunkState)
+        {
+        case CHUNK_SIZE:
+            if (_HexDigitValue(ch) >= 0)
+            {
+                if (pBody->cbRemaining > 0x0FFFFFFF)
+                {
+                    return false;
+                }
+                pBody->cbRemaining = pBody->cbRemaining * 16 + _HexDigitValue(ch);
+                pBody->cchSize++;
+                break;
+            }
+            // Anything else ends the size, which must have at least one digit.
+            if (pBody->cchSize == 0)
+            {
+                return false;
+            }
+            pBody->chunkState = CHUNK_SIZE_END;
+            // Fall through.
+        case CHUNK_SIZE_END:
+            if (ch == ';')
+            {
+                pBody->chunkState = CHUNK_EXTENSION;
+                break;
+            }
+            // Fall through to end the size line.
+        case CHUNK_EXTENSION:
+            if (ch == '\n')
+            {
+                // A zero-size chunk ends the body; trailers are not read.
+                pBody->fDone = (pBody->cbRemaining == 0);
+                pBody->chunkState = CHUNK_DATA;
+            }
+            else if (pBody->chunkState == CHUNK_SIZE_END && ch != '\r' && ch != ' ' && ch != '\t')
+            {
+                return false;
+            }
+            break;
+        case CHUNK_DATA_END:
+            if (ch == '\n')
+            {
+                pBody->chunkState = CHUNK_SIZE;
+                pBody->cbRemaining = 0;
+                pBody->cchSize = 0;
+            }
+            else if (ch != '\r')
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+HRESULT AvatarUploadReceive(SOCKET s,
+                            _In_reads_bytes_(cbReceived) const char *pbReceived,
+                            size_t cbReceived,
+                            _Out_ std::wstring *pstrSid,
+                            _Out_ BITMAP_IMAGE *pImage)
+{
+    DWORD dwTimeout = c_dwUploadTimeout;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&dwTimeout), sizeof(dwTimeout));
+
+    // The headers are small and bounded; only they are kept whole.
+    char rgbBlock[c_cbUploadBlock];
+    std::string strHeaders(pbReceived, cbReceived);
+    size_t ichBody = strHeaders.find("\r\n\r\n");
+    while (ichBody == std::string::npos && strHeaders.size() < c_cbMaxUploadHeaders)
+    {
+        int cb = recv(s, rgbBlock, sizeof(rgbBlock), 0);
+        if (cb <= 0)
+        {
+            return (cb == 0) ? HRESULT_FROM_WIN32(ERROR_HANDLE_EOF) : HRESULT_FROM_WIN32(WSAGetLastError());
+        }
+        strHeaders.append(rgbBlock, cb);
+        ichBody = strHeaders.find("\r\n\r\n");
+    }
+    if (ichBody == std::string::npos)
+    {
+        return E_INVALIDARG;
+    }
+    ichBody += 4;
+
+    UPLOAD_BODY body;
+    HRESULT hr = _ParseUploadHeaders(strHeaders.substr(0, ichBody), pstrSid, &body);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Turn away unauthenticated uploads before reading their bodies.
+    REQUEST_MAC mac;
+    hr = CRequestAuthenticator::Instance().Begin(strHeaders.data(), ichBody, &mac);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Body bytes that arrived with the headers, then the rest one block at a time.
+    // The decoder ignores padding or trailing data after the last row, but the tag
+    // covers them, so the body is read to the end.
+    CBmpStreamDecoder decoder(c_cxTileImage, c_cyTileImage);
+    if (!_ConsumeBody(&body, &decoder, &mac, strHeaders.data() + ichBody, strHeaders.size() - ichBody))
+    {
+        return E_INVALIDARG;
+    }
+    std::string().swap(strHeaders);
+
+    while (!body.fDone)
+    {
+        int cb = recv(s, rgbBlock, sizeof(rgbBlock), 0);
+        if (cb <= 0)
+        {
+            return (cb == 0) ? HRESULT_FROM_WIN32(ERROR_HANDLE_EOF) : HRESULT_FROM_WIN32(WSAGetLastError());
+        }
+        if (!_ConsumeBody(&body, &decoder, &mac, rgbBlock, cb))
+        {
+            return E_INVALIDARG;
+        }
+    }
+
+    hr = CRequestAuthenticator::Instance().Complete(&mac);
+    if (SUCCEEDED(hr) && !decoder.TakeImage(pImage))
+    {
+        hr = E_INVALIDARG;
+    }
+    return hr;
+}
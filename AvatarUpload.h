@@ -0,0 +1,34 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Tile pictures uploaded by the phone app to the HTTP server with
+// "POST /avatar?sid=<SID>". The body is a .bmp file sent with Content-Length or
+// chunked transfer encoding. It is read in fixed-size blocks that go straight to a
+// CBmpStreamDecoder, so an upload uses the same small amount of memory whatever
+// the size of the picture. Uploads are authenticated like approvals, see
+// RequestAuth.h, so the whole body is read before the picture is used.
+
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+#include <string>
+#include "BitmapCore.h"
+
+// True if a request starting with the cb bytes at pb is an avatar upload.
+bool AvatarUploadIsRequest(_In_reads_bytes_(cb) const char *pb, size_t cb);
+
+// Reads the rest of an avatar upload from s, given the first cbReceived bytes of
+// the request that were already read, and decodes the picture to the tile size.
+// Fails with E_ACCESSDENIED, returning no picture, unless the request carries the
+// tag of the paired phone.
+HRESULT AvatarUploadReceive(SOCKET s,
+                            _In_reads_bytes_(cbReceived) const char *pbReceived,
+                            size_t cbReceived,
+                            _Out_ std::wstring *pstrSid,
+                            _Out_ BITMAP_IMAGE *pImage);
@@ -0,0 +1,537 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// BMP decoding, both whole and streamed, scaling and BGR to BGRA row conversion.
+
+#include <algorithm>
+#include <cstring>
+#include "BitmapCore.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BITMAPCORE_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BITMAPCORE_TARGET_SSSE3
+#else
+#define BITMAPCORE_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+// Sizes of the BMP structures as laid out in the file.
+static const size_t c_cbFileHeader = 14;
+static const size_t c_cbInfoHeader = 40;
+
+// BITMAPINFOHEADER compression values we accept.
+static const uint32_t c_dwCompressionRgb = 0;
+static const uint32_t c_dwCompressionBitfields = 3;
+
+static uint16_t _ReadU16(const uint8_t *pb)
+{
+    return static_cast<uint16_t>(pb[0] | (pb[1] << 8));
+}
+
+static uint32_t _ReadU32(const uint8_t *pb)
+{
+    return static_cast<uint32_t>(pb[0]) | (static_cast<uint32_t>(pb[1]) << 8) |
+           (static_cast<uint32_t>(pb[2]) << 16) | (static_cast<uint32_t>(pb[3]) << 24);
+}
+
+static void _ConvertRowBgrToBgraScalar(const uint8_t *pbSource, uint8_t *pbDest, size_t cPixels)
+{
+    for (size_t i = 0; i < cPixels; i++)
+    {
+        pbDest[0] = pbSource[0];
+        pbDest[1] = pbSource[1];
+        pbDest[2] = pbSource[2];
+        pbDest[3] = 0xFF;
+        pbSource += 3;
+        pbDest += 4;
+    }
+}
+
+#ifdef BITMAPCORE_X86
+static bool _HasSsse3()
+{
+#if defined(_MSC_VER)
+    int rgInfo[4];
+    __cpuid(rgInfo, 1);
+    return (rgInfo[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+
+// Four pixels per iteration: a 16-byte load covers four BGR pixels plus four bytes
+// of the next ones, which a shuffle spreads into four BGRA pixels. The loop stops
+// while at least 16 source bytes remain so the load never reads past the row.
+BITMAPCORE_TARGET_SSSE3 static size_t _ConvertRowBgrToBgraSsse3(const uint8_t *pbSource, uint8_t *pbDest, size_t cPixels)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+    size_t i = 0;
+    for (; i + 6 <= cPixels; i += 4)
+    {
+        __m128i bgr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pbSource + i * 3));
+        __m128i bgra = _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pbDest + i * 4), bgra);
+    }
+    return i;
+}
+
+static const bool s_fHasSsse3 = _HasSsse3();
+#endif
+
+void ConvertRowBgrToBgra(const uint8_t *pbSource, uint8_t *pbDest, size_t cPixels)
+{
+    size_t iPixel = 0;
+#ifdef BITMAPCORE_X86
+    if (s_fHasSsse3)
+    {
+        iPixel = _ConvertRowBgrToBgraSsse3(pbSource, pbDest, cPixels);
+    }
+#endif
+    _ConvertRowBgrToBgraScalar(pbSource + iPixel * 3, pbDest + iPixel * 4, cPixels - iPixel);
+}
+
+// Reads the headers of a BMP. The palette must be in pb; the pixels need not be.
+static bool _ParseBmpHeaders(const uint8_t *pb, size_t cb, BMP_LAYOUT *pLayout)
+{
+    // A .bmp file starts with a file header giving the offset of the pixels; a packed
+    // DIB starts with the info header and the pixels follow the palette.
+    size_t ibInfo = 0;
+    size_t ibBits = 0;
+    if (cb >= c_cbFileHeader && pb[0] == 'B' && pb[1] == 'M')
+    {
+        ibInfo = c_cbFileHeader;
+        ibBits = _ReadU32(pb + 10);
+    }
+    if (cb < ibInfo + c_cbInfoHeader)
+    {
+        return false;
+    }
+
+    const uint8_t *pbInfo = pb + ibInfo;
+    uint32_t cbInfo = _ReadU32(pbInfo);
+    int32_t cxSigned = static_cast<int32_t>(_ReadU32(pbInfo + 4));
+    int32_t cySigned = static_cast<int32_t>(_ReadU32(pbInfo + 8));
+    uint16_t cBitCount = _ReadU16(pbInfo + 14);
+    uint32_t dwCompression = _ReadU32(pbInfo + 16);
+    uint32_t cClrUsed = _ReadU32(pbInfo + 32);
+
+    bool fTopDown = (cySigned < 0);
+    uint32_t cx = static_cast<uint32_t>(cxSigned);
+    uint32_t cy = fTopDown ? static_cast<uint32_t>(-static_cast<int64_t>(cySigned)) : static_cast<uint32_t>(cySigned);
+    if (cbInfo < c_cbInfoHeader || cb - ibInfo < cbInfo ||
+        cxSigned <= 0 || cy == 0 || cx > c_cMaxImageDimension || cy > c_cMaxImageDimension)
+    {
+        return false;
+    }
+
+    // Only uncompressed pixels are supported. 32 bpp bitfields are accepted when the
+    // masks are the usual BGRX ones.
+    size_t ibPalette = ibInfo + cbInfo;
+    if (dwCompression == c_dwCompressionBitfields && cBitCount == 32)
+    {
+        if (cbInfo == c_cbInfoHeader)
+        {
+            if (cb < ibPalette + 12)
+            {
+                return false;
+            }
+            ibPalette += 12;
+        }
+        const uint8_t *pbMasks = pbInfo + c_cbInfoHeader;
+        if (_ReadU32(pbMasks) != 0x00FF0000 || _ReadU32(pbMasks + 4) != 0x0000FF00 || _ReadU32(pbMasks + 8) != 0x000000FF)
+        {
+            return false;
+        }
+    }
+    else if (dwCompression != c_dwCompressionRgb)
+    {
+        return false;
+    }
+
+    uint32_t cPaletteEntries = 0;
+    if (cBitCount == 1 || cBitCount == 4 || cBitCount == 8)
+    {
+        cPaletteEntries = (cClrUsed != 0 && cClrUsed < (1u << cBitCount)) ? cClrUsed : (1u << cBitCount);
+    }
+    else if (cBitCount != 24 && cBitCount != 32)
+    {
+        return false;
+    }
+    if (cb < ibPalette + cPaletteEntries * 4)
+    {
+        return false;
+    }
+
+    if (ibBits == 0)
+    {
+        ibBits = ibPalette + cPaletteEntries * 4;
+    }
+    else if (ibBits < ibPalette + cPaletteEntries * 4)
+    {
+        // The pixels of a .bmp file cannot overlap its headers or palette.
+        return false;
+    }
+
+    pLayout->cx = cx;
+    pLayout->cy = cy;
+    pLayout->fTopDown = fTopDown;
+    pLayout->cBitCount = cBitCount;
+    pLayout->cPaletteEntries = cPaletteEntries;
+    pLayout->ibPalette = ibPalette;
+    pLayout->ibBits = ibBits;
+
+    // Rows are padded to four bytes.
+    pLayout->cbStride = ((static_cast<size_t>(cx) * cBitCount + 31) / 32) * 4;
+    return true;
+}
+
+// Converts one row of the file to BGRA.
+static void _ConvertRow(const BMP_LAYOUT &layout, const uint8_t *pbPalette, const uint8_t *pbRow, uint8_t *pbDest)
+{
+    const uint32_t cx = layout.cx;
+    if (layout.cBitCount == 24)
+    {
+        ConvertRowBgrToBgra(pbRow, pbDest, cx);
+    }
+    else if (layout.cBitCount == 32)
+    {
+        memcpy(pbDest, pbRow, static_cast<size_t>(cx) * 4);
+        for (uint32_t x = 0; x < cx; x++)
+        {
+            // The fourth byte is unused in BI_RGB bitmaps, so the tile is opaque.
+            pbDest[x * 4 + 3] = 0xFF;
+        }
+    }
+    else
+    {
+        uint32_t cPixelsPerByte = 8 / layout.cBitCount;
+        uint32_t dwMask = (1u << layout.cBitCount) - 1;
+        for (uint32_t x = 0; x < cx; x++)
+        {
+            uint32_t dwShift = (cPixelsPerByte - 1 - (x % cPixelsPerByte)) * layout.cBitCount;
+            uint32_t iColor = (pbRow[x / cPixelsPerByte] >> dwShift) & dwMask;
+            if (iColor >= layout.cPaletteEntries)
+            {
+                iColor = 0;
+            }
+            pbDest[x * 4 + 0] = pbPalette[iColor * 4 + 0];
+            pbDest[x * 4 + 1] = pbPalette[iColor * 4 + 1];
+            pbDest[x * 4 + 2] = pbPalette[iColor * 4 + 2];
+            pbDest[x * 4 + 3] = 0xFF;
+        }
+    }
+}
+
+// Finds the part of a cxSource by cySource image with the aspect ratio of cx:cy,
+// centered, by cropping its longer side.
+static void _ComputeCrop(uint32_t cxSource, uint32_t cySource, uint32_t cx, uint32_t cy,
+                         uint32_t *pxCrop, uint32_t *pyCrop, uint32_t *pcxCrop, uint32_t *pcyCrop)
+{
+    uint32_t cxCrop = cxSource;
+    uint32_t cyCrop = cySource;
+    if (static_cast<uint64_t>(cxSource) * cy > static_cast<uint64_t>(cySource) * cx)
+    {
+        cxCrop = static_cast<uint32_t>(static_cast<uint64_t>(cySource) * cx / cy);
+    }
+    else
+    {
+        cyCrop = static_cast<uint32_t>(static_cast<uint64_t>(cxSource) * cy / cx);
+    }
+    cxCrop = cxCrop ? cxCrop : 1;
+    cyCrop = cyCrop ? cyCrop : 1;
+    *pxCrop = (cxSource - cxCrop) / 2;
+    *pyCrop = (cySource - cyCrop) / 2;
+    *pcxCrop = cxCrop;
+    *pcyCrop = cyCrop;
+}
+
+bool BmpDecode(const uint8_t *pb, size_t cb, BITMAP_IMAGE *pImage)
+{
+    BMP_LAYOUT layout;
+    if (!_ParseBmpHeaders(pb, cb, &layout) ||
+        layout.ibBits > cb || (cb - layout.ibBits) / layout.cbStride < layout.cy)
+    {
+        return false;
+    }
+
+    pImage->cx = layout.cx;
+    pImage->cy = layout.cy;
+    pImage->pixels.resize(static_cast<size_t>(layout.cx) * layout.cy * 4);
+
+    for (uint32_t y = 0; y < layout.cy; y++)
+    {
+        // Bottom-up BMPs store the last row first.
+        const uint8_t *pbRow = pb + layout.ibBits + layout.cbStride * (layout.fTopDown ? y : layout.cy - 1 - y);
+        uint8_t *pbDest = pImage->pixels.data() + static_cast<size_t>(y) * layout.cx * 4;
+        _ConvertRow(layout, pb + layout.ibPalette, pbRow, pbDest);
+    }
+    return true;
+}
+
+bool ImageScale(const BITMAP_IMAGE &source, uint32_t cx, uint32_t cy, BITMAP_IMAGE *pScaled)
+{
+    if (source.cx == 0 || source.cy == 0 || cx == 0 || cy == 0 ||
+        source.pixels.size() < static_cast<size_t>(source.cx) * source.cy * 4)
+    {
+        return false;
+    }
+
+    // Crop the longer side of the source so its aspect ratio matches cx:cy.
+    uint32_t xCrop;
+    uint32_t yCrop;
+    uint32_t cxCrop;
+    uint32_t cyCrop;
+    _ComputeCrop(source.cx, source.cy, cx, cy, &xCrop, &yCrop, &cxCrop, &cyCrop);
+
+    pScaled->cx = cx;
+    pScaled->cy = cy;
+    pScaled->pixels.resize(static_cast<size_t>(cx) * cy * 4);
+
+    // Sample at pixel centers in 16.16 fixed point.
+    const int64_t xStep = (static_cast<int64_t>(cxCrop) << 16) / cx;
+    const int64_t yStep = (static_cast<int64_t>(cyCrop) << 16) / cy;
+    const size_t cbSourceStride = static_cast<size_t>(source.cx) * 4;
+
+    for (uint32_t y = 0; y < cy; y++)
+    {
+        int64_t ySample = (static_cast<int64_t>(y) * yStep) + (yStep >> 1) - 0x8000;
+        ySample = ySample < 0 ? 0 : ySample;
+        uint32_t y0 = static_cast<uint32_t>(ySample >> 16);
+        uint32_t y1 = (y0 + 1 < cyCrop) ? y0 + 1 : y0;
+        uint32_t wy = static_cast<uint32_t>(ySample & 0xFFFF) >> 8;
+        if (y0 >= cyCrop)
+        {
+            y0 = y1 = cyCrop - 1;
+        }
+
+        const uint8_t *pbRow0 = source.pixels.data() + (yCrop + y0) * cbSourceStride + xCrop * 4;
+        const uint8_t *pbRow1 = source.pixels.data() + (yCrop + y1) * cbSourceStride + xCrop * 4;
+        uint8_t *pbDest = pScaled->pixels.data() + static_cast<size_t>(y) * cx * 4;
+
+        for (uint32_t x = 0; x < cx; x++)
+        {
+            int64_t xSample = (static_cast<int64_t>(x) * xStep) + (xStep >> 1) - 0x8000;
+            xSample = xSample < 0 ? 0 : xSample;
+            uint32_t x0 = static_cast<uint32_t>(xSample >> 16);
+            uint32_t x1 = (x0 + 1 < cxCrop) ? x0 + 1 : x0;
+            uint32_t wx = static_cast<uint32_t>(xSample & 0xFFFF) >> 8;
+            if (x0 >= cxCrop)
+            {
+                x0 = x1 = cxCrop - 1;
+            }
+
+            // Weights are 8-bit, so each channel sum fits in 32 bits.
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                uint32_t top = pbRow0[x0 * 4 + c] * (256 - wx) + pbRow0[x1 * 4 + c] * wx;
+                uint32_t bottom = pbRow1[x0 * 4 + c] * (256 - wx) + pbRow1[x1 * 4 + c] * wx;
+                pbDest[x * 4 + c] = static_cast<uint8_t>((top * (256 - wy) + bottom * wy + 0x8000) >> 16);
+            }
+        }
+    }
+    return true;
+}
+
+CBmpStreamDecoder::CBmpStreamDecoder(uint32_t cx, uint32_t cy) :
+    _cxTarget(cx),
+    _cyTarget(cy),
+    _state((cx != 0 && cy != 0) ? STATE_HEADERS : STATE_FAILED),
+    _cbRow(0),
+    _cRowsReceived(0),
+    _cAccumulated(0),
+    _yAccumulated(0),
+    _xCrop(0),
+    _yCrop(0),
+    _cxCrop(0),
+    _cyCrop(0)
+{
+    memset(&_layout, 0, sizeof(_layout));
+    _image.cx = 0;
+    _image.cy = 0;
+}
+
+bool CBmpStreamDecoder::Write(const uint8_t *pb, size_t cb)
+{
+    while (cb > 0 && _state != STATE_COMPLETE && _state != STATE_FAILED)
+    {
+        if (_state == STATE_HEADERS)
+        {
+            // Until the file header is in, we don't know where the pixels start.
+            size_t cbWanted = c_cbFileHeader;
+            if (_headers.size() >= c_cbFileHeader)
+            {
+                cbWanted = _ReadU32(_headers.data() + 10);
+            }
+            size_t cbCopy = (std::min)(cb, cbWanted - _headers.size());
+            _headers.insert(_headers.end(), pb, pb + cbCopy);
+            pb += cbCopy;
+            cb -= cbCopy;
+
+            if (_headers.size() == c_cbFileHeader && cbWanted == c_cbFileHeader)
+            {
+                // Streams must be .bmp files, so the pixel offset is always known.
+                size_t ibBits = _ReadU32(_headers.data() + 10);
+                if (_headers[0] != 'B' || _headers[1] != 'M' ||
+                    ibBits < c_cbFileHeader + c_cbInfoHeader || ibBits > c_cbMaxBmpHeaders)
+                {
+                    _state = STATE_FAILED;
+                }
+                else
+                {
+                    _headers.reserve(ibBits);
+                }
+            }
+            else if (_headers.size() == cbWanted && !_BeginRows())
+            {
+                _state = STATE_FAILED;
+            }
+        }
+        else
+        {
+            size_t cbCopy = (std::min)(cb, _layout.cbStride - _cbRow);
+            memcpy(_row.data() + _cbRow, pb, cbCopy);
+            _cbRow += cbCopy;
+            pb += cbCopy;
+            cb -= cbCopy;
+
+            if (_cbRow == _layout.cbStride)
+            {
+                // Bottom-up BMPs store the last row first.
+                uint32_t y = _layout.fTopDown ? _cRowsReceived : _layout.cy - 1 - _cRowsReceived;
+                _ConvertRow(_layout, _headers.data() + _layout.ibPalette, _row.data(), _rowBgra.data());
+                _AddRow(y);
+                _cbRow = 0;
+                if (++_cRowsReceived == _layout.cy)
+                {
+                    _FlushAccumulatedRow();
+                    _state = STATE_COMPLETE;
+                }
+            }
+        }
+    }
+    return _state != STATE_FAILED;
+}
+
+bool CBmpStreamDecoder::TakeImage(BITMAP_IMAGE *pImage)
+{
+    if (_state != STATE_COMPLETE)
+    {
+        return false;
+    }
+    pImage->cx = _image.cx;
+    pImage->cy = _image.cy;
+    pImage->pixels.swap(_image.pixels);
+    _image.pixels.clear();
+    _state = STATE_FAILED;
+    return true;
+}
+
+// Parses the collected headers and sizes the row buffers for the image.
+bool CBmpStreamDecoder::_BeginRows()
+{
+    if (!_ParseBmpHeaders(_headers.data(), _headers.size(), &_layout) || _layout.ibBits != _headers.size())
+    {
+        return false;
+    }
+
+    _ComputeCrop(_layout.cx, _layout.cy, _cxTarget, _cyTarget, &_xCrop, &_yCrop, &_cxCrop, &_cyCrop);
+
+    _row.resize(_layout.cbStride);
+    _rowBgra.resize(static_cast<size_t>(_layout.cx) * 4);
+    _rowScaled.resize(static_cast<size_t>(_cxTarget) * 4);
+    _accumulated.assign(static_cast<size_t>(_cxTarget) * 4, 0);
+    _image.cx = _cxTarget;
+    _image.cy = _cyTarget;
+    _image.pixels.assign(static_cast<size_t>(_cxTarget) * _cyTarget * 4, 0);
+    _state = STATE_ROWS;
+    return true;
+}
+
+// Scales source row y, held in _rowBgra, into the target rows it covers.
+void CBmpStreamDecoder::_AddRow(uint32_t y)
+{
+    if (y < _yCrop || y - _yCrop >= _cyCrop)
+    {
+        return;
+    }
+    const uint32_t yCropped = y - _yCrop;
+
+    // Each target pixel averages the source pixels that map to it, or takes the one
+    // it falls on when growing.
+    const uint8_t *pbSource = _rowBgra.data() + static_cast<size_t>(_xCrop) * 4;
+    for (uint32_t x = 0; x < _cxTarget; x++)
+    {
+        uint32_t xFirst = static_cast<uint32_t>(static_cast<uint64_t>(x) * _cxCrop / _cxTarget);
+        uint32_t xEnd = static_cast<uint32_t>(static_cast<uint64_t>(x + 1) * _cxCrop / _cxTarget);
+        xEnd = (xEnd > xFirst) ? xEnd : xFirst + 1;
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            uint32_t sum = 0;
+            for (uint32_t xSource = xFirst; xSource < xEnd; xSource++)
+            {
+                sum += pbSource[xSource * 4 + c];
+            }
+            _rowScaled[x * 4 + c] = static_cast<uint8_t>((sum + (xEnd - xFirst) / 2) / (xEnd - xFirst));
+        }
+    }
+
+    if (_cyCrop >= _cyTarget)
+    {
+        // Shrinking: the row belongs to exactly one target row, the last one whose
+        // first source row is at or before it. Rows arrive in order, up or down, so
+        // a target row is complete once a row for a different one arrives.
+        uint32_t yTarget = static_cast<uint32_t>(static_cast<uint64_t>(yCropped) * _cyTarget / _cyCrop);
+        while (yTarget + 1 < _cyTarget &&
+               static_cast<uint64_t>(yTarget + 1) * _cyCrop / _cyTarget <= yCropped)
+        {
+            yTarget++;
+        }
+        if (_cAccumulated != 0 && yTarget != _yAccumulated)
+        {
+            _FlushAccumulatedRow();
+        }
+        _yAccumulated = yTarget;
+        for (size_t i = 0; i < _accumulated.size(); i++)
+        {
+            _accumulated[i] += _rowScaled[i];
+        }
+        _cAccumulated++;
+    }
+    else
+    {
+        // Growing: copy the row to every target row that samples it.
+        uint64_t yFirst = (static_cast<uint64_t>(yCropped) * _cyTarget + _cyCrop - 1) / _cyCrop;
+        uint64_t yEnd = (static_cast<uint64_t>(yCropped + 1) * _cyTarget + _cyCrop - 1) / _cyCrop;
+        for (uint64_t yTarget = yFirst; yTarget < yEnd && yTarget < _cyTarget; yTarget++)
+        {
+            memcpy(_image.pixels.data() + yTarget * _cxTarget * 4, _rowScaled.data(), _rowScaled.size());
+        }
+    }
+}
+
+// Writes the average of the accumulated rows to their target row.
+void CBmpStreamDecoder::_FlushAccumulatedRow()
+{
+    if (_cAccumulated == 0)
+    {
+        return;
+    }
+    uint8_t *pbDest = _image.pixels.data() + static_cast<size_t>(_yAccumulated) * _cxTarget * 4;
+    for (size_t i = 0; i < _accumulated.size(); i++)
+    {
+        pbDest[i] = static_cast<uint8_t>((_accumulated[i] + _cAccumulated / 2) / _cAccumulated);
+        _accumulated[i] = 0;
+    }
+    _cAccumulated = 0;
+}
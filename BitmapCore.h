@@ -0,0 +1,112 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Platform-independent image decoding and scaling for tile images. Nothing in
+// here depends on Windows headers, so it can be built and measured on its own.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A decoded image: 32-bit BGRA pixels in top-down rows with no padding, which is
+// the layout of a top-down 32bpp DIB section.
+struct BITMAP_IMAGE
+{
+    uint32_t                cx;
+    uint32_t                cy;
+    std::vector<uint8_t>    pixels;     // cx * cy * 4 bytes
+};
+
+// Largest width or height accepted from a BMP, to bound memory use.
+static const uint32_t c_cMaxImageDimension = 4096;
+
+// Largest offset of the pixels in a streamed BMP. The headers and palette of any
+// supported BMP fit in well under this.
+static const size_t c_cbMaxBmpHeaders = 4096;
+
+// Where the pixels of a BMP are and how to read them, from its headers.
+struct BMP_LAYOUT
+{
+    uint32_t    cx;
+    uint32_t    cy;
+    bool        fTopDown;
+    uint16_t    cBitCount;
+    uint32_t    cPaletteEntries;
+    size_t      ibPalette;
+    size_t      ibBits;
+    size_t      cbStride;           // Bytes per row, including padding
+};
+
+// Decodes an uncompressed BMP, either a .bmp file or a packed DIB as stored in a
+// BITMAP resource. Supports 1, 4 and 8 bpp with a palette and 24 and 32 bpp.
+bool BmpDecode(const uint8_t *pb, size_t cb, BITMAP_IMAGE *pImage);
+
+// Scales source to cx by cy with bilinear filtering. The source is cropped around
+// its center to the destination's aspect ratio first, so nothing is stretched.
+bool ImageScale(const BITMAP_IMAGE &source, uint32_t cx, uint32_t cy, BITMAP_IMAGE *pScaled);
+
+// Converts a row of 24-bit BGR pixels to opaque 32-bit BGRA. Uses SSSE3 when the
+// processor has it.
+void ConvertRowBgrToBgra(const uint8_t *pbSource, uint8_t *pbDest, size_t cPixels);
+
+// Decodes a .bmp file fed to it in blocks of any size, scaling it to a fixed size
+// as the rows arrive. The source is center-cropped like ImageScale, then box
+// filtered when shrinking and sampled when growing. Memory use is bounded by the
+// headers, one source row and the output image, however large the file is.
+class CBmpStreamDecoder
+{
+public:
+    CBmpStreamDecoder(uint32_t cx, uint32_t cy);
+
+    // Consumes the next cb bytes of the file. Returns false once the data is known
+    // not to be a supported BMP. Bytes after the last row are ignored.
+    bool Write(const uint8_t *pb, size_t cb);
+
+    // True once every row of the image has been received.
+    bool IsComplete() const { return _state == STATE_COMPLETE; }
+
+    // Moves the scaled image out once the decode is complete.
+    bool TakeImage(BITMAP_IMAGE *pImage);
+
+private:
+    CBmpStreamDecoder(const CBmpStreamDecoder &);
+    CBmpStreamDecoder &operator=(const CBmpStreamDecoder &);
+
+    enum STATE
+    {
+        STATE_HEADERS,      // Collecting everything before the pixels
+        STATE_ROWS,         // Collecting pixel rows
+        STATE_COMPLETE,
+        STATE_FAILED,
+    };
+
+    bool _BeginRows();
+    void _AddRow(uint32_t y);
+    void _FlushAccumulatedRow();
+
+    uint32_t                _cxTarget;
+    uint32_t                _cyTarget;
+    STATE                   _state;
+    BMP_LAYOUT              _layout;
+    std::vector<uint8_t>    _headers;           // File bytes before the pixels
+    std::vector<uint8_t>    _row;               // The source row being received
+    size_t                  _cbRow;             // Bytes of _row received so far
+    uint32_t                _cRowsReceived;
+    std::vector<uint8_t>    _rowBgra;           // Last complete source row as BGRA
+    std::vector<uint8_t>    _rowScaled;         // _rowBgra scaled to the target width
+    std::vector<uint32_t>   _accumulated;       // Channel sums for the target row being box filtered
+    uint32_t                _cAccumulated;      // Source rows in _accumulated
+    uint32_t                _yAccumulated;      // Target row _accumulated belongs to
+    uint32_t                _xCrop;
+    uint32_t                _yCrop;
+    uint32_t                _cxCrop;
+    uint32_t                _cyCrop;
+    BITMAP_IMAGE            _image;
+};
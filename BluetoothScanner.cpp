@@ -0,0 +1,508 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Parallel Bluetooth inquiry across all local radios.
+
+#include <windows.h>
+#include <strsafe.h>
+#include <bluetoothapis.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "BluetoothScanner.h"
+#include "PresenceModel.h"
+#include "Dll.h"
+
+#pragma comment(lib, "Bthprops.lib") // Link Bluetooth library
+
+// The absence window can be overridden with the AbsenceWindowSeconds DWORD under this key.
+static const WCHAR c_szSettingsKey[] = L"SOFTWARE\\AbsoluteID";
+static const WCHAR c_szAbsenceWindowValue[] = L"AbsenceWindowSeconds";
+static const DWORD c_dwDefaultAbsenceWindowMs = 60 * 1000;
+
+// A change of the target's presence, decided under the state lock and passed to
+// the sink after it is released.
+struct CBluetoothScanner::PROXIMITY_NOTIFICATION
+{
+    bool                fArrived;
+    BLUETOOTH_ADDRESS   address;    // Arrivals only
+    DWORD               dwRadio;    // Arrivals only
+    CPresenceModel      model;      // The presence model with the change recorded, to save
+};
+
+// State shared by the scanner and the radio threads of one scan. The threads hold
+// a reference, so it outlives both CBluetoothScanner and any thread still inside
+// a blocking inquiry when Stop is called.
+struct CBluetoothScanner::SCAN_STATE
+{
+    mutable std::mutex                                  lock;
+    std::condition_variable                             cvStop;
+    std::condition_variable                             cvNotified; // Signaled when fNotifying is cleared
+    bool                                                fStop = false;
+    bool                                                fNotifying = false; // A radio thread is delivering notifications
+    std::vector<PROXIMITY_NOTIFICATION>                 notifications;      // Waiting for delivery, oldest first
+    bool                                                fTargetPresent = false;
+    ULONGLONG                                           ullTargetLastSeen = 0;
+    DWORD                                               dwAbsenceWindowMs = c_dwDefaultAbsenceWindowMs;
+    std::wstring                                        strTargetName;
+    IBluetoothProximitySink                             *pSink = nullptr;
+    ULONGLONG                                           ullStartTick = 0;
+    LONG                                                cActiveRadios = 0;
+    std::vector<BLUETOOTH_RADIO_STATS>                  radioStats;
+    std::unordered_map<ULONGLONG, BLUETOOTH_SIGHTING>   sightings;  // Keyed by BLUETOOTH_ADDRESS::ullLong
+    CPresenceModel                                      presenceModel; // Paces the inquiry passes
+};
+
+// A radio of the machine, driven through the Bluetooth APIs.
+class CSystemBluetoothRadio : public IBluetoothRadio
+{
+public:
+    explicit CSystemBluetoothRadio(HANDLE hRadio) :
+        _hRadio(hRadio)
+    {
+    }
+
+    ~CSystemBluetoothRadio()
+    {
+        CloseHandle(_hRadio);
+    }
+
+    HRESULT GetInfo(_Out_ BLUETOOTH_ADDRESS *pAddress, _Out_writes_(cchName) PWSTR pszName, size_t cchName)
+    {
+        BLUETOOTH_RADIO_INFO bri = { sizeof(BLUETOOTH_RADIO_INFO) };
+        DWORD dwError = BluetoothGetRadioInfo(_hRadio, &bri);
+        if (dwError == ERROR_SUCCESS)
+        {
+            *pAddress = bri.address;
+            StringCchCopyW(pszName, cchName, bri.szName);
+        }
+        return HRESULT_FROM_WIN32(dwError);
+    }
+
+    void Inquire(const std::function<bool(const BLUETOOTH_DEVICE_INFO &)> &onDevice)
+    {
+        BLUETOOTH_DEVICE_SEARCH_PARAMS btdsp = { sizeof(BLUETOOTH_DEVICE_SEARCH_PARAMS) };
+        BLUETOOTH_DEVICE_INFO btdi = { sizeof(BLUETOOTH_DEVICE_INFO) };
+
+        btdsp.hRadio = _hRadio;
+        btdsp.fReturnAuthenticated = TRUE;
+        btdsp.fReturnRemembered = TRUE;
+        btdsp.fReturnUnknown = TRUE;
+        btdsp.fReturnConnected = TRUE;
+        btdsp.fIssueInquiry = TRUE;
+        btdsp.cTimeoutMultiplier = 5; // About 6.4 seconds
+
+        HBLUETOOTH_DEVICE_FIND hFindDevice = BluetoothFindFirstDevice(&btdsp, &btdi);
+        if (hFindDevice)
+        {
+            do
+            {
+                if (onDevice(btdi))
+                {
+                    break;
+                }
+            } while (BluetoothFindNextDevice(hFindDevice, &btdi));
+
+            BluetoothFindDeviceClose(hFindDevice);
+        }
+    }
+
+private:
+    HANDLE _hRadio;
+};
+
+HRESULT CSystemBluetoothRadioSource::OpenRadios(_Out_ std::vector<std::unique_ptr<IBluetoothRadio>> *pRadios)
+{
+    pRadios->clear();
+
+    BLUETOOTH_FIND_RADIO_PARAMS btfrp = { sizeof(BLUETOOTH_FIND_RADIO_PARAMS) };
+    HANDLE hRadio = nullptr;
+    HBLUETOOTH_RADIO_FIND hFind = BluetoothFindFirstRadio(&btfrp, &hRadio);
+    if (hFind == nullptr)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    do
+    {
+        std::unique_ptr<IBluetoothRadio> spRadio(new (std::nothrow) CSystemBluetoothRadio(hRadio));
+        if (spRadio)
+        {
+            pRadios->push_back(std::move(spRadio));
+        }
+        else
+        {
+            CloseHandle(hRadio);
+            hr = E_OUTOFMEMORY;
+        }
+    } while (SUCCEEDED(hr) && BluetoothFindNextRadio(hFind, &hRadio));
+    BluetoothFindRadioClose(hFind);
+
+    if (FAILED(hr))
+    {
+        pRadios->clear();
+    }
+    return hr;
+}
+
+// Set while this thread is inside a call to the sink, so a sink that stops the
+// scanner does not wait for itself.
+static thread_local bool t_fInSinkCall = false;
+
+// The radios of the machine, for scanners that are not given a source.
+static CSystemBluetoothRadioSource s_systemRadioSource;
+
+CBluetoothScanner::CBluetoothScanner() :
+    _pSource(&s_systemRadioSource)
+{
+}
+
+CBluetoothScanner::CBluetoothScanner(_In_ IBluetoothRadioSource *pSource) :
+    _pSource(pSource)
+{
+}
+
+CBluetoothScanner::~CBluetoothScanner()
+{
+    Stop();
+}
+
+// Opens every local radio and starts an inquiry thread on each of them.
+// Returns S_FALSE, leaving the tracking state alone, when the same target is
+// already being tracked for the same sink.
+HRESULT CBluetoothScanner::Start(_In_ PCWSTR pszTargetName, _In_ IBluetoothProximitySink *pSink)
+{
+    if (IsTracking(pszTargetName, pSink))
+    {
+        return S_FALSE;
+    }
+    Stop();
+
+    std::vector<std::unique_ptr<IBluetoothRadio>> radios;
+    HRESULT hr = _pSource->OpenRadios(&radios);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    if (radios.empty())
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+    }
+
+    std::shared_ptr<SCAN_STATE> spState = std::make_shared<SCAN_STATE>();
+    spState->strTargetName = pszTargetName;
+    spState->pSink = pSink;
+    spState->ullStartTick = GetTickCount64();
+    spState->radioStats.resize(radios.size());
+
+    // A missing model just means we have not seen the device arrive yet.
+    spState->presenceModel.Load(pszTargetName);
+
+    DWORD dwAbsenceWindowSeconds;
+    DWORD cbData = sizeof(dwAbsenceWindowSeconds);
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, c_szSettingsKey, c_szAbsenceWindowValue, RRF_RT_REG_DWORD, nullptr, &dwAbsenceWindowSeconds, &cbData) == ERROR_SUCCESS &&
+        dwAbsenceWindowSeconds > 0)
+    {
+        spState->dwAbsenceWindowMs = dwAbsenceWindowSeconds * 1000;
+    }
+
+    for (DWORD i = 0; i < radios.size(); i++)
+    {
+        BLUETOOTH_RADIO_STATS *pStats = &spState->radioStats[i];
+        ZeroMemory(pStats, sizeof(*pStats));
+        radios[i]->GetInfo(&pStats->address, pStats->szName, ARRAYSIZE(pStats->szName));
+    }
+
+    // Set before the threads start, as the sink they call may query the scanner.
+    _spState = spState;
+    spState->cActiveRadios = static_cast<LONG>(radios.size());
+    for (DWORD i = 0; i < radios.size(); i++)
+    {
+        std::thread(_ScanRadio, spState, i, std::move(radios[i])).detach();
+    }
+
+    wchar_t szMsg[128];
+    StringCchPrintfW(szMsg, ARRAYSIZE(szMsg), L"Bluetooth scan started on %u radio(s).\n", static_cast<UINT>(radios.size()));
+    OutputDebugStringW(szMsg);
+    return S_OK;
+}
+
+bool CBluetoothScanner::IsTracking(_In_ PCWSTR pszTargetName, _In_ IBluetoothProximitySink *pSink) const
+{
+    if (_spState)
+    {
+        std::lock_guard<std::mutex> lock(_spState->lock);
+        return _spState->cActiveRadios > 0 && _spState->pSink == pSink && _spState->strTargetName == pszTargetName;
+    }
+    return false;
+}
+
+void CBluetoothScanner::Stop()
+{
+    if (_spState)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_spState->lock);
+            _spState->fStop = true;
+            _spState->pSink = nullptr;
+            _spState->notifications.clear();
+            _spState->cvStop.notify_all();
+
+            // A notification already handed to the sink may still be running.
+            if (!t_fInSinkCall)
+            {
+                SCAN_STATE *pState = _spState.get();
+                pState->cvNotified.wait(lock, [pState] { return !pState->fNotifying; });
+            }
+        }
+        _spState.reset();
+    }
+}
+
+bool CBluetoothScanner::IsRunning() const
+{
+    if (_spState)
+    {
+        std::lock_guard<std::mutex> lock(_spState->lock);
+        return _spState->cActiveRadios > 0;
+    }
+    return false;
+}
+
+void CBluetoothScanner::GetRadioStats(_Out_ std::vector<BLUETOOTH_RADIO_STATS> *pStats) const
+{
+    pStats->clear();
+    if (_spState)
+    {
+        std::lock_guard<std::mutex> lock(_spState->lock);
+        *pStats = _spState->radioStats;
+    }
+}
+
+void CBluetoothScanner::GetSightings(_Out_ std::vector<BLUETOOTH_SIGHTING> *pSightings) const
+{
+    pSightings->clear();
+    if (_spState)
+    {
+        std::lock_guard<std::mutex> lock(_spState->lock);
+        pSightings->reserve(_spState->sightings.size());
+        for (const auto &entry : _spState->sightings)
+        {
+            pSightings->push_back(entry.second);
+        }
+    }
+}
+
+// Thread procedure for one radio. Repeats the inquiry until the scan is stopped.
+// The pause between passes comes from the presence model: while the target is
+// away it follows the usual arrival times, while it is present the departures.
+void CBluetoothScanner::_ScanRadio(std::shared_ptr<SCAN_STATE> spState, DWORD dwRadio, std::unique_ptr<IBluetoothRadio> spRadio)
+{
+    // Keep the DLL loaded for as long as this thread can run its code.
+    DllAddRef();
+
+    bool fDone = false;
+    while (!fDone)
+    {
+        spRadio->Inquire([&spState, dwRadio](const BLUETOOTH_DEVICE_INFO &btdi)
+        {
+            return _RecordSighting(spState.get(), dwRadio, btdi);
+        });
+
+        SYSTEMTIME stNow;
+        GetLocalTime(&stNow);
+
+        std::unique_lock<std::mutex> lock(spState->lock);
+        spState->radioStats[dwRadio].cScans++;
+        _CheckForDeparture(spState.get(), stNow);
+        _PruneSightings(spState.get());
+        _DeliverNotifications(spState.get(), lock);
+
+        DWORD dwIntervalMs;
+        if (spState->fTargetPresent)
+        {
+            dwIntervalMs = spState->presenceModel.GetTrackingIntervalMs(stNow, spState->dwAbsenceWindowMs);
+        }
+        else
+        {
+            dwIntervalMs = spState->presenceModel.GetScanIntervalMs(stNow);
+        }
+        fDone = spState->cvStop.wait_for(lock, std::chrono::milliseconds(dwIntervalMs),
+            [&spState] { return spState->fStop; });
+    }
+
+    spRadio.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(spState->lock);
+        spState->cActiveRadios--;
+    }
+    spState.reset();
+    DllRelease();
+}
+
+// Merges one device reported by a radio into the shared sighting list. Returns true
+// when the device is the target, which ends the current inquiry on this radio.
+bool CBluetoothScanner::_RecordSighting(SCAN_STATE *pState, DWORD dwRadio, const BLUETOOTH_DEVICE_INFO &btdi)
+{
+    std::unique_lock<std::mutex> lock(pState->lock);
+    if (pState->fStop)
+    {
+        return true;
+    }
+
+    ULONGLONG ullNow = GetTickCount64();
+    BLUETOOTH_RADIO_STATS *pStats = &pState->radioStats[dwRadio];
+    pStats->cSightings++;
+
+    BLUETOOTH_SIGHTING *pSighting;
+    auto it = pState->sightings.find(btdi.Address.ullLong);
+    if (it == pState->sightings.end())
+    {
+        BLUETOOTH_SIGHTING sighting = {};
+        sighting.address = btdi.Address;
+        sighting.dwRadio = dwRadio;
+        sighting.ullFirstSeen = ullNow;
+        pSighting = &pState->sightings.emplace(btdi.Address.ullLong, sighting).first->second;
+        pStats->cFirstSightings++;
+
+        std::wstring debugMsg = L"Found Bluetooth device: ";
+        debugMsg += btdi.szName;
+        debugMsg += L"\n";
+        OutputDebugStringW(debugMsg.c_str());
+    }
+    else
+    {
+        pSighting = &it->second;
+    }
+    pSighting->ullLastSeen = ullNow;
+
+    // Inquiry results do not always carry the remote name, so keep the last one we were given.
+    if (btdi.szName[0] != L'\0')
+    {
+        StringCchCopyW(pSighting->szName, ARRAYSIZE(pSighting->szName), btdi.szName);
+    }
+
+    bool fIsTarget = (pState->strTargetName == pSighting->szName);
+    if (fIsTarget)
+    {
+        if (pStats->ullTargetLatencyMs == 0)
+        {
+            pStats->ullTargetLatencyMs = ullNow - pState->ullStartTick;
+        }
+        pState->ullTargetLastSeen = ullNow;
+        if (!pState->fTargetPresent)
+        {
+            pState->fTargetPresent = true;
+            OutputDebugStringW(L"Target device found!\n");
+            _LogRadioStats(pState);
+
+            SYSTEMTIME stNow;
+            GetLocalTime(&stNow);
+            pState->presenceModel.RecordArrival(stNow);
+            pState->notifications.push_back({ true, btdi.Address, dwRadio, pState->presenceModel });
+            _DeliverNotifications(pState, lock);
+        }
+    }
+    return fIsTarget;
+}
+
+// Queues the departure event once the target has gone unseen by every radio for
+// longer than the absence window. Called with the state lock held.
+void CBluetoothScanner::_CheckForDeparture(SCAN_STATE *pState, const SYSTEMTIME &stNow)
+{
+    if (pState->fTargetPresent && !pState->fStop &&
+        GetTickCount64() - pState->ullTargetLastSeen > pState->dwAbsenceWindowMs)
+    {
+        pState->fTargetPresent = false;
+        OutputDebugStringW(L"Target device left Bluetooth proximity.\n");
+
+        pState->presenceModel.RecordDeparture(stNow);
+        pState->notifications.push_back({ false, {}, 0, pState->presenceModel });
+    }
+}
+
+// Forgets devices no radio has seen for longer than the absence window, so the
+// list holds what is around now rather than everything that ever passed by.
+// Called with the state lock held.
+void CBluetoothScanner::_PruneSightings(SCAN_STATE *pState)
+{
+    ULONGLONG ullNow = GetTickCount64();
+    for (auto it = pState->sightings.begin(); it != pState->sightings.end();)
+    {
+        if (ullNow - it->second.ullLastSeen > pState->dwAbsenceWindowMs)
+        {
+            it = pState->sightings.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Saves the presence model and calls the sink for each queued notification, with
+// the state lock released so the sink is free to take its own locks and call the
+// scanner. One thread delivers at a time, which keeps the notifications in order;
+// a thread that finds another one delivering leaves its notifications to it.
+// Called with the state lock held through lock, which is held again on return.
+void CBluetoothScanner::_DeliverNotifications(SCAN_STATE *pState, std::unique_lock<std::mutex> &lock)
+{
+    if (pState->fNotifying)
+    {
+        return;
+    }
+
+    pState->fNotifying = true;
+    while (!pState->notifications.empty())
+    {
+        PROXIMITY_NOTIFICATION notification = pState->notifications.front();
+        pState->notifications.erase(pState->notifications.begin());
+        IBluetoothProximitySink *pSink = pState->pSink;
+        lock.unlock();
+
+        // The target name does not change once the scan has started.
+        notification.model.Save(pState->strTargetName.c_str());
+        if (pSink)
+        {
+            t_fInSinkCall = true;
+            if (notification.fArrived)
+            {
+                pSink->OnTargetDeviceInProximity(notification.address, notification.dwRadio);
+            }
+            else
+            {
+                pSink->OnTargetDeviceDeparted();
+            }
+            t_fInSinkCall = false;
+        }
+
+        lock.lock();
+    }
+    pState->fNotifying = false;
+    pState->cvNotified.notify_all();
+}
+
+void CBluetoothScanner::_LogRadioStats(const SCAN_STATE *pState)
+{
+    for (DWORD i = 0; i < pState->radioStats.size(); i++)
+    {
+        const BLUETOOTH_RADIO_STATS &stats = pState->radioStats[i];
+        wchar_t szMsg[512];
+        StringCchPrintfW(szMsg, ARRAYSIZE(szMsg),
+            L"Radio %u (%s): %u scans, %u sightings, %u first, target latency %llu ms\n",
+            i, stats.szName, stats.cScans, stats.cSightings, stats.cFirstSightings, stats.ullTargetLatencyMs);
+        OutputDebugStringW(szMsg);
+    }
+}
@@ -0,0 +1,118 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CBluetoothScanner runs a device inquiry on every local Bluetooth radio
+// at the same time and merges what the radios see into a single list of
+// sightings, deduplicated by device address. It keeps tracking the target
+// device after it is found and reports when it leaves.
+
+#pragma once
+
+#include <windows.h>
+#include <bluetoothapis.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Receives proximity notifications from CBluetoothScanner. Called on one of the
+// scanner's radio threads, one notification at a time and in order, without any
+// scanner lock held; implementations may call the scanner, but must not block on
+// a thread that is calling Stop.
+class IBluetoothProximitySink
+{
+public:
+    virtual void OnTargetDeviceInProximity(const BLUETOOTH_ADDRESS &address, DWORD dwRadio) = 0;
+    virtual void OnTargetDeviceDeparted() = 0;
+};
+
+// One local radio. Each scan thread owns the radio it runs the inquiry on.
+class IBluetoothRadio
+{
+public:
+    virtual ~IBluetoothRadio() {}
+
+    // Gets the address and friendly name of the radio.
+    virtual HRESULT GetInfo(_Out_ BLUETOOTH_ADDRESS *pAddress, _Out_writes_(cchName) PWSTR pszName, size_t cchName) = 0;
+
+    // Runs one inquiry pass, passing each device found to onDevice until it returns true.
+    virtual void Inquire(const std::function<bool(const BLUETOOTH_DEVICE_INFO &)> &onDevice) = 0;
+};
+
+// Opens the local radios a scan runs on. CSystemBluetoothRadioSource opens the
+// radios of the machine; the scanner only depends on this interface, so simulated
+// radios can stand in for them.
+class IBluetoothRadioSource
+{
+public:
+    virtual HRESULT OpenRadios(_Out_ std::vector<std::unique_ptr<IBluetoothRadio>> *pRadios) = 0;
+};
+
+class CSystemBluetoothRadioSource : public IBluetoothRadioSource
+{
+public:
+    HRESULT OpenRadios(_Out_ std::vector<std::unique_ptr<IBluetoothRadio>> *pRadios);
+};
+
+// Statistics kept for each local radio taking part in a scan.
+struct BLUETOOTH_RADIO_STATS
+{
+    BLUETOOTH_ADDRESS   address;                            // Address of the local radio
+    WCHAR               szName[BLUETOOTH_MAX_NAME_SIZE];    // Friendly name of the local radio
+    DWORD               cScans;                             // Completed inquiry passes
+    DWORD               cSightings;                         // Devices reported, including repeats
+    DWORD               cFirstSightings;                    // Devices this radio reported before any other radio
+    ULONGLONG           ullTargetLatencyMs;                 // Scan start to first target sighting, 0 if never seen
+};
+
+// A remote device seen by at least one radio within the absence window.
+struct BLUETOOTH_SIGHTING
+{
+    BLUETOOTH_ADDRESS   address;
+    WCHAR               szName[BLUETOOTH_MAX_NAME_SIZE];
+    DWORD               dwRadio;                            // Index of the radio that saw the device first
+    ULONGLONG           ullFirstSeen;                       // GetTickCount64() at the first sighting
+    ULONGLONG           ullLastSeen;                        // GetTickCount64() at the latest sighting
+};
+
+class CBluetoothScanner
+{
+public:
+    CBluetoothScanner(); // Scans the radios of the machine
+    explicit CBluetoothScanner(_In_ IBluetoothRadioSource *pSource);
+    ~CBluetoothScanner();
+
+    // Starts one scan thread per local radio, stopping any scan of another target.
+    HRESULT Start(_In_ PCWSTR pszTargetName, _In_ IBluetoothProximitySink *pSink);
+
+    // Whether Start would return S_FALSE because the target is already tracked for the sink.
+    bool IsTracking(_In_ PCWSTR pszTargetName, _In_ IBluetoothProximitySink *pSink) const;
+
+    // Signals the scan threads to exit. Returns without waiting for them, but waits
+    // for a sink call in progress on another thread; once it returns the sink will
+    // not be called again.
+    void Stop();
+
+    bool IsRunning() const;
+    void GetRadioStats(_Out_ std::vector<BLUETOOTH_RADIO_STATS> *pStats) const;
+    void GetSightings(_Out_ std::vector<BLUETOOTH_SIGHTING> *pSightings) const;
+
+private:
+    struct SCAN_STATE;
+    struct PROXIMITY_NOTIFICATION;
+
+    static void _ScanRadio(std::shared_ptr<SCAN_STATE> spState, DWORD dwRadio, std::unique_ptr<IBluetoothRadio> spRadio);
+    static bool _RecordSighting(SCAN_STATE *pState, DWORD dwRadio, const BLUETOOTH_DEVICE_INFO &btdi);
+    static void _CheckForDeparture(SCAN_STATE *pState, const SYSTEMTIME &stNow);
+    static void _PruneSightings(SCAN_STATE *pState);
+    static void _DeliverNotifications(SCAN_STATE *pState, std::unique_lock<std::mutex> &lock);
+    static void _LogRadioStats(const SCAN_STATE *pState);
+
+    IBluetoothRadioSource                   *_pSource;  // Opens the radios of each scan
+    std::shared_ptr<SCAN_STATE>             _spState;   // Shared with the radio threads of the current scan
+};
@@ -15,12 +15,92 @@
 #include <unknwn.h>
 #include "CSampleCredential.h"
 #include "CSampleProvider.h"
+#include "TileBitmapCache.h"
+#include "SerializationCache.h"
+#include "AuthPackageResolver.h"
+#include "SecretArena.h"
+#include "ProtectedSecretCache.h"
+#include "SecretProvider.h"
 #include "guid.h"
 #include <iostream>
 #include <bluetoothapis.h> // Windows Bluetooth API
 
 #pragma comment(lib, "Bthprops.lib") // Link Bluetooth library
 
+static_assert(SFI_NUM_FIELDS <= c_cMaxFieldStrings, "The changed fields must fit in a bit mask");
+
+// Number of credentials carved from each slab; one slab covers a typical machine's user list
+static const DWORD c_cCredentialsPerSlab = 16;
+
+// Where the users' passwords come from.
+static ISecretProvider &_GetSecretProvider()
+{
+    return CVaultSecretProvider::Instance();
+}
+
+// Copies the user's password into a secret arena slot. Fails with E_CHANGED_STATE
+// if the secret is no longer the version the caller is packing for.
+static HRESULT _LoadPassword(_In_opt_ PCWSTR pszUserSid, DWORD dwSecretVersion, _Out_writes_(c_cchSecretSlot) PWSTR pszPassword)
+{
+    DWORD dwVersion;
+    HRESULT hr = _GetSecretProvider().GetSecret(pszUserSid, pszPassword, &dwVersion);
+    if (SUCCEEDED(hr) && dwVersion != dwSecretVersion)
+    {
+        hr = E_CHANGED_STATE;
+    }
+    return hr;
+}
+
+// Copies into the slot the form of the user's password that goes into a logon buffer
+// for cpus. The password is only loaded and protected again when the version changes.
+static HRESULT _LoadProtectedPassword(_In_opt_ PCWSTR pszUserSid,
+                                      CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                                      DWORD dwSecretVersion,
+                                      _Out_writes_(c_cchSecretSlot) PWSTR pszPassword)
+{
+    CProtectedSecretCache &cache = CProtectedSecretCache::Instance();
+    HRESULT hr = cache.Lookup(pszUserSid, cpus, dwSecretVersion, pszPassword);
+    if (hr == S_FALSE)
+    {
+        hr = _LoadPassword(pszUserSid, dwSecretVersion, pszPassword);
+        if (SUCCEEDED(hr))
+        {
+            hr = cache.Protect(pszUserSid, cpus, dwSecretVersion, pszPassword);
+        }
+    }
+    return hr;
+}
+
+// Pool that every CSampleCredential is allocated from
+static CSlabPool s_credentialPool(sizeof(CSampleCredential), c_cCredentialsPerSlab);
+
+// The arena's copy count at the last logon result, so each result reports its own copies.
+static volatile LONG64 s_cArenaCopiesReported = 0;
+
+// Allocates a credential from the pool, returning nullptr on failure like the default nothrow new
+void *CSampleCredential::operator new(size_t cb, const std::nothrow_t &) noexcept
+{
+    return s_credentialPool.Allocate(cb);
+}
+
+// Release calls delete this, which returns the credential's block to the pool
+void CSampleCredential::operator delete(void *pv) noexcept
+{
+    s_credentialPool.Free(pv);
+}
+
+// Matches the nothrow operator new; only called if the constructor throws
+void CSampleCredential::operator delete(void *pv, const std::nothrow_t &) noexcept
+{
+    s_credentialPool.Free(pv);
+}
+
+// Gets the allocation counters of the credential pool
+void CSampleCredential::GetPoolStats(_Out_ SLAB_POOL_STATS *pStats)
+{
+    s_credentialPool.GetStats(pStats);
+}
+
 // Constructor for CSampleCredential class
 CSampleCredential::CSampleCredential():
    // Initialize reference count to 1
@@ -31,34 +111,42 @@ CSampleCredential::CSampleCredential():
    _pszUserSid(nullptr),
    // Initialize qualified user name pointer to nullptr
    _pszQualifiedUserName(nullptr),
+   // Initialize the parsed qualified user name to empty
+   _qualifiedNameParts(),
+   // Initialize the pending user pointer to nullptr
+   _pcpUserPending(nullptr),
+   // Initialize the shared field descriptors pointer to nullptr
+   _rgCredProvFieldDescriptors(nullptr),
+   // Initialize the field strings, which are empty until Initialize
+   _fieldStrings(SFI_NUM_FIELDS),
    // Initialize local user flag to false
-   _fIsLocalUser(false)
+   _fIsLocalUser(false),
+   // Nothing is queued to pack the logon buffer yet
+   _fPrepareQueued(0),
+   // The logon status property is shown until the provider reports a state
+   _pszProviderStatus(nullptr)
 {
    // Increment DLL reference count
    DllAddRef();
 
-   // Zero out the memory for credential provider field descriptors array
-   ZeroMemory(_rgCredProvFieldDescriptors, sizeof(_rgCredProvFieldDescriptors));
+   // Initialize the lock that guards the field strings
+   InitializeSRWLock(&_lockFields);
+
    // Zero out the memory for field state pairs array
    ZeroMemory(_rgFieldStatePairs, sizeof(_rgFieldStatePairs));
-   // Zero out the memory for field strings array
-   ZeroMemory(_rgFieldStrings, sizeof(_rgFieldStrings));
 }
 
 CSampleCredential::~CSampleCredential()
 {
-    // Loop through each field string and free the allocated memory
-    for (int i = 0; i < ARRAYSIZE(_rgFieldStrings); i++)
-    {
-        // Free the memory allocated for the field string
-        CoTaskMemFree(_rgFieldStrings[i]);
-        // Free the memory allocated for the field descriptor label
-        CoTaskMemFree(_rgCredProvFieldDescriptors[i].pszLabel);
-    }
     // Free the memory allocated for the user SID
     CoTaskMemFree(_pszUserSid);
     // Free the memory allocated for the qualified user name
     CoTaskMemFree(_pszQualifiedUserName);
+    // Release the user if its properties were never fetched
+    if (_pcpUserPending != nullptr)
+    {
+        _pcpUserPending->Release();
+    }
     // Decrement the DLL reference count
     DllRelease();
 }
@@ -69,7 +157,8 @@ CSampleCredential::~CSampleCredential()
 HRESULT CSampleCredential::Initialize(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
                                       _In_ CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR const *rgcpfd,
                                       _In_ FIELD_STATE_PAIR const *rgfsp,
-                                      _In_ ICredentialProviderUser *pcpUser)
+                                      _In_ ICredentialProviderUser *pcpUser,
+                                      _In_ PCWSTR pszUserSid)
 {
     // Initialize the HRESULT variable to S_OK, indicating success.
     HRESULT hr = S_OK;
@@ -83,140 +172,367 @@ HRESULT CSampleCredential::Initialize(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
     // Check if the provider ID matches the local user provider ID and set the local user flag accordingly.
     _fIsLocalUser = (guidProvider == Identity_LocalUserProvider);
 
-    // Loop through each field descriptor and copy it to the member variable array.
-    for (DWORD i = 0; SUCCEEDED(hr) && i < ARRAYSIZE(_rgCredProvFieldDescriptors); i++)
+    // The field descriptors are static and identical for every user, so we point at
+    // them instead of copying their labels into each credential.
+    _rgCredProvFieldDescriptors = rgcpfd;
+
+    // Loop through each field state pair and copy it to the member variable array.
+    for (DWORD i = 0; i < ARRAYSIZE(_rgFieldStatePairs); i++)
     {
         // Copy the field state pair to the member variable array.
         _rgFieldStatePairs[i] = rgfsp[i];
-        // Copy the field descriptor to the member variable array.
-        hr = FieldDescriptorCopy(rgcpfd[i], &_rgCredProvFieldDescriptors[i]);
     }
 
-    // Initialize the string value of the label field.
+    // Initialize the string values of the label and large text fields. The user
+    // property fields are added to the arena when they are first fetched.
+    PCWSTR rgpszValues[SFI_NUM_FIELDS] = {};
+    rgpszValues[SFI_LABEL] = L"AbsoluteID Credential";
+    rgpszValues[SFI_LARGE_TEXT] = L"AbsoluteID Credential Provider";
+    DWORD dwChanged;
+    AcquireSRWLockExclusive(&_lockFields);
+    hr = _fieldStrings.Update(rgpszValues, &dwChanged);
+    ReleaseSRWLockExclusive(&_lockFields);
+
+    // Copy the user SID the provider already fetched to match tiles to users.
     if (SUCCEEDED(hr))
     {
-        hr = SHStrDupW(L"AbsoluteID Credential", &_rgFieldStrings[SFI_LABEL]);
+        hr = SHStrDupW(pszUserSid, &_pszUserSid);
     }
-    // Initialize the string value of the large text field.
+
+    // The other identity properties can block on a directory lookup for domain users,
+    // so they are fetched when a field needs them rather than for every enumerated user.
     if (SUCCEEDED(hr))
     {
-        hr = SHStrDupW(L"AbsoluteID Credential Provider", &_rgFieldStrings[SFI_LARGE_TEXT]);
+        _SetPendingUser(pcpUser);
     }
-    // Get the qualified user name from the user and store it in the member variable.
-    if (SUCCEEDED(hr))
+
+    // Return the HRESULT value indicating success or failure.
+    return hr;
+}
+
+// Called instead of Initialize when the user of an existing credential is enumerated
+// again. The SID is unchanged by definition; everything else may have changed.
+HRESULT CSampleCredential::Refresh(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                                   _In_ ICredentialProviderUser *pcpUser)
+{
+    // Re-check whether the user is a local user.
+    GUID guidProvider;
+    pcpUser->GetProviderID(&guidProvider);
+
+    // The usage scenario may differ from the previous enumeration. The background
+    // serialization reads both under the lock.
+    AcquireSRWLockExclusive(&_lockFields);
+    _cpus = cpus;
+    _fIsLocalUser = (guidProvider == Identity_LocalUserProvider);
+    ReleaseSRWLockExclusive(&_lockFields);
+
+    // Fetch the properties again the next time a field needs them.
+    _SetPendingUser(pcpUser);
+    return S_OK;
+}
+
+// Remembers the user whose properties are fetched by _EnsureUserProperties,
+// replacing any user that is still pending.
+void CSampleCredential::_SetPendingUser(_In_ ICredentialProviderUser *pcpUser)
+{
+    pcpUser->AddRef();
+    if (_pcpUserPending != nullptr)
     {
-        hr = pcpUser->GetStringValue(PKEY_Identity_QualifiedUserName, &_pszQualifiedUserName);
+        _pcpUserPending->Release();
     }
-    // Get the user name from the user and store it in the member variable.
-    if (SUCCEEDED(hr))
+    _pcpUserPending = pcpUser;
+}
+
+// Fetches the identity properties the first time they are needed after Initialize
+// or Refresh. After a failure the user stays pending so the next call retries.
+HRESULT CSampleCredential::_EnsureUserProperties()
+{
+    HRESULT hr = S_OK;
+    if (_pcpUserPending != nullptr)
     {
-        // Declare a pointer to store the user name.
-        PWSTR pszUserName;
-        // Get the user name from the user.
-        pcpUser->GetStringValue(PKEY_Identity_UserName, &pszUserName);
-        // Check if the user name is not null.
-        if (pszUserName != nullptr)
-        {
-            // Declare a buffer to store the formatted string.
-            wchar_t szString[256];
-            // Format the user name string.
-            StringCchPrintf(szString, ARRAYSIZE(szString), L"User Name: %s", pszUserName);
-            // Duplicate the formatted string and store it in the member variable.
-            hr = SHStrDupW(szString, &_rgFieldStrings[SFI_FULLNAME_TEXT]);
-            // Free the memory allocated for the user name.
-            CoTaskMemFree(pszUserName);
-        }
-        else
+        USER_PROPERTIES properties;
+        hr = UserPropertiesFetch(_pcpUserPending, &properties);
+        if (SUCCEEDED(hr))
         {
-            // If the user name is null, set the field string to indicate that.
-            hr =  SHStrDupW(L"User Name is NULL", &_rgFieldStrings[SFI_FULLNAME_TEXT]);
+            hr = SetUserProperties(&properties);
+            UserPropertiesFree(&properties);
         }
     }
-    // Get the display name from the user and store it in the member variable.
+    return hr;
+}
+
+// Takes the qualified user name and formats the displayed identity properties into
+// the field strings. Called with properties fetched by _EnsureUserProperties, or by
+// the provider with properties it prefetched for many users at once.
+HRESULT CSampleCredential::SetUserProperties(_Inout_ USER_PROPERTIES *pProperties)
+{
+    DISPLAY_TEXT text;
+    FormatDisplayText(pProperties, &text);
+
+    HRESULT hr = _ApplyDisplayText(text);
     if (SUCCEEDED(hr))
     {
-        // Declare a pointer to store the display name.
-        PWSTR pszDisplayName;
-        // Get the display name from the user.
-        pcpUser->GetStringValue(PKEY_Identity_DisplayName, &pszDisplayName);
-        // Check if the display name is not null.
-        if (pszDisplayName != nullptr)
+        // Take the qualified user name, which is used to pack the authentication buffer.
+        // A buffer packed for another name is of no use any more.
+        AcquireSRWLockExclusive(&_lockFields);
+        bool fRenamed = (_pszQualifiedUserName != nullptr && pProperties->pszQualifiedUserName != nullptr &&
+                         wcscmp(_pszQualifiedUserName, pProperties->pszQualifiedUserName) != 0);
+        CoTaskMemFree(_pszQualifiedUserName);
+        _pszQualifiedUserName = pProperties->pszQualifiedUserName;
+        pProperties->pszQualifiedUserName = nullptr;
+        _qualifiedNameParts = QUALIFIED_NAME_PARTS();
+        if (_pszQualifiedUserName != nullptr)
         {
-            // Declare a buffer to store the formatted string.
-            wchar_t szString[256];
-            // Format the display name string.
-            StringCchPrintf(szString, ARRAYSIZE(szString), L"Display Name: %s", pszDisplayName);
-            // Duplicate the formatted string and store it in the member variable.
-            hr = SHStrDupW(szString, &_rgFieldStrings[SFI_DISPLAYNAME_TEXT]);
-            // Free the memory allocated for the display name.
-            CoTaskMemFree(pszDisplayName);
+            ParseQualifiedUserName(reinterpret_cast<const char16_t*>(_pszQualifiedUserName), &_qualifiedNameParts);
         }
-        else
+        ReleaseSRWLockExclusive(&_lockFields);
+        if (fRenamed)
         {
-            // If the display name is null, set the field string to indicate that.
-            hr = SHStrDupW(L"Display Name is NULL", &_rgFieldStrings[SFI_DISPLAYNAME_TEXT]);
+            CSerializationCache::Instance().Invalidate(_pszUserSid);
+        }
+
+        // The properties are current, so there is nothing left to fetch.
+        if (_pcpUserPending != nullptr)
+        {
+            _pcpUserPending->Release();
+            _pcpUserPending = nullptr;
         }
     }
-    // Get the logon status from the user and store it in the member variable.
+    return hr;
+}
+
+// Shows display text that was read from the display cache or refreshed in the
+// background. May be called from any thread. The qualified user name is still
+// fetched on first use.
+HRESULT CSampleCredential::SetDisplayText(const DISPLAY_TEXT &text)
+{
+    return _ApplyDisplayText(text);
+}
+
+// Formats the user name, display name and logon status the way the tile shows them.
+void CSampleCredential::FormatDisplayText(_In_ const USER_PROPERTIES *pProperties, _Out_ DISPLAY_TEXT *pText)
+{
+    _FormatProperty(pProperties->pszUserName, L"User Name: %s", L"User Name is NULL", pText->szFullName, ARRAYSIZE(pText->szFullName));
+    _FormatProperty(pProperties->pszDisplayName, L"Display Name: %s", L"Display Name is NULL", pText->szDisplayName, ARRAYSIZE(pText->szDisplayName));
+    _FormatProperty(pProperties->pszLogonStatus, L"Logon Status: %s", L"Logon Status is NULL", pText->szLogonStatus, ARRAYSIZE(pText->szLogonStatus));
+}
+
+// Replaces the identity property fields with text.
+HRESULT CSampleCredential::_ApplyDisplayText(const DISPLAY_TEXT &text)
+{
+    PCWSTR rgpszValues[SFI_NUM_FIELDS] = {};
+    rgpszValues[SFI_FULLNAME_TEXT] = text.szFullName;
+    rgpszValues[SFI_DISPLAYNAME_TEXT] = text.szDisplayName;
+    rgpszValues[SFI_LOGONSTATUS_TEXT] = text.szLogonStatus;
+    return _UpdateFieldStrings(rgpszValues);
+}
+
+// Sets the string fields that have a non-null value in rgpszValues, and sends the
+// ones that changed to LogonUI in a single batch. May be called from any thread.
+HRESULT CSampleCredential::_UpdateFieldStrings(_In_reads_(SFI_NUM_FIELDS) PCWSTR const *rgpszValues)
+{
+    DWORD dwChanged = 0;  // Bit per field
+    ICredentialProviderCredentialEvents2 *pEvents = nullptr;
+
+    PCWSTR rgpszWanted[SFI_NUM_FIELDS];
+    CopyMemory(rgpszWanted, rgpszValues, sizeof(rgpszWanted));
+
+    AcquireSRWLockExclusive(&_lockFields);
+
+    // Once the provider has reported the phone's state, it owns the logon status,
+    // whoever is writing the field.
+    if (rgpszWanted[SFI_LOGONSTATUS_TEXT] != nullptr && _pszProviderStatus != nullptr)
+    {
+        rgpszWanted[SFI_LOGONSTATUS_TEXT] = _pszProviderStatus;
+    }
+
+    HRESULT hr = _fieldStrings.Update(rgpszWanted, &dwChanged);
+    if (dwChanged != 0 && _pCredProvCredentialEvents != nullptr)
+    {
+        // Hold our own reference so LogonUI can be called without holding the lock.
+        pEvents = _pCredProvCredentialEvents;
+        pEvents->AddRef();
+    }
+
+    ReleaseSRWLockExclusive(&_lockFields);
+
+    if (pEvents != nullptr)
+    {
+        CFieldStrings::Notify(pEvents, this, rgpszWanted, dwChanged);
+        pEvents->Release();
+    }
+    return hr;
+}
+
+// Called on the HTTP server thread after the phone app uploads a new picture for
+// the user. LogonUI copies the bitmap passed to SetFieldBitmap, so ours is deleted.
+HRESULT CSampleCredential::RefreshTileImage()
+{
+    HBITMAP hbmp = nullptr;
+    HRESULT hr = CTileBitmapCache::Instance().GetTileBitmap(_pszUserSid, &hbmp);
     if (SUCCEEDED(hr))
     {
-        // Declare a pointer to store the logon status.
-        PWSTR pszLogonStatus;
-        // Get the logon status from the user.
-        pcpUser->GetStringValue(PKEY_Identity_LogonStatusString, &pszLogonStatus);
-        // Check if the logon status is not null.
-        if (pszLogonStatus != nullptr)
+        ICredentialProviderCredentialEvents2 *pEvents = nullptr;
+        AcquireSRWLockShared(&_lockFields);
+        if (_pCredProvCredentialEvents != nullptr)
         {
-            // Declare a buffer to store the formatted string.
-            wchar_t szString[256];
-            // Format the logon status string.
-            StringCchPrintf(szString, ARRAYSIZE(szString), L"Logon Status: %s", pszLogonStatus);
-            // Duplicate the formatted string and store it in the member variable.
-            hr = SHStrDupW(szString, &_rgFieldStrings[SFI_LOGONSTATUS_TEXT]);
-            // Free the memory allocated for the logon status.
-            CoTaskMemFree(pszLogonStatus);
+            pEvents = _pCredProvCredentialEvents;
+            pEvents->AddRef();
         }
-        else
+        ReleaseSRWLockShared(&_lockFields);
+
+        if (pEvents != nullptr)
         {
-            // If the logon status is null, set the field string to indicate that.
-            hr = SHStrDupW(L"Logon Status is NULL", &_rgFieldStrings[SFI_LOGONSTATUS_TEXT]);
+            hr = pEvents->SetFieldBitmap(this, SFI_TILEIMAGE, hbmp);
+            pEvents->Release();
         }
+        DeleteObject(hbmp);
     }
+    return hr;
+}
 
-    // Get the user SID from the user and store it in the member variable.
-    if (SUCCEEDED(hr))
+// Called on any thread as the phone, LogonUI and the HTTP server move the user's
+// logon along. Returns false if the event meant nothing in the current state.
+bool CSampleCredential::OnAuthEvent(AUTH_EVENT event)
+{
+    AUTH_TRANSITION transition;
+    bool fChanged = _authState.OnEvent(event, &transition);
+    if (fChanged)
     {
-        hr = pcpUser->GetSid(&_pszUserSid);
+        _OnAuthTransition(transition);
     }
+    return fChanged;
+}
 
-    // Return the HRESULT value indicating success or failure.
-    return hr;
+// Expires a stale approval before answering, so an old one never logs the user on.
+bool CSampleCredential::ShouldAutoLogon()
+{
+    return CAuthStateMachine::IsAutoLogonState(_GetAuthState());
+}
+
+// Queues PrepareSerialization on the thread pool unless it is already queued or
+// running for this credential, in which case that run covers the new approval.
+HRESULT CSampleCredential::QueuePrepareSerialization()
+{
+    if (InterlockedCompareExchange(&_fPrepareQueued, 1, 0) != 0)
+    {
+        return S_FALSE;
+    }
+
+    AddRef();
+    DllAddRef();
+    if (!TrySubmitThreadpoolCallback(_PrepareSerializationCallback, this, nullptr))
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        InterlockedExchange(&_fPrepareQueued, 0);
+        Release();
+        DllRelease();
+        return hr;
+    }
+    return S_OK;
+}
+
+void CALLBACK CSampleCredential::_PrepareSerializationCallback(_Inout_ PTP_CALLBACK_INSTANCE /*pInstance*/, _In_ PVOID pv)
+{
+    CSampleCredential *pCredential = static_cast<CSampleCredential*>(pv);
+    if (pCredential->PrepareSerialization() != S_OK)
+    {
+        OutputDebugStringW(L"PrepareSerialization: Left packing to GetSerialization.\n");
+    }
+    InterlockedExchange(&pCredential->_fPrepareQueued, 0);
+    pCredential->Release();
+    DllRelease();
+}
+
+AUTH_STATE CSampleCredential::_GetAuthState()
+{
+    AUTH_TRANSITION transition;
+    if (_authState.Expire(&transition))
+    {
+        _OnAuthTransition(transition);
+    }
+    return _authState.GetState();
+}
+
+// Reports a logon state change. The packed buffer is dropped as soon as the logon
+// leaves the Serialized state other than by being submitted, for instance when it
+// expires, so it never outlives the approval it was packed for.
+void CSampleCredential::_OnAuthTransition(const AUTH_TRANSITION &transition)
+{
+    WCHAR szMessage[256];
+    if (SUCCEEDED(StringCchPrintfW(szMessage, ARRAYSIZE(szMessage), L"Logon state of %s: %s -> %s after %llu us.\n",
+        _pszUserSid ? _pszUserSid : L"(no SID)",
+        CAuthStateMachine::GetStateName(transition.stateFrom),
+        CAuthStateMachine::GetStateName(transition.stateTo),
+        transition.ullMicroseconds)))
+    {
+        OutputDebugStringW(szMessage);
+    }
+
+    if (transition.stateFrom == AUTH_STATE_SERIALIZED &&
+        transition.stateTo != AUTH_STATE_SERIALIZED &&
+        transition.stateTo != AUTH_STATE_SUBMITTED)
+    {
+        CSerializationCache::Instance().Invalidate(_pszUserSid);
+    }
+}
+
+// Formats one identity property for display, or copies pszNullValue if the user
+// does not have the property.
+void CSampleCredential::_FormatProperty(_In_opt_ PCWSTR pszProperty,
+                                        _In_ PCWSTR pszFormat,
+                                        _In_ PCWSTR pszNullValue,
+                                        _Out_writes_(cchValue) PWSTR pszValue,
+                                        size_t cchValue)
+{
+    // Check if the property is not null.
+    if (pszProperty != nullptr)
+    {
+        // Format the property string.
+        StringCchPrintf(pszValue, cchValue, pszFormat, pszProperty);
+    }
+    else
+    {
+        // If the property is null, use the value that says so.
+        StringCchCopy(pszValue, cchValue, pszNullValue);
+    }
 }
 
 // LogonUI calls this in order to give us a callback in case we need to notify it of anything.
 HRESULT CSampleCredential::Advise(_In_ ICredentialProviderCredentialEvents *pcpce)
 {
-    // Check if the credential provider events pointer is not null
-    if (_pCredProvCredentialEvents != nullptr)
+    // Query the interface for the credential provider events before taking the lock
+    ICredentialProviderCredentialEvents2 *pEvents = nullptr;
+    HRESULT hr = pcpce->QueryInterface(IID_PPV_ARGS(&pEvents));
+
+    // Swap the new events pointer in under the lock, since the display text refresh reads it
+    AcquireSRWLockExclusive(&_lockFields);
+    ICredentialProviderCredentialEvents2 *pOldEvents = _pCredProvCredentialEvents;
+    _pCredProvCredentialEvents = pEvents;
+    ReleaseSRWLockExclusive(&_lockFields);
+
+    // Release the previous credential provider events
+    if (pOldEvents != nullptr)
     {
-        // Release the current credential provider events
-        _pCredProvCredentialEvents->Release();
+        pOldEvents->Release();
     }
-    // Query the interface for the credential provider events and store the result in _pCredProvCredentialEvents
-    return pcpce->QueryInterface(IID_PPV_ARGS(&_pCredProvCredentialEvents));
+    return hr;
 }
 
 // LogonUI calls this to tell us to release the callback.
 HRESULT CSampleCredential::UnAdvise()
 {
-    // Check if the credential provider events pointer is not null
-    if (_pCredProvCredentialEvents)
+    // Clear the credential provider events pointer under the lock
+    AcquireSRWLockExclusive(&_lockFields);
+    ICredentialProviderCredentialEvents2 *pOldEvents = _pCredProvCredentialEvents;
+    _pCredProvCredentialEvents = nullptr;
+    ReleaseSRWLockExclusive(&_lockFields);
+
+    // Release the current credential provider events
+    if (pOldEvents != nullptr)
     {
-        // Release the current credential provider events
-        _pCredProvCredentialEvents->Release();
+        pOldEvents->Release();
     }
-    // Set the credential provider events pointer to null
-    _pCredProvCredentialEvents = nullptr;
     // Return S_OK to indicate success
     return S_OK;
 }
@@ -230,7 +546,8 @@ HRESULT CSampleCredential::UnAdvise()
 HRESULT CSampleCredential::SetSelected(_Out_ BOOL *pbAutoLogon)
 {
     *pbAutoLogon = FALSE;
-    return S_OK;
+    // The selected tile shows the identity properties, so fetch them now if we haven't yet.
+    return _EnsureUserProperties();
 }
 
 // Similarly to SetSelected, LogonUI calls this when your tile was selected
@@ -278,11 +595,29 @@ HRESULT CSampleCredential::GetStringValue(DWORD dwFieldID, _Outptr_result_nullon
     *ppwsz = nullptr;
 
     // Check to make sure dwFieldID is a legitimate index.
-    if (dwFieldID < ARRAYSIZE(_rgCredProvFieldDescriptors))
+    if (dwFieldID < SFI_NUM_FIELDS)
     {
+        // The identity property fields are fetched on first access, unless the
+        // display cache already filled them in.
+        hr = S_OK;
+        if (dwFieldID == SFI_FULLNAME_TEXT || dwFieldID == SFI_DISPLAYNAME_TEXT || dwFieldID == SFI_LOGONSTATUS_TEXT)
+        {
+            AcquireSRWLockShared(&_lockFields);
+            bool fHaveText = (_fieldStrings.Get(dwFieldID) != nullptr);
+            ReleaseSRWLockShared(&_lockFields);
+            if (!fHaveText)
+            {
+                hr = _EnsureUserProperties();
+            }
+        }
         // Make a copy of the string and return that. The caller
         // is responsible for freeing it.
-        hr = SHStrDupW(_rgFieldStrings[dwFieldID], ppwsz);
+        if (SUCCEEDED(hr))
+        {
+            AcquireSRWLockShared(&_lockFields);
+            hr = SHStrDupW(_fieldStrings.Get(dwFieldID), ppwsz);
+            ReleaseSRWLockShared(&_lockFields);
+        }
     }
     else
     {
@@ -302,16 +637,9 @@ HRESULT CSampleCredential::GetBitmapValue(DWORD dwFieldID, _Outptr_result_nullon
 
     if ((SFI_TILEIMAGE == dwFieldID))
     {
-        HBITMAP hbmp = LoadBitmap(HINST_THISDLL, MAKEINTRESOURCE(IDB_TILE_IMAGE));
-        if (hbmp != nullptr)
-        {
-            hr = S_OK;
-            *phbmp = hbmp;
-        }
-        else
-        {
-            hr = HRESULT_FROM_WIN32(GetLastError());
-        }
+        // The cache decodes the tile image once and gives us our own copy, since
+        // LogonUI takes ownership of the bitmap.
+        hr = CTileBitmapCache::Instance().GetTileBitmap(_pszUserSid, phbmp);
     }
     else
     {
@@ -378,71 +706,196 @@ HRESULT CSampleCredential::GetSerialization(
     *pcpsiOptionalStatusIcon = CPSI_NONE;
     ZeroMemory(pcpcs, sizeof(*pcpcs));
 
-    // Check if this is a Microsoft account based on the presence of '@' in the qualified username.
-    bool isMicrosoftAccount = false;
-    if (_pszQualifiedUserName && wcschr(_pszQualifiedUserName, L'@') != nullptr)
+    // Only a current approval from the phone logs the user on.
+    if (!CAuthStateMachine::IsSerializeState(_GetAuthState()))
+    {
+        OutputDebugString(L"GetSerialization: The logon has not been approved on the phone.\n");
+        return E_ACCESSDENIED;
+    }
+
+    // The qualified user name is fetched with the other identity properties.
+    hr = _EnsureUserProperties();
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Only the version is read here; the password itself is not needed on a cache hit.
+    DWORD dwSecretVersion;
+    hr = _GetSecretProvider().GetSecretVersion(_pszUserSid, &dwSecretVersion);
+    if (FAILED(hr))
+    {
+        OutputDebugString(L"GetSerialization: There is no secret for this user.\n");
+        return hr;
+    }
+
+    // The buffer is usually packed in the background when the phone approves, so
+    // all that is left is to copy it.
+    CSerializationCache &cache = CSerializationCache::Instance();
+    hr = cache.Lookup(_pszUserSid, _cpus, dwSecretVersion, pcpcs);
+    if (hr == S_OK)
+    {
+        OutputDebugString(L"GetSerialization: Served from the serialization cache.\n");
+    }
+    else if (hr == S_FALSE)
+    {
+        hr = _PackSerialization(_cpus, dwSecretVersion, _fIsLocalUser, _pszUserSid, _pszQualifiedUserName, _qualifiedNameParts, pcpcs);
+        if (SUCCEEDED(hr))
+        {
+            OnAuthEvent(AUTH_EVENT_SERIALIZED);
+            cache.Store(_pszUserSid, _cpus, dwSecretVersion, *pcpcs);
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pcpcs->clsidCredentialProvider = CLSID_CSample;
+        *pcpgsr = CPGSR_RETURN_CREDENTIAL_FINISHED;
+        OutputDebugString(L"GetSerialization: Successfully finished serialization.\n");
+        OnAuthEvent(AUTH_EVENT_SUBMITTED);
+    }
+    return hr;
+}
+
+// Packs the serialization into the background cache ahead of GetSerialization.
+// Runs on the thread pool after the phone approves. The qualified user name
+// can only be fetched on the LogonUI thread, so without it GetSerialization packs.
+HRESULT CSampleCredential::PrepareSerialization()
+{
+    PWSTR pszQualifiedUserName = nullptr;
+    HRESULT hr = S_FALSE;
+
+    AcquireSRWLockShared(&_lockFields);
+    CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus = _cpus;
+    bool fIsLocalUser = _fIsLocalUser;
+    QUALIFIED_NAME_PARTS qualifiedNameParts = _qualifiedNameParts; // Offsets, so they hold for the copy
+    if (_pszQualifiedUserName != nullptr)
+    {
+        hr = SHStrDupW(_pszQualifiedUserName, &pszQualifiedUserName);
+    }
+    ReleaseSRWLockShared(&_lockFields);
+
+    DWORD dwSecretVersion;
+    if (hr == S_OK)
+    {
+        hr = _GetSecretProvider().GetSecretVersion(_pszUserSid, &dwSecretVersion);
+    }
+    if (hr == S_OK)
+    {
+        CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION cpcs;
+        hr = _PackSerialization(cpus, dwSecretVersion, fIsLocalUser, _pszUserSid, pszQualifiedUserName, qualifiedNameParts, &cpcs);
+        if (SUCCEEDED(hr))
+        {
+            // The approval may have expired or been used while packing. The state
+            // moves before the buffer is published: were it the other way round,
+            // GetSerialization could take the buffer and submit before the state
+            // was Serialized, and this would then mark a submitted logon Serialized.
+            if (OnAuthEvent(AUTH_EVENT_SERIALIZED))
+            {
+                hr = CSerializationCache::Instance().Store(_pszUserSid, cpus, dwSecretVersion, cpcs);
+            }
+            else
+            {
+                hr = S_FALSE;
+            }
+            SecureZeroMemory(cpcs.rgbSerialization, cpcs.cbSerialization);
+            CoTaskMemFree(cpcs.rgbSerialization);
+        }
+    }
+    CoTaskMemFree(pszQualifiedUserName);
+    return hr;
+}
+
+// Packs the logon buffer for the user into a new CoTaskMem allocation, and looks up
+// the authentication package it is for. Takes everything it needs as parameters so
+// that it can run on any thread.
+HRESULT CSampleCredential::_PackSerialization(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                                              DWORD dwSecretVersion,
+                                              bool fIsLocalUser,
+                                              _In_opt_ PCWSTR pszUserSid,
+                                              _In_opt_ PCWSTR pszQualifiedUserName,
+                                              const QUALIFIED_NAME_PARTS &qualifiedNameParts,
+                                              _Out_ CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION *pcpcs)
+{
+    HRESULT hr = S_OK;
+    ZeroMemory(pcpcs, sizeof(*pcpcs));
+
+    // Any name with an '@' is taken for a Microsoft account, as the sample did.
+    bool isMicrosoftAccount = IsUserPrincipalName(qualifiedNameParts);
+    if (isMicrosoftAccount)
     {
-        isMicrosoftAccount = true;
         OutputDebugString(L"GetSerialization: Detected Microsoft account based on qualified username.\n");
     }
 
+    // The password is only ever held in a locked arena slot and the buffer packed from it.
+    CSecretArena &arena = CSecretArena::Instance();
+    PWSTR pszPassword = nullptr;
+    hr = arena.Allocate(&pszPassword);
+    if (SUCCEEDED(hr))
+    {
+        // CredPackAuthenticationBuffer protects the password itself.
+        hr = (fIsLocalUser || isMicrosoftAccount) ?
+            _LoadProtectedPassword(pszUserSid, cpus, dwSecretVersion, pszPassword) : _LoadPassword(pszUserSid, dwSecretVersion, pszPassword);
+    }
+
+    if (FAILED(hr))
+    {
+        OutputDebugString(L"GetSerialization: The password could not be loaded into the secret arena.\n");
+    }
     // For interactive unlock, treat Microsoft accounts as local.
-    if (_fIsLocalUser || isMicrosoftAccount)
+    else if (fIsLocalUser || isMicrosoftAccount)
     {
         OutputDebugString(L"GetSerialization: Using KerbInteractiveUnlockLogon branch.\n");
 
-        PWSTR pszDomain = nullptr;
-        PWSTR pszUsername = nullptr;
-        hr = SplitDomainAndUsername(_pszQualifiedUserName, &pszDomain, &pszUsername);
+        // Everything is packed straight from the qualified user name and the password
+        // into the one buffer LogonUI takes ownership of; nothing else is allocated.
+        UNICODE_STRING usDomain;
+        UNICODE_STRING usUsername;
+        UNICODE_STRING usPassword;
+        DWORD cbSerialization = 0;
+        hr = (pszQualifiedUserName != nullptr && qualifiedNameParts.form != QNF_INVALID) ? S_OK : E_UNEXPECTED;
+        if (SUCCEEDED(hr))
+        {
+            hr = UnicodeStringInitWithChars(pszQualifiedUserName + qualifiedNameParts.ichDomain, qualifiedNameParts.cchDomain, &usDomain);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = UnicodeStringInitWithChars(pszQualifiedUserName + qualifiedNameParts.ichUserName, qualifiedNameParts.cchUserName, &usUsername);
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = UnicodeStringInitWithChars(pszPassword, wcslen(pszPassword), &usPassword);
+        }
+        else
+        {
+            OutputDebugString(L"GetSerialization: The qualified user name could not be split.\n");
+        }
+
         if (SUCCEEDED(hr))
         {
-            wchar_t debugMsg[512] = { 0 };
-            StringCchPrintf(debugMsg, ARRAYSIZE(debugMsg),
-                L"GetSerialization: Split result - Domain: %s, Username: %s\n",
-                pszDomain ? pszDomain : L"(null)", pszUsername ? pszUsername : L"(null)");
-            OutputDebugString(debugMsg);
-
-            // Initialize the KerbInteractiveUnlockLogon structure.
-            // Note: Replace the hardcoded password with secure retrieval.
-            KERB_INTERACTIVE_UNLOCK_LOGON kiul;
-            hr = KerbInteractiveUnlockLogonInit(pszDomain, pszUsername, L"Awe$ome42", _cpus, &kiul);
-            if (SUCCEEDED(hr))
+            hr = KerbInteractiveUnlockLogonGetPackedSize(usDomain, usUsername, usPassword, &cbSerialization);
+        }
+        if (SUCCEEDED(hr))
+        {
+            pcpcs->rgbSerialization = static_cast<BYTE*>(CoTaskMemAlloc(cbSerialization));
+            if (pcpcs->rgbSerialization != nullptr)
             {
-                OutputDebugString(L"GetSerialization: KerbInteractiveUnlockLogonInit succeeded.\n");
-                hr = KerbInteractiveUnlockLogonPack(kiul, &pcpcs->rgbSerialization, &pcpcs->cbSerialization);
+                pcpcs->cbSerialization = cbSerialization;
+                hr = KerbInteractiveUnlockLogonPackInto(usDomain, usUsername, usPassword, cpus, pcpcs->rgbSerialization, cbSerialization);
                 if (SUCCEEDED(hr))
                 {
-                    OutputDebugString(L"GetSerialization: KerbInteractiveUnlockLogonPack succeeded.\n");
-                    ULONG ulAuthPackage;
-                    hr = RetrieveNegotiateAuthPackage(&ulAuthPackage);
-                    if (SUCCEEDED(hr))
-                    {
-                        pcpcs->ulAuthenticationPackage = ulAuthPackage;
-                        pcpcs->clsidCredentialProvider = CLSID_CSample;
-                        *pcpgsr = CPGSR_RETURN_CREDENTIAL_FINISHED;
-                        OutputDebugString(L"GetSerialization: Successfully finished serialization.\n");
-                    }
-                    else
-                    {
-                        OutputDebugString(L"GetSerialization: RetrieveNegotiateAuthPackage failed.\n");
-                    }
+                    arena.RecordCopy();
+                    OutputDebugString(L"GetSerialization: KerbInteractiveUnlockLogonPackInto succeeded.\n");
                 }
                 else
                 {
-                    OutputDebugString(L"GetSerialization: KerbInteractiveUnlockLogonPack failed.\n");
+                    OutputDebugString(L"GetSerialization: KerbInteractiveUnlockLogonPackInto failed.\n");
                 }
             }
             else
             {
-                OutputDebugString(L"GetSerialization: KerbInteractiveUnlockLogonInit failed.\n");
+                hr = E_OUTOFMEMORY;
             }
-
-            CoTaskMemFree(pszDomain);
-            CoTaskMemFree(pszUsername);
-        }
-        else
-        {
-            OutputDebugString(L"GetSerialization: SplitDomainAndUsername failed.\n");
         }
     }
     else
@@ -451,31 +904,18 @@ HRESULT CSampleCredential::GetSerialization(
 
         DWORD dwAuthFlags = CRED_PACK_PROTECTED_CREDENTIALS | CRED_PACK_ID_PROVIDER_CREDENTIALS;
         // First, get the required buffer size.
-        if (!CredPackAuthenticationBuffer(dwAuthFlags, _pszQualifiedUserName, L"Awe$ome42",
+        if (!CredPackAuthenticationBuffer(dwAuthFlags, const_cast<PWSTR>(pszQualifiedUserName), pszPassword,
             nullptr, &pcpcs->cbSerialization) &&
             (GetLastError() == ERROR_INSUFFICIENT_BUFFER))
         {
             pcpcs->rgbSerialization = static_cast<BYTE*>(CoTaskMemAlloc(pcpcs->cbSerialization));
             if (pcpcs->rgbSerialization != nullptr)
             {
-                hr = S_OK;
-                if (CredPackAuthenticationBuffer(dwAuthFlags, _pszQualifiedUserName, L"Awe$ome42",
+                if (CredPackAuthenticationBuffer(dwAuthFlags, const_cast<PWSTR>(pszQualifiedUserName), pszPassword,
                     pcpcs->rgbSerialization, &pcpcs->cbSerialization))
                 {
+                    arena.RecordCopy();
                     OutputDebugString(L"GetSerialization: CredPackAuthenticationBuffer succeeded.\n");
-                    ULONG ulAuthPackage;
-                    hr = RetrieveNegotiateAuthPackage(&ulAuthPackage);
-                    if (SUCCEEDED(hr))
-                    {
-                        pcpcs->ulAuthenticationPackage = ulAuthPackage;
-                        pcpcs->clsidCredentialProvider = CLSID_CSample;
-                        *pcpgsr = CPGSR_RETURN_CREDENTIAL_FINISHED;
-                        OutputDebugString(L"GetSerialization: Finished serialization in non-local branch.\n");
-                    }
-                    else
-                    {
-                        OutputDebugString(L"GetSerialization: RetrieveNegotiateAuthPackage failed (non-local branch).\n");
-                    }
                 }
                 else
                 {
@@ -485,7 +925,6 @@ HRESULT CSampleCredential::GetSerialization(
                     {
                         hr = E_FAIL;
                     }
-                    CoTaskMemFree(pcpcs->rgbSerialization);
                 }
             }
             else
@@ -496,10 +935,36 @@ HRESULT CSampleCredential::GetSerialization(
         }
         else
         {
+            // Without a failed size query there is no buffer to return.
+            hr = E_UNEXPECTED;
             OutputDebugString(L"GetSerialization: Unexpected behavior from CredPackAuthenticationBuffer call.\n");
         }
     }
 
+    if (SUCCEEDED(hr))
+    {
+        // The package id is looked up from LSA once and cached for the process.
+        ULONG ulAuthPackage;
+        hr = CAuthPackageResolver::Instance().Resolve(&ulAuthPackage);
+        if (SUCCEEDED(hr))
+        {
+            pcpcs->ulAuthenticationPackage = ulAuthPackage;
+        }
+        else
+        {
+            OutputDebugString(L"GetSerialization: RetrieveNegotiateAuthPackage failed.\n");
+        }
+    }
+
+    arena.Free(pszPassword);
+
+    // The buffer holds the password, so clear it before it goes back to the heap.
+    if (FAILED(hr) && pcpcs->rgbSerialization != nullptr)
+    {
+        SecureZeroMemory(pcpcs->rgbSerialization, pcpcs->cbSerialization);
+        CoTaskMemFree(pcpcs->rgbSerialization);
+        ZeroMemory(pcpcs, sizeof(*pcpcs));
+    }
     return hr;
 }
 
@@ -529,6 +994,35 @@ HRESULT CSampleCredential::ReportResult(NTSTATUS ntsStatus,
     *ppwszOptionalStatusText = nullptr;
     *pcpsiOptionalStatusIcon = CPSI_NONE;
 
+    OnAuthEvent((ntsStatus == STATUS_SUCCESS) ? AUTH_EVENT_LOGON_SUCCEEDED : AUTH_EVENT_LOGON_FAILED);
+
+    // The buffer was used up either way; after a failure it may hold a stale password.
+    CSerializationCache::Instance().Invalidate(_pszUserSid);
+
+    // Report how the password was handled during this unlock.
+    SECRET_ARENA_STATS arenaStats;
+    CSecretArena::Instance().GetStats(&arenaStats);
+    ULONGLONG cCopies = arenaStats.cCopies -
+        static_cast<ULONGLONG>(InterlockedExchange64(&s_cArenaCopiesReported, static_cast<LONG64>(arenaStats.cCopies)));
+    WCHAR szArenaStats[160];
+    if (SUCCEEDED(StringCchPrintfW(szArenaStats, ARRAYSIZE(szArenaStats), L"Secret arena: %u of %u slots in use, peak %u, %I64u secret copies (%I64u in all).\n",
+        arenaStats.cInUse, arenaStats.cSlots, arenaStats.cPeakInUse, cCopies, arenaStats.cCopies)))
+    {
+        OutputDebugStringW(szArenaStats);
+    }
+
+    // The password may have been changed and the vault rewritten since it was mapped.
+    if (ntsStatus == STATUS_LOGON_FAILURE)
+    {
+        _GetSecretProvider().Refresh();
+    }
+
+    // LSA no longer knows the package id we cached, so look it up again next time.
+    if (ntsStatus == STATUS_NO_SUCH_PACKAGE)
+    {
+        CAuthPackageResolver::Instance().Invalidate();
+    }
+
     DWORD dwStatusInfo = (DWORD)-1;
 
     // Look for a match on status and substatus.
@@ -583,27 +1077,18 @@ HRESULT CSampleCredential::GetFieldOptions(DWORD dwFieldID,
     return S_OK;
 }
 
+// The provider's report takes over the logon status field from the user's logon
+// status property, so the display text refresh cannot overwrite it. The status is
+// compared with what the tile already shows, so repeated notifications of the
+// same state do not reach LogonUI.
 void CSampleCredential::OnProviderStateChange(bool loggedIn)
 {
-    bool oldLoggedIn = false;
-    if (oldLoggedIn != loggedIn) {
-        if (loggedIn)
-        {
-			oldLoggedIn = true;
-            // Update the credential state to reflect the logged-in status
-            if (_pCredProvCredentialEvents)
-            {
-                _pCredProvCredentialEvents->SetFieldString(this, SFI_LOGONSTATUS_TEXT, L"User is logged in via Bluetooth proximity.");
-            }
-        }
-        else
-        {
-			oldLoggedIn = false;
-            // Update the credential state to reflect the logged-out status
-            if (_pCredProvCredentialEvents)
-            {
-                _pCredProvCredentialEvents->SetFieldString(this, SFI_LOGONSTATUS_TEXT, L"User is not in Bluetooth proximity.");
-            }
-        }
-    }
+    PCWSTR pszStatus = loggedIn ? L"User is logged in via Bluetooth proximity." : L"User is not in Bluetooth proximity.";
+    AcquireSRWLockExclusive(&_lockFields);
+    _pszProviderStatus = pszStatus;
+    ReleaseSRWLockExclusive(&_lockFields);
+
+    PCWSTR rgpszValues[SFI_NUM_FIELDS] = {};
+    rgpszValues[SFI_LOGONSTATUS_TEXT] = pszStatus;
+    _UpdateFieldStrings(rgpszValues);
 }
\ No newline at end of file
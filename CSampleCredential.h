@@ -37,6 +37,13 @@
 #include "common.h" // Includes common definitions
 #include "dll.h" // Includes DLL definitions
 #include "resource.h" // Includes resource definitions
+#include "SlabPool.h" // Includes the fixed-size block pool credentials are allocated from
+#include "UserPropertyPrefetch.h" // Includes the identity property reads
+#include "AuthStateMachine.h" // Includes the per-user logon state machine
+#include "DisplayCache.h" // Includes the formatted display text of a tile
+#include "QualifiedUserName.h" // Includes the qualified user name parser
+#include "FieldStrings.h" // Includes the packed field strings of a tile
+#include <new> // Includes std::nothrow_t
 
 // CSampleCredential class definition
 class CSampleCredential : public ICredentialProviderCredential2, ICredentialProviderCredentialWithFieldOptions
@@ -45,12 +52,12 @@ public:
     // IUnknown interface methods
     IFACEMETHODIMP_(ULONG) AddRef() // Increments the reference count
     {
-        return ++_cRef; // Returns the incremented reference count
+        return InterlockedIncrement(&_cRef); // Returns the incremented reference count; the display text refresh holds references from another thread
     }
 
     IFACEMETHODIMP_(ULONG) Release() // Decrements the reference count
     {
-        long cRef = --_cRef; // Decrements the reference count and stores it in cRef
+        long cRef = InterlockedDecrement(&_cRef); // Decrements the reference count and stores it in cRef
         if (!cRef) // If the reference count is zero
         {
             delete this; // Deletes the object
@@ -113,19 +120,64 @@ public:
     HRESULT Initialize(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
                        _In_ CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR const *rgcpfd,
                        _In_ FIELD_STATE_PAIR const *rgfsp,
-                       _In_ ICredentialProviderUser *pcpUser); // Initializes the credential
-    void OnProviderStateChange(bool loggedIn); // Handles provider state changes
+                       _In_ ICredentialProviderUser *pcpUser,
+                       _In_ PCWSTR pszUserSid); // Initializes the credential
+    HRESULT Refresh(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                    _In_ ICredentialProviderUser *pcpUser); // Refreshes the credential of a re-enumerated user
+    void OnProviderStateChange(bool loggedIn); // Shows the phone's state in the logon status field, which it then owns
+    PCWSTR UserSid() const { return _pszUserSid; } // The user SID, owned by the credential
+    ICredentialProviderUser *PendingUser() const { return _pcpUserPending; } // The user whose properties are still to be fetched, or nullptr
+    HRESULT SetUserProperties(_Inout_ USER_PROPERTIES *pProperties); // Applies fetched identity properties, taking the qualified user name
+    HRESULT SetDisplayText(const DISPLAY_TEXT &text); // Shows cached or refreshed display text, notifying LogonUI of changed fields
+    HRESULT RefreshTileImage(); // Shows the user's current image from the tile bitmap cache
+    bool OnAuthEvent(AUTH_EVENT event); // Advances the user's logon state machine and logs the transition
+    bool ShouldAutoLogon(); // Whether the user's logon state calls for logging on without input
+    HRESULT PrepareSerialization(); // Packs the logon buffer into the serialization cache ahead of GetSerialization
+    HRESULT QueuePrepareSerialization(); // Runs PrepareSerialization on the thread pool, at most once at a time
+    static void FormatDisplayText(_In_ const USER_PROPERTIES *pProperties, _Out_ DISPLAY_TEXT *pText); // Formats identity properties for display
     CSampleCredential(); // Constructor
 
+    // Credentials are allocated from a slab pool so that re-enumerating on every
+    // lock and unlock reuses the blocks of released credentials instead of the heap.
+    static void *operator new(size_t cb, const std::nothrow_t &) noexcept; // Allocates a credential from the pool
+    static void operator delete(void *pv) noexcept; // Returns a credential to the pool
+    static void operator delete(void *pv, const std::nothrow_t &) noexcept; // Called if the constructor throws
+    static void GetPoolStats(_Out_ SLAB_POOL_STATS *pStats); // Gets the allocation counters of the pool
+
 private:
     virtual ~CSampleCredential(); // Destructor
+    HRESULT _EnsureUserProperties(); // Fetches the user properties on first use
+    void _SetPendingUser(_In_ ICredentialProviderUser *pcpUser); // Defers fetching the properties of pcpUser
+    AUTH_STATE _GetAuthState(); // Expires a stale state and returns the current one
+    void _OnAuthTransition(const AUTH_TRANSITION &transition); // Reports a logon state change and drops a packed buffer that is no longer wanted
+    static void CALLBACK _PrepareSerializationCallback(_Inout_ PTP_CALLBACK_INSTANCE pInstance, _In_ PVOID pv); // Thread pool callback of QueuePrepareSerialization
+    static HRESULT _PackSerialization(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                               DWORD dwSecretVersion,
+                               bool fIsLocalUser,
+                               _In_opt_ PCWSTR pszUserSid,
+                               _In_opt_ PCWSTR pszQualifiedUserName,
+                               const QUALIFIED_NAME_PARTS &qualifiedNameParts,
+                               _Out_ CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION *pcpcs); // Packs the logon buffer on any thread
+    static void _FormatProperty(_In_opt_ PCWSTR pszProperty,
+                         _In_ PCWSTR pszFormat,
+                         _In_ PCWSTR pszNullValue,
+                         _Out_writes_(cchValue) PWSTR pszValue,
+                         size_t cchValue); // Formats a user property for display in a field
+    HRESULT _ApplyDisplayText(const DISPLAY_TEXT &text); // Updates the identity property fields and notifies LogonUI of the ones that changed
+    HRESULT _UpdateFieldStrings(_In_reads_(SFI_NUM_FIELDS) PCWSTR const *rgpszValues); // Sets the non-null values and sends the changed ones to LogonUI in one batch
     long                                    _cRef; // Reference count
     CREDENTIAL_PROVIDER_USAGE_SCENARIO      _cpus; // The usage scenario for which we were enumerated
-    CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR    _rgCredProvFieldDescriptors[SFI_NUM_FIELDS]; // An array holding the type and name of each field in the tile
+    CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR const *_rgCredProvFieldDescriptors; // The type and name of each field, shared by every credential and never freed
     FIELD_STATE_PAIR                        _rgFieldStatePairs[SFI_NUM_FIELDS]; // An array holding the state of each field in the tile
-    PWSTR                                   _rgFieldStrings[SFI_NUM_FIELDS]; // An array holding the string value of each field
+    CFieldStrings                           _fieldStrings; // The string value of each field, as LogonUI last saw it
+    SRWLOCK                                 _lockFields; // Guards the field strings and the events pointer against the display text refresh thread
     PWSTR                                   _pszUserSid; // User SID
     PWSTR                                   _pszQualifiedUserName; // The user name that's used to pack the authentication buffer
+    QUALIFIED_NAME_PARTS                    _qualifiedNameParts; // _pszQualifiedUserName parsed when it is taken, so serializing does not parse it
+    ICredentialProviderUser*                _pcpUserPending; // The user whose properties have not been fetched yet, or nullptr
     ICredentialProviderCredentialEvents2*   _pCredProvCredentialEvents; // Used to update fields
     bool                                    _fIsLocalUser; // If the cred prov is associating with a local user tile
+    CAuthStateMachine                       _authState; // Where the user is in the phone-approved logon
+    volatile LONG                           _fPrepareQueued; // Set while PrepareSerialization is queued or running
+    PCWSTR                                  _pszProviderStatus; // Static logon status text last reported by the provider, which takes precedence over the logon status property; guarded by _lockFields
 };
@@ -12,7 +12,6 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <windows.h>
-#include <bluetoothapis.h> // Windows Bluetooth API
 #include <iostream>
 #include <thread>
 #include <vector>
@@ -21,11 +20,31 @@
 #include <initguid.h>
 #include "CSampleProvider.h"
 #include "CSampleCredential.h"
+#include "AvatarUpload.h"
+#include "RequestAuth.h"
+#include "TileBitmapCache.h"
+#include "SerializationCache.h"
+#include "ProtectedSecretCache.h"
+#include "SecretProvider.h"
+#include "AuthPackageResolver.h"
 #include "guid.h"
 
-#pragma comment(lib, "Bthprops.lib") // Link Bluetooth library
 #pragma comment(lib, "Ws2_32.lib")     // Link Winsock library
 
+// Friendly name of the phone whose proximity unlocks the workstation.
+static const WCHAR c_szTargetDeviceName[] = L"Warren Thompson\u2019s iPhone";
+
+// Setting a non-zero PrefetchUserProperties DWORD under this key makes enumeration
+// fetch every user's identity properties up front instead of on first use.
+static const WCHAR c_szSettingsKey[] = L"SOFTWARE\\AbsoluteID";
+static const WCHAR c_szPrefetchValue[] = L"PrefetchUserProperties";
+
+// How long the HTTP server waits for a client to send more of its request.
+static const DWORD c_dwHttpReceiveTimeoutMs = 5 * 1000;
+
+// Upper bound on the threads that read identity properties in parallel.
+static const DWORD c_cMaxPrefetchWorkers = 8;
+
 //
 // CSampleProvider Implementation
 //
@@ -33,12 +52,12 @@
 // Constructor for CSampleProvider.
 CSampleProvider::CSampleProvider() :
     _cRef(1),
-    _pCredential(nullptr),
     _pCredProviderUserArray(nullptr),
-    _pCredProviderEvents(nullptr),
-    isLoggedIn(false),
-    isBluetoothDeviceInProximity(false),
-    _fRecreateEnumeratedCredentials(true)
+    _cLastPoolAllocations(0),
+    _cLastPoolHeapAllocations(0),
+    _fRecreateEnumeratedCredentials(true),
+    _sockListen(INVALID_SOCKET),
+    _fStopHttpServer(0)
 {
     DllAddRef();
 }
@@ -46,21 +65,51 @@ CSampleProvider::CSampleProvider() :
 // Destructor for CSampleProvider.
 CSampleProvider::~CSampleProvider()
 {
-    if (_pCredential != nullptr)
+    // Closing the listening socket fails the accept the server thread is blocked in.
+    if (_httpServerThread.joinable())
     {
-        _pCredential->Release();
-        _pCredential = nullptr;
+        InterlockedExchange(&_fStopHttpServer, 1);
+        closesocket(static_cast<SOCKET>(_sockListen));
+        _httpServerThread.join();
+        WSACleanup();
     }
+    _bluetoothScanner.Stop();
+    _ReleaseEnumeratedCredentials();
+
+    SERIALIZATION_CACHE_STATS stats;
+    CSerializationCache::Instance().GetStats(&stats);
+    wchar_t szStats[128];
+    StringCchPrintfW(szStats, ARRAYSIZE(szStats), L"Serialization cache: %I64u hits, %I64u misses\n",
+        stats.cHits, stats.cMisses);
+    OutputDebugStringW(szStats);
+    CSerializationCache::Instance().InvalidateAll();
+
+    // The password should only have been protected once per scenario and secret version.
+    PROTECTED_SECRET_CACHE_STATS protectStats;
+    CProtectedSecretCache::Instance().GetStats(&protectStats);
+    StringCchPrintfW(szStats, ARRAYSIZE(szStats), L"Protected secret cache: %I64u hits, %I64u protects\n",
+        protectStats.cHits, protectStats.cProtects);
+    OutputDebugStringW(szStats);
+    CProtectedSecretCache::Instance().InvalidateAll();
+
+    // With both caches warm, the vault should only be decrypted when a secret changes.
+    SECRET_PROVIDER_STATS vaultStats;
+    CVaultSecretProvider::Instance().GetStats(&vaultStats);
+    StringCchPrintfW(szStats, ARRAYSIZE(szStats), L"Secret vault: %I64u decrypts for %I64u lookups, %I64u opens\n",
+        vaultStats.cDecrypts, vaultStats.cLookups, vaultStats.cOpens);
+    OutputDebugStringW(szStats);
+
+    // Each LSA lookup is three round trips; after the first unlock there should be none.
+    AUTH_PACKAGE_STATS authStats;
+    CAuthPackageResolver::Instance().GetStats(&authStats);
+    StringCchPrintfW(szStats, ARRAYSIZE(szStats), L"Auth package: %I64u lookups for %I64u serializations\n",
+        authStats.cLookups, authStats.cResolves);
+    OutputDebugStringW(szStats);
     if (_pCredProviderUserArray != nullptr)
     {
         _pCredProviderUserArray->Release();
         _pCredProviderUserArray = nullptr;
     }
-    if (_pCredProviderEvents)
-    {
-        _pCredProviderEvents->Release();
-        _pCredProviderEvents = nullptr;
-    }
     DllRelease();
 }
 
@@ -71,6 +120,10 @@ HRESULT CSampleProvider::SetUsageScenario(
 {
     HRESULT hr;
 
+    // States replaced by the HTTP and Bluetooth threads are released here, on
+    // LogonUI's thread, since they hold the tiles and the events callback.
+    _state.Reclaim();
+
     switch (cpus)
     {
     case CPUS_LOGON:
@@ -105,25 +158,30 @@ HRESULT CSampleProvider::Advise(
     _In_ ICredentialProviderEvents *pcpe,
     _In_ UINT_PTR upAdviseContext)
 {
+    HRESULT hr = S_OK;
+    _state.Reclaim();
     if (pcpe)
     {
-        _pCredProviderEvents = pcpe;
-        _pCredProviderEvents->AddRef();
-        _upAdviseContext = upAdviseContext; // Store the context
+        // The HTTP and Bluetooth threads call back through the published state.
+        hr = _state.Update([pcpe, upAdviseContext](PROVIDER_STATE& state)
+        {
+            state.pEvents = pcpe;
+            state.upAdviseContext = upAdviseContext;
+        });
     }
-    return S_OK;
+    return hr;
 }
 
 
 // UnAdvise: LogonUI calls this to indicate that the ICredentialProviderEvents callback is no longer valid.
 HRESULT CSampleProvider::UnAdvise()
 {
-    if (_pCredProviderEvents)
+    _state.Reclaim();
+    return _state.Update([](PROVIDER_STATE& state)
     {
-        _pCredProviderEvents->Release();
-        _pCredProviderEvents = nullptr;
-    }
-    return S_OK;
+        state.pEvents = nullptr;
+        state.upAdviseContext = 0;
+    });
 }
 
 // GetFieldDescriptorCount: Returns the number of fields in our tile.
@@ -160,29 +218,34 @@ HRESULT CSampleProvider::GetCredentialCount(
     _Out_ DWORD* pdwDefault,
     _Out_ BOOL* pbAutoLogonWithDefault)
 {
-    // If our enumeration needs to be refreshed, do so.
+    _state.Reclaim();
+
+    // If our enumeration needs to be refreshed, do so. Credentials of users that are
+    // still in the user array are kept, so this is cheap after a simple lock.
     if (_fRecreateEnumeratedCredentials)
     {
         _fRecreateEnumeratedCredentials = false;
-        _ReleaseEnumeratedCredentials();
         _CreateEnumeratedCredentials();
     }
 
-    // We are only showing one tile in this provider.
-    *pdwCount = 1;
+    // One tile per enumerated user.
+    const PROVIDER_STATE* pState = _state.Acquire();
+    *pdwCount = pState->CredentialCount();
 
-    // If the phone is in proximity and we have received the "User logged in" event,
-    // then we want to auto logon.
-    if (isLoggedIn && isBluetoothDeviceInProximity)
+    // The approving user's logon state machine decides whether to auto logon: it
+    // only does while the phone is in range and the approval is fresh.
+    if (pState->dwDefault != CREDENTIAL_PROVIDER_NO_DEFAULT &&
+        pState->Credential(pState->dwDefault)->ShouldAutoLogon())
     {
-        *pdwDefault = 0;               // Use our only tile as the default.
-        *pbAutoLogonWithDefault = TRUE;  // Trigger auto logon.
+        *pdwDefault = pState->dwDefault;  // Use the approving user's tile as the default.
+        *pbAutoLogonWithDefault = TRUE;   // Trigger auto logon.
     }
     else
     {
         *pdwDefault = CREDENTIAL_PROVIDER_NO_DEFAULT;
         *pbAutoLogonWithDefault = FALSE;
     }
+    CProviderStateCell::Release(pState);
 
     return S_OK;
 }
@@ -196,16 +259,19 @@ HRESULT CSampleProvider::GetCredentialAt(
     HRESULT hr = E_INVALIDARG;
     *ppcpc = nullptr;
 
-    if ((dwIndex == 0) && ppcpc)
+    const PROVIDER_STATE* pState = _state.Acquire();
+    if ((dwIndex < pState->CredentialCount()) && ppcpc)
     {
-        hr = _pCredential->QueryInterface(IID_PPV_ARGS(ppcpc));
+        hr = pState->Credential(dwIndex)->QueryInterface(IID_PPV_ARGS(ppcpc));
     }
+    CProviderStateCell::Release(pState);
     return hr;
 }
 
 // SetUserArray: Called by LogonUI to pass in the array of users.
 HRESULT CSampleProvider::SetUserArray(_In_ ICredentialProviderUserArray* users)
 {
+    _state.Reclaim();
     if (_pCredProviderUserArray)
     {
         _pCredProviderUserArray->Release();
@@ -230,6 +296,7 @@ void CSampleProvider::_CreateEnumeratedCredentials()
         break;
     }
     default:
+        _ReleaseEnumeratedCredentials();
         break;
     }
 }
@@ -237,14 +304,23 @@ void CSampleProvider::_CreateEnumeratedCredentials()
 // _ReleaseEnumeratedCredentials: Releases any enumerated credentials.
 void CSampleProvider::_ReleaseEnumeratedCredentials()
 {
-    if (_pCredential != nullptr)
+    for (CSampleCredential* pCredential : _rgpCredentials)
     {
-        _pCredential->Release();
-        _pCredential = nullptr;
+        if (pCredential != nullptr)
+        {
+            pCredential->Release();
+        }
     }
+    // clear() keeps the capacity, so repeated enumerations of the same users do not reallocate.
+    _rgpCredentials.clear();
+    _mapSidToIndex.clear();
+    _PublishCredentials();
 }
 
-// _EnumerateCredentials: Enumerates users and creates a credential for each.
+// _EnumerateCredentials: Diffs the user array against the current tiles by SID.
+// Users that are still present keep their credential, which only refreshes its
+// properties; credentials are created for new users and released for users that
+// are gone.
 HRESULT CSampleProvider::_EnumerateCredentials()
 {
     HRESULT hr = E_UNEXPECTED;
@@ -256,37 +332,109 @@ HRESULT CSampleProvider::_EnumerateCredentials()
 
         if (SUCCEEDED(hr) && dwUserCount > 0)
         {
+            // Build the new tile order in a second array so that tile indexes follow the user array.
+            _rgpNextCredentials.clear();
+            _rgpNextCredentials.reserve(dwUserCount);
+
             for (DWORD i = 0; i < dwUserCount; i++)
             {
                 ICredentialProviderUser* pCredUser = nullptr;
                 hr = _pCredProviderUserArray->GetAt(i, &pCredUser);
                 if (SUCCEEDED(hr) && pCredUser != nullptr)
                 {
-                    CSampleCredential* pCredential = new (std::nothrow) CSampleCredential();
-                    if (pCredential != nullptr)
+                    PWSTR pszSid = nullptr;
+                    hr = pCredUser->GetSid(&pszSid);
+                    if (SUCCEEDED(hr))
                     {
-                        hr = pCredential->Initialize(_cpus, s_rgCredProvFieldDescriptors, s_rgFieldStatePairs, pCredUser);
+                        CSampleCredential* pCredential = _TakeCredentialBySid(pszSid);
+                        if (pCredential != nullptr)
+                        {
+                            hr = pCredential->Refresh(_cpus, pCredUser);
+                        }
+                        else
+                        {
+                            pCredential = new (std::nothrow) CSampleCredential();
+                            if (pCredential != nullptr)
+                            {
+                                hr = pCredential->Initialize(_cpus, s_rgCredProvFieldDescriptors, s_rgFieldStatePairs, pCredUser, pszSid);
+                            }
+                            else
+                            {
+                                hr = E_OUTOFMEMORY;
+                            }
+                        }
+
                         if (SUCCEEDED(hr))
                         {
-                            RegisterCredential(pCredential);
-                            _pCredential = pCredential;
+                            CProviderStateCell::MakeSidKey(pszSid, &_strSidLookup);
+                            _mapSidToIndex[_strSidLookup] = static_cast<DWORD>(_rgpNextCredentials.size());
+                            _rgpNextCredentials.push_back(pCredential);
                         }
                         else
                         {
-                            pCredential->Release();
+                            CProviderStateCell::MakeSidKey(pszSid, &_strSidLookup);
+                            _mapSidToIndex.erase(_strSidLookup);
+                            if (pCredential != nullptr)
+                            {
+                                pCredential->Release();
+                            }
                         }
-                    }
-                    else
-                    {
-                        hr = E_OUTOFMEMORY;
+                        CoTaskMemFree(pszSid);
                     }
 
                     pCredUser->Release();
                 }
             }
+
+            // Whatever is left in the old array belongs to users that are no longer enumerated.
+            for (CSampleCredential*& pCredential : _rgpCredentials)
+            {
+                if (pCredential != nullptr)
+                {
+                    CProviderStateCell::MakeSidKey(pCredential->UserSid(), &_strSidLookup);
+                    _mapSidToIndex.erase(_strSidLookup);
+                    CProtectedSecretCache::Instance().Invalidate(pCredential->UserSid());
+                    pCredential->Release();
+                    pCredential = nullptr;
+                }
+            }
+            _rgpCredentials.swap(_rgpNextCredentials);
+            _rgpNextCredentials.clear();
+            _PublishCredentials();
+
+            // New tiles start idle; catch them up if the phone is already in range.
+            const PROVIDER_STATE* pState = _state.Acquire();
+            bool fDeviceInProximity = pState->fDeviceInProximity;
+            CProviderStateCell::Release(pState);
+            if (fDeviceInProximity)
+            {
+                _BroadcastAuthEvent(AUTH_EVENT_DEVICE_ARRIVED);
+            }
+            _LogCredentialPoolStats();
+
+            if (!_spDisplayCache)
+            {
+                _spDisplayCache = std::make_shared<CDisplayCache>();
+                if (FAILED(_spDisplayCache->Open()))
+                {
+                    // Tiles still fetch their properties on first use.
+                    OutputDebugStringW(L"Display cache could not be opened.\n");
+                }
+            }
+
+            DWORD dwPrefetch = 0;
+            DWORD cbData = sizeof(dwPrefetch);
+            if (RegGetValueW(HKEY_LOCAL_MACHINE, c_szSettingsKey, c_szPrefetchValue, RRF_RT_REG_DWORD, nullptr, &dwPrefetch, &cbData) == ERROR_SUCCESS &&
+                dwPrefetch != 0)
+            {
+                _PrefetchUserProperties();
+            }
+
+            _ApplyDisplayCache();
         }
         else
         {
+            _ReleaseEnumeratedCredentials();
             hr = E_FAIL;
         }
     }
@@ -294,55 +442,301 @@ HRESULT CSampleProvider::_EnumerateCredentials()
     return hr;
 }
 
-// RegisterCredential: Stores a credential pointer for later notifications.
-void CSampleProvider::RegisterCredential(CSampleCredential* pCredential)
+// _PrefetchUserProperties: Reads the identity properties of every tile that has not
+// fetched them yet, in parallel, and hands them to the tiles once all reads are done.
+// Tiles whose read failed keep their user pending and fetch again on first use.
+void CSampleProvider::_PrefetchUserProperties()
+{
+    std::vector<CSampleCredential*> rgpPending;
+    std::vector<ICredentialProviderUser*> rgpUsers;
+    for (CSampleCredential* pCredential : _rgpCredentials)
+    {
+        if (pCredential->PendingUser() != nullptr)
+        {
+            rgpPending.push_back(pCredential);
+            rgpUsers.push_back(pCredential->PendingUser());
+        }
+    }
+
+    if (!rgpPending.empty())
+    {
+        DWORD cUsers = static_cast<DWORD>(rgpPending.size());
+        std::vector<USER_PROPERTIES> rgProperties(cUsers);
+        std::vector<HRESULT> rghrResults(cUsers);
+        ULONGLONG ullStart = GetTickCount64();
+
+        UserPropertiesPrefetch(rgpUsers.data(), cUsers, c_cMaxPrefetchWorkers, rgProperties.data(), rghrResults.data());
+
+        DWORD cFetched = 0;
+        for (DWORD i = 0; i < cUsers; i++)
+        {
+            if (SUCCEEDED(rghrResults[i]))
+            {
+                DISPLAY_TEXT text;
+                CSampleCredential::FormatDisplayText(&rgProperties[i], &text);
+                _spDisplayCache->Update(rgpPending[i]->UserSid(), text);
+                if (SUCCEEDED(rgpPending[i]->SetUserProperties(&rgProperties[i])))
+                {
+                    cFetched++;
+                }
+            }
+            UserPropertiesFree(&rgProperties[i]);
+        }
+
+        WCHAR szMessage[128];
+        if (SUCCEEDED(StringCchPrintfW(szMessage, ARRAYSIZE(szMessage),
+            L"Prefetched identity properties of %u of %u user(s) in %llu ms.\n",
+            cFetched, cUsers, GetTickCount64() - ullStart)))
+        {
+            OutputDebugStringW(szMessage);
+        }
+    }
+}
+
+// _ApplyDisplayCache: Shows the cached display text on every tile that has not
+// fetched its identity properties yet, then refreshes the users that are missing
+// from the cache or whose entry has expired on a background thread.
+void CSampleProvider::_ApplyDisplayCache()
 {
-    _credentials.push_back(pCredential);
+    std::vector<DISPLAY_REFRESH> rgRefresh;
+    for (CSampleCredential* pCredential : _rgpCredentials)
+    {
+        ICredentialProviderUser* pCredUser = pCredential->PendingUser();
+        if (pCredUser != nullptr)
+        {
+            DISPLAY_TEXT text;
+            bool fStale = false;
+            bool fCached = _spDisplayCache->Lookup(pCredential->UserSid(), &text, &fStale);
+            if (fCached)
+            {
+                pCredential->SetDisplayText(text);
+            }
+
+            if (!fCached || fStale)
+            {
+                DISPLAY_REFRESH refresh = { pCredential, nullptr };
+                if (SUCCEEDED(CoMarshalInterThreadInterfaceInStream(__uuidof(ICredentialProviderUser), pCredUser, &refresh.pStream)))
+                {
+                    pCredential->AddRef();
+                    rgRefresh.push_back(refresh);
+                }
+            }
+        }
+    }
+
+    if (!rgRefresh.empty())
+    {
+        DllAddRef();
+        std::thread(_RefreshDisplayText, _spDisplayCache, std::move(rgRefresh)).detach();
+    }
 }
 
-// NotifyCredentials: Notifies all stored credentials of a state change.
-void CSampleProvider::NotifyCredentials()
+// _RefreshDisplayText: Runs on its own thread. Reads the identity properties of the
+// given tiles, stores the formatted text in the display cache and pushes it to the
+// tiles, which notify LogonUI of any field that changed.
+void CSampleProvider::_RefreshDisplayText(std::shared_ptr<CDisplayCache> spDisplayCache, std::vector<DISPLAY_REFRESH> rgRefresh)
 {
-    for (auto* credential : _credentials)
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (SUCCEEDED(hr))
     {
-        if (credential)
+        std::vector<CSampleCredential*> rgpCredentials;
+        std::vector<ICredentialProviderUser*> rgpUsers;
+        for (DISPLAY_REFRESH& refresh : rgRefresh)
         {
-            // Pass the updated state (isLoggedIn) to the credential so it can update its UI.
-            credential->OnProviderStateChange(isLoggedIn);
+            ICredentialProviderUser* pCredUser = nullptr;
+            if (SUCCEEDED(CoGetInterfaceAndReleaseStream(refresh.pStream, IID_PPV_ARGS(&pCredUser))))
+            {
+                rgpCredentials.push_back(refresh.pCredential);
+                rgpUsers.push_back(pCredUser);
+            }
+            refresh.pStream = nullptr;
         }
-        if (credential == _pCredential)
+
+        if (!rgpUsers.empty())
         {
-            // Optionally, trigger serialization for this credential.
-            CREDENTIAL_PROVIDER_GET_SERIALIZATION_RESPONSE cpgsr;
-            CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION cpcs;
-            PWSTR pwszOptionalStatusText = nullptr;
-            CREDENTIAL_PROVIDER_STATUS_ICON cpsiOptionalStatusIcon;
-
-            HRESULT hr = _pCredential->GetSerialization(&cpgsr, &cpcs, &pwszOptionalStatusText, &cpsiOptionalStatusIcon);
-            if (SUCCEEDED(hr))
+            DWORD cUsers = static_cast<DWORD>(rgpUsers.size());
+            std::vector<USER_PROPERTIES> rgProperties(cUsers);
+            std::vector<HRESULT> rghrResults(cUsers);
+            UserPropertiesPrefetch(rgpUsers.data(), cUsers, c_cMaxPrefetchWorkers, rgProperties.data(), rghrResults.data());
+
+            for (DWORD i = 0; i < cUsers; i++)
             {
-                CoTaskMemFree(cpcs.rgbSerialization);
-                if (pwszOptionalStatusText)
+                if (SUCCEEDED(rghrResults[i]))
                 {
-                    CoTaskMemFree(pwszOptionalStatusText);
+                    DISPLAY_TEXT text;
+                    CSampleCredential::FormatDisplayText(&rgProperties[i], &text);
+                    spDisplayCache->Update(rgpCredentials[i]->UserSid(), text);
+                    rgpCredentials[i]->SetDisplayText(text);
                 }
+                UserPropertiesFree(&rgProperties[i]);
+                rgpUsers[i]->Release();
             }
         }
+        CoUninitialize();
+    }
+
+    for (DISPLAY_REFRESH& refresh : rgRefresh)
+    {
+        if (refresh.pStream != nullptr)
+        {
+            refresh.pStream->Release();
+        }
+        refresh.pCredential->Release();
+    }
+    DllRelease();
+}
+
+// _LogCredentialPoolStats: Reports how many credentials this enumeration allocated
+// and how many of those had to go to the heap. Once the pool has grown to cover the
+// user list, a lock/unlock cycle should show zero heap allocations.
+void CSampleProvider::_LogCredentialPoolStats()
+{
+    SLAB_POOL_STATS stats;
+    CSampleCredential::GetPoolStats(&stats);
+
+    WCHAR szMessage[160];
+    if (SUCCEEDED(StringCchPrintfW(szMessage, ARRAYSIZE(szMessage),
+        L"Credential pool: %llu credential(s) allocated, %llu heap allocation(s) this enumeration; %u in use, %u slab(s).\n",
+        stats.cAllocations - _cLastPoolAllocations, stats.cHeapAllocations - _cLastPoolHeapAllocations,
+        stats.cInUse, stats.cSlabs)))
+    {
+        OutputDebugStringW(szMessage);
+    }
+
+    _cLastPoolAllocations = stats.cAllocations;
+    _cLastPoolHeapAllocations = stats.cHeapAllocations;
+}
+
+// _TakeCredentialBySid: Removes the current credential for pszSid from the old tile
+// array and returns it, or returns nullptr if the user has no credential yet.
+CSampleCredential* CSampleProvider::_TakeCredentialBySid(_In_ PCWSTR pszSid)
+{
+    CSampleCredential* pCredential = nullptr;
+    CProviderStateCell::MakeSidKey(pszSid, &_strSidLookup);
+    auto it = _mapSidToIndex.find(_strSidLookup);
+    if (it != _mapSidToIndex.end() && it->second < _rgpCredentials.size())
+    {
+        // Entries already moved to the new array carry new indexes, so confirm the SID.
+        CSampleCredential* pCandidate = _rgpCredentials[it->second];
+        if (pCandidate != nullptr && _wcsicmp(pCandidate->UserSid(), pszSid) == 0)
+        {
+            pCredential = pCandidate;
+            _rgpCredentials[it->second] = nullptr;
+        }
+    }
+    return pCredential;
+}
+
+// _PublishCredentials: Makes the current tiles visible to LogonUI and the other
+// threads. Called on the LogonUI thread after _rgpCredentials changes. The tiles
+// and the SID index are copied once here, and the states published for other
+// changes share them. Re-enumerating the same users publishes nothing.
+void CSampleProvider::_PublishCredentials()
+{
+    const PROVIDER_STATE* pState = _state.Acquire();
+    bool fUnchanged = (pState->spCredentials ? pState->spCredentials->Matches(_rgpCredentials) : _rgpCredentials.empty());
+    CProviderStateCell::Release(pState);
+    if (fUnchanged)
+    {
+        return;
+    }
+
+    std::shared_ptr<const CTileList<CSampleCredential>> spCredentials;
+    std::shared_ptr<const SID_INDEX> spSidIndex;
+    if (!_rgpCredentials.empty())
+    {
+        spCredentials = std::make_shared<const CTileList<CSampleCredential>>(_rgpCredentials);
+        spSidIndex = std::make_shared<const SID_INDEX>(_mapSidToIndex);
+    }
+    _state.Update([&spCredentials, &spSidIndex](PROVIDER_STATE& state)
+    {
+        state.spCredentials.swap(spCredentials);
+        state.spSidIndex.swap(spSidIndex);
+    });
+}
+
+// _NotifyCredentialsChanged: Asks LogonUI to call GetCredentialCount again.
+void CSampleProvider::_NotifyCredentialsChanged()
+{
+    const PROVIDER_STATE* pState = _state.Acquire();
+    if (pState->pEvents)
+    {
+        pState->pEvents->CredentialsChanged(pState->upAdviseContext);
     }
+    CProviderStateCell::Release(pState);
+}
+
+// _BroadcastAuthEvent: Passes an event about the phone to every user's logon state machine.
+void CSampleProvider::_BroadcastAuthEvent(AUTH_EVENT event)
+{
+    const PROVIDER_STATE* pState = _state.Acquire();
+    for (DWORD i = 0; i < pState->CredentialCount(); i++)
+    {
+        pState->Credential(i)->OnAuthEvent(event);
+    }
+    CProviderStateCell::Release(pState);
+}
+
+// NotifyCredentials: Notifies the approving user's credential of a state change.
+// The approval belongs to that user alone, so no other tile is touched.
+// Serializing is left to LogonUI, which asks once the auto logon is under way;
+// a serialization made here would show up in the logon state as a submission.
+void CSampleProvider::NotifyCredentials()
+{
+    const PROVIDER_STATE* pState = _state.Acquire();
+    if (pState->dwDefault != CREDENTIAL_PROVIDER_NO_DEFAULT)
+    {
+        // Pass the approval state to the credential so it can update its UI.
+        pState->Credential(pState->dwDefault)->OnProviderStateChange(pState->fLoggedIn);
+    }
+    CProviderStateCell::Release(pState);
 }
 
 // UpdateStateFromEvent: Called when an HTTP event is received from the React Native app.
+// The app names the approving user with a "sid=<SID>" parameter.
 void CSampleProvider::UpdateStateFromEvent(const std::string& event)
 {
     if (event.find("User logged in") != std::string::npos)
     {
-        isLoggedIn = true;
+        std::wstring strApprovingUserSid;
+        size_t pos = event.find("sid=");
+        if (pos != std::string::npos)
+        {
+            pos += 4;
+            size_t end = event.find_first_of(" &\r\n", pos);
+            std::string sid = event.substr(pos, (end == std::string::npos) ? std::string::npos : end - pos);
+            strApprovingUserSid.assign(sid.begin(), sid.end()); // SIDs are plain ASCII
+        }
+
+        // The approval belongs to the default tile, which follows the approving SID
+        // through the SID index. An approval for another user takes over from the
+        // previous one, whose tile is told.
+        if (_state.Approve(std::move(strApprovingUserSid)) == S_FALSE)
+        {
+            OutputDebugStringW(L"UpdateStateFromEvent: The approving user has no tile.\n");
+        }
+
         // Notify LogonUI that our credentials have changed, using the stored context.
-        if (_pCredProviderEvents)
+        _NotifyCredentialsChanged();
+    }
+}
+
+// _SetUserTileImage: Called on the HTTP server thread with a picture the phone app
+// uploaded for a user. Stores it in the tile bitmap cache and shows it on the user's tile.
+HRESULT CSampleProvider::_SetUserTileImage(_In_ PCWSTR pszSid, const BITMAP_IMAGE& image)
+{
+    HRESULT hr = CTileBitmapCache::Instance().SetUserImage(pszSid, image);
+    if (SUCCEEDED(hr))
+    {
+        const PROVIDER_STATE* pState = _state.Acquire();
+        DWORD dwIndex = CProviderStateCell::FindUser(pState, pszSid);
+        if (dwIndex != CREDENTIAL_PROVIDER_NO_DEFAULT)
         {
-            _pCredProviderEvents->CredentialsChanged(_upAdviseContext);
+            pState->Credential(dwIndex)->RefreshTileImage();
         }
+        CProviderStateCell::Release(pState);
     }
+    return hr;
 }
 
 // ---------------------------------------------------
@@ -351,69 +745,68 @@ void CSampleProvider::UpdateStateFromEvent(const std::string& event)
 
 void CSampleProvider::InitializeBluetoothProximityCheck()
 {
-    isBluetoothDeviceInProximity = false;
     OutputDebugStringW(L"Initializing Bluetooth Proximity Check...\n");
 
-    // Initialize Bluetooth APIs
-    HANDLE hRadio = NULL;
-    BLUETOOTH_FIND_RADIO_PARAMS btfrp = { sizeof(BLUETOOTH_FIND_RADIO_PARAMS) };
+    // Scan on every radio at once; the first one to see the phone wins. The scan keeps
+    // tracking the phone across re-enumerations, so only a fresh scan resets the state.
+    // It is reset before the scan starts, since a radio can see the phone right away.
+    HRESULT hr = S_FALSE;
+    if (!_bluetoothScanner.IsTracking(c_szTargetDeviceName, this))
+    {
+        _state.Update([](PROVIDER_STATE& state)
+        {
+            state.fDeviceInProximity = false;
+        });
+        hr = _bluetoothScanner.Start(c_szTargetDeviceName, this);
+    }
 
-    HBLUETOOTH_RADIO_FIND hFind = BluetoothFindFirstRadio(&btfrp, &hRadio);
-    if (hFind)
+    if (hr == S_OK)
     {
-        OutputDebugStringW(L"Bluetooth radio found and initialized successfully.\n");
-        BluetoothFindRadioClose(hFind);
+        OutputDebugStringW(L"Bluetooth radios found and initialized successfully.\n");
+    }
+    else if (hr == S_FALSE)
+    {
+        OutputDebugStringW(L"Bluetooth proximity tracking already running.\n");
     }
     else
     {
         OutputDebugStringW(L"Failed to initialize Bluetooth radio. Ensure Bluetooth is enabled.\n");
-        return;
     }
+}
 
-    // Start a thread to periodically check Bluetooth proximity.
-    std::thread([this, hRadio]() {
-        OutputDebugStringW(L"Checking Bluetooth proximity...\n");
-        while (!isBluetoothDeviceInProximity)
-        {
-            OutputDebugStringW(L"Scanning for nearby Bluetooth devices...\n");
-
-            BLUETOOTH_DEVICE_SEARCH_PARAMS btdsp = { sizeof(BLUETOOTH_DEVICE_SEARCH_PARAMS) };
-            BLUETOOTH_DEVICE_INFO btdi = { sizeof(BLUETOOTH_DEVICE_INFO) };
-            bool deviceFound = false;
-
-            btdsp.hRadio = hRadio;
-            btdsp.fReturnAuthenticated = TRUE;
-            btdsp.fReturnRemembered = TRUE;
-            btdsp.fReturnUnknown = TRUE;
-            btdsp.fReturnConnected = TRUE;
-            btdsp.fIssueInquiry = TRUE;
-            btdsp.cTimeoutMultiplier = 5; // About 6.4 seconds
-
-            HBLUETOOTH_DEVICE_FIND hFindDevice = BluetoothFindFirstDevice(&btdsp, &btdi);
-            if (hFindDevice)
-            {
-                do
-                {
-                    std::wstring debugMsg = L"Found Bluetooth device: ";
-                    debugMsg += btdi.szName;
-                    OutputDebugStringW(debugMsg.c_str());
-                    if (wcscmp(btdi.szName, L"Warren Thompsons iPhone") == 0)
-                    {
-                        OutputDebugStringW(L"Target device found!\n");
-                        deviceFound = true;
-                        break;
-                    }
-                } while (BluetoothFindNextDevice(hFindDevice, &btdi));
+// OnTargetDeviceInProximity: Called on a scan thread when any radio sees the target device.
+void CSampleProvider::OnTargetDeviceInProximity(const BLUETOOTH_ADDRESS& /*address*/, DWORD /*dwRadio*/)
+{
+    // Sightings arrive with every inquiry result, so only publish the change. The
+    // state machines ignore arrivals unless they are idle, so they all hear of it.
+    _BroadcastAuthEvent(AUTH_EVENT_DEVICE_ARRIVED);
 
-                BluetoothFindDeviceClose(hFindDevice);
-            }
+    const PROVIDER_STATE* pState = _state.Acquire();
+    bool fInProximity = pState->fDeviceInProximity;
+    CProviderStateCell::Release(pState);
 
-            isBluetoothDeviceInProximity = deviceFound;
-            std::this_thread::sleep_for(std::chrono::seconds(10));
-        }
+    if (!fInProximity)
+    {
+        _state.Update([](PROVIDER_STATE& state)
+        {
+            state.fDeviceInProximity = true;
+        });
+    }
+}
 
-        CloseHandle(hRadio);
-        }).detach();
+// OnTargetDeviceDeparted: Called on a scan thread once the target device has been out of range
+// for the whole absence window. Drops any approval so it cannot be used after the user walked away.
+void CSampleProvider::OnTargetDeviceDeparted()
+{
+    _state.Update([](PROVIDER_STATE& state)
+    {
+        state.fDeviceInProximity = false;
+        state.fLoggedIn = false;
+    });
+    _BroadcastAuthEvent(AUTH_EVENT_DEVICE_DEPARTED);
+    CSerializationCache::Instance().InvalidateAll();
+    NotifyCredentials();
+    _NotifyCredentialsChanged();
 }
 
 void LogWSAError(const wchar_t* msg)
@@ -426,106 +819,156 @@ void LogWSAError(const wchar_t* msg)
     LocalFree(s);
 }
 
+// Starts the HTTP server once; later enumerations find it running. The listening
+// socket is set up here so that failures are logged before the thread starts.
 void CSampleProvider::InitializeReactNativeAppCommunication()
 {
+    if (_httpServerThread.joinable())
+    {
+        return;
+    }
+
     OutputDebugStringW(L"Starting HTTP server to listen for React Native app events...\n");
 
-    std::thread([this]() {
-        WSADATA wsaData;
-        int iResult;
+    WSADATA wsaData;
+    int iResult;
 
-        // Initialize Winsock
-        iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
-        if (iResult != 0) {
-            LogWSAError(L"WSAStartup failed");
-            return;
-        }
+    // Initialize Winsock
+    iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (iResult != 0) {
+        LogWSAError(L"WSAStartup failed");
+        return;
+    }
 
-        struct addrinfo* result = NULL, hints;
-        ZeroMemory(&hints, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_protocol = IPPROTO_TCP;
-        hints.ai_flags = AI_PASSIVE;
-
-        iResult = getaddrinfo(NULL, "32808", &hints, &result);
-        if (iResult != 0) {
-            LogWSAError(L"getaddrinfo failed");
-            WSACleanup();
-            return;
-        }
+    struct addrinfo* result = NULL, hints;
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_PASSIVE;
 
-        SOCKET ListenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-        if (ListenSocket == INVALID_SOCKET) {
-            LogWSAError(L"Socket creation failed");
-            freeaddrinfo(result);
-            WSACleanup();
-            return;
-        }
+    iResult = getaddrinfo(NULL, "32808", &hints, &result);
+    if (iResult != 0) {
+        LogWSAError(L"getaddrinfo failed");
+        WSACleanup();
+        return;
+    }
 
-        int optval = 1;
-        iResult = setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&optval, sizeof(optval));
-        if (iResult == SOCKET_ERROR) {
-            LogWSAError(L"setsockopt failed");
-            freeaddrinfo(result);
-            closesocket(ListenSocket);
-            WSACleanup();
-            return;
-        }
+    SOCKET ListenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (ListenSocket == INVALID_SOCKET) {
+        LogWSAError(L"Socket creation failed");
+        freeaddrinfo(result);
+        WSACleanup();
+        return;
+    }
 
-        iResult = bind(ListenSocket, result->ai_addr, (int)result->ai_addrlen);
-        if (iResult == SOCKET_ERROR) {
-            LogWSAError(L"Bind failed");
-            freeaddrinfo(result);
-            closesocket(ListenSocket);
-            WSACleanup();
-            return;
-        }
+    int optval = 1;
+    iResult = setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&optval, sizeof(optval));
+    if (iResult == SOCKET_ERROR) {
+        LogWSAError(L"setsockopt failed");
+        freeaddrinfo(result);
+        closesocket(ListenSocket);
+        WSACleanup();
+        return;
+    }
 
+    iResult = bind(ListenSocket, result->ai_addr, (int)result->ai_addrlen);
+    if (iResult == SOCKET_ERROR) {
+        LogWSAError(L"Bind failed");
         freeaddrinfo(result);
+        closesocket(ListenSocket);
+        WSACleanup();
+        return;
+    }
+
+    freeaddrinfo(result);
+
+    iResult = listen(ListenSocket, SOMAXCONN);
+    if (iResult == SOCKET_ERROR) {
+        LogWSAError(L"Listen failed");
+        closesocket(ListenSocket);
+        WSACleanup();
+        return;
+    }
+
+    _sockListen = ListenSocket;
+    _httpServerThread = std::thread(&CSampleProvider::_ServeHttpRequests, this);
+    OutputDebugStringW(L"HTTP server listening on port 32808...\n");
+    OutputDebugStringW(L"React Native app communication initialized successfully.\n");
+}
 
-        iResult = listen(ListenSocket, SOMAXCONN);
-        if (iResult == SOCKET_ERROR) {
-            LogWSAError(L"Listen failed");
-            closesocket(ListenSocket);
-            WSACleanup();
-            return;
+// Runs on the HTTP server thread until the destructor closes the listening socket.
+void CSampleProvider::_ServeHttpRequests()
+{
+    SOCKET ListenSocket = static_cast<SOCKET>(_sockListen);
+    while (true) {
+        SOCKET ClientSocket = accept(ListenSocket, NULL, NULL);
+        if (ClientSocket == INVALID_SOCKET) {
+            if (InterlockedCompareExchange(&_fStopHttpServer, 0, 0)) {
+                break;
+            }
+            LogWSAError(L"Accept failed");
+            continue;
         }
 
-        OutputDebugStringW(L"HTTP server listening on port 32808...\n");
+        // A client that stops sending cannot hold up shutdown for long.
+        DWORD dwTimeoutMs = c_dwHttpReceiveTimeoutMs;
+        setsockopt(ClientSocket, SOL_SOCKET, SO_RCVTIMEO, (char*)&dwTimeoutMs, sizeof(dwTimeoutMs));
+
+        char recvbuf[512];
+        int bytesReceived = recv(ClientSocket, recvbuf, sizeof(recvbuf), 0);
+        if (bytesReceived > 0 && AvatarUploadIsRequest(recvbuf, bytesReceived)) {
+            // Picture uploads are streamed into the decoder rather than read whole.
+            std::wstring strSid;
+            BITMAP_IMAGE image;
+            HRESULT hr = AvatarUploadReceive(ClientSocket, recvbuf, bytesReceived, &strSid, &image);
+            if (SUCCEEDED(hr)) {
+                hr = _SetUserTileImage(strSid.c_str(), image);
+            }
 
-        while (true) {
-            SOCKET ClientSocket = accept(ListenSocket, NULL, NULL);
-            if (ClientSocket == INVALID_SOCKET) {
-                LogWSAError(L"Accept failed");
-                continue;
+            const char* response = SUCCEEDED(hr)
+                ? "HTTP/1.1 200 OK\r\nContent-Length: 15\r\n\r\nAvatar Received"
+                : (hr == E_ACCESSDENIED)
+                ? "HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\n\r\n"
+                : "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+            send(ClientSocket, response, (int)strlen(response), 0);
+        }
+        else if (bytesReceived > 0) {
+            // Events are small, so the whole request has to be in the first read.
+            std::string request(recvbuf, bytesReceived);
+            size_t ichBody = request.find("\r\n\r\n");
+            REQUEST_MAC mac;
+            HRESULT hr = E_INVALIDARG;
+            if (ichBody != std::string::npos) {
+                ichBody += 4;
+                hr = CRequestAuthenticator::Instance().Begin(request.data(), ichBody, &mac);
+                if (SUCCEEDED(hr)) {
+                    CRequestAuthenticator::Update(&mac, request.data() + ichBody, request.size() - ichBody);
+                    hr = CRequestAuthenticator::Instance().Complete(&mac);
+                }
             }
 
-            char recvbuf[512];
-            int recvbuflen = 512;
-            int bytesReceived = recv(ClientSocket, recvbuf, recvbuflen, 0);
-            if (bytesReceived > 0) {
-                recvbuf[bytesReceived] = '\0';
-                std::string request(recvbuf);
-                OutputDebugStringA(("Received HTTP request:\n" + request + "\n").c_str());
+            if (SUCCEEDED(hr)) {
+                // Only what the tag covers is acted on: the request line and the body.
+                std::string event = request.substr(0, request.find("\r\n")) + "\n" + request.substr(ichBody);
+                OutputDebugStringA(("Received HTTP request:\n" + event + "\n").c_str());
 
                 // Update state based on the event.
-                UpdateStateFromEvent(request);
+                UpdateStateFromEvent(event);
                 // Optionally, notify credentials immediately.
                 NotifyCredentials();
-
-                const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 13\r\n\r\nEvent Received";
-                send(ClientSocket, response, (int)strlen(response), 0);
             }
 
-            closesocket(ClientSocket);
+            const char* response = SUCCEEDED(hr)
+                ? "HTTP/1.1 200 OK\r\nContent-Length: 13\r\n\r\nEvent Received"
+                : (hr == E_ACCESSDENIED)
+                ? "HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\n\r\n"
+                : "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+            send(ClientSocket, response, (int)strlen(response), 0);
         }
 
-        closesocket(ListenSocket);
-        WSACleanup();
-        }).detach();
-
-    OutputDebugStringW(L"React Native app communication initialized successfully.\n");
+        closesocket(ClientSocket);
+    }
 }
 
 // Boilerplate code to create our provider.
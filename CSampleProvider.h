@@ -13,23 +13,35 @@
 #include <new>
 
 #include "CSampleCredential.h"
+#include "BluetoothScanner.h"
+#include "DisplayCache.h"
+#include "BitmapCore.h"
+#include "ProviderState.h"
+#include <memory>
+#include <thread>
 #include <vector>
 #include <string>
+#include <unordered_map>
+
+// The provider state over our tiles.
+typedef PROVIDER_STATE_T<CSampleCredential> PROVIDER_STATE;
+typedef CProviderStateCellT<CSampleCredential> CProviderStateCell;
 
 
 class CSampleProvider : public ICredentialProvider,
-                        public ICredentialProviderSetUserArray
+                        public ICredentialProviderSetUserArray,
+                        private IBluetoothProximitySink
 {
   public:
     // IUnknown
     IFACEMETHODIMP_(ULONG) AddRef()
     {
-        return ++_cRef;
+        return InterlockedIncrement(&_cRef);
     }
 
     IFACEMETHODIMP_(ULONG) Release()
     {
-        long cRef = --_cRef;
+        long cRef = InterlockedDecrement(&_cRef);
         if (!cRef)
         {
             delete this;
@@ -68,9 +80,6 @@ class CSampleProvider : public ICredentialProvider,
 
     friend HRESULT CSample_CreateInstance(_In_ REFIID riid, _Outptr_ void** ppv);
 
-    // Register credentials for event notifications
-    void RegisterCredential(CSampleCredential* pCredential);
-
   protected:
     CSampleProvider();
     __override ~CSampleProvider();
@@ -79,24 +88,52 @@ private:
     void _ReleaseEnumeratedCredentials();
     void _CreateEnumeratedCredentials();
     HRESULT _EnumerateCredentials();
+    CSampleCredential* _TakeCredentialBySid(_In_ PCWSTR pszSid);
+    void _PublishCredentials();
+    void _NotifyCredentialsChanged();
+    void _BroadcastAuthEvent(AUTH_EVENT event);
+    void _LogCredentialPoolStats();
+    void _PrefetchUserProperties();
+    void _ApplyDisplayCache();
+
+    // A tile whose display text is refreshed in the background, with its user
+    // marshaled for the refresh thread.
+    struct DISPLAY_REFRESH
+    {
+        CSampleCredential   *pCredential;
+        IStream             *pStream;
+    };
+    static void _RefreshDisplayText(std::shared_ptr<CDisplayCache> spDisplayCache, std::vector<DISPLAY_REFRESH> rgRefresh);
     void InitializeBluetoothProximityCheck();
     void InitializeReactNativeAppCommunication();
+    void _ServeHttpRequests();
     void UpdateStateFromEvent(const std::string& event); // Helper for updating state
-    void NotifyCredentials(); // Notify all registered credentials of state changes
+    HRESULT _SetUserTileImage(_In_ PCWSTR pszSid, const BITMAP_IMAGE& image); // Shows a picture uploaded from the phone on the user's tile
+    void NotifyCredentials(); // Notify the approving user's credential of a state change
     void CheckBluetoothProximity(); // Check for nearby Bluetooth devices
 
+    // IBluetoothProximitySink
+    void OnTargetDeviceInProximity(const BLUETOOTH_ADDRESS &address, DWORD dwRadio);
+    void OnTargetDeviceDeparted();
+
     long                                    _cRef;            // Used for reference counting.
-    CSampleCredential                       *_pCredential;    // SampleV2Credential
+    std::vector<CSampleCredential*>         _rgpCredentials;  // One tile per user, indexed by tile number; only used on the LogonUI thread
+    std::vector<CSampleCredential*>         _rgpNextCredentials; // Scratch array used while re-enumerating
+    SID_INDEX                               _mapSidToIndex;   // Upper-case user SID to index in _rgpCredentials
+    std::wstring                            _strSidLookup;    // Reused lookup key, avoids an allocation per user
+    ULONGLONG                               _cLastPoolAllocations;     // Credential pool counters at the previous enumeration
+    ULONGLONG                               _cLastPoolHeapAllocations;
+    std::shared_ptr<CDisplayCache>          _spDisplayCache;  // Shared with display text refresh threads
     bool                                    _fRecreateEnumeratedCredentials;
     CREDENTIAL_PROVIDER_USAGE_SCENARIO      _cpus;
     ICredentialProviderUserArray            *_pCredProviderUserArray;
 
-    bool isLoggedIn = false;        // Tracks whether the user is logged in
-	bool isBluetoothDeviceInProximity = false; // Tracks whether a Bluetooth device is in proximity
+    CProviderStateCell _state; // Tiles, phone state and events callback shared with the HTTP and Bluetooth threads
+
+    CBluetoothScanner _bluetoothScanner; // Scans all local radios for the target device
 
-    std::vector<CSampleCredential*> _credentials; // List of registered credentials
-    // Add the events pointer to allow notifications to LogonUI.
-    ICredentialProviderEvents* _pCredProviderEvents = nullptr;
-    UINT_PTR _upAdviseContext = 0;
+    std::thread                             _httpServerThread; // Started by the first enumeration, joined by the destructor
+    UINT_PTR                                _sockListen;       // The server's listening SOCKET
+    volatile LONG                           _fStopHttpServer;  // Set before the destructor closes _sockListen
 
 };
@@ -0,0 +1,338 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// ChaCha20 works on 64-byte blocks; Poly1305 keeps its accumulator in five
+// 26-bit limbs so that every product fits in 64 bits. The MAC input is always a
+// whole number of 16-byte blocks, since RFC 8439 pads the AAD and ciphertext
+// with zeros and ends with a block of lengths.
+
+#include "ChaCha20Poly1305.h"
+#include <string.h>
+
+static const uint32_t c_dwLimbMask = 0x3ffffff;
+
+static uint32_t _Load32(const uint8_t *pb)
+{
+    return static_cast<uint32_t>(pb[0]) | (static_cast<uint32_t>(pb[1]) << 8) |
+        (static_cast<uint32_t>(pb[2]) << 16) | (static_cast<uint32_t>(pb[3]) << 24);
+}
+
+static void _Store32(uint8_t *pb, uint32_t dw)
+{
+    pb[0] = static_cast<uint8_t>(dw);
+    pb[1] = static_cast<uint8_t>(dw >> 8);
+    pb[2] = static_cast<uint8_t>(dw >> 16);
+    pb[3] = static_cast<uint8_t>(dw >> 24);
+}
+
+static void _Store64(uint8_t *pb, uint64_t ull)
+{
+    _Store32(pb, static_cast<uint32_t>(ull));
+    _Store32(pb + 4, static_cast<uint32_t>(ull >> 32));
+}
+
+static uint32_t _Rotate(uint32_t dw, int c)
+{
+    return (dw << c) | (dw >> (32 - c));
+}
+
+// Clears secrets in a way the compiler cannot drop as a dead store.
+static void _Wipe(void *pv, size_t cb)
+{
+    volatile uint8_t *pb = static_cast<volatile uint8_t*>(pv);
+    while (cb-- != 0)
+    {
+        *pb++ = 0;
+    }
+}
+
+#define QUARTER_ROUND(a, b, c, d) \
+    x[a] += x[b]; x[d] = _Rotate(x[d] ^ x[a], 16); \
+    x[c] += x[d]; x[b] = _Rotate(x[b] ^ x[c], 12); \
+    x[a] += x[b]; x[d] = _Rotate(x[d] ^ x[a], 8);  \
+    x[c] += x[d]; x[b] = _Rotate(x[b] ^ x[c], 7);
+
+static void _ChaCha20Block(const uint8_t *pbKey, uint32_t dwCounter, const uint8_t *pbNonce, uint8_t *pbBlock)
+{
+    uint32_t state[16];
+    state[0] = 0x61707865;  // "expand 32-byte k"
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++)
+    {
+        state[4 + i] = _Load32(pbKey + 4 * i);
+    }
+    state[12] = dwCounter;
+    for (int i = 0; i < 3; i++)
+    {
+        state[13 + i] = _Load32(pbNonce + 4 * i);
+    }
+
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++)
+    {
+        QUARTER_ROUND(0, 4, 8, 12);
+        QUARTER_ROUND(1, 5, 9, 13);
+        QUARTER_ROUND(2, 6, 10, 14);
+        QUARTER_ROUND(3, 7, 11, 15);
+        QUARTER_ROUND(0, 5, 10, 15);
+        QUARTER_ROUND(1, 6, 11, 12);
+        QUARTER_ROUND(2, 7, 8, 13);
+        QUARTER_ROUND(3, 4, 9, 14);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        _Store32(pbBlock + 4 * i, x[i] + state[i]);
+    }
+
+    _Wipe(state, sizeof(state));
+    _Wipe(x, sizeof(x));
+}
+
+#undef QUARTER_ROUND
+
+// XORs cb bytes of pbIn with the key stream starting at block dwCounter.
+static void _ChaCha20Xor(const uint8_t *pbKey, uint32_t dwCounter, const uint8_t *pbNonce,
+                         const uint8_t *pbIn, size_t cb, uint8_t *pbOut)
+{
+    uint8_t rgbStream[64];
+    while (cb != 0)
+    {
+        _ChaCha20Block(pbKey, dwCounter++, pbNonce, rgbStream);
+        size_t cbBlock = (cb < sizeof(rgbStream)) ? cb : sizeof(rgbStream);
+        for (size_t i = 0; i < cbBlock; i++)
+        {
+            pbOut[i] = pbIn[i] ^ rgbStream[i];
+        }
+        pbIn += cbBlock;
+        pbOut += cbBlock;
+        cb -= cbBlock;
+    }
+    _Wipe(rgbStream, sizeof(rgbStream));
+}
+
+static void _Poly1305Init(POLY1305 *pPoly, const uint8_t *pbKey)
+{
+    // r is clamped as the RFC requires.
+    pPoly->r[0] = _Load32(pbKey + 0) & 0x3ffffff;
+    pPoly->r[1] = (_Load32(pbKey + 3) >> 2) & 0x3ffff03;
+    pPoly->r[2] = (_Load32(pbKey + 6) >> 4) & 0x3ffc0ff;
+    pPoly->r[3] = (_Load32(pbKey + 9) >> 6) & 0x3f03fff;
+    pPoly->r[4] = (_Load32(pbKey + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 5; i++)
+    {
+        pPoly->h[i] = 0;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        pPoly->pad[i] = _Load32(pbKey + 16 + 4 * i);
+    }
+}
+
+// Adds one 16-byte block, with the 2^128 bit set, and multiplies by r.
+static void _Poly1305Block(POLY1305 *pPoly, const uint8_t *pbBlock)
+{
+    const uint32_t *r = pPoly->r;
+    uint32_t *h = pPoly->h;
+    uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+
+    h[0] += _Load32(pbBlock + 0) & c_dwLimbMask;
+    h[1] += (_Load32(pbBlock + 3) >> 2) & c_dwLimbMask;
+    h[2] += (_Load32(pbBlock + 6) >> 4) & c_dwLimbMask;
+    h[3] += (_Load32(pbBlock + 9) >> 6) & c_dwLimbMask;
+    h[4] += (_Load32(pbBlock + 12) >> 8) | (1 << 24);
+
+    uint64_t d0 = (uint64_t)h[0] * r[0] + (uint64_t)h[1] * s4 + (uint64_t)h[2] * s3 + (uint64_t)h[3] * s2 + (uint64_t)h[4] * s1;
+    uint64_t d1 = (uint64_t)h[0] * r[1] + (uint64_t)h[1] * r[0] + (uint64_t)h[2] * s4 + (uint64_t)h[3] * s3 + (uint64_t)h[4] * s2;
+    uint64_t d2 = (uint64_t)h[0] * r[2] + (uint64_t)h[1] * r[1] + (uint64_t)h[2] * r[0] + (uint64_t)h[3] * s4 + (uint64_t)h[4] * s3;
+    uint64_t d3 = (uint64_t)h[0] * r[3] + (uint64_t)h[1] * r[2] + (uint64_t)h[2] * r[1] + (uint64_t)h[3] * r[0] + (uint64_t)h[4] * s4;
+    uint64_t d4 = (uint64_t)h[0] * r[4] + (uint64_t)h[1] * r[3] + (uint64_t)h[2] * r[2] + (uint64_t)h[3] * r[1] + (uint64_t)h[4] * r[0];
+
+    uint32_t c;
+    c = (uint32_t)(d0 >> 26); h[0] = (uint32_t)d0 & c_dwLimbMask; d1 += c;
+    c = (uint32_t)(d1 >> 26); h[1] = (uint32_t)d1 & c_dwLimbMask; d2 += c;
+    c = (uint32_t)(d2 >> 26); h[2] = (uint32_t)d2 & c_dwLimbMask; d3 += c;
+    c = (uint32_t)(d3 >> 26); h[3] = (uint32_t)d3 & c_dwLimbMask; d4 += c;
+    c = (uint32_t)(d4 >> 26); h[4] = (uint32_t)d4 & c_dwLimbMask;
+    h[0] += c * 5;
+    c = h[0] >> 26; h[0] &= c_dwLimbMask; h[1] += c;
+}
+
+// Adds cb bytes followed by zeros up to a whole block.
+static void _Poly1305Padded(POLY1305 *pPoly, const uint8_t *pb, size_t cb)
+{
+    for (; cb >= 16; pb += 16, cb -= 16)
+    {
+        _Poly1305Block(pPoly, pb);
+    }
+    if (cb != 0)
+    {
+        uint8_t rgbBlock[16] = {};
+        memcpy(rgbBlock, pb, cb);
+        _Poly1305Block(pPoly, rgbBlock);
+        _Wipe(rgbBlock, sizeof(rgbBlock));
+    }
+}
+
+// Reduces h fully modulo 2^130 - 5, adds the pad and writes the tag.
+static void _Poly1305Finish(POLY1305 *pPoly, uint8_t *pbTag)
+{
+    uint32_t *h = pPoly->h;
+    uint32_t c;
+    c = h[1] >> 26; h[1] &= c_dwLimbMask; h[2] += c;
+    c = h[2] >> 26; h[2] &= c_dwLimbMask; h[3] += c;
+    c = h[3] >> 26; h[3] &= c_dwLimbMask; h[4] += c;
+    c = h[4] >> 26; h[4] &= c_dwLimbMask; h[0] += c * 5;
+    c = h[0] >> 26; h[0] &= c_dwLimbMask; h[1] += c;
+
+    // g = h - p; keep it instead of h if it did not go negative, without branching.
+    uint32_t g[5];
+    g[0] = h[0] + 5; c = g[0] >> 26; g[0] &= c_dwLimbMask;
+    g[1] = h[1] + c; c = g[1] >> 26; g[1] &= c_dwLimbMask;
+    g[2] = h[2] + c; c = g[2] >> 26; g[2] &= c_dwLimbMask;
+    g[3] = h[3] + c; c = g[3] >> 26; g[3] &= c_dwLimbMask;
+    g[4] = h[4] + c - (1 << 26);
+    uint32_t dwMask = (g[4] >> 31) - 1;
+    for (int i = 0; i < 5; i++)
+    {
+        h[i] = (h[i] & ~dwMask) | (g[i] & dwMask);
+    }
+
+    uint32_t dw0 = h[0] | (h[1] << 26);
+    uint32_t dw1 = (h[1] >> 6) | (h[2] << 20);
+    uint32_t dw2 = (h[2] >> 12) | (h[3] << 14);
+    uint32_t dw3 = (h[3] >> 18) | (h[4] << 8);
+
+    uint64_t f;
+    f = (uint64_t)dw0 + pPoly->pad[0];             _Store32(pbTag + 0, (uint32_t)f);
+    f = (uint64_t)dw1 + pPoly->pad[1] + (f >> 32); _Store32(pbTag + 4, (uint32_t)f);
+    f = (uint64_t)dw2 + pPoly->pad[2] + (f >> 32); _Store32(pbTag + 8, (uint32_t)f);
+    f = (uint64_t)dw3 + pPoly->pad[3] + (f >> 32); _Store32(pbTag + 12, (uint32_t)f);
+
+    _Wipe(g, sizeof(g));
+}
+
+// Computes the tag over the AAD and ciphertext with the one-time key from block 0.
+static void _ComputeTag(const uint8_t *pbKey, const uint8_t *pbNonce,
+                        const uint8_t *pbAad, size_t cbAad,
+                        const uint8_t *pbCipher, size_t cb,
+                        uint8_t *pbTag)
+{
+    uint8_t rgbBlock0[64];
+    _ChaCha20Block(pbKey, 0, pbNonce, rgbBlock0);
+
+    POLY1305 poly;
+    _Poly1305Init(&poly, rgbBlock0);
+    _Poly1305Padded(&poly, pbAad, cbAad);
+    _Poly1305Padded(&poly, pbCipher, cb);
+
+    uint8_t rgbLengths[16];
+    _Store64(rgbLengths, cbAad);
+    _Store64(rgbLengths + 8, cb);
+    _Poly1305Block(&poly, rgbLengths);
+    _Poly1305Finish(&poly, pbTag);
+
+    _Wipe(rgbBlock0, sizeof(rgbBlock0));
+    _Wipe(&poly, sizeof(poly));
+}
+
+// Compares every byte, so the time taken says nothing about where a forged tag differs.
+static bool _TagsEqual(const uint8_t *pbTag1, const uint8_t *pbTag2)
+{
+    uint8_t bDiff = 0;
+    for (size_t i = 0; i < c_cbPoly1305Tag; i++)
+    {
+        bDiff |= pbTag1[i] ^ pbTag2[i];
+    }
+    return bDiff == 0;
+}
+
+void ChaCha20Poly1305Seal(const uint8_t *pbKey,
+                          const uint8_t *pbNonce,
+                          const uint8_t *pbAad, size_t cbAad,
+                          const uint8_t *pbPlain, size_t cb,
+                          uint8_t *pbCipher,
+                          uint8_t *pbTag)
+{
+    _ChaCha20Xor(pbKey, 1, pbNonce, pbPlain, cb, pbCipher);
+    _ComputeTag(pbKey, pbNonce, pbAad, cbAad, pbCipher, cb, pbTag);
+}
+
+bool ChaCha20Poly1305Open(const uint8_t *pbKey,
+                          const uint8_t *pbNonce,
+                          const uint8_t *pbAad, size_t cbAad,
+                          const uint8_t *pbCipher, size_t cb,
+                          const uint8_t *pbTag,
+                          uint8_t *pbPlain)
+{
+    uint8_t rgbTag[c_cbPoly1305Tag];
+    _ComputeTag(pbKey, pbNonce, pbAad, cbAad, pbCipher, cb, rgbTag);
+    if (!_TagsEqual(rgbTag, pbTag))
+    {
+        return false;
+    }
+
+    _ChaCha20Xor(pbKey, 1, pbNonce, pbCipher, cb, pbPlain);
+    return true;
+}
+
+void ChaCha20Poly1305MacInit(CHACHA20_POLY1305_MAC *pMac, const uint8_t *pbKey, const uint8_t *pbNonce)
+{
+    uint8_t rgbBlock0[64];
+    _ChaCha20Block(pbKey, 0, pbNonce, rgbBlock0);
+    _Poly1305Init(&pMac->poly, rgbBlock0);
+    pMac->cbPending = 0;
+    pMac->cbAad = 0;
+    _Wipe(rgbBlock0, sizeof(rgbBlock0));
+}
+
+void ChaCha20Poly1305MacUpdate(CHACHA20_POLY1305_MAC *pMac, const uint8_t *pb, size_t cb)
+{
+    pMac->cbAad += cb;
+    if (pMac->cbPending != 0)
+    {
+        size_t cbCopy = (cb < 16 - pMac->cbPending) ? cb : 16 - pMac->cbPending;
+        memcpy(pMac->rgbPending + pMac->cbPending, pb, cbCopy);
+        pMac->cbPending += cbCopy;
+        pb += cbCopy;
+        cb -= cbCopy;
+        if (pMac->cbPending < 16)
+        {
+            return;
+        }
+        _Poly1305Block(&pMac->poly, pMac->rgbPending);
+        pMac->cbPending = 0;
+    }
+    for (; cb >= 16; pb += 16, cb -= 16)
+    {
+        _Poly1305Block(&pMac->poly, pb);
+    }
+    memcpy(pMac->rgbPending, pb, cb);
+    pMac->cbPending = cb;
+}
+
+bool ChaCha20Poly1305MacVerify(CHACHA20_POLY1305_MAC *pMac, const uint8_t *pbTag)
+{
+    // The AAD padding, an empty ciphertext, then the lengths, as _ComputeTag does.
+    _Poly1305Padded(&pMac->poly, pMac->rgbPending, pMac->cbPending);
+
+    uint8_t rgbLengths[16];
+    _Store64(rgbLengths, pMac->cbAad);
+    _Store64(rgbLengths + 8, 0);
+    _Poly1305Block(&pMac->poly, rgbLengths);
+
+    uint8_t rgbTag[c_cbPoly1305Tag];
+    _Poly1305Finish(&pMac->poly, rgbTag);
+    bool fEqual = _TagsEqual(rgbTag, pbTag);
+
+    _Wipe(pMac, sizeof(*pMac));
+    _Wipe(rgbTag, sizeof(rgbTag));
+    return fEqual;
+}
@@ -0,0 +1,68 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The ChaCha20-Poly1305 AEAD of RFC 8439, self-contained so that the sealed
+// secret vault and the pairing authentication of the phone app's requests do not
+// depend on a crypto library being present in LogonUI.
+// Like KerbPackedLayout, nothing here uses Windows headers, so it behaves the
+// same on every compiler, bitness and byte order.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+static const size_t c_cbChaChaKey = 32;
+static const size_t c_cbChaChaNonce = 12;
+static const size_t c_cbPoly1305Tag = 16;
+
+struct POLY1305
+{
+    uint32_t    r[5];
+    uint32_t    h[5];
+    uint32_t    pad[4];
+};
+
+// The tag ChaCha20Poly1305Seal gives an empty plaintext, computed over additional
+// data that arrives in pieces, such as a request body read from a socket.
+struct CHACHA20_POLY1305_MAC
+{
+    POLY1305    poly;
+    uint8_t     rgbPending[16];     // Data short of a whole block
+    size_t      cbPending;
+    uint64_t    cbAad;
+};
+
+// Encrypts cb bytes of pbPlain into pbCipher, which may be the same buffer, and
+// writes the tag that authenticates them together with the cbAad bytes of pbAad.
+// A nonce must never be used twice with the same key.
+void ChaCha20Poly1305Seal(const uint8_t *pbKey,
+                          const uint8_t *pbNonce,
+                          const uint8_t *pbAad, size_t cbAad,
+                          const uint8_t *pbPlain, size_t cb,
+                          uint8_t *pbCipher,
+                          uint8_t *pbTag);
+
+// Checks the tag over pbAad and pbCipher and only then decrypts cb bytes into
+// pbPlain, which may be the same buffer. Returns false, writing nothing, if the
+// tag does not match.
+bool ChaCha20Poly1305Open(const uint8_t *pbKey,
+                          const uint8_t *pbNonce,
+                          const uint8_t *pbAad, size_t cbAad,
+                          const uint8_t *pbCipher, size_t cb,
+                          const uint8_t *pbTag,
+                          uint8_t *pbPlain);
+
+// Starts a MAC under pbKey and pbNonce. The same nonce rules apply as for sealing.
+void ChaCha20Poly1305MacInit(CHACHA20_POLY1305_MAC *pMac, const uint8_t *pbKey, const uint8_t *pbNonce);
+
+// Adds cb more bytes of additional data.
+void ChaCha20Poly1305MacUpdate(CHACHA20_POLY1305_MAC *pMac, const uint8_t *pb, size_t cb);
+
+// Returns whether pbTag is the tag of everything added, and wipes the MAC.
+bool ChaCha20Poly1305MacVerify(CHACHA20_POLY1305_MAC *pMac, const uint8_t *pbTag);
@@ -0,0 +1,291 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Memory-mapped display text cache. The file is a fixed-size open-addressed
+// hash table of SID-keyed entries. Each entry carries a version stamp that is
+// odd while the entry is being written, so readers in any process that maps the
+// file can detect and retry torn reads without taking a lock.
+
+#include <windows.h>
+#include <shlobj.h>
+#include <sddl.h>
+#include <strsafe.h>
+#include "DisplayCache.h"
+
+#pragma comment(lib, "Shell32.lib")
+
+// Directory under %ProgramData% holding the cache, and the file name within it.
+static const WCHAR c_szCacheDirectory[] = L"AbsoluteID";
+static const WCHAR c_szCacheFile[] = L"DisplayCache.dat";
+
+// Only SYSTEM and administrators can write the cache, so users can't spoof tile text.
+static const WCHAR c_szCacheDirectorySddl[] = L"D:P(A;OICI;GA;;;SY)(A;OICI;GA;;;BA)";
+
+static const DWORD c_dwCacheMagic = 0x43444941;    // 'AIDC'
+static const DWORD c_dwCacheLayout = 1;             // Bump when DISPLAY_CACHE_ENTRY changes
+static const DWORD c_cCacheEntries = 256;           // Power of two, for the probe mask
+static const DWORD c_cchCacheSid = 188;             // SECURITY_MAX_SID_STRING_CHARACTERS, rounded up
+
+// Entries older than this are shown but refreshed, in FILETIME units (24 hours).
+static const ULONGLONG c_ullCacheTtl = 24ULL * 60 * 60 * 10000000;
+
+// Readers and writers give up on an entry that stays locked for this many attempts.
+static const DWORD c_cReadRetries = 16;
+
+struct DISPLAY_CACHE_ENTRY
+{
+    volatile LONG   lVersion;                       // Even when stable, odd while being written
+    DWORD           dwReserved;
+    ULONGLONG       ullUpdated;                     // FILETIME of the last Update
+    WCHAR           szSid[c_cchCacheSid];           // Empty if the slot is unused
+    DISPLAY_TEXT    text;
+};
+
+struct DISPLAY_CACHE_FILE
+{
+    DWORD               dwMagic;
+    DWORD               dwLayout;
+    DWORD               cEntries;
+    DWORD               dwReserved;
+    DISPLAY_CACHE_ENTRY rgEntries[c_cCacheEntries];
+};
+
+static ULONGLONG _GetCurrentFileTime()
+{
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return (static_cast<ULONGLONG>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+}
+
+CDisplayCache::CDisplayCache() :
+    _hFile(INVALID_HANDLE_VALUE),
+    _hMapping(nullptr),
+    _pFile(nullptr)
+{
+}
+
+CDisplayCache::~CDisplayCache()
+{
+    if (_pFile != nullptr)
+    {
+        UnmapViewOfFile(_pFile);
+    }
+    if (_hMapping != nullptr)
+    {
+        CloseHandle(_hMapping);
+    }
+    if (_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(_hFile);
+    }
+}
+
+HRESULT CDisplayCache::Open()
+{
+    if (_pFile != nullptr)
+    {
+        return S_FALSE;
+    }
+
+    WCHAR szPath[MAX_PATH];
+    PWSTR pszProgramData = nullptr;
+    HRESULT hr = SHGetKnownFolderPath(FOLDERID_ProgramData, 0, nullptr, &pszProgramData);
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchPrintfW(szPath, ARRAYSIZE(szPath), L"%s\\%s", pszProgramData, c_szCacheDirectory);
+        CoTaskMemFree(pszProgramData);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, FALSE };
+        if (ConvertStringSecurityDescriptorToSecurityDescriptorW(c_szCacheDirectorySddl, SDDL_REVISION_1, &sa.lpSecurityDescriptor, nullptr))
+        {
+            if (!CreateDirectoryW(szPath, &sa) && GetLastError() != ERROR_ALREADY_EXISTS)
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            LocalFree(sa.lpSecurityDescriptor);
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchCatW(szPath, ARRAYSIZE(szPath), L"\\");
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchCatW(szPath, ARRAYSIZE(szPath), c_szCacheFile);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        _hFile = CreateFileW(szPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_hFile == INVALID_HANDLE_VALUE)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    // Mapping the file at its full size extends a new or truncated file with zeros.
+    if (SUCCEEDED(hr))
+    {
+        _hMapping = CreateFileMappingW(_hFile, nullptr, PAGE_READWRITE, 0, sizeof(DISPLAY_CACHE_FILE), nullptr);
+        if (_hMapping == nullptr)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    if (SUCCEEDED(hr))
+    {
+        _pFile = static_cast<DISPLAY_CACHE_FILE*>(MapViewOfFile(_hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(DISPLAY_CACHE_FILE)));
+        if (_pFile == nullptr)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (SUCCEEDED(hr) &&
+        (_pFile->dwMagic != c_dwCacheMagic || _pFile->dwLayout != c_dwCacheLayout || _pFile->cEntries != c_cCacheEntries))
+    {
+        ZeroMemory(_pFile, sizeof(*_pFile));
+        _pFile->dwLayout = c_dwCacheLayout;
+        _pFile->cEntries = c_cCacheEntries;
+        MemoryBarrier();
+        _pFile->dwMagic = c_dwCacheMagic;
+    }
+
+    return hr;
+}
+
+bool CDisplayCache::Lookup(_In_ PCWSTR pszSid, _Out_ DISPLAY_TEXT *pText, _Out_ bool *pfStale) const
+{
+    *pfStale = false;
+    if (_pFile == nullptr)
+    {
+        return false;
+    }
+
+    DWORD iHome = _HashSid(pszSid);
+    for (DWORD iProbe = 0; iProbe < c_cCacheEntries; iProbe++)
+    {
+        const DISPLAY_CACHE_ENTRY *pEntry = &_pFile->rgEntries[(iHome + iProbe) & (c_cCacheEntries - 1)];
+
+        // Copy the entry, then check the version did not change while we copied it.
+        for (DWORD iTry = 0; iTry < c_cReadRetries; iTry++)
+        {
+            LONG lVersion = pEntry->lVersion;
+            if (lVersion & 1)
+            {
+                YieldProcessor();
+                continue;
+            }
+            MemoryBarrier();
+
+            WCHAR szSid[c_cchCacheSid];
+            CopyMemory(szSid, pEntry->szSid, sizeof(szSid));
+            CopyMemory(pText, &pEntry->text, sizeof(*pText));
+            ULONGLONG ullUpdated = pEntry->ullUpdated;
+
+            MemoryBarrier();
+            if (pEntry->lVersion != lVersion)
+            {
+                continue;
+            }
+
+            szSid[ARRAYSIZE(szSid) - 1] = L'\0';
+            if (szSid[0] == L'\0')
+            {
+                // An empty slot ends the probe sequence; the SID is not cached.
+                return false;
+            }
+            if (_wcsicmp(szSid, pszSid) == 0)
+            {
+                pText->szFullName[c_cchDisplayText - 1] = L'\0';
+                pText->szDisplayName[c_cchDisplayText - 1] = L'\0';
+                pText->szLogonStatus[c_cchDisplayText - 1] = L'\0';
+                *pfStale = (_GetCurrentFileTime() - ullUpdated > c_ullCacheTtl);
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+void CDisplayCache::Update(_In_ PCWSTR pszSid, const DISPLAY_TEXT &text)
+{
+    if (_pFile == nullptr || wcslen(pszSid) >= c_cchCacheSid)
+    {
+        return;
+    }
+
+    // Claim the slot holding this SID or the first empty slot. If the table is full,
+    // the SID's home slot is overwritten.
+    DWORD iHome = _HashSid(pszSid);
+    DISPLAY_CACHE_ENTRY *pTarget = nullptr;
+    LONG lVersion = 0;
+    for (DWORD iProbe = 0; pTarget == nullptr && iProbe <= c_cCacheEntries; iProbe++)
+    {
+        DISPLAY_CACHE_ENTRY *pEntry = &_pFile->rgEntries[(iHome + iProbe) & (c_cCacheEntries - 1)];
+        bool fLocked = _TryLockEntry(pEntry, &lVersion);
+        for (DWORD iTry = 0; !fLocked && iTry < c_cReadRetries; iTry++)
+        {
+            YieldProcessor();
+            fLocked = _TryLockEntry(pEntry, &lVersion);
+        }
+        if (!fLocked)
+        {
+            // The cache is only a hint; skip the update rather than wait on another writer.
+            return;
+        }
+
+        if (iProbe == c_cCacheEntries || pEntry->szSid[0] == L'\0' || _wcsicmp(pEntry->szSid, pszSid) == 0)
+        {
+            pTarget = pEntry;
+        }
+        else
+        {
+            pEntry->lVersion = lVersion;
+        }
+    }
+
+    if (pTarget != nullptr)
+    {
+        StringCchCopyW(pTarget->szSid, ARRAYSIZE(pTarget->szSid), pszSid);
+        CopyMemory(&pTarget->text, &text, sizeof(text));
+        pTarget->ullUpdated = _GetCurrentFileTime();
+        MemoryBarrier();
+        pTarget->lVersion = lVersion + 2;
+    }
+}
+
+// Makes the version odd so readers retry and other writers skip the entry.
+// Returns false if another writer already holds it.
+bool CDisplayCache::_TryLockEntry(DISPLAY_CACHE_ENTRY *pEntry, _Out_ LONG *plVersion)
+{
+    LONG lVersion = pEntry->lVersion;
+    *plVersion = lVersion;
+    return !(lVersion & 1) && InterlockedCompareExchange(&pEntry->lVersion, lVersion + 1, lVersion) == lVersion;
+}
+
+// FNV-1a over the upper-cased SID, matching the case-insensitive comparison.
+DWORD CDisplayCache::_HashSid(_In_ PCWSTR pszSid)
+{
+    DWORD dwHash = 2166136261;
+    for (PCWSTR pch = pszSid; *pch != L'\0'; pch++)
+    {
+        WCHAR ch = (*pch >= L'a' && *pch <= L'z') ? static_cast<WCHAR>(*pch - L'a' + L'A') : *pch;
+        dwHash = (dwHash ^ ch) * 16777619;
+    }
+    return dwHash & (c_cCacheEntries - 1);
+}
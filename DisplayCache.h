@@ -0,0 +1,57 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CDisplayCache keeps the formatted display text of each user's tile in a
+// memory-mapped file keyed by SID, so that tiles can show their text as soon as
+// they are enumerated, before the identity properties have been read again.
+
+#pragma once
+
+#include <windows.h>
+
+// Length of each formatted display string, including the terminator.
+static const DWORD c_cchDisplayText = 128;
+
+// The formatted text of the identity property fields of one tile.
+struct DISPLAY_TEXT
+{
+    WCHAR   szFullName[c_cchDisplayText];       // SFI_FULLNAME_TEXT
+    WCHAR   szDisplayName[c_cchDisplayText];    // SFI_DISPLAYNAME_TEXT
+    WCHAR   szLogonStatus[c_cchDisplayText];    // SFI_LOGONSTATUS_TEXT
+};
+
+struct DISPLAY_CACHE_FILE;
+struct DISPLAY_CACHE_ENTRY;
+
+class CDisplayCache
+{
+public:
+    CDisplayCache();
+    ~CDisplayCache();
+
+    // Maps the cache file, creating it if needed. A file with another layout is reset.
+    HRESULT Open();
+
+    // Copies the cached text for pszSid. *pfStale is set when the entry is older
+    // than the refresh interval and should be fetched again.
+    bool Lookup(_In_ PCWSTR pszSid, _Out_ DISPLAY_TEXT *pText, _Out_ bool *pfStale) const;
+
+    // Stores the text for pszSid and stamps the entry with the current time.
+    void Update(_In_ PCWSTR pszSid, const DISPLAY_TEXT &text);
+
+private:
+    CDisplayCache(const CDisplayCache &);
+    CDisplayCache &operator=(const CDisplayCache &);
+
+    static DWORD _HashSid(_In_ PCWSTR pszSid);
+    static bool _TryLockEntry(DISPLAY_CACHE_ENTRY *pEntry, _Out_ LONG *plVersion);
+
+    HANDLE                  _hFile;
+    HANDLE                  _hMapping;
+    DISPLAY_CACHE_FILE      *_pFile;
+};
@@ -0,0 +1,120 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Packing the field strings of a tile and sending the changed ones to LogonUI.
+
+#include "FieldStrings.h"
+
+CFieldStrings::CFieldStrings(DWORD cFields) :
+    _cFields((cFields < c_cMaxFieldStrings) ? cFields : c_cMaxFieldStrings),
+    _pszArena(nullptr)
+{
+    ZeroMemory(_rgpszFields, sizeof(_rgpszFields));
+}
+
+CFieldStrings::~CFieldStrings()
+{
+    CoTaskMemFree(_pszArena);
+}
+
+HRESULT CFieldStrings::Update(_In_reads_(_cFields) PCWSTR const *rgpszValues, _Out_ DWORD *pdwChanged)
+{
+    *pdwChanged = 0;
+
+    PCWSTR rgpszNext[c_cMaxFieldStrings];
+    CopyMemory(rgpszNext, _rgpszFields, sizeof(rgpszNext));
+    for (DWORD i = 0; i < _cFields; i++)
+    {
+        if (rgpszValues[i] != nullptr &&
+            (_rgpszFields[i] == nullptr || wcscmp(rgpszValues[i], _rgpszFields[i]) != 0))
+        {
+            rgpszNext[i] = rgpszValues[i];
+            *pdwChanged |= (1u << i);
+        }
+    }
+
+    HRESULT hr = S_OK;
+    if (*pdwChanged != 0)
+    {
+        hr = _Pack(rgpszNext);
+        if (FAILED(hr))
+        {
+            *pdwChanged = 0;
+        }
+    }
+    return hr;
+}
+
+PCWSTR CFieldStrings::Get(DWORD dwField) const
+{
+    return (dwField < _cFields) ? _rgpszFields[dwField] : nullptr;
+}
+
+void CFieldStrings::Notify(_In_ ICredentialProviderCredentialEvents2 *pEvents,
+                           _In_ ICredentialProviderCredential *pcpc,
+                           _In_ PCWSTR const *rgpszValues,
+                           DWORD dwChanged)
+{
+    if (dwChanged != 0)
+    {
+        pEvents->BeginFieldUpdates();
+        for (DWORD i = 0; i < c_cMaxFieldStrings; i++)
+        {
+            if (dwChanged & (1u << i))
+            {
+                pEvents->SetFieldString(pcpc, i, rgpszValues[i]);
+            }
+        }
+        pEvents->EndFieldUpdates();
+    }
+}
+
+// Copies every non-null value into a single new allocation and points the field
+// strings into it. The values may point into the current arena, so it is only
+// freed once the copy is complete.
+HRESULT CFieldStrings::_Pack(_In_reads_(_cFields) PCWSTR const *rgpszValues)
+{
+    // Add up the space needed for every string and its terminator.
+    size_t rgcchValues[c_cMaxFieldStrings] = {};
+    size_t cchArena = 0;
+    for (DWORD i = 0; i < _cFields; i++)
+    {
+        if (rgpszValues[i] != nullptr)
+        {
+            rgcchValues[i] = wcslen(rgpszValues[i]) + 1;
+            cchArena += rgcchValues[i];
+        }
+    }
+
+    HRESULT hr = S_OK;
+    PWSTR pszArena = static_cast<PWSTR>(CoTaskMemAlloc(cchArena * sizeof(WCHAR)));
+    if (pszArena != nullptr)
+    {
+        // Copy the strings back to back and remember where each one starts.
+        PCWSTR rgpszPacked[c_cMaxFieldStrings] = {};
+        PWSTR pszNext = pszArena;
+        for (DWORD i = 0; i < _cFields; i++)
+        {
+            if (rgpszValues[i] != nullptr)
+            {
+                CopyMemory(pszNext, rgpszValues[i], rgcchValues[i] * sizeof(WCHAR));
+                rgpszPacked[i] = pszNext;
+                pszNext += rgcchValues[i];
+            }
+        }
+
+        CopyMemory(_rgpszFields, rgpszPacked, sizeof(_rgpszFields));
+        CoTaskMemFree(_pszArena);
+        _pszArena = pszArena;
+    }
+    else
+    {
+        hr = E_OUTOFMEMORY;
+    }
+    return hr;
+}
@@ -0,0 +1,53 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CFieldStrings holds the string value of each field of a tile, packed back to
+// back in a single allocation. The values are what LogonUI last saw, so an
+// update reports only the fields whose value changed, and those go to LogonUI in
+// one batch. It does no locking of its own; CSampleCredential guards it.
+
+#pragma once
+
+#include <windows.h>
+#include <credentialprovider.h>
+
+// Most fields a CFieldStrings can hold, since the changed fields are a bit mask.
+static const DWORD c_cMaxFieldStrings = 32;
+
+class CFieldStrings
+{
+public:
+    explicit CFieldStrings(DWORD cFields);
+    ~CFieldStrings();
+
+    // Sets the fields that have a non-null value in rgpszValues, and sets *pdwChanged
+    // to a bit per field whose value differs from the one held. The strings are only
+    // repacked if one does. The values may point into the strings held.
+    HRESULT Update(_In_reads_(_cFields) PCWSTR const *rgpszValues, _Out_ DWORD *pdwChanged);
+
+    // Returns the value of the field, or nullptr if it has none yet. Valid until the next Update.
+    PCWSTR Get(DWORD dwField) const;
+
+    // Sends the changed values to LogonUI in one BeginFieldUpdates/EndFieldUpdates
+    // batch, so the tile is redrawn once. Nothing is sent when no field changed.
+    // Called without the lock, with the values that were passed to Update.
+    static void Notify(_In_ ICredentialProviderCredentialEvents2 *pEvents,
+                       _In_ ICredentialProviderCredential *pcpc,
+                       _In_ PCWSTR const *rgpszValues,
+                       DWORD dwChanged);
+
+private:
+    CFieldStrings(const CFieldStrings &);
+    CFieldStrings &operator=(const CFieldStrings &);
+
+    HRESULT _Pack(_In_reads_(_cFields) PCWSTR const *rgpszValues);
+
+    DWORD   _cFields;
+    PCWSTR  _rgpszFields[c_cMaxFieldStrings];   // The value of each field, pointing into _pszArena
+    PWSTR   _pszArena;                          // One allocation holding every field string
+};
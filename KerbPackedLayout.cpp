@@ -0,0 +1,250 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Every field is read and written as little-endian bytes. Packed buffers may come
+// from another process, so every offset and length in one is checked before any
+// string is used.
+
+#include "KerbPackedLayout.h"
+#include <string.h>
+
+static const size_t c_cbMaxString = 0xFFFE;    // The largest even USHORT
+
+static uint16_t _ReadU16(const uint8_t *pb)
+{
+    return static_cast<uint16_t>(pb[0] | (pb[1] << 8));
+}
+
+static uint32_t _ReadU32(const uint8_t *pb)
+{
+    return static_cast<uint32_t>(pb[0]) | (static_cast<uint32_t>(pb[1]) << 8) |
+           (static_cast<uint32_t>(pb[2]) << 16) | (static_cast<uint32_t>(pb[3]) << 24);
+}
+
+static uint64_t _ReadU64(const uint8_t *pb)
+{
+    return static_cast<uint64_t>(_ReadU32(pb)) | (static_cast<uint64_t>(_ReadU32(pb + 4)) << 32);
+}
+
+static void _WriteU16(uint8_t *pb, uint16_t us)
+{
+    pb[0] = static_cast<uint8_t>(us);
+    pb[1] = static_cast<uint8_t>(us >> 8);
+}
+
+static void _WriteU32(uint8_t *pb, uint32_t ul)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        pb[i] = static_cast<uint8_t>(ul >> (8 * i));
+    }
+}
+
+static void _WriteU64(uint8_t *pb, uint64_t ull)
+{
+    _WriteU32(pb, static_cast<uint32_t>(ull));
+    _WriteU32(pb + 4, static_cast<uint32_t>(ull >> 32));
+}
+
+static size_t _HeaderSize(KERB_PACKED_LAYOUT layout)
+{
+    return (layout == KERB_PACKED_LAYOUT_64) ? sizeof(KERB_PACKED_UNLOCK_LOGON64) : sizeof(KERB_PACKED_UNLOCK_LOGON32);
+}
+
+// Checks one packed string and makes a view of it. An empty string may have any
+// offset, since nothing is read from it.
+static bool _UnpackString(const uint8_t *pb, size_t cb, size_t cbHeader,
+                          uint16_t cbString, uint16_t cbMaximum, uint64_t ib,
+                          KERB_STRING_VIEW *pView)
+{
+    pView->pch = nullptr;
+    pView->cch = 0;
+    if (cbString == 0)
+    {
+        return true;
+    }
+    if ((cbString % 2) != 0 || cbString > cbMaximum || (ib % 2) != 0 ||
+        ib < cbHeader || ib > cb || cbString > cb - ib)
+    {
+        return false;
+    }
+    pView->pch = reinterpret_cast<const char16_t*>(pb + ib);
+    pView->cch = cbString / sizeof(char16_t);
+    return true;
+}
+
+// Copies one string to the next free byte of the packed buffer and fills in the
+// fields describing it.
+static void _PackString(const KERB_STRING_VIEW &view, uint8_t *pb, size_t *pibNext,
+                        uint8_t *pbLength, uint8_t *pbMaximumLength)
+{
+    uint16_t cbString = static_cast<uint16_t>(view.cch * sizeof(char16_t));
+    _WriteU16(pbLength, cbString);
+    _WriteU16(pbMaximumLength, cbString);
+    if (cbString != 0)
+    {
+        memcpy(pb + *pibNext, view.pch, cbString);
+    }
+    *pibNext += cbString;
+}
+
+size_t KerbPackedUnlockLogonSize(KERB_PACKED_LAYOUT layout, const KERB_UNLOCK_LOGON_VIEW &logon)
+{
+    const KERB_STRING_VIEW *rgViews[] = { &logon.domain, &logon.userName, &logon.password };
+    size_t cb = _HeaderSize(layout);
+    for (const KERB_STRING_VIEW *pView : rgViews)
+    {
+        if (pView->cch > c_cbMaxString / sizeof(char16_t))
+        {
+            return 0;
+        }
+        cb += pView->cch * sizeof(char16_t);
+    }
+    return cb;
+}
+
+bool KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT layout, const KERB_UNLOCK_LOGON_VIEW &logon, uint8_t *pb, size_t cb)
+{
+    size_t cbExpected = KerbPackedUnlockLogonSize(layout, logon);
+    if (cbExpected == 0 || cbExpected != cb || pb == nullptr)
+    {
+        return false;
+    }
+
+    size_t ibNext = _HeaderSize(layout);
+    if (layout == KERB_PACKED_LAYOUT_64)
+    {
+        KERB_PACKED_UNLOCK_LOGON64 header;
+        memset(&header, 0, sizeof(header));
+        _WriteU32(header.MessageType, logon.ulMessageType);
+        _WriteU64(header.LogonId, logon.ullLogonId);
+
+        KERB_PACKED_STRING64 *rgStrings[] = { &header.LogonDomainName, &header.UserName, &header.Password };
+        const KERB_STRING_VIEW *rgViews[] = { &logon.domain, &logon.userName, &logon.password };
+        for (size_t i = 0; i < 3; i++)
+        {
+            _WriteU64(rgStrings[i]->Buffer, ibNext);
+            _PackString(*rgViews[i], pb, &ibNext, rgStrings[i]->Length, rgStrings[i]->MaximumLength);
+        }
+        memcpy(pb, &header, sizeof(header));
+    }
+    else
+    {
+        KERB_PACKED_UNLOCK_LOGON32 header;
+        memset(&header, 0, sizeof(header));
+        _WriteU32(header.MessageType, logon.ulMessageType);
+        _WriteU64(header.LogonId, logon.ullLogonId);
+
+        KERB_PACKED_STRING32 *rgStrings[] = { &header.LogonDomainName, &header.UserName, &header.Password };
+        const KERB_STRING_VIEW *rgViews[] = { &logon.domain, &logon.userName, &logon.password };
+        for (size_t i = 0; i < 3; i++)
+        {
+            _WriteU32(rgStrings[i]->Buffer, static_cast<uint32_t>(ibNext));
+            _PackString(*rgViews[i], pb, &ibNext, rgStrings[i]->Length, rgStrings[i]->MaximumLength);
+        }
+        memcpy(pb, &header, sizeof(header));
+    }
+    return true;
+}
+
+bool KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT layout, const uint8_t *pb, size_t cb, KERB_UNLOCK_LOGON_VIEW *pLogon)
+{
+    size_t cbHeader = _HeaderSize(layout);
+    if (pb == nullptr || cb < cbHeader)
+    {
+        return false;
+    }
+
+    if (layout == KERB_PACKED_LAYOUT_64)
+    {
+        KERB_PACKED_UNLOCK_LOGON64 header;
+        memcpy(&header, pb, sizeof(header));
+        pLogon->ulMessageType = _ReadU32(header.MessageType);
+        pLogon->ullLogonId = _ReadU64(header.LogonId);
+        const KERB_PACKED_STRING64 *rgStrings[] = { &header.LogonDomainName, &header.UserName, &header.Password };
+        KERB_STRING_VIEW *rgViews[] = { &pLogon->domain, &pLogon->userName, &pLogon->password };
+        for (size_t i = 0; i < 3; i++)
+        {
+            if (!_UnpackString(pb, cb, cbHeader, _ReadU16(rgStrings[i]->Length), _ReadU16(rgStrings[i]->MaximumLength),
+                               _ReadU64(rgStrings[i]->Buffer), rgViews[i]))
+            {
+                return false;
+            }
+        }
+    }
+    else
+    {
+        KERB_PACKED_UNLOCK_LOGON32 header;
+        memcpy(&header, pb, sizeof(header));
+        pLogon->ulMessageType = _ReadU32(header.MessageType);
+        pLogon->ullLogonId = _ReadU64(header.LogonId);
+        const KERB_PACKED_STRING32 *rgStrings[] = { &header.LogonDomainName, &header.UserName, &header.Password };
+        KERB_STRING_VIEW *rgViews[] = { &pLogon->domain, &pLogon->userName, &pLogon->password };
+        for (size_t i = 0; i < 3; i++)
+        {
+            if (!_UnpackString(pb, cb, cbHeader, _ReadU16(rgStrings[i]->Length), _ReadU16(rgStrings[i]->MaximumLength),
+                               _ReadU32(rgStrings[i]->Buffer), rgViews[i]))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+size_t KerbPackedUnlockLogonWowToNativeSize(const uint8_t *pbWow, size_t cbWow)
+{
+    KERB_UNLOCK_LOGON_VIEW logon;
+    if (!KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, pbWow, cbWow, &logon))
+    {
+        return 0;
+    }
+    return KerbPackedUnlockLogonSize(KERB_PACKED_LAYOUT_64, logon);
+}
+
+bool KerbPackedUnlockLogonWowToNative(const uint8_t *pbWow, size_t cbWow, uint8_t *pbNative, size_t cbNative)
+{
+    KERB_UNLOCK_LOGON_VIEW logon;
+    return KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, pbWow, cbWow, &logon) &&
+           KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT_64, logon, pbNative, cbNative);
+}
+
+bool KerbSplitQualifiedUserName(KERB_STRING_VIEW qualified, KERB_STRING_VIEW *pDomain, KERB_STRING_VIEW *pUserName)
+{
+    for (size_t i = 0; i < qualified.cch; i++)
+    {
+        if (qualified.pch[i] == u'\\')
+        {
+            pDomain->pch = qualified.pch;
+            pDomain->cch = i;
+            pUserName->pch = qualified.pch + i + 1;
+            pUserName->cch = qualified.cch - i - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t KerbJoinQualifiedUserName(KERB_STRING_VIEW domain, KERB_STRING_VIEW userName, char16_t *pch, size_t cch)
+{
+    size_t cchNeeded = domain.cch + 1 + userName.cch + 1;
+    if (pch != nullptr && cch >= cchNeeded)
+    {
+        if (domain.cch != 0)
+        {
+            memcpy(pch, domain.pch, domain.cch * sizeof(char16_t));
+        }
+        pch[domain.cch] = u'\\';
+        if (userName.cch != 0)
+        {
+            memcpy(pch + domain.cch + 1, userName.pch, userName.cch * sizeof(char16_t));
+        }
+        pch[cchNeeded - 1] = u'\0';
+    }
+    return cchNeeded;
+}
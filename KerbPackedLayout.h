@@ -0,0 +1,112 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The platform-neutral core of logon buffer serialization: the packed
+// KERB_INTERACTIVE_UNLOCK_LOGON as laid out by 32-bit and 64-bit processes,
+// spelled out byte by byte, and packing, unpacking and user name splitting on
+// UTF-16 text held as char16_t. Nothing here uses Windows headers or wchar_t,
+// so the results do not depend on the compiler, bitness or byte order of the
+// build. helpers.cpp adapts the Windows types to it.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A little-endian UNICODE_STRING whose Buffer is an offset from the start of the
+// packed structure.
+struct KERB_PACKED_STRING32
+{
+    uint8_t     Length[2];          // In bytes, without a terminator
+    uint8_t     MaximumLength[2];
+    uint8_t     Buffer[4];
+};
+
+struct KERB_PACKED_STRING64
+{
+    uint8_t     Length[2];
+    uint8_t     MaximumLength[2];
+    uint8_t     Reserved[4];        // Alignment of Buffer
+    uint8_t     Buffer[8];
+};
+
+struct KERB_PACKED_UNLOCK_LOGON32
+{
+    uint8_t                 MessageType[4];
+    KERB_PACKED_STRING32    LogonDomainName;
+    KERB_PACKED_STRING32    UserName;
+    KERB_PACKED_STRING32    Password;
+    uint8_t                 LogonId[8];
+};
+
+struct KERB_PACKED_UNLOCK_LOGON64
+{
+    uint8_t                 MessageType[4];
+    uint8_t                 Reserved[4];    // Alignment of the strings
+    KERB_PACKED_STRING64    LogonDomainName;
+    KERB_PACKED_STRING64    UserName;
+    KERB_PACKED_STRING64    Password;
+    uint8_t                 LogonId[8];
+};
+
+static_assert(sizeof(KERB_PACKED_UNLOCK_LOGON32) == 36, "32-bit packed logon layout");
+static_assert(sizeof(KERB_PACKED_UNLOCK_LOGON64) == 64, "64-bit packed logon layout");
+
+enum KERB_PACKED_LAYOUT
+{
+    KERB_PACKED_LAYOUT_32,
+    KERB_PACKED_LAYOUT_64,
+};
+
+// UTF-16 text that need not be terminated. cch is in char16_t units.
+struct KERB_STRING_VIEW
+{
+    const char16_t  *pch;
+    size_t          cch;
+};
+
+// The fields of a packed logon, with the strings pointing into the packed buffer.
+struct KERB_UNLOCK_LOGON_VIEW
+{
+    uint32_t            ulMessageType;
+    uint64_t            ullLogonId;         // LowPart in the low 32 bits
+    KERB_STRING_VIEW    domain;
+    KERB_STRING_VIEW    userName;
+    KERB_STRING_VIEW    password;
+};
+
+// Returns the packed size for the strings in logon, or 0 if a string is longer than
+// a UNICODE_STRING can describe.
+size_t KerbPackedUnlockLogonSize(KERB_PACKED_LAYOUT layout, const KERB_UNLOCK_LOGON_VIEW &logon);
+
+// Packs logon into pb, which must be exactly the size returned above, copying the
+// strings back to back in one pass. Returns false, writing nothing, on a size mismatch.
+bool KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT layout, const KERB_UNLOCK_LOGON_VIEW &logon, uint8_t *pb, size_t cb);
+
+// Reads the packed logon in pb without copying. Returns false if pb does not hold a
+// valid one: every non-empty string has to lie within cb after the structure, start
+// at an even offset and have an even length no greater than its maximum. pb must be
+// at least 2-byte aligned for the string views to be usable.
+bool KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT layout, const uint8_t *pb, size_t cb, KERB_UNLOCK_LOGON_VIEW *pLogon);
+
+// Returns the size of the 64-bit form of the 32-bit packed logon in pbWow, or 0
+// if pbWow does not hold a valid one.
+size_t KerbPackedUnlockLogonWowToNativeSize(const uint8_t *pbWow, size_t cbWow);
+
+// Writes the 64-bit form of the 32-bit packed logon in pbWow to pbNative, which
+// must be exactly the size returned above. Returns false, writing nothing, if
+// pbWow is not valid.
+bool KerbPackedUnlockLogonWowToNative(const uint8_t *pbWow, size_t cbWow, uint8_t *pbNative, size_t cbNative);
+
+// Splits DOMAIN\user at the first backslash into views of its two parts. Returns
+// false if there is no backslash.
+bool KerbSplitQualifiedUserName(KERB_STRING_VIEW qualified, KERB_STRING_VIEW *pDomain, KERB_STRING_VIEW *pUserName);
+
+// Writes DOMAIN\user and a terminator to pch if cch is large enough. Returns the
+// number of char16_t units needed, including the terminator.
+size_t KerbJoinQualifiedUserName(KERB_STRING_VIEW domain, KERB_STRING_VIEW userName, char16_t *pch, size_t cch);
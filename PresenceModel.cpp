@@ -0,0 +1,195 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Weekday/hour presence histograms used to schedule Bluetooth inquiries.
+
+#include <windows.h>
+#include <strsafe.h>
+#include <algorithm>
+#include "PresenceModel.h"
+
+// Devices are enrolled under this key, one subkey per device name.
+static const WCHAR c_szDevicesKey[] = L"SOFTWARE\\AbsoluteID\\Devices";
+static const WCHAR c_szPresenceValue[] = L"PresenceModel";
+static const DWORD c_dwPresenceModelVersion = 1;
+
+// Scan intervals. The default is used until the model has seen enough events.
+static const DWORD c_dwAggressiveScanIntervalMs = 2 * 1000;
+static const DWORD c_dwDefaultScanIntervalMs = 10 * 1000;
+static const DWORD c_dwSparseScanIntervalMs = 60 * 1000;
+static const DWORD c_cMinEventsForPrediction = 5;
+
+CPresenceModel::CPresenceModel() :
+    _cArrivals(0),
+    _cDepartures(0)
+{
+    ZeroMemory(&_histograms, sizeof(_histograms));
+    _histograms.dwVersion = c_dwPresenceModelVersion;
+}
+
+void CPresenceModel::RecordArrival(const SYSTEMTIME &st)
+{
+    _Increment(_histograms.rgArrivals, _BucketFromTime(st));
+    _UpdateCounts();
+}
+
+void CPresenceModel::RecordDeparture(const SYSTEMTIME &st)
+{
+    _Increment(_histograms.rgDepartures, _BucketFromTime(st));
+    _UpdateCounts();
+}
+
+//
+// Windows dense with arrivals get the aggressive interval, windows that never
+// saw an arrival get the sparse one.
+//
+DWORD CPresenceModel::GetScanIntervalMs(const SYSTEMTIME &st) const
+{
+    DWORD dwInterval;
+    switch (_GetWindowDensity(_histograms.rgArrivals, _cArrivals, st))
+    {
+    case WD_EMPTY:
+        dwInterval = c_dwSparseScanIntervalMs;
+        break;
+    case WD_DENSE:
+        dwInterval = c_dwAggressiveScanIntervalMs;
+        break;
+    default:
+        dwInterval = c_dwDefaultScanIntervalMs;
+        break;
+    }
+    return dwInterval;
+}
+
+//
+// The departure is only declared once the device has been unseen for the whole
+// absence window, counted from the last pass that saw it, so polling faster does
+// not make it noticed sooner on average; it only narrows the spread. Windows that
+// saw departures keep the default interval, windows that never saw one poll just
+// often enough that a departure is still noticed within a third of the window.
+//
+DWORD CPresenceModel::GetTrackingIntervalMs(const SYSTEMTIME &st, DWORD dwAbsenceWindowMs) const
+{
+    DWORD dwInterval = c_dwDefaultScanIntervalMs;
+    if (_GetWindowDensity(_histograms.rgDepartures, _cDepartures, st) == WD_EMPTY)
+    {
+        dwInterval = dwAbsenceWindowMs / 3;
+    }
+    return (std::min)(dwInterval, dwAbsenceWindowMs / 3);
+}
+
+//
+// Compares the events seen in the hour before, during and after st against what
+// events spread uniformly across the week would produce.
+//
+CPresenceModel::WINDOW_DENSITY CPresenceModel::_GetWindowDensity(_In_reads_(c_cBuckets) const BYTE *rgBuckets, DWORD cEvents, const SYSTEMTIME &st)
+{
+    if (cEvents < c_cMinEventsForPrediction)
+    {
+        return WD_UNKNOWN;
+    }
+
+    DWORD dwBucket = _BucketFromTime(st);
+    DWORD cWindow = rgBuckets[(dwBucket + c_cBuckets - 1) % c_cBuckets] +
+                    rgBuckets[dwBucket] +
+                    rgBuckets[(dwBucket + 1) % c_cBuckets];
+
+    WINDOW_DENSITY density;
+    if (cWindow == 0)
+    {
+        density = WD_EMPTY;
+    }
+    else if (cWindow * c_cBuckets >= 2 * 3 * cEvents)
+    {
+        density = WD_DENSE;
+    }
+    else
+    {
+        density = WD_TYPICAL;
+    }
+    return density;
+}
+
+HRESULT CPresenceModel::Load(_In_ PCWSTR pszDeviceName)
+{
+    WCHAR szKey[MAX_PATH];
+    HRESULT hr = StringCchPrintfW(szKey, ARRAYSIZE(szKey), L"%s\\%s", c_szDevicesKey, pszDeviceName);
+    if (SUCCEEDED(hr))
+    {
+        PRESENCE_HISTOGRAMS histograms;
+        DWORD cb = sizeof(histograms);
+        LSTATUS ls = RegGetValueW(HKEY_LOCAL_MACHINE, szKey, c_szPresenceValue, RRF_RT_REG_BINARY, nullptr, &histograms, &cb);
+        if (ls == ERROR_SUCCESS && cb == sizeof(histograms) && histograms.dwVersion == c_dwPresenceModelVersion)
+        {
+            _histograms = histograms;
+            _UpdateCounts();
+        }
+        else if (ls == ERROR_SUCCESS)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(ls);
+        }
+    }
+    return hr;
+}
+
+HRESULT CPresenceModel::Save(_In_ PCWSTR pszDeviceName) const
+{
+    WCHAR szKey[MAX_PATH];
+    HRESULT hr = StringCchPrintfW(szKey, ARRAYSIZE(szKey), L"%s\\%s", c_szDevicesKey, pszDeviceName);
+    if (SUCCEEDED(hr))
+    {
+        HKEY hKey;
+        LSTATUS ls = RegCreateKeyExW(HKEY_LOCAL_MACHINE, szKey, 0, nullptr, REG_OPTION_NON_VOLATILE, KEY_SET_VALUE, nullptr, &hKey, nullptr);
+        if (ls == ERROR_SUCCESS)
+        {
+            ls = RegSetValueExW(hKey, c_szPresenceValue, 0, REG_BINARY, reinterpret_cast<const BYTE*>(&_histograms), sizeof(_histograms));
+            RegCloseKey(hKey);
+        }
+        hr = HRESULT_FROM_WIN32(ls);
+    }
+    return hr;
+}
+
+DWORD CPresenceModel::_BucketFromTime(const SYSTEMTIME &st)
+{
+    return (st.wDayOfWeek % 7) * 24 + (st.wHour % 24);
+}
+
+// Counts saturate at 255; when a bucket is full the whole histogram is halved so
+// that old habits fade out and the relative shape is preserved.
+void CPresenceModel::_Increment(_Inout_updates_(c_cBuckets) BYTE *rgBuckets, DWORD dwBucket)
+{
+    if (rgBuckets[dwBucket] == 0xFF)
+    {
+        for (DWORD i = 0; i < c_cBuckets; i++)
+        {
+            rgBuckets[i] /= 2;
+        }
+    }
+    rgBuckets[dwBucket]++;
+}
+
+DWORD CPresenceModel::_Sum(_In_reads_(c_cBuckets) const BYTE *rgBuckets)
+{
+    DWORD cEvents = 0;
+    for (DWORD i = 0; i < c_cBuckets; i++)
+    {
+        cEvents += rgBuckets[i];
+    }
+    return cEvents;
+}
+
+void CPresenceModel::_UpdateCounts()
+{
+    _cArrivals = _Sum(_histograms.rgArrivals);
+    _cDepartures = _Sum(_histograms.rgDepartures);
+}
@@ -0,0 +1,67 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CPresenceModel learns when a device usually arrives and leaves, by day of
+// the week and hour of the day, and turns that into scan intervals. While the
+// device is away they are short around the usual arrival times and long when it
+// is unlikely to show up; while it is present they are only relaxed at times it
+// has never been seen to leave.
+
+#pragma once
+
+#include <windows.h>
+
+class CPresenceModel
+{
+public:
+    static const DWORD c_cBuckets = 7 * 24; // One bucket per hour of the week
+
+    CPresenceModel();
+
+    void RecordArrival(const SYSTEMTIME &st);
+    void RecordDeparture(const SYSTEMTIME &st);
+
+    // Returns how long to wait before the next inquiry pass at local time st
+    // while the device is away.
+    DWORD GetScanIntervalMs(const SYSTEMTIME &st) const;
+
+    // Returns how long to wait before the next inquiry pass at local time st
+    // while the device is present. Never more than a third of the absence window.
+    DWORD GetTrackingIntervalMs(const SYSTEMTIME &st, DWORD dwAbsenceWindowMs) const;
+
+    // Persist the histograms under the device's enrollment key.
+    HRESULT Load(_In_ PCWSTR pszDeviceName);
+    HRESULT Save(_In_ PCWSTR pszDeviceName) const;
+
+private:
+    // On-disk layout, stored as a single REG_BINARY value.
+    struct PRESENCE_HISTOGRAMS
+    {
+        DWORD   dwVersion;
+        BYTE    rgArrivals[c_cBuckets];
+        BYTE    rgDepartures[c_cBuckets];
+    };
+
+    enum WINDOW_DENSITY
+    {
+        WD_UNKNOWN,     // Too few events to predict from
+        WD_EMPTY,       // No event in the window
+        WD_TYPICAL,
+        WD_DENSE,       // At least twice the uniform density
+    };
+
+    static DWORD _BucketFromTime(const SYSTEMTIME &st);
+    static void _Increment(_Inout_updates_(c_cBuckets) BYTE *rgBuckets, DWORD dwBucket);
+    static DWORD _Sum(_In_reads_(c_cBuckets) const BYTE *rgBuckets);
+    static WINDOW_DENSITY _GetWindowDensity(_In_reads_(c_cBuckets) const BYTE *rgBuckets, DWORD cEvents, const SYSTEMTIME &st);
+    void _UpdateCounts();
+
+    PRESENCE_HISTOGRAMS _histograms;
+    DWORD               _cArrivals;     // Sum of rgArrivals, kept to avoid rescanning the table
+    DWORD               _cDepartures;   // Sum of rgDepartures
+};
@@ -0,0 +1,221 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Every copy of a protected password lives in a secret arena slot, and each slot
+// is zeroed as its entry is dropped.
+
+#include "ProtectedSecretCache.h"
+#include <algorithm>
+
+static const DWORD c_iNotFound = static_cast<DWORD>(-1);
+
+CProtectedSecretCache::CProtectedSecretCache(_In_ ISecretProtector *pProtector) :
+    _pProtector(pProtector),
+    _cHits(0),
+    _cProtects(0),
+    _cEvictions(0)
+{
+    InitializeSRWLock(&_lock);
+
+    // The entries live in the arena, so the arena must be destroyed after the cache.
+    CSecretArena::Instance();
+}
+
+CProtectedSecretCache::~CProtectedSecretCache()
+{
+    InvalidateAll();
+}
+
+CProtectedSecretCache &CProtectedSecretCache::Instance()
+{
+    static CCredProtectSecretProtector s_protector;
+    static CProtectedSecretCache s_cache(&s_protector);
+    return s_cache;
+}
+
+HRESULT CProtectedSecretCache::Lookup(_In_opt_ PCWSTR pszSid,
+                                      CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                                      DWORD dwSecretVersion,
+                                      _Out_writes_(c_cchSecretSlot) PWSTR pszSecret)
+{
+    HRESULT hr = S_FALSE;
+    if (pszSid == nullptr)
+    {
+        return hr;
+    }
+
+    AcquireSRWLockExclusive(&_lock);
+    DWORD iEntry = _Find(pszSid);
+    if (iEntry != c_iNotFound)
+    {
+        const ENTRY &entry = _rgEntries[iEntry];
+        if (entry.cpus == cpus && entry.dwSecretVersion == dwSecretVersion)
+        {
+            hr = CSecretArena::Instance().CopyInto(pszSecret, entry.pszProtected);
+            std::rotate(_rgEntries.begin() + iEntry, _rgEntries.begin() + iEntry + 1, _rgEntries.end());
+        }
+        else
+        {
+            // Made for another scenario or an old secret; it can never be served.
+            _Remove(iEntry);
+        }
+    }
+    ReleaseSRWLockExclusive(&_lock);
+
+    if (hr == S_OK)
+    {
+        InterlockedIncrement64(&_cHits);
+    }
+    return hr;
+}
+
+HRESULT CProtectedSecretCache::Protect(_In_opt_ PCWSTR pszSid,
+                                       CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                                       DWORD dwSecretVersion,
+                                       _Inout_updates_(c_cchSecretSlot) PWSTR pszSecret)
+{
+    // The protected form goes into the slot the entry keeps, then back over the secret.
+    CSecretArena &arena = CSecretArena::Instance();
+    PWSTR pszProtected;
+    HRESULT hr = arena.Allocate(&pszProtected);
+    if (SUCCEEDED(hr))
+    {
+        hr = _ProtectInto(cpus, pszSecret, pszProtected);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = arena.CopyInto(pszSecret, pszProtected);
+    }
+
+    if (SUCCEEDED(hr) && pszSid != nullptr)
+    {
+        ENTRY entry;
+        entry.strSid.assign(pszSid);
+        entry.cpus = cpus;
+        entry.dwSecretVersion = dwSecretVersion;
+        entry.pszProtected = pszProtected;
+        pszProtected = nullptr;
+
+        AcquireSRWLockExclusive(&_lock);
+        DWORD iEntry = _Find(pszSid);
+        if (iEntry != c_iNotFound)
+        {
+            _Remove(iEntry);
+        }
+        else if (_rgEntries.size() >= c_cMaxProtectedSecrets)
+        {
+            _Remove(0);
+            InterlockedIncrement64(&_cEvictions);
+        }
+        _rgEntries.push_back(std::move(entry));
+        ReleaseSRWLockExclusive(&_lock);
+    }
+
+    arena.Free(pszProtected);
+    return hr;
+}
+
+void CProtectedSecretCache::Invalidate(_In_opt_ PCWSTR pszSid)
+{
+    if (pszSid == nullptr)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&_lock);
+    DWORD iEntry = _Find(pszSid);
+    if (iEntry != c_iNotFound)
+    {
+        _Remove(iEntry);
+    }
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+void CProtectedSecretCache::InvalidateAll()
+{
+    AcquireSRWLockExclusive(&_lock);
+    for (ENTRY &entry : _rgEntries)
+    {
+        CSecretArena::Instance().Free(entry.pszProtected);
+    }
+    _rgEntries.clear();
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+void CProtectedSecretCache::GetStats(_Out_ PROTECTED_SECRET_CACHE_STATS *pStats)
+{
+    pStats->cHits = static_cast<ULONGLONG>(_cHits);
+    pStats->cProtects = static_cast<ULONGLONG>(_cProtects);
+    pStats->cEvictions = static_cast<ULONGLONG>(_cEvictions);
+
+    AcquireSRWLockShared(&_lock);
+    pStats->cEntries = static_cast<DWORD>(_rgEntries.size());
+    ReleaseSRWLockShared(&_lock);
+}
+
+// Writes to pszProtected the form of pszSecret that goes into a logon buffer for cpus.
+HRESULT CProtectedSecretCache::_ProtectInto(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                                            _In_ PWSTR pszSecret,
+                                            _Out_writes_(c_cchSecretSlot) PWSTR pszProtected)
+{
+    // Passwords should not be encrypted in the CPUS_CREDUI scenario.  We cannot
+    // know if our caller expects or can handle an encrypted password. Empty
+    // passwords do not need to be encrypted.
+    bool fAsIs = (CPUS_CREDUI == cpus) || (*pszSecret == L'\0');
+    HRESULT hr = S_OK;
+    if (!fAsIs)
+    {
+        InterlockedIncrement64(&_cProtects);
+        hr = _pProtector->IsProtected(pszSecret, &fAsIs);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (fAsIs)
+        {
+            hr = CSecretArena::Instance().CopyInto(pszProtected, pszSecret);
+        }
+        else
+        {
+            hr = _pProtector->Protect(pszSecret, pszProtected);
+            if (SUCCEEDED(hr))
+            {
+                CSecretArena::Instance().RecordCopy();
+            }
+            else if (hr == HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER))
+            {
+                // Too long to protect within a slot. LSA takes the password as
+                // it is, as it does for CredUI.
+                OutputDebugStringW(L"Protected secret cache: The protected password does not fit; using it as it is.\n");
+                hr = CSecretArena::Instance().CopyInto(pszProtected, pszSecret);
+            }
+        }
+    }
+    return hr;
+}
+
+// Returns the index of the entry for pszSid, or c_iNotFound. _lock must be held.
+DWORD CProtectedSecretCache::_Find(_In_ PCWSTR pszSid)
+{
+    for (DWORD i = 0; i < _rgEntries.size(); i++)
+    {
+        if (_wcsicmp(_rgEntries[i].strSid.c_str(), pszSid) == 0)
+        {
+            return i;
+        }
+    }
+    return c_iNotFound;
+}
+
+// Zeroes and frees the slot of an entry and drops it, keeping the others in order
+// of use. _lock must be held exclusively.
+void CProtectedSecretCache::_Remove(DWORD iEntry)
+{
+    CSecretArena::Instance().Free(_rgEntries[iEntry].pszProtected);
+    _rgEntries.erase(_rgEntries.begin() + iEntry);
+}
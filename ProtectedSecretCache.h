@@ -0,0 +1,114 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CProtectedSecretCache holds the CredProtect form of recently unlocked users'
+// passwords in secret arena slots, so that a password is only checked and
+// encrypted again when it changes. An entry is only served for the usage scenario
+// and secret version it was made for, like the serialization cache.
+
+#pragma once
+
+#include <windows.h>
+#include <credentialprovider.h>
+#include <string>
+#include <vector>
+#include "SecretArena.h"
+
+// Users whose protected password is kept. Each entry holds an arena slot for as
+// long as it is cached, so the cache takes at most half of them and the least
+// recently used entry makes way for a new one; a machine with hundreds of users
+// still leaves slots for the passwords being loaded and packed.
+static const DWORD c_cMaxProtectedSecrets = 8;
+static_assert(c_cMaxProtectedSecrets <= c_cSecretSlots / 2, "The cache must leave arena slots for serialization");
+
+// Encrypts secrets. CCredProtectSecretProtector uses CredProtect and lives with
+// the other credential helpers in helpers.cpp; the cache only depends on this
+// interface, so another protector can stand in for it.
+class ISecretProtector
+{
+public:
+    // Sets *pfProtected if pszSecret is already encrypted, as a password received
+    // through SetSerialization during a Terminal Services connection can be.
+    virtual HRESULT IsProtected(_In_ PWSTR pszSecret, _Out_ bool *pfProtected) = 0;
+
+    // Encrypts pszSecret into the arena slot pszProtected. Fails with
+    // HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) if the encrypted form does not fit.
+    virtual HRESULT Protect(_In_ PWSTR pszSecret, _Out_writes_(c_cchSecretSlot) PWSTR pszProtected) = 0;
+};
+
+class CCredProtectSecretProtector : public ISecretProtector
+{
+public:
+    HRESULT IsProtected(_In_ PWSTR pszSecret, _Out_ bool *pfProtected);
+    HRESULT Protect(_In_ PWSTR pszSecret, _Out_writes_(c_cchSecretSlot) PWSTR pszProtected);
+};
+
+struct PROTECTED_SECRET_CACHE_STATS
+{
+    ULONGLONG   cHits;
+    ULONGLONG   cProtects;      // Calls that went to the protector
+    ULONGLONG   cEvictions;     // Entries dropped to make room for another user
+    DWORD       cEntries;
+};
+
+class CProtectedSecretCache
+{
+public:
+    explicit CProtectedSecretCache(_In_ ISecretProtector *pProtector);
+    ~CProtectedSecretCache();
+
+    // The cache GetSerialization uses, backed by CredProtect.
+    static CProtectedSecretCache &Instance();
+
+    // Copies the user's protected password into the arena slot pszSecret. Returns
+    // S_FALSE on a miss, dropping an entry made for another scenario or version.
+    HRESULT Lookup(_In_opt_ PCWSTR pszSid,
+                   CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                   DWORD dwSecretVersion,
+                   _Out_writes_(c_cchSecretSlot) PWSTR pszSecret);
+
+    // Replaces the password in the arena slot pszSecret with the form that goes into
+    // a logon buffer for cpus, and stores that as the user's entry, evicting the
+    // least recently used entry if the cache is full. Passwords are not encrypted
+    // for CredUI, nor encrypted twice. Without a SID nothing is stored.
+    HRESULT Protect(_In_opt_ PCWSTR pszSid,
+                    CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                    DWORD dwSecretVersion,
+                    _Inout_updates_(c_cchSecretSlot) PWSTR pszSecret);
+
+    // Drops the user's entry, as when their tile goes away.
+    void Invalidate(_In_opt_ PCWSTR pszSid);
+    void InvalidateAll();
+
+    void GetStats(_Out_ PROTECTED_SECRET_CACHE_STATS *pStats);
+
+private:
+    CProtectedSecretCache(const CProtectedSecretCache &);
+    CProtectedSecretCache &operator=(const CProtectedSecretCache &);
+
+    struct ENTRY
+    {
+        std::wstring                        strSid;
+        CREDENTIAL_PROVIDER_USAGE_SCENARIO  cpus;
+        DWORD                               dwSecretVersion;
+        PWSTR                               pszProtected;   // Arena slot
+    };
+
+    HRESULT _ProtectInto(CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                         _In_ PWSTR pszSecret,
+                         _Out_writes_(c_cchSecretSlot) PWSTR pszProtected);
+    DWORD _Find(_In_ PCWSTR pszSid);
+    void _Remove(DWORD iEntry);
+
+    ISecretProtector        *_pProtector;
+    SRWLOCK                 _lock;
+    std::vector<ENTRY>      _rgEntries;     // Least recently used first; c_cMaxProtectedSecrets at most, so a list is enough
+    volatile LONGLONG       _cHits;
+    volatile LONGLONG       _cProtects;
+    volatile LONGLONG       _cEvictions;
+};
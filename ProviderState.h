@@ -0,0 +1,267 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The provider state that LogonUI, the HTTP server thread and the Bluetooth scan
+// threads all read: the tiles, the phone approval and proximity, and the events
+// callback. Each change publishes a new immutable PROVIDER_STATE in a
+// CSnapshotCell. Replaced states are released by Reclaim, which LogonUI's thread
+// calls, so the tiles and the STA events callback are only released there.
+//
+// The tiles are a CTileList that every state shares until the tiles change, so
+// publishing a state for a phone event copies a pointer, not one reference per
+// tile. The state is a template over the tile type so that the tests can stand
+// in their own tiles; CSampleProvider.h names the instantiation it uses.
+
+#pragma once
+
+#include <windows.h>
+#include <credentialprovider.h>
+#include <new>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AuthStateMachine.h"
+#include "SnapshotCell.h"
+
+// Upper-case user SID to tile index.
+typedef std::unordered_map<std::wstring, DWORD> SID_INDEX;
+
+// The tiles of one enumeration, one per user, indexed by tile number. Each holds a
+// reference that is released when the list is deleted, which is when the last
+// state sharing it is reclaimed.
+template <typename TCredential>
+class CTileList
+{
+public:
+    explicit CTileList(const std::vector<TCredential*> &rgpCredentials) :
+        _rgpCredentials(rgpCredentials)
+    {
+        for (TCredential *pCredential : _rgpCredentials)
+        {
+            pCredential->AddRef();
+        }
+    }
+
+    ~CTileList()
+    {
+        for (TCredential *pCredential : _rgpCredentials)
+        {
+            pCredential->Release();
+        }
+    }
+
+    DWORD Count() const
+    {
+        return static_cast<DWORD>(_rgpCredentials.size());
+    }
+
+    TCredential *At(DWORD dwIndex) const
+    {
+        return _rgpCredentials[dwIndex];
+    }
+
+    // Whether the list holds exactly these tiles, in this order.
+    bool Matches(const std::vector<TCredential*> &rgpCredentials) const
+    {
+        return _rgpCredentials == rgpCredentials;
+    }
+
+private:
+    CTileList(const CTileList &);
+    CTileList &operator=(const CTileList &);
+
+    std::vector<TCredential*> _rgpCredentials;
+};
+
+template <typename TCredential>
+class CProviderStateCellT;
+
+template <typename TCredential>
+struct PROVIDER_STATE_T
+{
+    PROVIDER_STATE_T() :
+        fLoggedIn(false),
+        fDeviceInProximity(false),
+        dwDefault(CREDENTIAL_PROVIDER_NO_DEFAULT),
+        pEvents(nullptr),
+        upAdviseContext(0)
+    {
+    }
+
+    // Takes the reference the state holds on the events callback and works out the default tile.
+    void OnPublish()
+    {
+        if (pEvents != nullptr)
+        {
+            pEvents->AddRef();
+        }
+
+        // The approving user's tile is the default. Without an approving SID we can
+        // only pick a default when there is a single tile.
+        dwDefault = CREDENTIAL_PROVIDER_NO_DEFAULT;
+        if (!strApprovingUserSid.empty())
+        {
+            dwDefault = CProviderStateCellT<TCredential>::FindUser(this, strApprovingUserSid.c_str());
+        }
+        else if (CredentialCount() == 1)
+        {
+            dwDefault = 0;
+        }
+    }
+
+    // Drops the references, on the thread that calls CProviderStateCellT::Reclaim.
+    // The tiles go with the last state that shares them, as the state is deleted.
+    void OnReclaim()
+    {
+        if (pEvents != nullptr)
+        {
+            pEvents->Release();
+        }
+    }
+
+    DWORD CredentialCount() const
+    {
+        return spCredentials ? spCredentials->Count() : 0;
+    }
+
+    // dwIndex must be below CredentialCount().
+    TCredential *Credential(DWORD dwIndex) const
+    {
+        return spCredentials->At(dwIndex);
+    }
+
+    std::shared_ptr<const CTileList<TCredential>>   spCredentials;          // One tile per user, shared until the tiles change
+    std::shared_ptr<const SID_INDEX>                spSidIndex;             // Index of spCredentials, shared with it
+    std::wstring                                    strApprovingUserSid;    // SID of the user who approved the logon on the phone
+    bool                                            fLoggedIn;              // The phone app approved the logon
+    bool                                            fDeviceInProximity;     // The phone is in Bluetooth range
+    DWORD                                           dwDefault;              // Tile of the approving user, set when published
+    ICredentialProviderEvents                       *pEvents;               // Holds a reference, or nullptr when not advised
+    UINT_PTR                                        upAdviseContext;
+};
+
+template <typename TCredential>
+class CProviderStateCellT
+{
+public:
+    typedef PROVIDER_STATE_T<TCredential> STATE;
+
+    CProviderStateCellT()
+    {
+    }
+
+    // Returns a reference to the current state without blocking. Never nullptr.
+    const STATE *Acquire()
+    {
+        return _cell.Acquire();
+    }
+
+    static void Release(_In_ const STATE *pState)
+    {
+        CSnapshotCell<STATE>::Release(pState);
+    }
+
+    // Releases the states nobody can read any more. Called on LogonUI's thread.
+    DWORD Reclaim()
+    {
+        return _cell.Reclaim();
+    }
+
+    // Returns the tile of the user with pszSid, or CREDENTIAL_PROVIDER_NO_DEFAULT.
+    static DWORD FindUser(_In_ const STATE *pState, _In_opt_ PCWSTR pszSid)
+    {
+        if (pszSid == nullptr || *pszSid == L'\0' || !pState->spSidIndex)
+        {
+            return CREDENTIAL_PROVIDER_NO_DEFAULT;
+        }
+
+        std::wstring strKey;
+        MakeSidKey(pszSid, &strKey);
+        auto it = pState->spSidIndex->find(strKey);
+        if (it != pState->spSidIndex->end() && it->second < pState->CredentialCount())
+        {
+            // The index is built from the tiles, but confirm the SID rather than trust it.
+            PCWSTR pszCredentialSid = pState->Credential(it->second)->UserSid();
+            if (pszCredentialSid != nullptr && _wcsicmp(pszCredentialSid, pszSid) == 0)
+            {
+                return it->second;
+            }
+        }
+        return CREDENTIAL_PROVIDER_NO_DEFAULT;
+    }
+
+    // Sets *pstrKey to the SID_INDEX key of pszSid, reusing its buffer. SIDs are
+    // compared case-insensitively, so they are indexed by the upper-case form.
+    static void MakeSidKey(_In_ PCWSTR pszSid, _Inout_ std::wstring *pstrKey)
+    {
+        pstrKey->assign(pszSid);
+        for (WCHAR &ch : *pstrKey)
+        {
+            if (ch >= L'a' && ch <= L'z')
+            {
+                ch = static_cast<WCHAR>(ch - L'a' + L'A');
+            }
+        }
+    }
+
+    // Copies the current state, lets update change the copy and publishes it.
+    // Writers are serialized with each other but never block readers.
+    template <typename TUpdate>
+    HRESULT Update(TUpdate update)
+    {
+        return _cell.Update(update);
+    }
+
+    // Makes the user with strSid the approving user, whose tile becomes the default,
+    // and passes the approval to that tile alone, which starts packing its logon
+    // buffer. The tile of a previous approving user is told that its approval is
+    // gone. Returns S_FALSE when the user has no tile.
+    HRESULT Approve(std::wstring strSid)
+    {
+        const STATE *pState = Acquire();
+        DWORD dwPrevious = pState->fLoggedIn ? pState->dwDefault : CREDENTIAL_PROVIDER_NO_DEFAULT;
+        if (dwPrevious != CREDENTIAL_PROVIDER_NO_DEFAULT &&
+            dwPrevious != FindUser(pState, strSid.c_str()))
+        {
+            pState->Credential(dwPrevious)->OnProviderStateChange(false);
+        }
+        Release(pState);
+
+        HRESULT hr = Update([&strSid](STATE &state)
+        {
+            state.strApprovingUserSid.swap(strSid);
+            state.fLoggedIn = true;
+        });
+        if (SUCCEEDED(hr))
+        {
+            pState = Acquire();
+            if (pState->dwDefault != CREDENTIAL_PROVIDER_NO_DEFAULT)
+            {
+                TCredential *pCredential = pState->Credential(pState->dwDefault);
+                pCredential->OnAuthEvent(AUTH_EVENT_APP_APPROVED);
+
+                // Pack the logon buffer now, so LogonUI only has to copy it. Repeated
+                // approvals while it is being packed share the one run.
+                pCredential->QueuePrepareSerialization();
+            }
+            else
+            {
+                hr = S_FALSE;
+            }
+            Release(pState);
+        }
+        return hr;
+    }
+
+private:
+    CProviderStateCellT(const CProviderStateCellT &);
+    CProviderStateCellT &operator=(const CProviderStateCellT &);
+
+    CSnapshotCell<STATE>    _cell;
+};
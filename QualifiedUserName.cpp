@@ -0,0 +1,142 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The delimiters are found in a single pass that compares eight characters at a
+// time with SSE2 where it is available.
+
+#include "QualifiedUserName.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define QUALIFIED_NAME_SSE2
+#endif
+
+static const std::u16string_view c_svMicrosoftAccount = u"MicrosoftAccount";
+
+// Finds the first backslash and the first '@' in name, or npos for either.
+static void _FindDelimiters(std::u16string_view name, size_t *pichWhack, size_t *pichAt)
+{
+    size_t ichWhack = std::u16string_view::npos;
+    size_t ichAt = std::u16string_view::npos;
+    size_t ich = 0;
+
+#ifdef QUALIFIED_NAME_SSE2
+    const __m128i xmmWhack = _mm_set1_epi16(u'\\');
+    const __m128i xmmAt = _mm_set1_epi16(u'@');
+    for (; ich + 8 <= name.size() && (ichWhack == std::u16string_view::npos || ichAt == std::u16string_view::npos); ich += 8)
+    {
+        __m128i xmmChars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(name.data() + ich));
+        // Two mask bits per character; the lowest set bit is the first match.
+        unsigned int uWhack = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi16(xmmChars, xmmWhack)));
+        unsigned int uAt = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi16(xmmChars, xmmAt)));
+        for (unsigned int i = 0; i < 8 && (uWhack | uAt) != 0; i++)
+        {
+            unsigned int uBits = 3u << (2 * i);
+            if ((uWhack & uBits) != 0 && ichWhack == std::u16string_view::npos)
+            {
+                ichWhack = ich + i;
+            }
+            if ((uAt & uBits) != 0 && ichAt == std::u16string_view::npos)
+            {
+                ichAt = ich + i;
+            }
+            uWhack &= ~uBits;
+            uAt &= ~uBits;
+        }
+    }
+#endif
+
+    for (; ich < name.size() && (ichWhack == std::u16string_view::npos || ichAt == std::u16string_view::npos); ich++)
+    {
+        if (name[ich] == u'\\' && ichWhack == std::u16string_view::npos)
+        {
+            ichWhack = ich;
+        }
+        else if (name[ich] == u'@' && ichAt == std::u16string_view::npos)
+        {
+            ichAt = ich;
+        }
+    }
+
+    *pichWhack = ichWhack;
+    *pichAt = ichAt;
+}
+
+static bool _EqualsIgnoreCaseAscii(std::u16string_view sv1, std::u16string_view sv2)
+{
+    if (sv1.size() != sv2.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < sv1.size(); i++)
+    {
+        char16_t ch1 = (sv1[i] >= u'a' && sv1[i] <= u'z') ? static_cast<char16_t>(sv1[i] - u'a' + u'A') : sv1[i];
+        char16_t ch2 = (sv2[i] >= u'a' && sv2[i] <= u'z') ? static_cast<char16_t>(sv2[i] - u'a' + u'A') : sv2[i];
+        if (ch1 != ch2)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParseQualifiedUserName(std::u16string_view name, QUALIFIED_NAME_PARTS *pParts)
+{
+    *pParts = QUALIFIED_NAME_PARTS();
+    pParts->form = QNF_INVALID;
+
+    size_t ichWhack;
+    size_t ichAt;
+    _FindDelimiters(name, &ichWhack, &ichAt);
+    pParts->fHasAt = (ichAt != std::u16string_view::npos);
+
+    if (ichWhack != std::u16string_view::npos)
+    {
+        // Anything with a backslash is down-level; the domain says which kind.
+        std::u16string_view svDomain = name.substr(0, ichWhack);
+        pParts->ichDomain = 0;
+        pParts->cchDomain = ichWhack;
+        pParts->ichUserName = ichWhack + 1;
+        pParts->cchUserName = name.size() - ichWhack - 1;
+        if (pParts->cchUserName != 0)
+        {
+            if (svDomain == u".")
+            {
+                pParts->form = QNF_LOCAL;
+            }
+            else if (_EqualsIgnoreCaseAscii(svDomain, c_svMicrosoftAccount))
+            {
+                pParts->form = QNF_MICROSOFT_ACCOUNT;
+            }
+            else
+            {
+                pParts->form = QNF_DOWN_LEVEL;
+            }
+        }
+    }
+    else if (ichAt != std::u16string_view::npos)
+    {
+        // LSA takes a UPN whole as the user name, with an empty domain.
+        pParts->ichUserName = 0;
+        pParts->cchUserName = name.size();
+        pParts->ichDomain = name.size();
+        if (ichAt != 0 && ichAt + 1 < name.size())
+        {
+            pParts->form = QNF_UPN;
+        }
+    }
+    else if (!name.empty())
+    {
+        pParts->ichUserName = 0;
+        pParts->cchUserName = name.size();
+        pParts->ichDomain = name.size();
+        pParts->form = QNF_USER_ONLY;
+    }
+
+    return pParts->form != QNF_INVALID;
+}
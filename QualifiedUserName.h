@@ -0,0 +1,52 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Classifies a qualified user name and splits it into the domain and user name
+// that go into the logon buffer, without allocating. The parts are kept as
+// offsets, so a parse stays valid for any copy of the same name.
+
+#pragma once
+
+#include <stddef.h>
+#include <string_view>
+
+enum QUALIFIED_NAME_FORM
+{
+    QNF_INVALID,
+    QNF_USER_ONLY,          // user, with no domain
+    QNF_DOWN_LEVEL,         // DOMAIN\user
+    QNF_LOCAL,              // .\user
+    QNF_UPN,                // user@domain
+    QNF_MICROSOFT_ACCOUNT,  // MicrosoftAccount\user@domain
+};
+
+struct QUALIFIED_NAME_PARTS
+{
+    QUALIFIED_NAME_FORM     form;
+    size_t                  ichDomain;      // Empty for QNF_USER_ONLY and QNF_UPN
+    size_t                  cchDomain;
+    size_t                  ichUserName;    // The whole name for QNF_UPN
+    size_t                  cchUserName;
+    bool                    fHasAt;         // An '@' anywhere in the name
+
+    std::u16string_view Domain(std::u16string_view name) const { return name.substr(ichDomain, cchDomain); }
+    std::u16string_view UserName(std::u16string_view name) const { return name.substr(ichUserName, cchUserName); }
+};
+
+// Fills *pParts for name. Returns false, with form QNF_INVALID, for an empty name,
+// an empty user name or a UPN without a domain.
+bool ParseQualifiedUserName(std::u16string_view name, QUALIFIED_NAME_PARTS *pParts);
+
+// Whether the name goes into a KERB_INTERACTIVE_UNLOCK_LOGON even for tiles that
+// are not local users. As in the sample that is any name with an '@' in it, so
+// AzureAD\user@contoso.com takes this path as well as user@contoso.com, whatever
+// its form.
+inline bool IsUserPrincipalName(const QUALIFIED_NAME_PARTS &parts)
+{
+    return parts.fHasAt;
+}
@@ -0,0 +1,218 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The counter is checked when a request begins, so a replay is turned away
+// before its body is read, and again when it completes, since the counter is
+// only raised once the tag has been checked.
+
+#include "RequestAuth.h"
+#include "SealedKey.h"
+
+static const WCHAR c_szSettingsKey[] = L"SOFTWARE\\AbsoluteID";
+static const char c_szAuthorizationHeader[] = "authorization:";
+static const char c_szAuthorizationScheme[] = "absoluteid ";
+
+static bool _IsEqualNoCase(const char *pch, const char *pszLower, size_t cch)
+{
+    for (size_t i = 0; i < cch; i++)
+    {
+        char ch = (pch[i] >= 'A' && pch[i] <= 'Z') ? static_cast<char>(pch[i] - 'A' + 'a') : pch[i];
+        if (ch != pszLower[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int _HexDigitValue(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+    {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f')
+    {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F')
+    {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+// Reads "<counter>:<tag>" from the Authorization header of the cch characters of
+// header lines at pch, the request line excluded.
+static bool _ParseAuthorization(const char *pch, size_t cch, _Out_ ULONGLONG *pullCounter, _Out_writes_bytes_(c_cbPoly1305Tag) BYTE *pbTag)
+{
+    *pullCounter = 0;
+    const size_t cchHeader = ARRAYSIZE(c_szAuthorizationHeader) - 1;
+    const size_t cchScheme = ARRAYSIZE(c_szAuthorizationScheme) - 1;
+    const char *pchEnd = pch + cch;
+    while (pch < pchEnd)
+    {
+        const char *pchLineEnd = pch;
+        while (pchLineEnd < pchEnd && *pchLineEnd != '\r' && *pchLineEnd != '\n')
+        {
+            pchLineEnd++;
+        }
+
+        if (static_cast<size_t>(pchLineEnd - pch) > cchHeader && _IsEqualNoCase(pch, c_szAuthorizationHeader, cchHeader))
+        {
+            const char *pchValue = pch + cchHeader;
+            while (pchValue < pchLineEnd && (*pchValue == ' ' || *pchValue == '\t'))
+            {
+                pchValue++;
+            }
+            if (static_cast<size_t>(pchLineEnd - pchValue) <= cchScheme || !_IsEqualNoCase(pchValue, c_szAuthorizationScheme, cchScheme))
+            {
+                return false;
+            }
+            pchValue += cchScheme;
+
+            // Twenty digits can exceed 64 bits, so the counter is capped at nineteen.
+            size_t cDigits = 0;
+            for (; pchValue < pchLineEnd && *pchValue >= '0' && *pchValue <= '9'; pchValue++, cDigits++)
+            {
+                if (cDigits == 19)
+                {
+                    return false;
+                }
+                *pullCounter = *pullCounter * 10 + (*pchValue - '0');
+            }
+            if (cDigits == 0 || static_cast<size_t>(pchLineEnd - pchValue) != 1 + 2 * c_cbPoly1305Tag || *pchValue != ':')
+            {
+                return false;
+            }
+            pchValue++;
+
+            for (size_t i = 0; i < c_cbPoly1305Tag; i++)
+            {
+                int iHigh = _HexDigitValue(pchValue[2 * i]);
+                int iLow = _HexDigitValue(pchValue[2 * i + 1]);
+                if (iHigh < 0 || iLow < 0)
+                {
+                    return false;
+                }
+                pbTag[i] = static_cast<BYTE>(iHigh * 16 + iLow);
+            }
+            return true;
+        }
+
+        pch = pchLineEnd;
+        while (pch < pchEnd && (*pch == '\r' || *pch == '\n'))
+        {
+            pch++;
+        }
+    }
+    return false;
+}
+
+CRequestAuthenticator &CRequestAuthenticator::Instance()
+{
+    static CRequestAuthenticator s_authenticator;
+    return s_authenticator;
+}
+
+CRequestAuthenticator::CRequestAuthenticator()
+{
+    InitializeSRWLock(&_lock);
+}
+
+// Returns the last counter accepted, or 0 if the phone has not been paired or has
+// sent nothing since.
+ULONGLONG CRequestAuthenticator::_GetLastCounter()
+{
+    ULONGLONG ullCounter = 0;
+    DWORD cbData = sizeof(ullCounter);
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, c_szSettingsKey, c_szPairingCounterValue, RRF_RT_REG_QWORD, nullptr, &ullCounter, &cbData) != ERROR_SUCCESS)
+    {
+        ullCounter = 0;
+    }
+    return ullCounter;
+}
+
+HRESULT CRequestAuthenticator::Begin(_In_reads_(cchHeaders) const char *pchHeaders, size_t cchHeaders, _Out_ REQUEST_MAC *pMac)
+{
+    ZeroMemory(pMac, sizeof(*pMac));
+
+    size_t cchRequestLine = 0;
+    while (cchRequestLine < cchHeaders && pchHeaders[cchRequestLine] != '\r' && pchHeaders[cchRequestLine] != '\n')
+    {
+        cchRequestLine++;
+    }
+    if (!_ParseAuthorization(pchHeaders + cchRequestLine, cchHeaders - cchRequestLine, &pMac->ullCounter, pMac->rgbTag))
+    {
+        OutputDebugStringW(L"CRequestAuthenticator::Begin: The request is not authorized.\n");
+        return E_ACCESSDENIED;
+    }
+
+    AcquireSRWLockShared(&_lock);
+    bool fReplayed = (pMac->ullCounter <= _GetLastCounter());
+    ReleaseSRWLockShared(&_lock);
+    if (fReplayed)
+    {
+        OutputDebugStringW(L"CRequestAuthenticator::Begin: The request's counter was already used.\n");
+        return E_ACCESSDENIED;
+    }
+
+    BYTE rgbKey[c_cbChaChaKey];
+    HRESULT hr = SealedKeyLoad(c_szPairingKeyFile, rgbKey, sizeof(rgbKey));
+    if (SUCCEEDED(hr))
+    {
+        BYTE rgbNonce[c_cbChaChaNonce] = {};
+        for (size_t i = 0; i < sizeof(ULONGLONG); i++)
+        {
+            rgbNonce[4 + i] = static_cast<BYTE>(pMac->ullCounter >> (8 * i));
+        }
+        ChaCha20Poly1305MacInit(&pMac->mac, rgbKey, rgbNonce);
+        SecureZeroMemory(rgbKey, sizeof(rgbKey));
+
+        Update(pMac, pchHeaders, cchRequestLine);
+        Update(pMac, "\n", 1);
+    }
+    else
+    {
+        OutputDebugStringW(L"CRequestAuthenticator::Begin: The phone has not been paired.\n");
+        hr = E_ACCESSDENIED;
+    }
+    return hr;
+}
+
+void CRequestAuthenticator::Update(_Inout_ REQUEST_MAC *pMac, _In_reads_bytes_(cb) const void *pv, size_t cb)
+{
+    ChaCha20Poly1305MacUpdate(&pMac->mac, static_cast<const uint8_t*>(pv), cb);
+}
+
+HRESULT CRequestAuthenticator::Complete(_Inout_ REQUEST_MAC *pMac)
+{
+    if (!ChaCha20Poly1305MacVerify(&pMac->mac, pMac->rgbTag))
+    {
+        OutputDebugStringW(L"CRequestAuthenticator::Complete: The request's tag does not match.\n");
+        return E_ACCESSDENIED;
+    }
+
+    HRESULT hr = E_ACCESSDENIED;
+    AcquireSRWLockExclusive(&_lock);
+    if (pMac->ullCounter > _GetLastCounter())
+    {
+        HKEY hKey = nullptr;
+        LSTATUS status = RegCreateKeyExW(HKEY_LOCAL_MACHINE, c_szSettingsKey, 0, nullptr, REG_OPTION_NON_VOLATILE, KEY_SET_VALUE, nullptr, &hKey, nullptr);
+        if (status == ERROR_SUCCESS)
+        {
+            status = RegSetValueExW(hKey, c_szPairingCounterValue, 0, REG_QWORD, reinterpret_cast<const BYTE*>(&pMac->ullCounter), sizeof(pMac->ullCounter));
+            RegCloseKey(hKey);
+        }
+
+        // A counter that could not be stored could be replayed, so the request is refused.
+        hr = HRESULT_FROM_WIN32(status);
+    }
+    ReleaseSRWLockExclusive(&_lock);
+    return hr;
+}
@@ -0,0 +1,69 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Authentication of the requests the phone app sends to the HTTP server, both
+// approvals and avatar uploads. Pairing gives the phone a 32-byte key, which the
+// admin tool keeps here sealed in Pairing.key. Every request then carries
+//
+//     Authorization: AbsoluteID <counter>:<tag>
+//
+// where counter is a decimal number the phone raises with every request and tag
+// is 32 hex digits: the ChaCha20-Poly1305 tag of an empty plaintext under the
+// pairing key, with a nonce of four zero bytes and the counter as a little-endian
+// 64-bit number, over the request line, a line feed and the body, de-chunked.
+// A request is only accepted with a counter above the last one accepted, which
+// is kept in the registry, so an overheard request cannot be replayed.
+
+#pragma once
+
+#include <windows.h>
+#include "ChaCha20Poly1305.h"
+
+// Name of the sealed pairing key in the AbsoluteID directory under %ProgramData%.
+static const WCHAR c_szPairingKeyFile[] = L"Pairing.key";
+
+// The registry value under HKLM\SOFTWARE\AbsoluteID holding the last counter accepted.
+static const WCHAR c_szPairingCounterValue[] = L"PairingCounter";
+
+// One request being checked while its body is read.
+struct REQUEST_MAC
+{
+    ULONGLONG               ullCounter;
+    BYTE                    rgbTag[c_cbPoly1305Tag];
+    CHACHA20_POLY1305_MAC   mac;
+};
+
+class CRequestAuthenticator
+{
+public:
+    static CRequestAuthenticator &Instance();
+
+    // Starts checking the request whose headers, request line first, are the
+    // cchHeaders characters at pchHeaders. Fails with E_ACCESSDENIED if the request
+    // has no valid Authorization header, its counter was already used or the phone
+    // was never paired. The key is read for every request, so pairing again takes
+    // effect at once.
+    HRESULT Begin(_In_reads_(cchHeaders) const char *pchHeaders, size_t cchHeaders, _Out_ REQUEST_MAC *pMac);
+
+    // Adds the next cb bytes of the body.
+    static void Update(_Inout_ REQUEST_MAC *pMac, _In_reads_bytes_(cb) const void *pv, size_t cb);
+
+    // Checks the tag over the request line and body. Only if it matches and the
+    // counter is still unused does the counter become the last one accepted and
+    // this return S_OK; otherwise it returns E_ACCESSDENIED.
+    HRESULT Complete(_Inout_ REQUEST_MAC *pMac);
+
+private:
+    CRequestAuthenticator();
+    CRequestAuthenticator(const CRequestAuthenticator &);
+    CRequestAuthenticator &operator=(const CRequestAuthenticator &);
+
+    static ULONGLONG _GetLastCounter();
+
+    SRWLOCK     _lock;      // Orders checking and raising the counter
+};
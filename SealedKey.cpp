@@ -0,0 +1,162 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Keys are sealed with CRYPTPROTECT_LOCAL_MACHINE, since the admin tool that
+// writes them and LogonUI that reads them run as different accounts; the
+// directory's access list is what keeps other users out.
+
+#include <windows.h>
+#include <bcrypt.h>
+#include <sddl.h>
+#include <shlobj.h>
+#include <strsafe.h>
+#include <wincrypt.h>
+#include "SealedKey.h"
+
+#pragma comment(lib, "Bcrypt.lib")
+#pragma comment(lib, "Crypt32.lib")
+
+static const WCHAR c_szKeyDirectory[] = L"AbsoluteID";
+static const WCHAR c_szKeyDirectorySddl[] = L"D:P(A;OICI;GA;;;SY)(A;OICI;GA;;;BA)";
+
+// Largest sealed key file read; a DPAPI blob of a 32-byte key is a few hundred bytes.
+static const DWORD c_cbMaxKeyFile = 4096;
+
+HRESULT SealedKeyGetPath(_In_ PCWSTR pszFile, _Out_writes_(cchPath) PWSTR pszPath, size_t cchPath)
+{
+    PWSTR pszProgramData = nullptr;
+    HRESULT hr = SHGetKnownFolderPath(FOLDERID_ProgramData, 0, nullptr, &pszProgramData);
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchPrintfW(pszPath, cchPath, L"%s\\%s\\%s", pszProgramData, c_szKeyDirectory, pszFile);
+        CoTaskMemFree(pszProgramData);
+    }
+    return hr;
+}
+
+HRESULT SealedKeyCreateDirectory()
+{
+    WCHAR szPath[MAX_PATH];
+    PWSTR pszProgramData = nullptr;
+    HRESULT hr = SHGetKnownFolderPath(FOLDERID_ProgramData, 0, nullptr, &pszProgramData);
+    if (SUCCEEDED(hr))
+    {
+        hr = StringCchPrintfW(szPath, ARRAYSIZE(szPath), L"%s\\%s", pszProgramData, c_szKeyDirectory);
+        CoTaskMemFree(pszProgramData);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, FALSE };
+        if (ConvertStringSecurityDescriptorToSecurityDescriptorW(c_szKeyDirectorySddl, SDDL_REVISION_1, &sa.lpSecurityDescriptor, nullptr))
+        {
+            if (!CreateDirectoryW(szPath, &sa) && GetLastError() != ERROR_ALREADY_EXISTS)
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            LocalFree(sa.lpSecurityDescriptor);
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    return hr;
+}
+
+HRESULT SealedKeyLoad(_In_ PCWSTR pszFile, _Out_writes_bytes_(cbKey) BYTE *pbKey, DWORD cbKey)
+{
+    WCHAR szPath[MAX_PATH];
+    HRESULT hr = SealedKeyGetPath(pszFile, szPath, ARRAYSIZE(szPath));
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    HANDLE hFile = CreateFileW(szPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    BYTE rgbSealed[c_cbMaxKeyFile];
+    DWORD cbSealed = 0;
+    if (!ReadFile(hFile, rgbSealed, sizeof(rgbSealed), &cbSealed, nullptr))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr))
+    {
+        DATA_BLOB blobSealed = { cbSealed, rgbSealed };
+        DATA_BLOB blobKey = {};
+        if (CryptUnprotectData(&blobSealed, nullptr, nullptr, nullptr, nullptr, CRYPTPROTECT_UI_FORBIDDEN, &blobKey))
+        {
+            if (blobKey.cbData == cbKey)
+            {
+                CopyMemory(pbKey, blobKey.pbData, cbKey);
+            }
+            else
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            SecureZeroMemory(blobKey.pbData, blobKey.cbData);
+            LocalFree(blobKey.pbData);
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    return hr;
+}
+
+HRESULT SealedKeyCreate(_In_ PCWSTR pszFile, _Out_writes_bytes_(cbKey) BYTE *pbKey, DWORD cbKey)
+{
+    WCHAR szPath[MAX_PATH];
+    HRESULT hr = SealedKeyCreateDirectory();
+    if (SUCCEEDED(hr))
+    {
+        hr = SealedKeyGetPath(pszFile, szPath, ARRAYSIZE(szPath));
+    }
+    if (SUCCEEDED(hr))
+    {
+        NTSTATUS status = BCryptGenRandom(nullptr, pbKey, cbKey, BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+        hr = BCRYPT_SUCCESS(status) ? S_OK : HRESULT_FROM_NT(status);
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    DATA_BLOB blobKey = { cbKey, pbKey };
+    DATA_BLOB blobSealed = {};
+    if (!CryptProtectData(&blobKey, nullptr, nullptr, nullptr, nullptr, CRYPTPROTECT_UI_FORBIDDEN | CRYPTPROTECT_LOCAL_MACHINE, &blobSealed))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // The file inherits the directory's access list.
+    HANDLE hFile = CreateFileW(szPath, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        DWORD cbWritten = 0;
+        if (!WriteFile(hFile, blobSealed.pbData, blobSealed.cbData, &cbWritten, nullptr))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        CloseHandle(hFile);
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    LocalFree(blobSealed.pbData);
+    return hr;
+}
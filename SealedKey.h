@@ -0,0 +1,30 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Keys kept in files under %ProgramData%\AbsoluteID, each sealed to the machine
+// with DPAPI: the vault key and the key the phone app was paired with. The
+// directory only admits SYSTEM and administrators, so LogonUI and the admin tool
+// can unseal the keys and other users cannot read the files.
+
+#pragma once
+
+#include <windows.h>
+
+// Builds the path of pszFile in the AbsoluteID directory under %ProgramData%.
+HRESULT SealedKeyGetPath(_In_ PCWSTR pszFile, _Out_writes_(cchPath) PWSTR pszPath, size_t cchPath);
+
+// Creates the AbsoluteID directory with its restricted access, if it is not there.
+HRESULT SealedKeyCreateDirectory();
+
+// Reads the sealed key in pszFile and unseals it into pbKey, which holds cbKey
+// bytes. Fails with ERROR_INVALID_DATA if the key is of another size.
+HRESULT SealedKeyLoad(_In_ PCWSTR pszFile, _Out_writes_bytes_(cbKey) BYTE *pbKey, DWORD cbKey);
+
+// Generates a random key of cbKey bytes into pbKey, seals it and replaces
+// pszFile with it. Used by the admin tool when provisioning.
+HRESULT SealedKeyCreate(_In_ PCWSTR pszFile, _Out_writes_bytes_(cbKey) BYTE *pbKey, DWORD cbKey);
@@ -0,0 +1,326 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Records are open-addressed with linear probing. Vaults are rewritten whole
+// rather than edited, so records are never removed and an unused record ends
+// every probe sequence. Two SIDs with the same hash are told apart by the SID
+// kept in each record, so the second is simply probed past the first.
+
+#include "SealedVault.h"
+#include <string.h>
+
+static const uint32_t c_dwVaultMagic = 0x56444941;     // 'AIDV'
+static const uint32_t c_dwVaultLayout = 2;             // Bump when SEALED_VAULT_RECORD changes
+
+// The authenticated fields of a record: everything before the nonce.
+static const size_t c_cbRecordAad = offsetof(SEALED_VAULT_RECORD, Nonce);
+
+static uint32_t _Load32(const uint8_t *pb)
+{
+    return static_cast<uint32_t>(pb[0]) | (static_cast<uint32_t>(pb[1]) << 8) |
+        (static_cast<uint32_t>(pb[2]) << 16) | (static_cast<uint32_t>(pb[3]) << 24);
+}
+
+static uint64_t _Load64(const uint8_t *pb)
+{
+    return _Load32(pb) | (static_cast<uint64_t>(_Load32(pb + 4)) << 32);
+}
+
+static void _Store32(uint8_t *pb, uint32_t dw)
+{
+    pb[0] = static_cast<uint8_t>(dw);
+    pb[1] = static_cast<uint8_t>(dw >> 8);
+    pb[2] = static_cast<uint8_t>(dw >> 16);
+    pb[3] = static_cast<uint8_t>(dw >> 24);
+}
+
+static void _Store64(uint8_t *pb, uint64_t ull)
+{
+    _Store32(pb, static_cast<uint32_t>(ull));
+    _Store32(pb + 4, static_cast<uint32_t>(ull >> 32));
+}
+
+static void _Wipe(void *pv, size_t cb)
+{
+    volatile uint8_t *pb = static_cast<volatile uint8_t*>(pv);
+    while (cb-- != 0)
+    {
+        *pb++ = 0;
+    }
+}
+
+static char16_t _UpperCase(char16_t ch)
+{
+    return (ch >= u'a' && ch <= u'z') ? static_cast<char16_t>(ch - u'a' + u'A') : ch;
+}
+
+// Returns whether the SID can be kept in a record: ASCII, and short enough to
+// leave a terminator.
+static bool _IsStorableSid(const char16_t *pchSid, size_t cchSid)
+{
+    if (cchSid == 0 || cchSid >= c_cchVaultSid)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < cchSid; i++)
+    {
+        if (pchSid[i] == u'\0' || pchSid[i] > 0x7F)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _IsSameSid(const SEALED_VAULT_RECORD &record, const char16_t *pchSid, size_t cchSid)
+{
+    if (cchSid >= c_cchVaultSid || record.Sid[cchSid] != 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < cchSid; i++)
+    {
+        if (record.Sid[i] != _UpperCase(pchSid[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the record count of the vault in pb, or 0 if it is not a vault of size cb.
+static uint32_t _RecordCount(const uint8_t *pb, size_t cb)
+{
+    if (cb < sizeof(SEALED_VAULT_HEADER))
+    {
+        return 0;
+    }
+    const SEALED_VAULT_HEADER *pHeader = reinterpret_cast<const SEALED_VAULT_HEADER*>(pb);
+    uint32_t cRecords = _Load32(pHeader->cRecords);
+    if (_Load32(pHeader->Magic) != c_dwVaultMagic || _Load32(pHeader->Layout) != c_dwVaultLayout ||
+        SealedVaultSize(cRecords) != cb)
+    {
+        return 0;
+    }
+    return cRecords;
+}
+
+// Returns the record for the SID or, if there is none, the unused record that
+// ends its probe sequence. Returns nullptr if neither is found.
+static SEALED_VAULT_RECORD *_Probe(uint8_t *pb, uint32_t cRecords, const char16_t *pchSid, size_t cchSid)
+{
+    uint64_t ullSidHash = SealedVaultHashSid(pchSid, cchSid);
+    SEALED_VAULT_RECORD *rgRecords = reinterpret_cast<SEALED_VAULT_RECORD*>(pb + sizeof(SEALED_VAULT_HEADER));
+    uint32_t iHome = static_cast<uint32_t>(ullSidHash) & (cRecords - 1);
+    for (uint32_t iProbe = 0; iProbe < cRecords; iProbe++)
+    {
+        SEALED_VAULT_RECORD *pRecord = &rgRecords[(iHome + iProbe) & (cRecords - 1)];
+        uint64_t ullHash = _Load64(pRecord->SidHash);
+        if (ullHash == 0 || (ullHash == ullSidHash && _IsSameSid(*pRecord, pchSid, cchSid)))
+        {
+            return pRecord;
+        }
+    }
+    return nullptr;
+}
+
+uint64_t SealedVaultHashSid(const char16_t *pchSid, size_t cchSid)
+{
+    uint64_t ullHash = 14695981039346656037ULL;
+    for (size_t i = 0; i < cchSid; i++)
+    {
+        ullHash = (ullHash ^ _UpperCase(pchSid[i])) * 1099511628211ULL;
+    }
+    return (ullHash != 0) ? ullHash : 1;
+}
+
+size_t SealedVaultSize(uint32_t cRecords)
+{
+    if (cRecords == 0 || (cRecords & (cRecords - 1)) != 0)
+    {
+        return 0;
+    }
+    return sizeof(SEALED_VAULT_HEADER) + static_cast<size_t>(cRecords) * sizeof(SEALED_VAULT_RECORD);
+}
+
+bool SealedVaultInitialize(uint8_t *pb, size_t cb, uint32_t cRecords, uint32_t dwGeneration)
+{
+    if (cb == 0 || SealedVaultSize(cRecords) != cb)
+    {
+        return false;
+    }
+    memset(pb, 0, cb);
+    SEALED_VAULT_HEADER *pHeader = reinterpret_cast<SEALED_VAULT_HEADER*>(pb);
+    _Store32(pHeader->Magic, c_dwVaultMagic);
+    _Store32(pHeader->Layout, c_dwVaultLayout);
+    _Store32(pHeader->cRecords, cRecords);
+    _Store32(pHeader->Generation, dwGeneration);
+    return true;
+}
+
+bool SealedVaultIsValid(const uint8_t *pb, size_t cb)
+{
+    return _RecordCount(pb, cb) != 0;
+}
+
+uint32_t SealedVaultGeneration(const uint8_t *pb, size_t cb)
+{
+    if (_RecordCount(pb, cb) == 0)
+    {
+        return 0;
+    }
+    return _Load32(reinterpret_cast<const SEALED_VAULT_HEADER*>(pb)->Generation);
+}
+
+const SEALED_VAULT_RECORD *SealedVaultFind(const uint8_t *pb, size_t cb, const char16_t *pchSid, size_t cchSid)
+{
+    uint32_t cRecords = _RecordCount(pb, cb);
+    if (cRecords == 0 || !_IsStorableSid(pchSid, cchSid))
+    {
+        return nullptr;
+    }
+    const SEALED_VAULT_RECORD *pRecord = _Probe(const_cast<uint8_t*>(pb), cRecords, pchSid, cchSid);
+    return (pRecord != nullptr && _Load64(pRecord->SidHash) != 0) ? pRecord : nullptr;
+}
+
+uint32_t SealedVaultRecordVersion(const SEALED_VAULT_RECORD &record)
+{
+    return _Load32(record.SecretVersion);
+}
+
+bool SealedVaultOpen(const uint8_t *pbKey, uint32_t dwGeneration, const SEALED_VAULT_RECORD &record, char16_t *pch)
+{
+    // The record may be in a file another process can rewrite, so decrypt from a copy.
+    SEALED_VAULT_RECORD copy;
+    memcpy(&copy, &record, sizeof(copy));
+
+    // The generation is authenticated with the rest, so checking it first only
+    // saves decrypting a record from an older vault.
+    bool fOpened = (_Load32(copy.Generation) == dwGeneration) &&
+        ChaCha20Poly1305Open(pbKey, copy.Nonce, reinterpret_cast<const uint8_t*>(&copy), c_cbRecordAad,
+                             copy.Secret, sizeof(copy.Secret), copy.Tag, copy.Secret);
+    if (fOpened)
+    {
+        const uint8_t *pbSecret = copy.Secret;
+        for (size_t i = 0; i < c_cchVaultSecret; i++, pbSecret += 2)
+        {
+            pch[i] = static_cast<char16_t>(pbSecret[0] | (pbSecret[1] << 8));
+        }
+        fOpened = (pch[c_cchVaultSecret - 1] == u'\0');
+    }
+    if (!fOpened)
+    {
+        _Wipe(pch, c_cchVaultSecret * sizeof(char16_t));
+    }
+
+    _Wipe(&copy, sizeof(copy));
+    return fOpened;
+}
+
+// Fills pRecord with the secret for the SID and seals it. The SID must be storable.
+static void _Seal(SEALED_VAULT_RECORD *pRecord,
+                  const uint8_t *pbKey,
+                  const uint8_t *pbNonce,
+                  uint32_t dwGeneration,
+                  const char16_t *pchSid, size_t cchSid,
+                  uint32_t dwSecretVersion,
+                  const char16_t *pchSecret, size_t cchSecret)
+{
+    memset(pRecord, 0, sizeof(*pRecord));
+    _Store64(pRecord->SidHash, SealedVaultHashSid(pchSid, cchSid));
+    _Store32(pRecord->SecretVersion, dwSecretVersion);
+    _Store32(pRecord->Generation, dwGeneration);
+    for (size_t i = 0; i < cchSid; i++)
+    {
+        pRecord->Sid[i] = static_cast<uint8_t>(_UpperCase(pchSid[i]));
+    }
+    memcpy(pRecord->Nonce, pbNonce, sizeof(pRecord->Nonce));
+    uint8_t *pbSecret = pRecord->Secret;
+    for (size_t i = 0; i < cchSecret; i++, pbSecret += 2)
+    {
+        pbSecret[0] = static_cast<uint8_t>(pchSecret[i]);
+        pbSecret[1] = static_cast<uint8_t>(pchSecret[i] >> 8);
+    }
+
+    ChaCha20Poly1305Seal(pbKey, pRecord->Nonce, reinterpret_cast<const uint8_t*>(pRecord), c_cbRecordAad,
+                         pRecord->Secret, sizeof(pRecord->Secret), pRecord->Secret, pRecord->Tag);
+}
+
+bool SealedVaultStore(uint8_t *pb, size_t cb,
+                      const uint8_t *pbKey,
+                      const uint8_t *pbNonce,
+                      const char16_t *pchSid, size_t cchSid,
+                      uint32_t dwSecretVersion,
+                      const char16_t *pchSecret, size_t cchSecret)
+{
+    uint32_t cRecords = _RecordCount(pb, cb);
+    if (cRecords == 0 || !_IsStorableSid(pchSid, cchSid) || cchSecret >= c_cchVaultSecret)
+    {
+        return false;
+    }
+    SEALED_VAULT_RECORD *pRecord = _Probe(pb, cRecords, pchSid, cchSid);
+    if (pRecord == nullptr)
+    {
+        return false;
+    }
+
+    uint32_t dwGeneration = _Load32(reinterpret_cast<SEALED_VAULT_HEADER*>(pb)->Generation);
+    _Seal(pRecord, pbKey, pbNonce, dwGeneration, pchSid, cchSid, dwSecretVersion, pchSecret, cchSecret);
+    return true;
+}
+
+bool SealedVaultReseal(uint8_t *pb, size_t cb,
+                       const uint8_t *pbKey,
+                       uint32_t dwGeneration,
+                       const uint8_t *pbNonces)
+{
+    uint32_t cRecords = _RecordCount(pb, cb);
+    SEALED_VAULT_HEADER *pHeader = reinterpret_cast<SEALED_VAULT_HEADER*>(pb);
+    if (cRecords == 0 || dwGeneration <= _Load32(pHeader->Generation))
+    {
+        return false;
+    }
+
+    uint32_t dwOldGeneration = _Load32(pHeader->Generation);
+    SEALED_VAULT_RECORD *rgRecords = reinterpret_cast<SEALED_VAULT_RECORD*>(pb + sizeof(SEALED_VAULT_HEADER));
+    char16_t rgchSid[c_cchVaultSid];
+    char16_t rgchSecret[c_cchVaultSecret];
+    bool fResealed = true;
+    for (uint32_t i = 0; fResealed && i < cRecords; i++)
+    {
+        SEALED_VAULT_RECORD *pRecord = &rgRecords[i];
+        if (_Load64(pRecord->SidHash) == 0)
+        {
+            continue;
+        }
+        fResealed = SealedVaultOpen(pbKey, dwOldGeneration, *pRecord, rgchSecret);
+        if (fResealed)
+        {
+            size_t cchSid = 0;
+            while (cchSid < c_cchVaultSid - 1 && pRecord->Sid[cchSid] != 0)
+            {
+                rgchSid[cchSid] = pRecord->Sid[cchSid];
+                cchSid++;
+            }
+            size_t cchSecret = 0;
+            while (rgchSecret[cchSecret] != u'\0')
+            {
+                cchSecret++;
+            }
+            _Seal(pRecord, pbKey, pbNonces + static_cast<size_t>(i) * c_cbChaChaNonce, dwGeneration,
+                  rgchSid, cchSid, SealedVaultRecordVersion(*pRecord), rgchSecret, cchSecret);
+        }
+    }
+    _Wipe(rgchSecret, sizeof(rgchSecret));
+
+    if (fResealed)
+    {
+        _Store32(pHeader->Generation, dwGeneration);
+    }
+    return fResealed;
+}
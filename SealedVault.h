@@ -0,0 +1,106 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The platform-neutral layout of the sealed secret vault: a header followed by
+// a power-of-two table of fixed-size records, each holding one user's secret
+// sealed with ChaCha20-Poly1305. Records are placed by the hash of the user's
+// SID and found again by probing from there, so a lookup reads one hash, compares
+// one SID and decrypts one record. The vault's generation is sealed into every
+// record, so a copy of an older vault can be told apart from the current one.
+// All fields are little-endian byte arrays and secrets are UTF-16 held as
+// char16_t, so a vault written anywhere reads the same here.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ChaCha20Poly1305.h"
+
+// Characters in the secret field of a record, including the terminator.
+static const size_t c_cchVaultSecret = 256;
+
+// Characters in the SID field of a record, including the terminator. A SID
+// string is at most 184 characters.
+static const size_t c_cchVaultSid = 192;
+
+struct SEALED_VAULT_HEADER
+{
+    uint8_t     Magic[4];           // 'AIDV'
+    uint8_t     Layout[4];          // c_dwVaultLayout
+    uint8_t     cRecords[4];        // A power of two
+    uint8_t     Generation[4];      // Raised whenever the vault is written
+};
+
+// The fields up to Nonce are authenticated with the secret, so a record cannot be
+// moved to another user, given another version or put back into a later vault
+// without the tag failing.
+struct SEALED_VAULT_RECORD
+{
+    uint8_t     SidHash[8];                         // SealedVaultHashSid; zero if unused
+    uint8_t     SecretVersion[4];                   // Raised whenever the secret changes
+    uint8_t     Generation[4];                      // The vault's generation when sealed
+    uint8_t     Sid[c_cchVaultSid];                 // Upper-cased ASCII, padded with zeros
+    uint8_t     Nonce[c_cbChaChaNonce];
+    uint8_t     Tag[c_cbPoly1305Tag];
+    uint8_t     Secret[c_cchVaultSecret * 2];       // Terminated and padded with zeros, then sealed
+};
+
+static_assert(sizeof(SEALED_VAULT_HEADER) == 16, "Vault header layout");
+static_assert(sizeof(SEALED_VAULT_RECORD) == 748, "Vault record layout");
+
+// FNV-1a over the SID with ASCII letters upper-cased, since SIDs compare
+// case-insensitively. Never zero, which marks an unused record.
+uint64_t SealedVaultHashSid(const char16_t *pchSid, size_t cchSid);
+
+// Returns the size of a vault with cRecords records, or 0 if cRecords is not a
+// power of two.
+size_t SealedVaultSize(uint32_t cRecords);
+
+// Writes an empty vault of cRecords records and generation dwGeneration to pb,
+// which must be exactly the size returned above.
+bool SealedVaultInitialize(uint8_t *pb, size_t cb, uint32_t cRecords, uint32_t dwGeneration);
+
+// Returns whether pb holds a vault of this layout that is exactly cb bytes.
+bool SealedVaultIsValid(const uint8_t *pb, size_t cb);
+
+// Returns the generation of the vault in pb, or 0 if pb does not hold a vault.
+// The header is not authenticated; SealedVaultOpen checks each record against it.
+uint32_t SealedVaultGeneration(const uint8_t *pb, size_t cb);
+
+// Returns the record for the SID in the vault in pb, comparing the whole SID and
+// not just its hash, or nullptr if there is none or pb does not hold a vault.
+const SEALED_VAULT_RECORD *SealedVaultFind(const uint8_t *pb, size_t cb, const char16_t *pchSid, size_t cchSid);
+
+uint32_t SealedVaultRecordVersion(const SEALED_VAULT_RECORD &record);
+
+// Decrypts the secret in record into pch, which holds c_cchVaultSecret characters.
+// Returns false, leaving pch zeroed, if the record was not sealed with pbKey in a
+// vault of generation dwGeneration or was changed since, or the secret is not
+// terminated.
+bool SealedVaultOpen(const uint8_t *pbKey, uint32_t dwGeneration, const SEALED_VAULT_RECORD &record, char16_t *pch);
+
+// Seals cchSecret characters of pchSecret into the record for the SID, adding
+// one if there is none, at the vault's current generation. pbNonce must not have
+// been used with pbKey before. Returns false if the SID is not ASCII or too long,
+// the secret is too long or the vault is full.
+bool SealedVaultStore(uint8_t *pb, size_t cb,
+                      const uint8_t *pbKey,
+                      const uint8_t *pbNonce,
+                      const char16_t *pchSid, size_t cchSid,
+                      uint32_t dwSecretVersion,
+                      const char16_t *pchSecret, size_t cchSecret);
+
+// Raises the vault's generation to dwGeneration and seals every record again at
+// it, record i with the i-th c_cbChaChaNonce bytes of pbNonces, which holds one
+// unused nonce for each record. Returns false if dwGeneration is not above the
+// current one or a record does not open under pbKey, and the vault must then be
+// discarded.
+bool SealedVaultReseal(uint8_t *pb, size_t cb,
+                       const uint8_t *pbKey,
+                       uint32_t dwGeneration,
+                       const uint8_t *pbNonces);
@@ -0,0 +1,178 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The slot pages are small enough to stay within the default minimum working
+// set, so VirtualLock succeeds without raising the process quota.
+
+#include "SecretArena.h"
+#include <strsafe.h>
+
+CSecretArena &CSecretArena::Instance()
+{
+    static CSecretArena s_arena;
+    return s_arena;
+}
+
+CSecretArena::CSecretArena() :
+    _pbRegion(nullptr),
+    _pchSlots(nullptr),
+    _cbRegion(0),
+    _cbSlots(0),
+    _dwInUse(0),
+    _cPeakInUse(0),
+    _cCopies(0)
+{
+    InitializeSRWLock(&_lock);
+}
+
+CSecretArena::~CSecretArena()
+{
+    if (_pbRegion != nullptr)
+    {
+        SecureZeroMemory(_pchSlots, _cbSlots);
+        VirtualUnlock(_pchSlots, _cbSlots);
+        VirtualFree(_pbRegion, 0, MEM_RELEASE);
+    }
+}
+
+HRESULT CSecretArena::Allocate(_Outptr_result_buffer_(c_cchSecretSlot) PWSTR *ppsz)
+{
+    *ppsz = nullptr;
+
+    AcquireSRWLockExclusive(&_lock);
+    HRESULT hr = _EnsurePages();
+    if (SUCCEEDED(hr))
+    {
+        hr = E_OUTOFMEMORY;
+        for (DWORD i = 0; i < c_cSecretSlots; i++)
+        {
+            if ((_dwInUse & (1u << i)) == 0)
+            {
+                _dwInUse |= (1u << i);
+                *ppsz = _pchSlots + i * c_cchSecretSlot;
+                hr = S_OK;
+                break;
+            }
+        }
+
+        DWORD cInUse = 0;
+        for (DWORD dwBits = _dwInUse; dwBits != 0; dwBits &= dwBits - 1)
+        {
+            cInUse++;
+        }
+        if (cInUse > _cPeakInUse)
+        {
+            _cPeakInUse = cInUse;
+        }
+    }
+    ReleaseSRWLockExclusive(&_lock);
+    return hr;
+}
+
+void CSecretArena::Free(_In_opt_ PWSTR psz)
+{
+    if (psz != nullptr)
+    {
+        AcquireSRWLockExclusive(&_lock);
+        // Compare addresses as integers, since psz may not point into the slots at all.
+        ULONG_PTR ulpSlots = reinterpret_cast<ULONG_PTR>(_pchSlots);
+        ULONG_PTR ulpSlot = reinterpret_cast<ULONG_PTR>(psz);
+        ULONG_PTR cbOffset = ulpSlot - ulpSlots;
+        DWORD iSlot = static_cast<DWORD>(cbOffset / (c_cchSecretSlot * sizeof(WCHAR)));
+        if (_pchSlots == nullptr || ulpSlot < ulpSlots ||
+            cbOffset >= c_cSecretSlots * c_cchSecretSlot * sizeof(WCHAR) ||
+            (cbOffset % (c_cchSecretSlot * sizeof(WCHAR))) != 0 ||
+            (_dwInUse & (1u << iSlot)) == 0)
+        {
+            __fastfail(FAST_FAIL_INVALID_ARG);
+        }
+
+        SecureZeroMemory(psz, c_cchSecretSlot * sizeof(WCHAR));
+        _dwInUse &= ~(1u << iSlot);
+        ReleaseSRWLockExclusive(&_lock);
+    }
+}
+
+HRESULT CSecretArena::CopyInto(_Out_writes_(c_cchSecretSlot) PWSTR pszSlot, _In_ PCWSTR pszSecret)
+{
+    HRESULT hr = StringCchCopyW(pszSlot, c_cchSecretSlot, pszSecret);
+    if (SUCCEEDED(hr))
+    {
+        RecordCopy();
+    }
+    else
+    {
+        SecureZeroMemory(pszSlot, c_cchSecretSlot * sizeof(WCHAR));
+    }
+    return hr;
+}
+
+void CSecretArena::RecordCopy()
+{
+    InterlockedIncrement64(&_cCopies);
+}
+
+void CSecretArena::GetStats(_Out_ SECRET_ARENA_STATS *pStats)
+{
+    pStats->cSlots = c_cSecretSlots;
+    pStats->cCopies = static_cast<ULONGLONG>(ReadAcquire64(&_cCopies));
+
+    AcquireSRWLockShared(&_lock);
+    pStats->cInUse = 0;
+    for (DWORD dwBits = _dwInUse; dwBits != 0; dwBits &= dwBits - 1)
+    {
+        pStats->cInUse++;
+    }
+    pStats->cPeakInUse = _cPeakInUse;
+    ReleaseSRWLockShared(&_lock);
+}
+
+// Reserves the guard pages and the slot pages between them, and locks the slot
+// pages. _lock must be held exclusively.
+HRESULT CSecretArena::_EnsurePages()
+{
+    if (_pbRegion != nullptr)
+    {
+        return S_OK;
+    }
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    SIZE_T cbPage = si.dwPageSize;
+    SIZE_T cbSlots = ((c_cSecretSlots * c_cchSecretSlot * sizeof(WCHAR)) + cbPage - 1) / cbPage * cbPage;
+    SIZE_T cbRegion = cbPage + cbSlots + cbPage;
+
+    HRESULT hr = S_OK;
+    BYTE *pbRegion = static_cast<BYTE*>(VirtualAlloc(nullptr, cbRegion, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    if (pbRegion == nullptr)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    DWORD dwOldProtect;
+    if (!VirtualProtect(pbRegion, cbPage, PAGE_NOACCESS, &dwOldProtect) ||
+        !VirtualProtect(pbRegion + cbPage + cbSlots, cbPage, PAGE_NOACCESS, &dwOldProtect) ||
+        !VirtualLock(pbRegion + cbPage, cbSlots))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        if (SUCCEEDED(hr))
+        {
+            hr = E_FAIL;
+        }
+        VirtualFree(pbRegion, 0, MEM_RELEASE);
+        OutputDebugStringW(L"Secret arena: The slot pages could not be guarded and locked.\n");
+    }
+    else
+    {
+        _pbRegion = pbRegion;
+        _pchSlots = reinterpret_cast<WCHAR*>(pbRegion + cbPage);
+        _cbRegion = cbRegion;
+        _cbSlots = cbSlots;
+    }
+    return hr;
+}
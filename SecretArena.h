@@ -0,0 +1,74 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CSecretArena holds passwords and other secrets in a few pages that are locked
+// into memory, so they are never written to the page file, with an inaccessible
+// guard page on either side to catch overruns. It hands out fixed-size slots and
+// zeroes each one as it is freed. It also counts every copy made of a secret, so
+// the number of copies one unlock makes can be reported.
+
+#pragma once
+
+#include <windows.h>
+
+// Characters in one slot, including the terminator. Large enough for a password
+// and its CredProtect form.
+static const DWORD c_cchSecretSlot = 512;
+
+// Slots in the arena. The slot bitmap is one DWORD.
+static const DWORD c_cSecretSlots = 16;
+
+struct SECRET_ARENA_STATS
+{
+    DWORD       cSlots;             // Slots in the arena
+    DWORD       cInUse;             // Slots currently handed out
+    DWORD       cPeakInUse;         // Most slots ever in use at once
+    ULONGLONG   cCopies;            // Secret copies recorded since the arena was created
+};
+
+class CSecretArena
+{
+public:
+    static CSecretArena &Instance();
+
+    // Returns a zeroed slot of c_cchSecretSlot characters. The pages are set up on
+    // first use; fails if they cannot be locked.
+    HRESULT Allocate(_Outptr_result_buffer_(c_cchSecretSlot) PWSTR *ppsz);
+
+    // Zeroes the slot and makes it available again. psz must be a slot Allocate
+    // returned and that is still in use; anything else ends the process, since
+    // zeroing it would corrupt memory.
+    void Free(_In_opt_ PWSTR psz);
+
+    // Copies the terminated secret pszSecret into the slot pszSlot.
+    HRESULT CopyInto(_Out_writes_(c_cchSecretSlot) PWSTR pszSlot, _In_ PCWSTR pszSecret);
+
+    // Counts a copy of a secret made outside the arena, such as into a logon buffer.
+    void RecordCopy();
+
+    // Reads the counters without changing them; callers that report the copies
+    // for one unlock subtract an earlier count.
+    void GetStats(_Out_ SECRET_ARENA_STATS *pStats);
+
+private:
+    CSecretArena();
+    ~CSecretArena();
+    CSecretArena(const CSecretArena &);
+    CSecretArena &operator=(const CSecretArena &);
+
+    HRESULT _EnsurePages();
+
+    SRWLOCK             _lock;              // Guards the pages and the slot bitmap
+    BYTE                *_pbRegion;         // Guard page, slot pages, guard page
+    WCHAR               *_pchSlots;         // The first slot, just after the leading guard page
+    SIZE_T              _cbRegion;
+    SIZE_T              _cbSlots;
+    DWORD               _dwInUse;           // Bit per slot
+    DWORD               _cPeakInUse;
+    volatile LONG64     _cCopies;
+};
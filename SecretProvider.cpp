@@ -0,0 +1,272 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The vault key is kept next to the vault, sealed to the machine with DPAPI, and
+// is unsealed into the secret arena when the vault is mapped. The vault file is
+// only ever replaced whole, so a mapped view stays consistent until Refresh maps
+// the new one, and is only mapped if its generation is at least the one the
+// admin tool last recorded in the registry. SealedVault does the parsing and
+// decryption.
+
+#include <windows.h>
+#include "SecretProvider.h"
+#include "SealedKey.h"
+#include "SealedVault.h"
+
+static const WCHAR c_szSettingsKey[] = L"SOFTWARE\\AbsoluteID";
+
+static_assert(sizeof(WCHAR) == sizeof(char16_t), "Vault secrets are decrypted straight into arena slots");
+static_assert(c_cchVaultSecret <= c_cchSecretSlot, "A vault secret must fit in an arena slot");
+static_assert(c_cbChaChaKey <= c_cchSecretSlot * sizeof(WCHAR), "The vault key must fit in an arena slot");
+
+// Unseals the vault key into pbKey, which holds c_cbChaChaKey bytes.
+static HRESULT _LoadKey(_Out_writes_bytes_(c_cbChaChaKey) BYTE *pbKey)
+{
+    HRESULT hr = SealedKeyLoad(c_szVaultKeyFile, pbKey, c_cbChaChaKey);
+    if (SUCCEEDED(hr))
+    {
+        CSecretArena::Instance().RecordCopy();
+    }
+    return hr;
+}
+
+// Returns the lowest vault generation to accept; 0 if the admin tool never wrote one.
+static DWORD _GenerationFloor()
+{
+    DWORD dwGeneration = 0;
+    DWORD cbData = sizeof(dwGeneration);
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, c_szSettingsKey, c_szVaultGenerationValue, RRF_RT_REG_DWORD, nullptr, &dwGeneration, &cbData) != ERROR_SUCCESS)
+    {
+        dwGeneration = 0;
+    }
+    return dwGeneration;
+}
+
+CVaultSecretProvider::CVaultSecretProvider() :
+    _hMapping(nullptr),
+    _pbVault(nullptr),
+    _cbVault(0),
+    _dwGeneration(0),
+    _pbKey(nullptr),
+    _cLookups(0),
+    _cDecrypts(0),
+    _cOpens(0)
+{
+    InitializeSRWLock(&_lock);
+
+    // The key lives in the arena, so the arena must be destroyed after the provider.
+    CSecretArena::Instance();
+}
+
+CVaultSecretProvider::~CVaultSecretProvider()
+{
+    _Close();
+}
+
+CVaultSecretProvider &CVaultSecretProvider::Instance()
+{
+    static CVaultSecretProvider s_provider;
+    return s_provider;
+}
+
+HRESULT CVaultSecretProvider::GetSecretVersion(_In_opt_ PCWSTR pszSid, _Out_ DWORD *pdwVersion)
+{
+    *pdwVersion = 0;
+    InterlockedIncrement64(&_cLookups);
+    if (pszSid == nullptr)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+    }
+
+    HRESULT hr = _AcquireOpen();
+    if (SUCCEEDED(hr))
+    {
+        const SEALED_VAULT_RECORD *pRecord = SealedVaultFind(_pbVault, _cbVault, reinterpret_cast<const char16_t*>(pszSid), wcslen(pszSid));
+        if (pRecord != nullptr)
+        {
+            *pdwVersion = SealedVaultRecordVersion(*pRecord);
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        }
+        ReleaseSRWLockShared(&_lock);
+    }
+    return hr;
+}
+
+HRESULT CVaultSecretProvider::GetSecret(_In_opt_ PCWSTR pszSid,
+                                        _Out_writes_(c_cchSecretSlot) PWSTR pszSecret,
+                                        _Out_ DWORD *pdwVersion)
+{
+    *pdwVersion = 0;
+    InterlockedIncrement64(&_cLookups);
+    if (pszSid == nullptr)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+    }
+
+    HRESULT hr = _AcquireOpen();
+    if (SUCCEEDED(hr))
+    {
+        const SEALED_VAULT_RECORD *pRecord = SealedVaultFind(_pbVault, _cbVault, reinterpret_cast<const char16_t*>(pszSid), wcslen(pszSid));
+        if (pRecord == nullptr)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        }
+        else
+        {
+            InterlockedIncrement64(&_cDecrypts);
+            if (SealedVaultOpen(_pbKey, _dwGeneration, *pRecord, reinterpret_cast<char16_t*>(pszSecret)))
+            {
+                *pdwVersion = SealedVaultRecordVersion(*pRecord);
+                CSecretArena::Instance().RecordCopy();
+            }
+            else
+            {
+                // Sealed with another key or in another generation, or changed since it was sealed.
+                hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                OutputDebugStringW(L"Secret vault: A record failed authentication.\n");
+            }
+        }
+        ReleaseSRWLockShared(&_lock);
+    }
+    return hr;
+}
+
+void CVaultSecretProvider::Refresh()
+{
+    AcquireSRWLockExclusive(&_lock);
+    _Close();
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+void CVaultSecretProvider::GetStats(_Out_ SECRET_PROVIDER_STATS *pStats)
+{
+    pStats->cLookups = static_cast<ULONGLONG>(_cLookups);
+    pStats->cDecrypts = static_cast<ULONGLONG>(_cDecrypts);
+    pStats->cOpens = static_cast<ULONGLONG>(_cOpens);
+}
+
+// Returns with _lock held shared and the vault mapped, mapping it first if needed.
+HRESULT CVaultSecretProvider::_AcquireOpen()
+{
+    for (;;)
+    {
+        AcquireSRWLockShared(&_lock);
+        if (_pbVault != nullptr)
+        {
+            return S_OK;
+        }
+        ReleaseSRWLockShared(&_lock);
+
+        AcquireSRWLockExclusive(&_lock);
+        HRESULT hr = (_pbVault != nullptr) ? S_OK : _Open();
+        ReleaseSRWLockExclusive(&_lock);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+}
+
+// Unseals the key and maps the vault read-only. _lock must be held exclusively.
+HRESULT CVaultSecretProvider::_Open()
+{
+    InterlockedIncrement64(&_cOpens);
+
+    PWSTR pszKeySlot = nullptr;
+    HRESULT hr = CSecretArena::Instance().Allocate(&pszKeySlot);
+    if (SUCCEEDED(hr))
+    {
+        _pbKey = reinterpret_cast<BYTE*>(pszKeySlot);
+        hr = _LoadKey(_pbKey);
+    }
+
+    WCHAR szPath[MAX_PATH];
+    if (SUCCEEDED(hr))
+    {
+        hr = SealedKeyGetPath(c_szVaultFile, szPath, ARRAYSIZE(szPath));
+    }
+
+    // Sharing delete lets the vault be replaced by a rename while it is mapped.
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    LARGE_INTEGER liSize = {};
+    if (SUCCEEDED(hr))
+    {
+        hFile = CreateFileW(szPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &liSize))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    if (SUCCEEDED(hr))
+    {
+        _hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (_hMapping == nullptr)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        _pbVault = static_cast<const BYTE*>(MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (_pbVault == nullptr)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    if (SUCCEEDED(hr))
+    {
+        _cbVault = static_cast<SIZE_T>(liSize.QuadPart);
+        if (!SealedVaultIsValid(_pbVault, _cbVault))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+    }
+    if (SUCCEEDED(hr))
+    {
+        _dwGeneration = SealedVaultGeneration(_pbVault, _cbVault);
+        if (_dwGeneration < _GenerationFloor())
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            OutputDebugStringW(L"Secret vault: The vault is older than the last one written.\n");
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        _Close();
+        OutputDebugStringW(L"Secret vault: The vault could not be opened.\n");
+    }
+    return hr;
+}
+
+// Unmaps the vault and zeroes the key. _lock must be held exclusively.
+void CVaultSecretProvider::_Close()
+{
+    if (_pbVault != nullptr)
+    {
+        UnmapViewOfFile(_pbVault);
+        _pbVault = nullptr;
+        _cbVault = 0;
+        _dwGeneration = 0;
+    }
+    if (_hMapping != nullptr)
+    {
+        CloseHandle(_hMapping);
+        _hMapping = nullptr;
+    }
+    CSecretArena::Instance().Free(reinterpret_cast<PWSTR>(_pbKey));
+    _pbKey = nullptr;
+}
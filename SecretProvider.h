@@ -0,0 +1,86 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// ISecretProvider supplies each user's password and the version of it, which
+// the serialization and protected secret caches are keyed by. CVaultSecretProvider
+// reads them from a sealed vault file that is mapped into memory: finding a user
+// costs one hash, and only reading the password itself decrypts anything.
+
+#pragma once
+
+#include <windows.h>
+#include "SecretArena.h"
+
+// Names of the vault and its key in the AbsoluteID directory under %ProgramData%.
+static const WCHAR c_szVaultFile[] = L"SecretVault.dat";
+static const WCHAR c_szVaultKeyFile[] = L"SecretVault.key";
+
+// The registry value under HKLM\SOFTWARE\AbsoluteID holding the generation of the
+// last vault the admin tool wrote. A vault of a lower generation is refused, so an
+// old copy of the file cannot bring back a password that has since changed.
+static const WCHAR c_szVaultGenerationValue[] = L"VaultGeneration";
+
+class ISecretProvider
+{
+public:
+    // Sets *pdwVersion to the version of the user's secret without reading the
+    // secret. Fails with HRESULT_FROM_WIN32(ERROR_NOT_FOUND) if there is none.
+    virtual HRESULT GetSecretVersion(_In_opt_ PCWSTR pszSid, _Out_ DWORD *pdwVersion) = 0;
+
+    // Copies the user's secret into the arena slot pszSecret and sets *pdwVersion
+    // to its version.
+    virtual HRESULT GetSecret(_In_opt_ PCWSTR pszSid,
+                              _Out_writes_(c_cchSecretSlot) PWSTR pszSecret,
+                              _Out_ DWORD *pdwVersion) = 0;
+
+    // Drops what the provider has read, so that a secret changed since is seen.
+    virtual void Refresh() = 0;
+};
+
+struct SECRET_PROVIDER_STATS
+{
+    ULONGLONG   cLookups;       // Calls to GetSecretVersion and GetSecret
+    ULONGLONG   cDecrypts;      // Calls that decrypted a secret
+    ULONGLONG   cOpens;         // Times the vault was mapped
+};
+
+class CVaultSecretProvider : public ISecretProvider
+{
+public:
+    CVaultSecretProvider();
+    ~CVaultSecretProvider();
+
+    // The provider GetSerialization uses, reading the vault under %ProgramData%.
+    static CVaultSecretProvider &Instance();
+
+    HRESULT GetSecretVersion(_In_opt_ PCWSTR pszSid, _Out_ DWORD *pdwVersion);
+    HRESULT GetSecret(_In_opt_ PCWSTR pszSid,
+                      _Out_writes_(c_cchSecretSlot) PWSTR pszSecret,
+                      _Out_ DWORD *pdwVersion);
+    void Refresh();
+
+    void GetStats(_Out_ SECRET_PROVIDER_STATS *pStats);
+
+private:
+    CVaultSecretProvider(const CVaultSecretProvider &);
+    CVaultSecretProvider &operator=(const CVaultSecretProvider &);
+
+    HRESULT _AcquireOpen();
+    HRESULT _Open();
+    void _Close();
+
+    SRWLOCK             _lock;          // Shared while the vault is read, exclusive to map or unmap it
+    HANDLE              _hMapping;
+    const BYTE          *_pbVault;      // Read-only view of the whole vault file
+    SIZE_T              _cbVault;
+    DWORD               _dwGeneration;  // Of the mapped vault, at or above the registry's
+    BYTE                *_pbKey;        // Vault key, in a secret arena slot
+    volatile LONGLONG   _cLookups;
+    volatile LONGLONG   _cDecrypts;
+    volatile LONGLONG   _cOpens;
+};
@@ -0,0 +1,182 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Per-user logon buffer cache. Lookups copy out under the lock, so a buffer is
+// never freed while it is being copied, and allocate nothing but the copy.
+
+#include "SerializationCache.h"
+#include "SecretArena.h"
+
+CSerializationCache &CSerializationCache::Instance()
+{
+    static CSerializationCache s_cache;
+    return s_cache;
+}
+
+CSerializationCache::CSerializationCache() :
+    _cHits(0),
+    _cMisses(0)
+{
+    InitializeSRWLock(&_lock);
+}
+
+CSerializationCache::~CSerializationCache()
+{
+    InvalidateAll();
+}
+
+HRESULT CSerializationCache::Lookup(_In_opt_ PCWSTR pszSid,
+                                    CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                                    DWORD dwSecretVersion,
+                                    _Out_ CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION *pcpcs)
+{
+    ZeroMemory(pcpcs, sizeof(*pcpcs));
+    HRESULT hr = S_FALSE;
+    if (pszSid == nullptr)
+    {
+        InterlockedIncrement64(&_cMisses);
+        return hr;
+    }
+    ULONGLONG ullKey = _HashSid(pszSid);
+
+    AcquireSRWLockExclusive(&_lock);
+    auto it = _mapEntries.find(ullKey);
+    if (it != _mapEntries.end() && _wcsicmp(it->second.strSid.c_str(), pszSid) == 0)
+    {
+        ENTRY &entry = it->second;
+        if (entry.cpus == cpus && entry.dwSecretVersion == dwSecretVersion)
+        {
+            pcpcs->rgbSerialization = static_cast<BYTE*>(CoTaskMemAlloc(entry.cbSerialization));
+            if (pcpcs->rgbSerialization != nullptr)
+            {
+                CopyMemory(pcpcs->rgbSerialization, entry.pbSerialization, entry.cbSerialization);
+                CSecretArena::Instance().RecordCopy();
+                pcpcs->cbSerialization = entry.cbSerialization;
+                pcpcs->ulAuthenticationPackage = entry.ulAuthenticationPackage;
+                hr = S_OK;
+            }
+            else
+            {
+                hr = E_OUTOFMEMORY;
+            }
+        }
+        else
+        {
+            // Packed for another scenario or an old secret; it can never be served.
+            _FreeEntry(&entry);
+            _mapEntries.erase(it);
+        }
+    }
+    ReleaseSRWLockExclusive(&_lock);
+
+    InterlockedIncrement64((hr == S_OK) ? &_cHits : &_cMisses);
+    return hr;
+}
+
+HRESULT CSerializationCache::Store(_In_opt_ PCWSTR pszSid,
+                                   CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                                   DWORD dwSecretVersion,
+                                   const CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION &cpcs)
+{
+    if (pszSid == nullptr)
+    {
+        return S_FALSE;
+    }
+
+    ENTRY entry;
+    entry.strSid.assign(pszSid);
+    entry.cpus = cpus;
+    entry.dwSecretVersion = dwSecretVersion;
+    entry.ulAuthenticationPackage = cpcs.ulAuthenticationPackage;
+    entry.cbSerialization = cpcs.cbSerialization;
+    entry.pbSerialization = static_cast<BYTE*>(HeapAlloc(GetProcessHeap(), 0, cpcs.cbSerialization));
+    if (entry.pbSerialization == nullptr)
+    {
+        return E_OUTOFMEMORY;
+    }
+    CopyMemory(entry.pbSerialization, cpcs.rgbSerialization, cpcs.cbSerialization);
+    CSecretArena::Instance().RecordCopy();
+
+    // A SID whose hash collides with another's simply takes over the slot.
+    ULONGLONG ullKey = _HashSid(pszSid);
+    AcquireSRWLockExclusive(&_lock);
+    auto it = _mapEntries.find(ullKey);
+    if (it != _mapEntries.end())
+    {
+        _FreeEntry(&it->second);
+        it->second = std::move(entry);
+    }
+    else
+    {
+        _mapEntries.emplace(ullKey, std::move(entry));
+    }
+    ReleaseSRWLockExclusive(&_lock);
+    return S_OK;
+}
+
+void CSerializationCache::Invalidate(_In_opt_ PCWSTR pszSid)
+{
+    if (pszSid == nullptr)
+    {
+        return;
+    }
+
+    ULONGLONG ullKey = _HashSid(pszSid);
+    AcquireSRWLockExclusive(&_lock);
+    auto it = _mapEntries.find(ullKey);
+    if (it != _mapEntries.end() && _wcsicmp(it->second.strSid.c_str(), pszSid) == 0)
+    {
+        _FreeEntry(&it->second);
+        _mapEntries.erase(it);
+    }
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+void CSerializationCache::InvalidateAll()
+{
+    AcquireSRWLockExclusive(&_lock);
+    for (auto &pair : _mapEntries)
+    {
+        _FreeEntry(&pair.second);
+    }
+    _mapEntries.clear();
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+void CSerializationCache::GetStats(_Out_ SERIALIZATION_CACHE_STATS *pStats)
+{
+    pStats->cHits = static_cast<ULONGLONG>(_cHits);
+    pStats->cMisses = static_cast<ULONGLONG>(_cMisses);
+
+    AcquireSRWLockShared(&_lock);
+    pStats->cEntries = static_cast<DWORD>(_mapEntries.size());
+    ReleaseSRWLockShared(&_lock);
+}
+
+// FNV-1a over the upper-case SID, since SIDs are compared case-insensitively.
+ULONGLONG CSerializationCache::_HashSid(_In_ PCWSTR pszSid)
+{
+    ULONGLONG ullHash = 14695981039346656037ULL;
+    for (PCWSTR pch = pszSid; *pch != L'\0'; pch++)
+    {
+        WCHAR ch = (*pch >= L'a' && *pch <= L'z') ? static_cast<WCHAR>(*pch - L'a' + L'A') : *pch;
+        ullHash = (ullHash ^ ch) * 1099511628211ULL;
+    }
+    return ullHash;
+}
+
+void CSerializationCache::_FreeEntry(_Inout_ ENTRY *pEntry)
+{
+    if (pEntry->pbSerialization != nullptr)
+    {
+        SecureZeroMemory(pEntry->pbSerialization, pEntry->cbSerialization);
+        HeapFree(GetProcessHeap(), 0, pEntry->pbSerialization);
+        pEntry->pbSerialization = nullptr;
+        pEntry->cbSerialization = 0;
+    }
+}
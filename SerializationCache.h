@@ -0,0 +1,76 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CSerializationCache holds the packed logon buffer of each user, so that the
+// buffer can be built in the background as soon as the phone approves and
+// GetSerialization only has to copy it. An entry is only served for the usage
+// scenario and secret version it was packed for. The buffers hold the password,
+// so they are zeroed whenever an entry is dropped.
+
+#pragma once
+
+#include <windows.h>
+#include <credentialprovider.h>
+#include <string>
+#include <unordered_map>
+
+struct SERIALIZATION_CACHE_STATS
+{
+    ULONGLONG   cHits;
+    ULONGLONG   cMisses;
+    DWORD       cEntries;
+};
+
+class CSerializationCache
+{
+public:
+    static CSerializationCache &Instance();
+
+    // Copies the user's buffer into a new CoTaskMem allocation in pcpcs. Returns
+    // S_FALSE on a miss, dropping an entry made for another scenario or version.
+    // A tile without a SID is never cached.
+    HRESULT Lookup(_In_opt_ PCWSTR pszSid,
+                   CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                   DWORD dwSecretVersion,
+                   _Out_ CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION *pcpcs);
+
+    // Stores a copy of the buffer in pcpcs as the user's entry.
+    HRESULT Store(_In_opt_ PCWSTR pszSid,
+                  CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                  DWORD dwSecretVersion,
+                  const CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION &cpcs);
+
+    void Invalidate(_In_opt_ PCWSTR pszSid);
+    void InvalidateAll();
+
+    void GetStats(_Out_ SERIALIZATION_CACHE_STATS *pStats);
+
+private:
+    CSerializationCache();
+    ~CSerializationCache();
+    CSerializationCache(const CSerializationCache &);
+    CSerializationCache &operator=(const CSerializationCache &);
+
+    struct ENTRY
+    {
+        std::wstring                        strSid;             // Confirms a hash match
+        CREDENTIAL_PROVIDER_USAGE_SCENARIO  cpus;
+        DWORD                               dwSecretVersion;
+        ULONG                               ulAuthenticationPackage;
+        BYTE                                *pbSerialization;   // From the process heap
+        DWORD                               cbSerialization;
+    };
+
+    static ULONGLONG _HashSid(_In_ PCWSTR pszSid);
+    static void _FreeEntry(_Inout_ ENTRY *pEntry);
+
+    SRWLOCK                                     _lock;
+    std::unordered_map<ULONGLONG, ENTRY>        _mapEntries;    // SID hash to entry, so lookups do not allocate
+    volatile LONGLONG                           _cHits;
+    volatile LONGLONG                           _cMisses;
+};
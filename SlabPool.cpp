@@ -0,0 +1,125 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Fixed-size block pool backed by slabs from the process heap.
+
+#include <windows.h>
+#include "SlabPool.h"
+
+// Each slab starts with a header that links it to the next slab. The header is
+// padded so that every block stays MEMORY_ALLOCATION_ALIGNMENT aligned, which
+// InterlockedPushEntrySList requires.
+struct SLAB_HEADER
+{
+    SLAB_HEADER *pNext;
+};
+
+static const SIZE_T c_cbSlabHeader = (sizeof(SLAB_HEADER) + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~(SIZE_T)(MEMORY_ALLOCATION_ALIGNMENT - 1);
+
+CSlabPool::CSlabPool(SIZE_T cbSlot, DWORD cSlotsPerSlab) :
+    _pSlabs(nullptr),
+    _cSlotsPerSlab(cSlotsPerSlab),
+    _cSlabs(0),
+    _cInUse(0),
+    _cAllocations(0)
+{
+    if (cbSlot < sizeof(SLIST_ENTRY))
+    {
+        cbSlot = sizeof(SLIST_ENTRY);
+    }
+    _cbSlot = (cbSlot + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~(SIZE_T)(MEMORY_ALLOCATION_ALIGNMENT - 1);
+
+    InitializeSListHead(&_freeList);
+    InitializeSRWLock(&_lockGrow);
+}
+
+// The pool is only destroyed when the DLL unloads, at which point DllCanUnloadNow
+// has guaranteed that no block is still in use.
+CSlabPool::~CSlabPool()
+{
+    SLAB_HEADER *pSlab = static_cast<SLAB_HEADER*>(_pSlabs);
+    while (pSlab != nullptr)
+    {
+        SLAB_HEADER *pNext = pSlab->pNext;
+        HeapFree(GetProcessHeap(), 0, pSlab);
+        pSlab = pNext;
+    }
+}
+
+void *CSlabPool::Allocate(SIZE_T cb)
+{
+    if (cb > _cbSlot)
+    {
+        return nullptr;
+    }
+
+    PSLIST_ENTRY pEntry = InterlockedPopEntrySList(&_freeList);
+    while (pEntry == nullptr)
+    {
+        if (!_Grow())
+        {
+            return nullptr;
+        }
+        pEntry = InterlockedPopEntrySList(&_freeList);
+    }
+
+    InterlockedIncrement(&_cInUse);
+    InterlockedIncrement64(&_cAllocations);
+    return pEntry;
+}
+
+void CSlabPool::Free(_In_opt_ void *pv)
+{
+    if (pv != nullptr)
+    {
+        InterlockedDecrement(&_cInUse);
+        InterlockedPushEntrySList(&_freeList, static_cast<PSLIST_ENTRY>(pv));
+    }
+}
+
+void CSlabPool::GetStats(_Out_ SLAB_POOL_STATS *pStats) const
+{
+    pStats->cbSlot = static_cast<DWORD>(_cbSlot);
+    pStats->cSlabs = _cSlabs;
+    pStats->cInUse = _cInUse;
+    pStats->cAllocations = _cAllocations;
+    pStats->cHeapAllocations = _cSlabs;
+}
+
+// Allocates one more slab and puts all of its blocks on the free list. If another
+// thread grew the pool while we waited for the lock, there is nothing to do.
+bool CSlabPool::_Grow()
+{
+    bool fGrown = false;
+    AcquireSRWLockExclusive(&_lockGrow);
+
+    if (QueryDepthSList(&_freeList) > 0)
+    {
+        fGrown = true;
+    }
+    else
+    {
+        SLAB_HEADER *pSlab = static_cast<SLAB_HEADER*>(HeapAlloc(GetProcessHeap(), 0, c_cbSlabHeader + _cbSlot * _cSlotsPerSlab));
+        if (pSlab != nullptr)
+        {
+            pSlab->pNext = static_cast<SLAB_HEADER*>(_pSlabs);
+            _pSlabs = pSlab;
+            InterlockedIncrement(&_cSlabs);
+
+            BYTE *pbSlot = reinterpret_cast<BYTE*>(pSlab) + c_cbSlabHeader;
+            for (DWORD i = 0; i < _cSlotsPerSlab; i++)
+            {
+                InterlockedPushEntrySList(&_freeList, reinterpret_cast<PSLIST_ENTRY>(pbSlot + i * _cbSlot));
+            }
+            fGrown = true;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&_lockGrow);
+    return fGrown;
+}
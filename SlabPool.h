@@ -0,0 +1,53 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CSlabPool hands out fixed-size blocks carved from large slabs. Freed blocks
+// go on a lock-free list and are handed out again before a new slab is
+// allocated, so objects that are created and destroyed on every enumeration
+// stop costing a heap allocation each time.
+
+#pragma once
+
+#include <windows.h>
+
+struct SLAB_POOL_STATS
+{
+    DWORD       cbSlot;             // Size of one block
+    DWORD       cSlabs;             // Slabs allocated from the process heap
+    DWORD       cInUse;             // Blocks currently handed out
+    ULONGLONG   cAllocations;       // Total Allocate calls that succeeded
+    ULONGLONG   cHeapAllocations;   // Heap allocations made by the pool, one per slab
+};
+
+class CSlabPool
+{
+public:
+    CSlabPool(SIZE_T cbSlot, DWORD cSlotsPerSlab);
+    ~CSlabPool();
+
+    // Returns nullptr if cb is larger than the slot size or the heap is exhausted.
+    void *Allocate(SIZE_T cb);
+    void Free(_In_opt_ void *pv);
+
+    void GetStats(_Out_ SLAB_POOL_STATS *pStats) const;
+
+private:
+    CSlabPool(const CSlabPool &);
+    CSlabPool &operator=(const CSlabPool &);
+
+    bool _Grow();
+
+    SLIST_HEADER            _freeList;          // Free blocks, reused most-recently-freed first
+    SRWLOCK                 _lockGrow;          // Serializes slab allocation and guards _pSlabs
+    void                    *_pSlabs;           // Singly linked list of slabs, for cleanup
+    SIZE_T                  _cbSlot;
+    DWORD                   _cSlotsPerSlab;
+    volatile LONG           _cSlabs;
+    volatile LONG           _cInUse;
+    volatile LONG64         _cAllocations;
+};
@@ -0,0 +1,224 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CSnapshotCell holds a value of type T that any thread reads without blocking
+// and writers replace, one at a time, by publishing an updated copy, RCU style.
+// Neither readers nor writers ever wait for each other. Replaced copies are
+// dropped later, by Reclaim, on the thread that calls it, so whatever a value
+// holds is only ever released on that thread.
+//
+// Readers register in the reader count of the current epoch, load the current
+// pointer, take a reference and leave; a reader that registers under an epoch
+// that has since ended registers again. The epoch only moves on once the count
+// of the epoch before it has drained, so two moves after a copy was replaced no
+// reader can still be about to take a reference to it, and the reference it held
+// for being current can be dropped.
+//
+// T must be copyable and provide OnPublish, called under the writer lock when a
+// copy is made current, and OnReclaim, called by Reclaim before the copy is
+// deleted. The initial, default-constructed value is never passed to either.
+
+#pragma once
+
+#include <windows.h>
+#include <new>
+
+template <typename T>
+class CSnapshotCell
+{
+public:
+    CSnapshotCell() :
+        _pCurrent(&_initial),
+        _initial(this, T(), 2),
+        _lEpoch(0),
+        _pRetiredHead(nullptr),
+        _pRetiredTail(nullptr)
+    {
+        // _initial has one reference for being current, and one that is never released.
+        _rgcReaders[0] = 0;
+        _rgcReaders[1] = 0;
+        InitializeSListHead(&_freed);
+        InitializeSRWLock(&_lockWriters);
+    }
+
+    // No thread may still be reading or writing the cell.
+    ~CSnapshotCell()
+    {
+        while (_pRetiredHead != nullptr)
+        {
+            SNAPSHOT *pSnapshot = _pRetiredHead;
+            _pRetiredHead = pSnapshot->pNextRetired;
+            _ReleaseSnapshot(pSnapshot);
+        }
+        _ReleaseSnapshot(_pCurrent);
+        _DeleteFreed();
+    }
+
+    // Returns a reference to the current value without blocking. Never nullptr.
+    const T *Acquire()
+    {
+        for (;;)
+        {
+            LONG lEpoch = ReadAcquire(&_lEpoch);
+            volatile LONG *pcReaders = &_rgcReaders[lEpoch & 1];
+            InterlockedIncrement(pcReaders);
+            if (ReadAcquire(&_lEpoch) == lEpoch)
+            {
+                SNAPSHOT *pSnapshot = static_cast<SNAPSHOT*>(ReadPointerAcquire(reinterpret_cast<PVOID const volatile *>(&_pCurrent)));
+                InterlockedIncrement(&pSnapshot->cRef);
+                InterlockedDecrement(pcReaders);
+                return pSnapshot;
+            }
+            InterlockedDecrement(pcReaders);
+        }
+    }
+
+    // Drops a reference from Acquire, on any thread. The value is deleted by a later Reclaim.
+    static void Release(_In_ const T *pValue)
+    {
+        _ReleaseSnapshot(static_cast<SNAPSHOT*>(const_cast<T*>(pValue)));
+    }
+
+    // Copies the current value, lets update change the copy and publishes it.
+    // Writers are serialized with each other but never block readers.
+    template <typename TUpdate>
+    HRESULT Update(TUpdate update)
+    {
+        HRESULT hr = E_OUTOFMEMORY;
+        AcquireSRWLockExclusive(&_lockWriters);
+        // Only the value is copied; readers are still changing the reference count.
+        SNAPSHOT *pSnapshot = new (std::nothrow) SNAPSHOT(this, *static_cast<const T*>(_pCurrent), 1);
+        if (pSnapshot != nullptr)
+        {
+            T &value = *pSnapshot;
+            update(value);
+            value.OnPublish();
+
+            SNAPSHOT *pPrevious = static_cast<SNAPSHOT*>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile *>(&_pCurrent), pSnapshot));
+            pPrevious->lRetiredEpoch = ReadAcquire(&_lEpoch);
+            if (_pRetiredTail != nullptr)
+            {
+                _pRetiredTail->pNextRetired = pPrevious;
+            }
+            else
+            {
+                _pRetiredHead = pPrevious;
+            }
+            _pRetiredTail = pPrevious;
+            _ReleaseUnreachable();
+            hr = S_OK;
+        }
+        ReleaseSRWLockExclusive(&_lockWriters);
+        return hr;
+    }
+
+    // Deletes the copies that were replaced and have no references left, calling
+    // their OnReclaim on this thread. Returns how many were deleted.
+    DWORD Reclaim()
+    {
+        AcquireSRWLockExclusive(&_lockWriters);
+        _ReleaseUnreachable();
+        ReleaseSRWLockExclusive(&_lockWriters);
+        return _DeleteFreed();
+    }
+
+private:
+    CSnapshotCell(const CSnapshotCell &);
+    CSnapshotCell &operator=(const CSnapshotCell &);
+
+    // The list entry comes first, so an entry popped from _freed is its snapshot.
+    struct SNAPSHOT_LINK
+    {
+        SLIST_ENTRY     entry;
+    };
+
+    struct SNAPSHOT : SNAPSHOT_LINK, T
+    {
+        SNAPSHOT(_In_ CSnapshotCell *pOwnerIn, const T &value, LONG cRefIn) :
+            T(value),
+            pOwner(pOwnerIn),
+            cRef(cRefIn),
+            lRetiredEpoch(0),
+            pNextRetired(nullptr)
+        {
+        }
+
+        CSnapshotCell   *pOwner;
+        volatile LONG   cRef;
+        LONG            lRetiredEpoch;      // The epoch when it stopped being current
+        SNAPSHOT        *pNextRetired;      // In the retired list while it holds its reference for being current
+    };
+
+    // Moves to the next epoch if no reader is left in the previous one. _lockWriters must be held.
+    bool _TryAdvanceEpoch()
+    {
+        LONG lEpoch = ReadAcquire(&_lEpoch);
+        if (ReadAcquire(&_rgcReaders[(lEpoch - 1) & 1]) != 0)
+        {
+            return false;
+        }
+        InterlockedIncrement(&_lEpoch);
+        return true;
+    }
+
+    // Drops the reference for being current from the replaced snapshots no reader
+    // can reach any more, oldest first. _lockWriters must be held.
+    void _ReleaseUnreachable()
+    {
+        while (_pRetiredHead != nullptr)
+        {
+            if (ReadAcquire(&_lEpoch) - _pRetiredHead->lRetiredEpoch < 2 && !_TryAdvanceEpoch())
+            {
+                break;
+            }
+            if (ReadAcquire(&_lEpoch) - _pRetiredHead->lRetiredEpoch >= 2)
+            {
+                SNAPSHOT *pSnapshot = _pRetiredHead;
+                _pRetiredHead = pSnapshot->pNextRetired;
+                if (_pRetiredHead == nullptr)
+                {
+                    _pRetiredTail = nullptr;
+                }
+                _ReleaseSnapshot(pSnapshot);
+            }
+        }
+    }
+
+    static void _ReleaseSnapshot(_In_ SNAPSHOT *pSnapshot)
+    {
+        if (InterlockedDecrement(&pSnapshot->cRef) == 0)
+        {
+            InterlockedPushEntrySList(&pSnapshot->pOwner->_freed, &pSnapshot->entry);
+        }
+    }
+
+    DWORD _DeleteFreed()
+    {
+        DWORD cDeleted = 0;
+        PSLIST_ENTRY pEntry = InterlockedFlushSList(&_freed);
+        while (pEntry != nullptr)
+        {
+            SNAPSHOT *pSnapshot = static_cast<SNAPSHOT*>(reinterpret_cast<SNAPSHOT_LINK*>(pEntry));
+            pEntry = pEntry->Next;
+            T &value = *pSnapshot;
+            value.OnReclaim();
+            delete pSnapshot;
+            cDeleted++;
+        }
+        return cDeleted;
+    }
+
+    SLIST_HEADER            _freed;             // Snapshots with no references left, waiting for Reclaim
+    SNAPSHOT * volatile     _pCurrent;
+    SNAPSHOT                _initial;           // Default value, never freed
+    volatile LONG           _lEpoch;
+    volatile LONG           _rgcReaders[2];     // Readers taking a reference, by epoch parity
+    SNAPSHOT                *_pRetiredHead;     // Replaced snapshots, oldest first; guarded by _lockWriters
+    SNAPSHOT                *_pRetiredTail;
+    SRWLOCK                 _lockWriters;
+};
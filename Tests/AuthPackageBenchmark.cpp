@@ -0,0 +1,85 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Counts the LSA calls and time per unlock spent finding the authentication
+// package, looking it up on every GetSerialization as the sample did against
+// CAuthPackageResolver, when some of the logons fail and drop the cached id.
+//
+//   AuthPackageBenchmark [lookup latency ms]
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "AuthPackageResolver.h"
+#include "FakeAuthPackageSource.h"
+
+static const DWORD c_cUnlocks = 500;
+
+static double _Milliseconds(const LARGE_INTEGER &liStart, const LARGE_INTEGER &liEnd)
+{
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    return (liEnd.QuadPart - liStart.QuadPart) * 1e3 / liFrequency.QuadPart;
+}
+
+// One unlock in cFailEvery fails, which is when ReportResult invalidates the id;
+// zero means every unlock succeeds.
+static void _Run(bool fResolver, DWORD cFailEvery, DWORD dwLatencyMs)
+{
+    CFakeAuthPackageSource source(1);
+    source.SetLatency(dwLatencyMs);
+    CAuthPackageResolver resolver(&source);
+
+    LARGE_INTEGER liStart, liEnd;
+    QueryPerformanceCounter(&liStart);
+    for (DWORD iUnlock = 1; iUnlock <= c_cUnlocks; iUnlock++)
+    {
+        ULONG ulAuthPackage;
+        if (fResolver)
+        {
+            resolver.Resolve(&ulAuthPackage);
+            if (cFailEvery != 0 && iUnlock % cFailEvery == 0)
+            {
+                resolver.Invalidate();
+            }
+        }
+        else
+        {
+            source.LookupNegotiatePackage(&ulAuthPackage);
+        }
+    }
+    QueryPerformanceCounter(&liEnd);
+
+    char szFailures[32];
+    if (cFailEvery != 0)
+    {
+        sprintf(szFailures, "1 in %u", cFailEvery);
+    }
+    else
+    {
+        sprintf(szFailures, "none");
+    }
+    printf("%-10s %10s %16.3f %12.3f\n", fResolver ? "resolver" : "uncached", szFailures,
+        static_cast<double>(source.LsaCallCount()) / c_cUnlocks,
+        _Milliseconds(liStart, liEnd) / c_cUnlocks);
+}
+
+int main(int argc, char **argv)
+{
+    static const DWORD c_rgcFailEvery[] = { 0, 100, 10 };
+    DWORD dwLatencyMs = (argc >= 2) ? static_cast<DWORD>(atoi(argv[1])) : 1;
+
+    printf("lookup latency %u ms, %u unlocks\n\n", dwLatencyMs, c_cUnlocks);
+    printf("%-10s %10s %16s %12s\n", "lookup", "failures", "LSA calls/unlock", "ms/unlock");
+    _Run(false, 0, dwLatencyMs);
+    for (DWORD cFailEvery : c_rgcFailEvery)
+    {
+        _Run(true, cFailEvery, dwLatencyMs);
+    }
+    return 0;
+}
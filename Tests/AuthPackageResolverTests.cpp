@@ -0,0 +1,103 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks that CAuthPackageResolver looks the package up once, shares one lookup
+// between concurrent misses, and looks it up again after a failure.
+
+#include <windows.h>
+#include <thread>
+#include <vector>
+#include "AuthPackageResolver.h"
+#include "FakeAuthPackageSource.h"
+#include "TestHarness.h"
+
+static const ULONG c_ulNegotiate = 7;
+
+static void LooksUpOnce()
+{
+    CFakeAuthPackageSource source(c_ulNegotiate);
+    CAuthPackageResolver resolver(&source);
+    for (DWORD i = 0; i < 100; i++)
+    {
+        ULONG ulAuthPackage = 0;
+        CHECK(resolver.Resolve(&ulAuthPackage) == S_OK);
+        CHECK(ulAuthPackage == c_ulNegotiate);
+    }
+    CHECK(source.LookupCount() == 1);
+
+    AUTH_PACKAGE_STATS stats;
+    resolver.GetStats(&stats);
+    CHECK(stats.cResolves == 100);
+    CHECK(stats.cLookups == 1);
+}
+
+static void DoesNotCacheFailures()
+{
+    CFakeAuthPackageSource source(c_ulNegotiate);
+    CAuthPackageResolver resolver(&source);
+    source.FailNext(2);
+
+    ULONG ulAuthPackage = 0;
+    CHECK(FAILED(resolver.Resolve(&ulAuthPackage)));
+    CHECK(FAILED(resolver.Resolve(&ulAuthPackage)));
+    CHECK(resolver.Resolve(&ulAuthPackage) == S_OK);
+    CHECK(ulAuthPackage == c_ulNegotiate);
+    CHECK(resolver.Resolve(&ulAuthPackage) == S_OK);
+    CHECK(source.LookupCount() == 3);
+}
+
+static void LooksUpAgainAfterInvalidate()
+{
+    CFakeAuthPackageSource source(c_ulNegotiate);
+    CAuthPackageResolver resolver(&source);
+    ULONG ulAuthPackage = 0;
+    CHECK(resolver.Resolve(&ulAuthPackage) == S_OK);
+    resolver.Invalidate();
+    CHECK(resolver.Resolve(&ulAuthPackage) == S_OK);
+    CHECK(resolver.Resolve(&ulAuthPackage) == S_OK);
+    CHECK(source.LookupCount() == 2);
+}
+
+static void ConcurrentMissesShareOneLookup()
+{
+    static const DWORD c_cThreads = 8;
+
+    CFakeAuthPackageSource source(c_ulNegotiate);
+    source.SetLatency(20);
+    CAuthPackageResolver resolver(&source);
+
+    volatile LONG cWrong = 0;
+    std::vector<std::thread> rgThreads;
+    for (DWORD i = 0; i < c_cThreads; i++)
+    {
+        rgThreads.emplace_back([&]()
+        {
+            ULONG ulAuthPackage = 0;
+            if (resolver.Resolve(&ulAuthPackage) != S_OK || ulAuthPackage != c_ulNegotiate)
+            {
+                InterlockedIncrement(&cWrong);
+            }
+        });
+    }
+    for (std::thread &thread : rgThreads)
+    {
+        thread.join();
+    }
+    CHECK(cWrong == 0);
+    CHECK(source.LookupCount() == 1);
+    CHECK(source.PeakConcurrentLookups() == 1);
+}
+
+int main()
+{
+    RUN_TEST(LooksUpOnce);
+    RUN_TEST(DoesNotCacheFailures);
+    RUN_TEST(LooksUpAgainAfterInvalidate);
+    RUN_TEST(ConcurrentMissesShareOneLookup);
+    return TestExitCode();
+}
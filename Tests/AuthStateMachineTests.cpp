@@ -0,0 +1,140 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks the transitions, lifetimes and serialize gate of CAuthStateMachine.
+
+#include <windows.h>
+#include "AuthStateMachine.h"
+#include "TestHarness.h"
+
+static bool _Apply(CAuthStateMachine *pMachine, AUTH_EVENT event)
+{
+    AUTH_TRANSITION transition;
+    bool fChanged = pMachine->OnEvent(event, &transition);
+    if (fChanged)
+    {
+        CHECK(transition.stateTo == pMachine->GetState());
+    }
+    return fChanged;
+}
+
+static void _Approve(CAuthStateMachine *pMachine)
+{
+    CHECK(_Apply(pMachine, AUTH_EVENT_DEVICE_ARRIVED));
+    CHECK(_Apply(pMachine, AUTH_EVENT_APP_APPROVED));
+    CHECK(pMachine->GetState() == AUTH_STATE_APP_APPROVED);
+}
+
+static void FollowsAnApprovedLogon()
+{
+    CAuthStateMachine machine;
+    CHECK(machine.GetState() == AUTH_STATE_IDLE);
+    _Approve(&machine);
+    CHECK(_Apply(&machine, AUTH_EVENT_SERIALIZED));
+    CHECK(machine.GetState() == AUTH_STATE_SERIALIZED);
+    CHECK(_Apply(&machine, AUTH_EVENT_SUBMITTED));
+    CHECK(machine.GetState() == AUTH_STATE_SUBMITTED);
+
+    // A departure does not cancel a logon that is already in flight.
+    CHECK(!_Apply(&machine, AUTH_EVENT_DEVICE_DEPARTED));
+    CHECK(_Apply(&machine, AUTH_EVENT_LOGON_SUCCEEDED));
+    CHECK(machine.GetState() == AUTH_STATE_SUCCEEDED);
+}
+
+static void ApprovalsNeedTheDevice()
+{
+    CAuthStateMachine machine;
+    CHECK(!_Apply(&machine, AUTH_EVENT_APP_APPROVED));
+    CHECK(machine.GetState() == AUTH_STATE_IDLE);
+
+    _Approve(&machine);
+    CHECK(_Apply(&machine, AUTH_EVENT_DEVICE_DEPARTED));
+    CHECK(machine.GetState() == AUTH_STATE_IDLE);
+}
+
+// Approving again once the buffer is packed must not strand the logon in a state
+// that refuses the submission.
+static void RepeatedApprovalKeepsThePackedLogon()
+{
+    CAuthStateMachine machine;
+    _Approve(&machine);
+    CHECK(_Apply(&machine, AUTH_EVENT_SERIALIZED));
+    CHECK(!_Apply(&machine, AUTH_EVENT_APP_APPROVED));
+    CHECK(machine.GetState() == AUTH_STATE_SERIALIZED);
+    CHECK(_Apply(&machine, AUTH_EVENT_SUBMITTED));
+
+    // Once submitted, the approval is used up.
+    CHECK(!_Apply(&machine, AUTH_EVENT_APP_APPROVED));
+    CHECK(machine.GetState() == AUTH_STATE_SUBMITTED);
+}
+
+static void StatesExpire()
+{
+    CAuthStateMachine machine;
+    AUTH_TRANSITION transition;
+    _Approve(&machine);
+    CHECK(!machine.Expire(&transition));
+    ShimAdvanceTickCount(61 * 1000);
+    CHECK(machine.Expire(&transition));
+    CHECK(transition.stateFrom == AUTH_STATE_APP_APPROVED);
+    CHECK(transition.stateTo == AUTH_STATE_DEVICE_PRESENT);
+    CHECK(transition.ullMicroseconds >= 61ull * 1000 * 1000);
+
+    // The device being present lasts until it departs.
+    ShimAdvanceTickCount(24 * 60 * 60 * 1000);
+    CHECK(!machine.Expire(&transition));
+
+    CHECK(_Apply(&machine, AUTH_EVENT_APP_APPROVED));
+    CHECK(_Apply(&machine, AUTH_EVENT_SERIALIZED));
+    ShimAdvanceTickCount(31 * 1000);
+    CHECK(machine.Expire(&transition));
+    CHECK(transition.stateFrom == AUTH_STATE_SERIALIZED);
+    CHECK(machine.GetState() == AUTH_STATE_DEVICE_PRESENT);
+
+    // A failed or finished logon leaves the phone present, so it can approve again
+    // without first leaving and coming back.
+    CHECK(_Apply(&machine, AUTH_EVENT_APP_APPROVED));
+    CHECK(_Apply(&machine, AUTH_EVENT_SERIALIZED));
+    CHECK(_Apply(&machine, AUTH_EVENT_LOGON_FAILED));
+    CHECK(machine.GetState() == AUTH_STATE_FAILED);
+    ShimAdvanceTickCount(11 * 1000);
+    CHECK(machine.Expire(&transition));
+    CHECK(transition.stateFrom == AUTH_STATE_FAILED);
+    CHECK(transition.stateTo == AUTH_STATE_DEVICE_PRESENT);
+    CHECK(_Apply(&machine, AUTH_EVENT_APP_APPROVED));
+    CHECK(machine.GetState() == AUTH_STATE_APP_APPROVED);
+
+    CHECK(_Apply(&machine, AUTH_EVENT_SERIALIZED));
+    CHECK(_Apply(&machine, AUTH_EVENT_SUBMITTED));
+    CHECK(_Apply(&machine, AUTH_EVENT_LOGON_SUCCEEDED));
+    ShimAdvanceTickCount(11 * 1000);
+    CHECK(machine.Expire(&transition));
+    CHECK(transition.stateTo == AUTH_STATE_DEVICE_PRESENT);
+    CHECK(_Apply(&machine, AUTH_EVENT_APP_APPROVED));
+}
+
+static void OnlyApprovedStatesSerialize()
+{
+    for (int i = 0; i < AUTH_STATE_COUNT; i++)
+    {
+        AUTH_STATE state = static_cast<AUTH_STATE>(i);
+        bool fExpected = (state == AUTH_STATE_APP_APPROVED || state == AUTH_STATE_SERIALIZED);
+        CHECK(CAuthStateMachine::IsSerializeState(state) == fExpected);
+    }
+    CHECK(!CAuthStateMachine::IsSerializeState(AUTH_STATE_COUNT));
+}
+
+int main()
+{
+    RUN_TEST(FollowsAnApprovedLogon);
+    RUN_TEST(ApprovalsNeedTheDevice);
+    RUN_TEST(RepeatedApprovalKeepsThePackedLogon);
+    RUN_TEST(StatesExpire);
+    RUN_TEST(OnlyApprovedStatesSerialize);
+    return TestExitCode();
+}
@@ -0,0 +1,483 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Sends avatar uploads through AvatarUploadReceive the way the phone app does,
+// the body arriving in blocks the shim's recv hands out. Checks Content-Length and
+// chunked bodies split at every byte, chunk extensions, oversize and overflowing
+// sizes, truncated bodies, bad pictures and unsigned uploads, and fuzzes the chunk
+// framing.
+//
+//   AvatarUploadTests [fuzz iterations] [seed]
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "AvatarUpload.h"
+#include "RequestAuth.h"
+#include "SealedKey.h"
+#include "TileBitmapCache.h"
+#include "TestHarness.h"
+
+static const SOCKET c_socket = 7;
+static const char c_szUploadLine[] = "POST /avatar?sid=S-1-5-21-1-2-3-1001 HTTP/1.1";
+static const WCHAR c_szUploadSid[] = L"S-1-5-21-1-2-3-1001";
+
+static DWORD s_cFuzzIterations = 200000;
+static DWORD s_dwSeed = 1;
+
+static std::string s_strProgramData;
+static BYTE s_rgbKey[c_cbChaChaKey];
+static ULONGLONG s_ullCounter = 0;
+static std::string s_strPicture;
+static BITMAP_IMAGE s_expected;
+
+// Pairs a private ProgramData, as the admin tool would.
+static void _Pair()
+{
+    char szTemplate[] = "/tmp/AvatarUploadTests.XXXXXX";
+    s_strProgramData = mkdtemp(szTemplate);
+    std::wstring strDirectory(s_strProgramData.begin(), s_strProgramData.end());
+    ShimSetProgramDataPath(strDirectory.c_str());
+    ShimResetRegistry();
+    CHECK_HR(SealedKeyCreate(c_szPairingKeyFile, s_rgbKey, sizeof(s_rgbKey)));
+}
+
+static void _Unpair()
+{
+    WCHAR szPath[MAX_PATH];
+    SealedKeyGetPath(c_szPairingKeyFile, szPath, ARRAYSIZE(szPath));
+    DeleteFileW(szPath);
+    rmdir((s_strProgramData + "/AbsoluteID").c_str());
+    rmdir(s_strProgramData.c_str());
+}
+
+static std::string _ReadFile(const char *pszPath)
+{
+    std::string str;
+    FILE *pfile = fopen(pszPath, "rb");
+    if (pfile != nullptr)
+    {
+        char rgchBlock[4096];
+        size_t cb;
+        while ((cb = fread(rgchBlock, 1, sizeof(rgchBlock), pfile)) > 0)
+        {
+            str.append(rgchBlock, cb);
+        }
+        fclose(pfile);
+    }
+    return str;
+}
+
+// The Authorization header the phone app sends for the request line and body,
+// with the next unused counter.
+static std::string _Authorization(const std::string &strBody)
+{
+    ULONGLONG ullCounter = ++s_ullCounter;
+    BYTE rgbNonce[c_cbChaChaNonce] = {};
+    for (size_t i = 0; i < 8; i++)
+    {
+        rgbNonce[4 + i] = static_cast<BYTE>(ullCounter >> (8 * i));
+    }
+    std::string strAad = std::string(c_szUploadLine) + "\n" + strBody;
+    BYTE rgbTag[c_cbPoly1305Tag];
+    ChaCha20Poly1305Seal(s_rgbKey, rgbNonce, reinterpret_cast<const uint8_t*>(strAad.data()), strAad.size(), nullptr, 0, nullptr, rgbTag);
+
+    char szHeader[128];
+    int cch = snprintf(szHeader, sizeof(szHeader), "Authorization: AbsoluteID %llu:", ullCounter);
+    for (size_t i = 0; i < sizeof(rgbTag); i++)
+    {
+        cch += snprintf(szHeader + cch, sizeof(szHeader) - cch, "%02x", rgbTag[i]);
+    }
+    return szHeader;
+}
+
+static std::string _Request(const std::string &strFraming, const std::string &strAuthorization, const std::string &strEncodedBody)
+{
+    return std::string(c_szUploadLine) + "\r\nHost: 192.168.1.20:32808\r\n" + strAuthorization + "\r\n" + strFraming + "\r\n\r\n" + strEncodedBody;
+}
+
+// A signed upload of strBody sent with Content-Length.
+static std::string _LengthRequest(const std::string &strBody)
+{
+    return _Request("Content-Length: " + std::to_string(strBody.size()), _Authorization(strBody), strBody);
+}
+
+// strBody in chunks of the given sizes, the last one taking the rest, each size
+// line written by fnSizeLine.
+template <typename SIZE_LINE>
+static std::string _Chunked(const std::string &strBody, const std::vector<size_t> &rgcbChunks, SIZE_LINE fnSizeLine)
+{
+    std::string strEncoded;
+    size_t ib = 0;
+    for (size_t iChunk = 0; ib < strBody.size(); iChunk++)
+    {
+        size_t cbChunk = (iChunk < rgcbChunks.size()) ? (std::min)(rgcbChunks[iChunk], strBody.size() - ib) : strBody.size() - ib;
+        strEncoded += fnSizeLine(cbChunk) + strBody.substr(ib, cbChunk) + "\r\n";
+        ib += cbChunk;
+    }
+    return strEncoded + fnSizeLine(0) + "\r\n";
+}
+
+static std::string _SizeLine(size_t cb)
+{
+    char sz[32];
+    snprintf(sz, sizeof(sz), "%zx\r\n", cb);
+    return sz;
+}
+
+// Sends the request the way the server reads it: the first cbFirst bytes already
+// received, the rest queued in blocks of cbBlock. Whatever the upload did not read
+// is dropped, and its size returned in *pcbUnread if asked for.
+static HRESULT _Receive(const std::string &strRequest, size_t cbFirst, size_t cbBlock, BITMAP_IMAGE *pImage, size_t *pcbUnread = nullptr)
+{
+    cbFirst = (std::min)(cbFirst, strRequest.size());
+    for (size_t ib = cbFirst; ib < strRequest.size(); ib += cbBlock)
+    {
+        ShimQueueReceive(c_socket, strRequest.substr(ib, cbBlock));
+    }
+
+    std::wstring strSid;
+    pImage->cx = 0;
+    pImage->cy = 0;
+    pImage->pixels.clear();
+    HRESULT hr = AvatarUploadReceive(c_socket, strRequest.data(), cbFirst, &strSid, pImage);
+    if (SUCCEEDED(hr))
+    {
+        CHECK(strSid == c_szUploadSid);
+    }
+    size_t cbUnread = ShimClearReceives(c_socket);
+    if (pcbUnread != nullptr)
+    {
+        *pcbUnread = cbUnread;
+    }
+    return hr;
+}
+
+static bool _IsExpectedImage(const BITMAP_IMAGE &image)
+{
+    return image.cx == s_expected.cx && image.cy == s_expected.cy && image.pixels == s_expected.pixels;
+}
+
+static void RecognizesUploads()
+{
+    static const char c_szUpload[] = "POST /avatar?sid=S-1 HTTP/1.1";
+    CHECK(AvatarUploadIsRequest(c_szUpload, ARRAYSIZE(c_szUpload) - 1));
+    CHECK(AvatarUploadIsRequest("POST /avatar HTTP/1.1", 21));
+    CHECK(!AvatarUploadIsRequest("POST /avatar", 12));
+    CHECK(!AvatarUploadIsRequest("POST /avatars HTTP/1.1", 22));
+    CHECK(!AvatarUploadIsRequest("POST /event?sid=S-1 HTTP/1.1", 28));
+}
+
+// The picture comes through whole whether it arrived with the headers or in blocks
+// of any size.
+static void ReceivesContentLengthUploads()
+{
+    static const size_t c_rgcbBlock[] = { 1, 13, 1000, 4096, 100000 };
+    for (size_t cbBlock : c_rgcbBlock)
+    {
+        std::string strRequest = _LengthRequest(s_strPicture);
+        BITMAP_IMAGE image;
+        CHECK_HR(_Receive(strRequest, strRequest.size() - s_strPicture.size() + 100, cbBlock, &image));
+        CHECK(_IsExpectedImage(image));
+    }
+
+    // The first read can end anywhere in the headers.
+    std::string strRequest = _LengthRequest(s_strPicture);
+    BITMAP_IMAGE image;
+    CHECK_HR(_Receive(strRequest, 20, 4096, &image));
+    CHECK(_IsExpectedImage(image));
+}
+
+// Chunk sizes in either case, with leading zeros and bare line feeds, every framing
+// byte split from the next by the recv blocks.
+static void ReceivesChunkedUploads()
+{
+    const std::vector<size_t> rgcbChunks = { 1, 0x10, 0x1FF, 3, 4096, 0xABC };
+    std::string strUpper = _Chunked(s_strPicture, rgcbChunks, [](size_t cb)
+    {
+        char sz[32];
+        snprintf(sz, sizeof(sz), "%04zX\r\n", cb);
+        return std::string(sz);
+    });
+    std::string strBareLf = _Chunked(s_strPicture, rgcbChunks, [](size_t cb)
+    {
+        char sz[32];
+        snprintf(sz, sizeof(sz), "%zx\n", cb);
+        return std::string(sz);
+    });
+
+    static const size_t c_rgcbBlock[] = { 1, 2, 3, 7, 4096 };
+    for (const std::string &strEncoded : { strUpper, strBareLf, _Chunked(s_strPicture, {}, _SizeLine) })
+    {
+        for (size_t cbBlock : c_rgcbBlock)
+        {
+            std::string strRequest = _Request("Transfer-Encoding: chunked", _Authorization(s_strPicture), strEncoded);
+            BITMAP_IMAGE image;
+            CHECK_HR(_Receive(strRequest, strRequest.size() - strEncoded.size() + 3, cbBlock, &image));
+            CHECK(_IsExpectedImage(image));
+        }
+    }
+
+    // Chunked encoding wins over a Content-Length sent with it.
+    std::string strEncoded = _Chunked(s_strPicture, rgcbChunks, _SizeLine);
+    std::string strRequest = _Request("Content-Length: 5\r\nTransfer-Encoding: gzip, CHUNKED", _Authorization(s_strPicture), strEncoded);
+    BITMAP_IMAGE image;
+    CHECK_HR(_Receive(strRequest, 64, 4096, &image));
+    CHECK(_IsExpectedImage(image));
+}
+
+// Extensions and spaces after the size are skipped; nothing in them reaches the body.
+static void SkipsChunkExtensions()
+{
+    std::string strEncoded = _Chunked(s_strPicture, { 100, 2000, 5 }, [](size_t cb)
+    {
+        char sz[64];
+        snprintf(sz, sizeof(sz), "%zx ;name=value;quoted=\"a\\r\\n;b\"\t\r\n", cb);
+        return std::string(sz);
+    });
+    for (size_t cbBlock : { 1, 4096 })
+    {
+        std::string strRequest = _Request("Transfer-Encoding: chunked", _Authorization(s_strPicture), strEncoded);
+        BITMAP_IMAGE image;
+        CHECK_HR(_Receive(strRequest, 64, cbBlock, &image));
+        CHECK(_IsExpectedImage(image));
+    }
+}
+
+// A size past what the decoder takes, or one that would overflow, ends the upload
+// without reading on.
+static void RefusesOversizeChunks()
+{
+    static const char *const c_rgpszSizes[] = { "100000000", "FFFFFFFFFFFFFFFFF", "1000000000000000000000001" };
+    for (const char *pszSize : c_rgpszSizes)
+    {
+        std::string strEncoded = std::string(pszSize) + "\r\n" + s_strPicture + "\r\n0\r\n\r\n";
+        std::string strRequest = _Request("Transfer-Encoding: chunked", _Authorization(s_strPicture), strEncoded);
+        BITMAP_IMAGE image;
+        size_t cbUnread;
+        CHECK(_Receive(strRequest, 64, 1, &image, &cbUnread) == E_INVALIDARG);
+        CHECK(cbUnread > s_strPicture.size());
+    }
+
+    // Lengths are refused from the headers alone.
+    static const char *const c_rgpszLengths[] = { "67112961", "18446744073709551616", "-1" };
+    for (const char *pszLength : c_rgpszLengths)
+    {
+        std::string strRequest = _Request(std::string("Content-Length: ") + pszLength, _Authorization(s_strPicture), s_strPicture);
+        BITMAP_IMAGE image;
+        size_t cbUnread;
+        CHECK(_Receive(strRequest, strRequest.size() - s_strPicture.size(), 4096, &image, &cbUnread) == E_INVALIDARG);
+        CHECK(cbUnread == s_strPicture.size());
+    }
+
+    // So are sizes that are missing, not hex or split by a space, and chunk data
+    // not followed by a line end.
+    static const char *const c_rgpszBad[] =
+    {
+        "1g\r\nx\r\n0\r\n\r\n",
+        "0x10\r\n",
+        "\r\n",
+        ";ext\r\n",
+        "1 0\r\n",
+        "2\r\nBMxx\r\n0\r\n\r\n",
+    };
+    for (const char *pszBad : c_rgpszBad)
+    {
+        std::string strRequest = _Request("Transfer-Encoding: chunked", _Authorization(s_strPicture), pszBad);
+        BITMAP_IMAGE image;
+        CHECK(_Receive(strRequest, 64, 1, &image) == E_INVALIDARG);
+    }
+}
+
+// A body that stops early fails as the connection closing, however it is framed,
+// and so do headers that never end.
+static void RefusesTruncatedUploads()
+{
+    std::string strLength = _LengthRequest(s_strPicture);
+    std::string strEncoded = _Chunked(s_strPicture, { 1000 }, _SizeLine);
+    std::string strChunked = _Request("Transfer-Encoding: chunked", _Authorization(s_strPicture), strEncoded);
+    std::string strHeaders = strLength.substr(0, strLength.size() - s_strPicture.size());
+    const std::string rgstrTruncated[] =
+    {
+        strLength.substr(0, strLength.size() - 1),
+        strLength.substr(0, strHeaders.size() + 60),
+        strChunked.substr(0, strChunked.size() - 5),            // No zero-size chunk
+        strChunked.substr(0, strChunked.size() - 3),            // Cut in the last size line
+        strChunked.substr(0, strChunked.size() - s_strPicture.size() + 500),
+        strHeaders.substr(0, strHeaders.size() - 2),
+    };
+    for (const std::string &strRequest : rgstrTruncated)
+    {
+        for (size_t cbBlock : { 1, 4096 })
+        {
+            BITMAP_IMAGE image;
+            CHECK(_Receive(strRequest, 32, cbBlock, &image) == HRESULT_FROM_WIN32(ERROR_HANDLE_EOF));
+            CHECK(image.pixels.empty());
+        }
+    }
+
+    // A body that is all there but holds only part of the picture gives no image.
+    std::string strPart = s_strPicture.substr(0, s_strPicture.size() / 2);
+    BITMAP_IMAGE image;
+    CHECK(_Receive(_LengthRequest(strPart), 64, 4096, &image) == E_INVALIDARG);
+    CHECK(image.pixels.empty());
+}
+
+// A body that is not a picture the decoder takes ends the upload as soon as that is
+// known, signed or not.
+static void RefusesBadPictures()
+{
+    std::string strNotBmp = "GIF89a" + s_strPicture.substr(6);
+    std::string strSixteenBit = s_strPicture;
+    strSixteenBit[28] = 16;
+    for (const std::string &strBody : { strNotBmp, strSixteenBit })
+    {
+        for (bool fChunked : { false, true })
+        {
+            std::string strRequest = fChunked ?
+                _Request("Transfer-Encoding: chunked", _Authorization(strBody), _Chunked(strBody, { 10 }, _SizeLine)) :
+                _LengthRequest(strBody);
+            BITMAP_IMAGE image;
+            size_t cbUnread;
+            CHECK(_Receive(strRequest, 64, 1, &image, &cbUnread) == E_INVALIDARG);
+            CHECK(cbUnread > s_strPicture.size() - 100);
+        }
+    }
+}
+
+// Uploads without a valid tag give no picture; without an Authorization header the
+// body is not even read.
+static void RefusesUnsignedUploads()
+{
+    std::string strUnsigned = _Request("Content-Length: " + std::to_string(s_strPicture.size()), "X-Other: 1", s_strPicture);
+    BITMAP_IMAGE image;
+    size_t cbUnread;
+    CHECK(_Receive(strUnsigned, strUnsigned.size() - s_strPicture.size(), 4096, &image, &cbUnread) == E_ACCESSDENIED);
+    CHECK(cbUnread == s_strPicture.size());
+
+    std::string strOther = s_strPicture;
+    strOther[strOther.size() - 1] ^= 1;
+    std::string strTampered = _Request("Content-Length: " + std::to_string(strOther.size()), _Authorization(s_strPicture), strOther);
+    CHECK(_Receive(strTampered, 64, 4096, &image) == E_ACCESSDENIED);
+    CHECK(image.pixels.empty());
+
+    std::string strNoSid = _LengthRequest(s_strPicture);
+    strNoSid.replace(strNoSid.find("sid="), 4, "uid=");
+    CHECK(_Receive(strNoSid, 64, 4096, &image) == E_INVALIDARG);
+}
+
+// Chunked uploads of a small picture with random chunk sizes, size lines and
+// extensions, sent in random blocks, some with their framing damaged. Every one is
+// signed for its picture with a fresh counter, so one that succeeds must give the
+// picture, and one whose framing was damaged must fail unless the damage left the
+// body as it was. Each upload reads the pairing key, so a hundredth of the
+// iterations are run.
+static void FuzzesChunkFraming()
+{
+    std::string strPicture = _ReadFile("../bitmap1.bmp");
+    BITMAP_IMAGE expected;
+    CBmpStreamDecoder decoder(c_cxTileImage, c_cyTileImage);
+    CHECK(decoder.Write(reinterpret_cast<const uint8_t*>(strPicture.data()), strPicture.size()) && decoder.TakeImage(&expected));
+
+    static const char c_rgchFraming[] = { '0', '9', 'a', 'F', 'g', ';', ' ', '\t', '\r', '\n', '=', '"' };
+    std::mt19937 random(s_dwSeed);
+    const DWORD cIterations = s_cFuzzIterations / 100;
+    DWORD cReceived = 0;
+    for (DWORD iIteration = 0; iIteration < cIterations; iIteration++)
+    {
+        std::vector<size_t> rgcbChunks;
+        for (size_t cb = 0; cb < strPicture.size(); )
+        {
+            rgcbChunks.push_back(1 + random() % 600);
+            cb += rgcbChunks.back();
+        }
+        bool fUpper = (random() % 2) != 0;
+        size_t cchZeros = random() % 3;
+        bool fExtension = (random() % 4) == 0;
+        std::string strEncoded = _Chunked(strPicture, rgcbChunks, [&](size_t cb)
+        {
+            char sz[64];
+            snprintf(sz, sizeof(sz), fUpper ? "%0*zX%s\r\n" : "%0*zx%s\r\n", static_cast<int>(cchZeros + 1), cb, fExtension ? ";ext=1" : "");
+            return std::string(sz);
+        });
+
+        bool fDamaged = (random() % 2) != 0;
+        if (fDamaged)
+        {
+            DWORD cMutations = 1 + random() % 3;
+            for (DWORD i = 0; i < cMutations && !strEncoded.empty(); i++)
+            {
+                size_t ich = random() % strEncoded.size();
+                switch (random() % 3)
+                {
+                case 0:
+                    strEncoded[ich] = c_rgchFraming[random() % ARRAYSIZE(c_rgchFraming)];
+                    break;
+                case 1:
+                    strEncoded.insert(ich, 1, c_rgchFraming[random() % ARRAYSIZE(c_rgchFraming)]);
+                    break;
+                default:
+                    strEncoded.erase(ich, 1 + random() % 8);
+                    break;
+                }
+            }
+        }
+
+        std::string strRequest = _Request("Transfer-Encoding: chunked", _Authorization(strPicture), strEncoded);
+        BITMAP_IMAGE image;
+        HRESULT hr = _Receive(strRequest, 1 + random() % 300, 1 + random() % 700, &image);
+        if (hr == S_OK)
+        {
+            cReceived++;
+            CHECK(image.cx == expected.cx && image.cy == expected.cy && image.pixels == expected.pixels);
+        }
+        else
+        {
+            CHECK(fDamaged);
+            CHECK(hr == E_INVALIDARG || hr == E_ACCESSDENIED || hr == HRESULT_FROM_WIN32(ERROR_HANDLE_EOF));
+            CHECK(image.pixels.empty());
+        }
+    }
+
+    // The undamaged half should all come through.
+    CHECK(cReceived >= cIterations / 3);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2)
+    {
+        s_cFuzzIterations = static_cast<DWORD>(strtoul(argv[1], nullptr, 10));
+    }
+    if (argc >= 3)
+    {
+        s_dwSeed = static_cast<DWORD>(strtoul(argv[2], nullptr, 10));
+    }
+
+    // tileimage.bmp is already tile sized, so it comes out as it went in.
+    s_strPicture = _ReadFile("../tileimage.bmp");
+    CHECK(BmpDecode(reinterpret_cast<const uint8_t*>(s_strPicture.data()), s_strPicture.size(), &s_expected));
+    CHECK(s_expected.cx == c_cxTileImage && s_expected.cy == c_cyTileImage);
+
+    _Pair();
+    RUN_TEST(RecognizesUploads);
+    RUN_TEST(ReceivesContentLengthUploads);
+    RUN_TEST(ReceivesChunkedUploads);
+    RUN_TEST(SkipsChunkExtensions);
+    RUN_TEST(RefusesOversizeChunks);
+    RUN_TEST(RefusesTruncatedUploads);
+    RUN_TEST(RefusesBadPictures);
+    RUN_TEST(RefusesUnsignedUploads);
+    RUN_TEST(FuzzesChunkFraming);
+    _Unpair();
+    return TestExitCode();
+}
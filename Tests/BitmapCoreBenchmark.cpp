@@ -0,0 +1,149 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Measures what a tile image costs: decoding tileimage.bmp and bitmap1.bmp whole,
+// scaling the result to the tile size, and streaming the file through
+// CBmpStreamDecoder in 4 KB blocks as an upload arrives. The BGR to BGRA row
+// conversion is measured on its own against the scalar loop it replaces.
+//
+//   BitmapCoreBenchmark [iterations]
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "BitmapCore.h"
+
+// Size tiles are scaled to, as c_cxTileImage and c_cyTileImage in TileBitmapCache.h.
+static const uint32_t c_cxTile = 128;
+static const uint32_t c_cyTile = 128;
+
+static const size_t c_cbBlock = 4096;
+
+static volatile size_t s_cSink = 0;
+
+static double _Milliseconds(const LARGE_INTEGER &liStart, const LARGE_INTEGER &liEnd)
+{
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    return (liEnd.QuadPart - liStart.QuadPart) * 1e3 / liFrequency.QuadPart;
+}
+
+// Runs op cIterations times and returns microseconds per run.
+template <typename OPERATION>
+static double _Run(DWORD cIterations, OPERATION op)
+{
+    LARGE_INTEGER liStart, liEnd;
+    QueryPerformanceCounter(&liStart);
+    for (DWORD i = 0; i < cIterations; i++)
+    {
+        s_cSink = s_cSink + op();
+    }
+    QueryPerformanceCounter(&liEnd);
+    return _Milliseconds(liStart, liEnd) * 1e3 / cIterations;
+}
+
+static std::vector<uint8_t> _ReadFile(const char *pszPath)
+{
+    std::vector<uint8_t> rgb;
+    FILE *pfile = fopen(pszPath, "rb");
+    if (pfile != nullptr)
+    {
+        uint8_t rgbBlock[c_cbBlock];
+        size_t cb;
+        while ((cb = fread(rgbBlock, 1, sizeof(rgbBlock), pfile)) > 0)
+        {
+            rgb.insert(rgb.end(), rgbBlock, rgbBlock + cb);
+        }
+        fclose(pfile);
+    }
+    return rgb;
+}
+
+static void _ConvertRowScalar(const uint8_t *pbSource, uint8_t *pbDest, size_t cPixels)
+{
+    for (size_t i = 0; i < cPixels; i++)
+    {
+        pbDest[i * 4 + 0] = pbSource[i * 3 + 0];
+        pbDest[i * 4 + 1] = pbSource[i * 3 + 1];
+        pbDest[i * 4 + 2] = pbSource[i * 3 + 2];
+        pbDest[i * 4 + 3] = 0xFF;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    DWORD cIterations = (argc >= 2) ? static_cast<DWORD>(atoi(argv[1])) : 2000;
+
+    printf("%u iterations, scaled to %ux%u, streamed in %u byte blocks\n\n",
+           cIterations, c_cxTile, c_cyTile, static_cast<unsigned>(c_cbBlock));
+    printf("%-18s %10s %10s %10s %12s\n", "image", "size", "decode us", "scale us", "stream us");
+
+    static const char *const c_rgpszFiles[] = { "../tileimage.bmp", "../bitmap1.bmp" };
+    for (const char *pszFile : c_rgpszFiles)
+    {
+        std::vector<uint8_t> rgbFile = _ReadFile(pszFile);
+        BITMAP_IMAGE decoded;
+        if (!BmpDecode(rgbFile.data(), rgbFile.size(), &decoded))
+        {
+            fprintf(stderr, "cannot decode %s\n", pszFile);
+            return 1;
+        }
+
+        double dDecodeUs = _Run(cIterations, [&]()
+        {
+            BITMAP_IMAGE image;
+            BmpDecode(rgbFile.data(), rgbFile.size(), &image);
+            return static_cast<size_t>(image.pixels[0]);
+        });
+        double dScaleUs = _Run(cIterations, [&]()
+        {
+            BITMAP_IMAGE scaled;
+            ImageScale(decoded, c_cxTile, c_cyTile, &scaled);
+            return static_cast<size_t>(scaled.pixels[0]);
+        });
+        double dStreamUs = _Run(cIterations, [&]()
+        {
+            CBmpStreamDecoder decoder(c_cxTile, c_cyTile);
+            for (size_t ib = 0; ib < rgbFile.size(); ib += c_cbBlock)
+            {
+                decoder.Write(rgbFile.data() + ib, (std::min)(rgbFile.size() - ib, c_cbBlock));
+            }
+            BITMAP_IMAGE streamed;
+            decoder.TakeImage(&streamed);
+            return streamed.pixels.size();
+        });
+
+        char szSize[32];
+        snprintf(szSize, sizeof(szSize), "%ux%u", decoded.cx, decoded.cy);
+        printf("%-18s %10s %10.1f %10.1f %12.1f\n", pszFile + 3, szSize, dDecodeUs, dScaleUs, dStreamUs);
+    }
+
+    // Rows of the tile width and of the widest image accepted.
+    printf("\n%8s %12s %12s\n", "pixels", "scalar ns", "converted ns");
+    static const size_t c_rgcPixels[] = { c_cxTile, c_cMaxImageDimension };
+    for (size_t cPixels : c_rgcPixels)
+    {
+        std::vector<uint8_t> rgbSource(cPixels * 3, 0x5A);
+        std::vector<uint8_t> rgbDest(cPixels * 4);
+        DWORD cRows = cIterations * 50;
+        double dScalarNs = _Run(cRows, [&]()
+        {
+            _ConvertRowScalar(rgbSource.data(), rgbDest.data(), cPixels);
+            return static_cast<size_t>(rgbDest[cPixels * 4 - 2]);
+        }) * 1e3;
+        double dConvertNs = _Run(cRows, [&]()
+        {
+            ConvertRowBgrToBgra(rgbSource.data(), rgbDest.data(), cPixels);
+            return static_cast<size_t>(rgbDest[cPixels * 4 - 2]);
+        }) * 1e3;
+        printf("%8zu %12.0f %12.0f\n", cPixels, dScalarNs, dConvertNs);
+    }
+    return 0;
+}
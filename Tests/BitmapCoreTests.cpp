@@ -0,0 +1,475 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks the BGR to BGRA row conversion against a scalar reference at every width
+// its SIMD loop and tail can see, decoding of each supported bit depth, and that
+// both tile images decode, scale and stream to the same pixels. Streamed files are
+// split at every size, refused for each bad header and left incomplete when cut
+// short, and damaged files are fuzzed through both decoders.
+//
+//   BitmapCoreTests [fuzz iterations] [seed]
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "BitmapCore.h"
+#include "TestHarness.h"
+
+static const uint8_t c_bGuard = 0xA5;
+
+static DWORD s_cFuzzIterations = 200000;
+static DWORD s_dwSeed = 1;
+
+static void _ConvertRowReference(const uint8_t *pbSource, uint8_t *pbDest, size_t cPixels)
+{
+    for (size_t i = 0; i < cPixels; i++)
+    {
+        pbDest[i * 4 + 0] = pbSource[i * 3 + 0];
+        pbDest[i * 4 + 1] = pbSource[i * 3 + 1];
+        pbDest[i * 4 + 2] = pbSource[i * 3 + 2];
+        pbDest[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void _AppendU16(std::vector<uint8_t> &rgb, uint16_t w)
+{
+    rgb.push_back(static_cast<uint8_t>(w));
+    rgb.push_back(static_cast<uint8_t>(w >> 8));
+}
+
+static void _AppendU32(std::vector<uint8_t> &rgb, uint32_t dw)
+{
+    _AppendU16(rgb, static_cast<uint16_t>(dw));
+    _AppendU16(rgb, static_cast<uint16_t>(dw >> 16));
+}
+
+// Builds a .bmp file with the given headers, palette and rows, padding each row to
+// four bytes. rgbRows holds the rows in file order, unpadded.
+static std::vector<uint8_t> _Bmp(int32_t cx, int32_t cy, uint16_t cBitCount,
+                                 const std::vector<uint8_t> &rgbPalette, const std::vector<uint8_t> &rgbRows)
+{
+    uint32_t cRows = static_cast<uint32_t>(cy < 0 ? -cy : cy);
+    size_t cbRow = (static_cast<size_t>(cx) * cBitCount + 7) / 8;
+    size_t cbStride = (static_cast<size_t>(cx) * cBitCount + 31) / 32 * 4;
+
+    std::vector<uint8_t> rgb;
+    rgb.push_back('B');
+    rgb.push_back('M');
+    _AppendU32(rgb, static_cast<uint32_t>(54 + rgbPalette.size() + cbStride * cRows));
+    _AppendU32(rgb, 0);
+    _AppendU32(rgb, static_cast<uint32_t>(54 + rgbPalette.size()));
+    _AppendU32(rgb, 40);
+    _AppendU32(rgb, static_cast<uint32_t>(cx));
+    _AppendU32(rgb, static_cast<uint32_t>(cy));
+    _AppendU16(rgb, 1);
+    _AppendU16(rgb, cBitCount);
+    _AppendU32(rgb, 0);
+    _AppendU32(rgb, static_cast<uint32_t>(cbStride * cRows));
+    _AppendU32(rgb, 2835);
+    _AppendU32(rgb, 2835);
+    _AppendU32(rgb, static_cast<uint32_t>(rgbPalette.size() / 4));
+    _AppendU32(rgb, 0);
+    rgb.insert(rgb.end(), rgbPalette.begin(), rgbPalette.end());
+    for (uint32_t y = 0; y < cRows; y++)
+    {
+        rgb.insert(rgb.end(), rgbRows.begin() + y * cbRow, rgbRows.begin() + (y + 1) * cbRow);
+        rgb.insert(rgb.end(), cbStride - cbRow, 0);
+    }
+    return rgb;
+}
+
+static void _SetU32(std::vector<uint8_t> &rgb, size_t ib, uint32_t dw)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        rgb[ib + i] = static_cast<uint8_t>(dw >> (8 * i));
+    }
+}
+
+// A cx by cy 24 bpp file with a different color in every pixel.
+static std::vector<uint8_t> _Gradient(int32_t cx, int32_t cy)
+{
+    std::vector<uint8_t> rgbRows;
+    for (int32_t i = 0; i < cx * (cy < 0 ? -cy : cy); i++)
+    {
+        rgbRows.push_back(static_cast<uint8_t>(i));
+        rgbRows.push_back(static_cast<uint8_t>(i * 5));
+        rgbRows.push_back(static_cast<uint8_t>(i >> 3));
+    }
+    return _Bmp(cx, cy, 24, {}, rgbRows);
+}
+
+// Streams the cb bytes at pb to a decoder in blocks of cbBlock. Returns whether
+// every Write succeeded; the decoder is left for the caller to look at.
+static bool _Stream(const uint8_t *pb, size_t cb, size_t cbBlock, CBmpStreamDecoder *pDecoder)
+{
+    bool fWritten = true;
+    for (size_t ib = 0; ib < cb && fWritten; ib += cbBlock)
+    {
+        fWritten = pDecoder->Write(pb + ib, (std::min)(cb - ib, cbBlock));
+    }
+    return fWritten;
+}
+
+static bool _Pixel(const BITMAP_IMAGE &image, uint32_t x, uint32_t y, uint8_t b, uint8_t g, uint8_t r)
+{
+    const uint8_t *pb = image.pixels.data() + (static_cast<size_t>(y) * image.cx + x) * 4;
+    return pb[0] == b && pb[1] == g && pb[2] == r && pb[3] == 0xFF;
+}
+
+static std::vector<uint8_t> _ReadFile(const char *pszPath)
+{
+    std::vector<uint8_t> rgb;
+    FILE *pfile = fopen(pszPath, "rb");
+    if (pfile != nullptr)
+    {
+        uint8_t rgbBlock[4096];
+        size_t cb;
+        while ((cb = fread(rgbBlock, 1, sizeof(rgbBlock), pfile)) > 0)
+        {
+            rgb.insert(rgb.end(), rgbBlock, rgbBlock + cb);
+        }
+        fclose(pfile);
+    }
+    return rgb;
+}
+
+// Every width up to a few SIMD iterations past the shortest row the SIMD loop takes,
+// so each count of tail pixels is seen, and a few long rows, from each alignment of
+// the source. The source is exactly the row, so a load past its end shows up under
+// AddressSanitizer, and the destination is followed by guard bytes.
+static void ConvertsRowsLikeScalar()
+{
+    std::vector<size_t> rgcPixels;
+    for (size_t cPixels = 0; cPixels <= 40; cPixels++)
+    {
+        rgcPixels.push_back(cPixels);
+    }
+    rgcPixels.push_back(127);
+    rgcPixels.push_back(128);
+    rgcPixels.push_back(129);
+    rgcPixels.push_back(c_cMaxImageDimension - 1);
+    rgcPixels.push_back(c_cMaxImageDimension);
+
+    for (size_t cPixels : rgcPixels)
+    {
+        for (size_t ibAlign = 0; ibAlign < 4; ibAlign++)
+        {
+            std::vector<uint8_t> rgbSource(ibAlign + cPixels * 3);
+            for (size_t i = 0; i < rgbSource.size(); i++)
+            {
+                rgbSource[i] = static_cast<uint8_t>(i * 37 + cPixels);
+            }
+            std::vector<uint8_t> rgbExpected(cPixels * 4 + 16, c_bGuard);
+            std::vector<uint8_t> rgbActual(cPixels * 4 + 16, c_bGuard);
+            _ConvertRowReference(rgbSource.data() + ibAlign, rgbExpected.data(), cPixels);
+            ConvertRowBgrToBgra(rgbSource.data() + ibAlign, rgbActual.data(), cPixels);
+            CHECK(rgbActual == rgbExpected);
+        }
+    }
+}
+
+// An odd width pads each row, which a bottom-up file stores last row first.
+static void DecodesTrueColorRows()
+{
+    std::vector<uint8_t> rgbRows;
+    for (uint32_t i = 0; i < 5 * 3; i++)
+    {
+        rgbRows.push_back(static_cast<uint8_t>(i * 3));
+        rgbRows.push_back(static_cast<uint8_t>(i * 3 + 1));
+        rgbRows.push_back(static_cast<uint8_t>(i * 3 + 2));
+    }
+
+    BITMAP_IMAGE image;
+    std::vector<uint8_t> rgbBottomUp = _Bmp(5, 3, 24, {}, rgbRows);
+    CHECK(BmpDecode(rgbBottomUp.data(), rgbBottomUp.size(), &image));
+    CHECK(image.cx == 5 && image.cy == 3);
+    CHECK(_Pixel(image, 0, 2, 0, 1, 2));
+    CHECK(_Pixel(image, 4, 0, 42, 43, 44));
+
+    std::vector<uint8_t> rgbTopDown = _Bmp(5, -3, 24, {}, rgbRows);
+    CHECK(BmpDecode(rgbTopDown.data(), rgbTopDown.size(), &image));
+    CHECK(_Pixel(image, 0, 0, 0, 1, 2));
+    CHECK(_Pixel(image, 4, 2, 42, 43, 44));
+
+    // The unused fourth byte of a 32 bpp pixel is ignored.
+    std::vector<uint8_t> rgb32 = _Bmp(1, 1, 32, {}, { 10, 20, 30, 0 });
+    CHECK(BmpDecode(rgb32.data(), rgb32.size(), &image));
+    CHECK(_Pixel(image, 0, 0, 10, 20, 30));
+}
+
+// Palette indexes are read from the high bits of each byte first, and an index past
+// the palette takes its first color.
+static void DecodesPaletteRows()
+{
+    std::vector<uint8_t> rgbPalette = { 0, 0, 0, 0,  255, 255, 255, 0 };
+    BITMAP_IMAGE image;
+    std::vector<uint8_t> rgb1 = _Bmp(9, -1, 1, rgbPalette, { 0xA0, 0x80 });
+    CHECK(BmpDecode(rgb1.data(), rgb1.size(), &image));
+    CHECK(_Pixel(image, 0, 0, 255, 255, 255));
+    CHECK(_Pixel(image, 1, 0, 0, 0, 0));
+    CHECK(_Pixel(image, 2, 0, 255, 255, 255));
+    CHECK(_Pixel(image, 8, 0, 255, 255, 255));
+
+    std::vector<uint8_t> rgb8 = _Bmp(3, -1, 8, rgbPalette, { 1, 0, 7 });
+    CHECK(BmpDecode(rgb8.data(), rgb8.size(), &image));
+    CHECK(_Pixel(image, 0, 0, 255, 255, 255));
+    CHECK(_Pixel(image, 1, 0, 0, 0, 0));
+    CHECK(_Pixel(image, 2, 0, 0, 0, 0));
+}
+
+// The tile image is already tile sized, so scaling it and streaming it must both
+// give back the decoded pixels. bitmap1.bmp is a 4 bpp image that grows to the tile.
+static void DecodesTheTileImages()
+{
+    static const char *const c_rgpszFiles[] = { "../tileimage.bmp", "../bitmap1.bmp" };
+    static const uint32_t c_rgcxExpected[] = { 128, 48 };
+    for (size_t iFile = 0; iFile < ARRAYSIZE(c_rgpszFiles); iFile++)
+    {
+        std::vector<uint8_t> rgbFile = _ReadFile(c_rgpszFiles[iFile]);
+        BITMAP_IMAGE decoded;
+        CHECK(BmpDecode(rgbFile.data(), rgbFile.size(), &decoded));
+        CHECK(decoded.cx == c_rgcxExpected[iFile] && decoded.cy == c_rgcxExpected[iFile]);
+
+        BITMAP_IMAGE scaled;
+        CHECK(ImageScale(decoded, 128, 128, &scaled));
+        CHECK(scaled.pixels.size() == 128 * 128 * 4);
+
+        CBmpStreamDecoder decoder(128, 128);
+        for (size_t ib = 0; ib < rgbFile.size(); ib += 1000)
+        {
+            CHECK(decoder.Write(rgbFile.data() + ib, (std::min)(rgbFile.size() - ib, static_cast<size_t>(1000))));
+        }
+        BITMAP_IMAGE streamed;
+        CHECK(decoder.IsComplete());
+        CHECK(decoder.TakeImage(&streamed));
+        CHECK(streamed.cx == 128 && streamed.cy == 128);
+        if (decoded.cx == 128)
+        {
+            CHECK(scaled.pixels == decoded.pixels);
+            CHECK(streamed.pixels == decoded.pixels);
+        }
+    }
+}
+
+// However the file is split, shrinking or growing, the decoder sees the same rows.
+static void StreamsAnySplit()
+{
+    static const uint32_t c_rgcxyTarget[] = { 16, 50 };
+    for (int32_t cy : { 23, -23 })
+    {
+        std::vector<uint8_t> rgbFile = _Gradient(37, cy);
+        for (uint32_t cxyTarget : c_rgcxyTarget)
+        {
+            CBmpStreamDecoder whole(cxyTarget, cxyTarget);
+            BITMAP_IMAGE expected;
+            CHECK(_Stream(rgbFile.data(), rgbFile.size(), rgbFile.size(), &whole));
+            CHECK(whole.TakeImage(&expected));
+            CHECK(expected.cx == cxyTarget && expected.cy == cxyTarget);
+
+            for (size_t cbBlock = 1; cbBlock <= 120; cbBlock++)
+            {
+                CBmpStreamDecoder decoder(cxyTarget, cxyTarget);
+                BITMAP_IMAGE image;
+                CHECK(_Stream(rgbFile.data(), rgbFile.size(), cbBlock, &decoder));
+                CHECK(decoder.TakeImage(&image));
+                CHECK(image.pixels == expected.pixels);
+            }
+        }
+    }
+}
+
+// Each header a stream cannot decode is refused once it is in, and BmpDecode
+// refuses the same files.
+static void StreamRefusesBadHeaders()
+{
+    const std::vector<uint8_t> rgbGood = _Gradient(5, 3);
+    struct BAD_FIELD
+    {
+        size_t      ib;
+        uint32_t    dw;
+        size_t      cb;
+    };
+    static const BAD_FIELD c_rgBad[] =
+    {
+        { 0, 'B' | ('X' << 8), 2 },     // Not "BM"
+        { 10, 20, 4 },                  // Pixels inside the file header
+        { 10, static_cast<uint32_t>(c_cbMaxBmpHeaders + 1), 4 },
+        { 14, 12, 4 },                  // BITMAPCOREHEADER
+        { 14, 1000, 4 },                // Info header past the pixels
+        { 18, 0, 4 },                   // No width
+        { 18, 0xFFFFFFFF, 4 },          // Negative width
+        { 18, c_cMaxImageDimension + 1, 4 },
+        { 22, 0, 4 },                   // No height
+        { 22, 0x80000000, 4 },          // Most negative height
+        { 22, c_cMaxImageDimension + 1, 4 },
+        { 28, 16, 2 },                  // 16 bpp
+        { 28, 8, 2 },                   // A palette the headers do not hold
+        { 30, 1, 4 },                   // RLE8
+        { 30, 3, 4 },                   // Bitfields at 24 bpp
+    };
+    for (const BAD_FIELD &bad : c_rgBad)
+    {
+        std::vector<uint8_t> rgbFile = rgbGood;
+        for (size_t i = 0; i < bad.cb; i++)
+        {
+            rgbFile[bad.ib + i] = static_cast<uint8_t>(bad.dw >> (8 * i));
+        }
+        CBmpStreamDecoder decoder(16, 16);
+        BITMAP_IMAGE image;
+        CHECK(!_Stream(rgbFile.data(), rgbFile.size(), rgbFile.size(), &decoder));
+        CHECK(!decoder.IsComplete() && !decoder.TakeImage(&image));
+        CHECK(!BmpDecode(rgbFile.data(), rgbFile.size(), &image));
+    }
+
+    // 32 bpp bitfields are only taken with the BGRX masks.
+    std::vector<uint8_t> rgbBitfields = _Bmp(1, 1, 32, { 0, 0, 0xFF, 0,  0, 0xFF, 0, 0,  0xFF, 0, 0, 0 }, { 1, 2, 3, 4 });
+    _SetU32(rgbBitfields, 30, 3);
+    _SetU32(rgbBitfields, 46, 0);
+    CBmpStreamDecoder good(1, 1);
+    CHECK(_Stream(rgbBitfields.data(), rgbBitfields.size(), 1, &good) && good.IsComplete());
+    rgbBitfields[54] = 0xFF;
+    CBmpStreamDecoder bad(1, 1);
+    CHECK(!_Stream(rgbBitfields.data(), rgbBitfields.size(), 1, &bad));
+
+    // A decoder with no size refuses everything.
+    CBmpStreamDecoder empty(0, 16);
+    CHECK(!empty.Write(rgbGood.data(), rgbGood.size()));
+}
+
+// A file cut short anywhere is never complete and gives no image; bytes after the
+// last row are ignored.
+static void StreamStopsShortOfTruncatedFiles()
+{
+    std::vector<uint8_t> rgbFile = _Gradient(5, 3);
+    for (size_t cb = 0; cb < rgbFile.size(); cb++)
+    {
+        CBmpStreamDecoder decoder(4, 4);
+        BITMAP_IMAGE image;
+        CHECK(_Stream(rgbFile.data(), cb, 1, &decoder));
+        CHECK(!decoder.IsComplete() && !decoder.TakeImage(&image));
+        CHECK(!BmpDecode(rgbFile.data(), cb, &image));
+    }
+
+    rgbFile.insert(rgbFile.end(), 100, 0xEE);
+    CBmpStreamDecoder decoder(4, 4);
+    BITMAP_IMAGE image;
+    CHECK(_Stream(rgbFile.data(), rgbFile.size(), 7, &decoder));
+    CHECK(decoder.TakeImage(&image));
+
+    // The image can only be taken once.
+    CHECK(!decoder.TakeImage(&image));
+}
+
+// Small files of every supported depth with headers and rows damaged, cut short or
+// run on, streamed in random blocks and decoded whole from an exactly sized heap
+// copy, so an overrun shows up under AddressSanitizer. A file costs about as much
+// as ten packed logons, so a tenth of the iterations are run.
+static void FuzzesDecoders()
+{
+    static const uint16_t c_rgcBitCount[] = { 1, 4, 8, 24, 32 };
+    static const uint32_t c_rgdwInteresting[] = { 0, 1, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF, c_cMaxImageDimension, c_cMaxImageDimension + 1, 54, 4096 };
+    std::mt19937 random(s_dwSeed);
+    const DWORD cIterations = s_cFuzzIterations / 10;
+    DWORD cStreamed = 0;
+    for (DWORD iIteration = 0; iIteration < cIterations; iIteration++)
+    {
+        uint16_t cBitCount = c_rgcBitCount[random() % ARRAYSIZE(c_rgcBitCount)];
+        int32_t cx = 1 + random() % 9;
+        int32_t cy = (1 + random() % 9) * ((random() % 2) ? -1 : 1);
+        std::vector<uint8_t> rgbPalette((cBitCount <= 8) ? (4u << cBitCount) : 0);
+        std::vector<uint8_t> rgbRows((cx * cBitCount + 7) / 8 * (cy < 0 ? -cy : cy));
+        for (uint8_t &b : rgbPalette)
+        {
+            b = static_cast<uint8_t>(random());
+        }
+        for (uint8_t &b : rgbRows)
+        {
+            b = static_cast<uint8_t>(random());
+        }
+        std::vector<uint8_t> rgbFile = _Bmp(cx, cy, cBitCount, rgbPalette, rgbRows);
+
+        size_t cbHeaders = 54 + rgbPalette.size();
+        DWORD cMutations = random() % 4;
+        for (DWORD i = 0; i < cMutations; i++)
+        {
+            switch (random() % 4)
+            {
+            case 0:
+                rgbFile[random() % cbHeaders] ^= static_cast<uint8_t>(1 << (random() % 8));
+                break;
+            case 1:
+                _SetU32(rgbFile, random() % (cbHeaders - 3), c_rgdwInteresting[random() % ARRAYSIZE(c_rgdwInteresting)]);
+                break;
+            case 2:
+                rgbFile.resize(random() % rgbFile.size());
+                break;
+            default:
+                rgbFile.resize(rgbFile.size() + random() % 64, static_cast<uint8_t>(random()));
+                break;
+            }
+            if (rgbFile.size() < cbHeaders)
+            {
+                break;
+            }
+        }
+
+        uint8_t *pb = rgbFile.empty() ? nullptr : new uint8_t[rgbFile.size()];
+        if (pb != nullptr)
+        {
+            memcpy(pb, rgbFile.data(), rgbFile.size());
+        }
+        BITMAP_IMAGE image;
+        if (BmpDecode(pb, rgbFile.size(), &image))
+        {
+            CHECK(image.pixels.size() == static_cast<size_t>(image.cx) * image.cy * 4);
+        }
+
+        uint32_t cxTarget = 1 + random() % 12;
+        uint32_t cyTarget = 1 + random() % 12;
+        CBmpStreamDecoder decoder(cxTarget, cyTarget);
+        _Stream(pb, rgbFile.size(), 1 + random() % 64, &decoder);
+        if (decoder.IsComplete())
+        {
+            cStreamed++;
+            CHECK(decoder.TakeImage(&image));
+            CHECK(image.cx == cxTarget && image.cy == cyTarget && image.pixels.size() == static_cast<size_t>(cxTarget) * cyTarget * 4);
+        }
+        delete[] pb;
+    }
+
+    // Plenty of the damaged files should still decode, or the fuzzing only ever
+    // reaches the first check.
+    CHECK(cStreamed > cIterations / 10);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2)
+    {
+        s_cFuzzIterations = static_cast<DWORD>(strtoul(argv[1], nullptr, 10));
+    }
+    if (argc >= 3)
+    {
+        s_dwSeed = static_cast<DWORD>(strtoul(argv[2], nullptr, 10));
+    }
+
+    RUN_TEST(ConvertsRowsLikeScalar);
+    RUN_TEST(DecodesTrueColorRows);
+    RUN_TEST(DecodesPaletteRows);
+    RUN_TEST(DecodesTheTileImages);
+    RUN_TEST(StreamsAnySplit);
+    RUN_TEST(StreamRefusesBadHeaders);
+    RUN_TEST(StreamStopsShortOfTruncatedFiles);
+    RUN_TEST(FuzzesDecoders);
+    return TestExitCode();
+}
@@ -0,0 +1,285 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Runs CBluetoothScanner over simulated radios.
+
+#include <windows.h>
+#include <atomic>
+#include <vector>
+#include "BluetoothScanner.h"
+#include "SimulatedBluetoothRadios.h"
+#include "TestHarness.h"
+
+static const WCHAR c_szTarget[] = L"Test Phone";
+static const ULONGLONG c_ullTargetAddress = 0x1234;
+static const DWORD c_dwInquiryMs = 20;
+static const DWORD c_dwTimeoutMs = 5000;
+
+class CTestSink : public IBluetoothProximitySink
+{
+public:
+    void OnTargetDeviceInProximity(const BLUETOOTH_ADDRESS &address, DWORD dwRadio)
+    {
+        ullAddress = address.ullLong;
+        dwArrivalRadio = dwRadio;
+        cArrivals++;
+    }
+
+    void OnTargetDeviceDeparted()
+    {
+        cDepartures++;
+    }
+
+    std::atomic<ULONGLONG>  ullAddress{0};
+    std::atomic<DWORD>      dwArrivalRadio{0};
+    std::atomic<LONG>       cArrivals{0};
+    std::atomic<LONG>       cDepartures{0};
+};
+
+static bool _AllRadiosScanned(const CBluetoothScanner &scanner)
+{
+    std::vector<BLUETOOTH_RADIO_STATS> stats;
+    scanner.GetRadioStats(&stats);
+    for (const BLUETOOTH_RADIO_STATS &radio : stats)
+    {
+        if (radio.cScans == 0)
+        {
+            return false;
+        }
+    }
+    return !stats.empty();
+}
+
+// Sets the absence window the next scan reads from the registry.
+static void _SetAbsenceWindowSeconds(DWORD dwSeconds)
+{
+    HKEY hKey;
+    CHECK(RegCreateKeyExW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\AbsoluteID", 0, nullptr, 0, KEY_WRITE, nullptr, &hKey, nullptr) == ERROR_SUCCESS);
+    CHECK(RegSetValueExW(hKey, L"AbsenceWindowSeconds", 0, REG_DWORD, reinterpret_cast<const BYTE *>(&dwSeconds), sizeof(dwSeconds)) == ERROR_SUCCESS);
+    RegCloseKey(hKey);
+}
+
+static void _WaitForScanThreadsToExit()
+{
+    CHECK(WaitUntil([] { return ShimDllRefCount() == 0; }, c_dwTimeoutMs));
+}
+
+// Three radios see overlapping sets of devices; the scanner keeps one sighting per
+// address, credits each device to one radio and reports the target once.
+static void MergesSightingsAcrossRadios()
+{
+    ShimResetRegistry();
+    CSimulatedRadioSource radios(3, c_dwInquiryMs);
+    radios.SetInRange(0, 0xA1, L"Headphones", true);
+    radios.SetInRange(0, 0xB2, L"Keyboard", true);
+    radios.SetInRange(1, 0xB2, L"Keyboard", true);
+    radios.SetInRange(1, 0xC3, L"Mouse", true);
+    radios.SetInRange(2, 0xC3, L"Mouse", true);
+    radios.SetInRange(2, 0xD4, L"Watch", true);
+    radios.SetInRange(2, c_ullTargetAddress, c_szTarget, true);
+
+    CTestSink sink;
+    {
+        CBluetoothScanner scanner(&radios);
+        CHECK(scanner.Start(c_szTarget, &sink) == S_OK);
+        CHECK(scanner.IsTracking(c_szTarget, &sink));
+        CHECK(scanner.Start(c_szTarget, &sink) == S_FALSE);
+        CHECK(WaitUntil([&scanner] { return _AllRadiosScanned(scanner); }, c_dwTimeoutMs));
+
+        std::vector<BLUETOOTH_SIGHTING> sightings;
+        scanner.GetSightings(&sightings);
+        CHECK(sightings.size() == 5);
+
+        std::vector<BLUETOOTH_RADIO_STATS> stats;
+        scanner.GetRadioStats(&stats);
+        CHECK(stats.size() == 3);
+        DWORD cFirstSightings = 0;
+        for (DWORD i = 0; i < stats.size(); i++)
+        {
+            cFirstSightings += stats[i].cFirstSightings;
+            CHECK(stats[i].address.ullLong == 0xA000 + i);
+        }
+        CHECK(cFirstSightings == 5);
+        CHECK(stats[0].cSightings == 2);
+        CHECK(stats[1].cSightings == 2);
+        CHECK(stats[2].cSightings == 3);
+        CHECK(stats[0].ullTargetLatencyMs == 0);
+        CHECK(stats[1].ullTargetLatencyMs == 0);
+        CHECK(stats[2].ullTargetLatencyMs >= c_dwInquiryMs);
+
+        CHECK(WaitUntil([&sink] { return sink.cArrivals == 1; }, c_dwTimeoutMs));
+        CHECK(sink.dwArrivalRadio == 2);
+        CHECK(sink.ullAddress == c_ullTargetAddress);
+    }
+    _WaitForScanThreadsToExit();
+    CHECK(sink.cArrivals == 1);
+    CHECK(sink.cDepartures == 0);
+}
+
+// Every radio sees the target; whichever sees it first reports it, and only once.
+static void ReportsTargetOnceWhenEveryRadioSeesIt()
+{
+    ShimResetRegistry();
+    CSimulatedRadioSource radios(4, c_dwInquiryMs);
+    for (DWORD i = 0; i < 4; i++)
+    {
+        radios.SetInRange(i, c_ullTargetAddress, c_szTarget, true);
+    }
+
+    CTestSink sink;
+    {
+        CBluetoothScanner scanner(&radios);
+        CHECK(scanner.Start(c_szTarget, &sink) == S_OK);
+        CHECK(WaitUntil([&scanner] { return _AllRadiosScanned(scanner); }, c_dwTimeoutMs));
+
+        std::vector<BLUETOOTH_SIGHTING> sightings;
+        scanner.GetSightings(&sightings);
+        CHECK(sightings.size() == 1);
+
+        std::vector<BLUETOOTH_RADIO_STATS> stats;
+        scanner.GetRadioStats(&stats);
+        DWORD cFirstSightings = 0;
+        for (const BLUETOOTH_RADIO_STATS &radio : stats)
+        {
+            cFirstSightings += radio.cFirstSightings;
+            CHECK(radio.cSightings == 1);
+        }
+        CHECK(cFirstSightings == 1);
+        CHECK(sightings.size() == 1 && stats[sightings[0].dwRadio].cFirstSightings == 1);
+        CHECK(WaitUntil([&sink] { return sink.cArrivals > 0; }, c_dwTimeoutMs));
+    }
+    _WaitForScanThreadsToExit();
+    CHECK(sink.cArrivals == 1);
+}
+
+// Starting for another target stops the scan in progress and starts a fresh one.
+static void RestartsForAnotherTarget()
+{
+    ShimResetRegistry();
+    CSimulatedRadioSource radios(2, c_dwInquiryMs);
+    radios.SetInRange(1, c_ullTargetAddress, c_szTarget, true);
+
+    CTestSink sink;
+    {
+        CBluetoothScanner scanner(&radios);
+        CHECK(scanner.Start(L"Another Phone", &sink) == S_OK);
+        CHECK(!scanner.IsTracking(c_szTarget, &sink));
+        CHECK(scanner.Start(c_szTarget, &sink) == S_OK);
+        CHECK(scanner.IsRunning());
+        CHECK(WaitUntil([&sink] { return sink.cArrivals == 1; }, c_dwTimeoutMs));
+        scanner.Stop();
+        CHECK(!scanner.IsTracking(c_szTarget, &sink));
+    }
+    _WaitForScanThreadsToExit();
+}
+
+// Once the target has been gone for the absence window the sink hears of it, and
+// the devices nobody sees any more drop out of the sightings.
+static void ReportsDepartureAndPrunesSightings()
+{
+    ShimResetRegistry();
+    _SetAbsenceWindowSeconds(1);
+    CSimulatedRadioSource radios(2, c_dwInquiryMs);
+    radios.SetInRange(0, 0xA1, L"Headphones", true);
+    radios.SetInRange(1, c_ullTargetAddress, c_szTarget, true);
+
+    CTestSink sink;
+    {
+        CBluetoothScanner scanner(&radios);
+        CHECK(scanner.Start(c_szTarget, &sink) == S_OK);
+        CHECK(WaitUntil([&sink] { return sink.cArrivals == 1; }, c_dwTimeoutMs));
+        CHECK(WaitUntil([&scanner] { return _AllRadiosScanned(scanner); }, c_dwTimeoutMs));
+
+        radios.SetOutOfRange(0xA1);
+        radios.SetOutOfRange(c_ullTargetAddress);
+        CHECK(WaitUntil([&sink] { return sink.cDepartures == 1; }, c_dwTimeoutMs));
+        CHECK(WaitUntil([&scanner]
+        {
+            std::vector<BLUETOOTH_SIGHTING> sightings;
+            scanner.GetSightings(&sightings);
+            return sightings.empty();
+        }, c_dwTimeoutMs));
+    }
+    _WaitForScanThreadsToExit();
+    CHECK(sink.cArrivals == 1);
+    CHECK(sink.cDepartures == 1);
+}
+
+// The sink is called without the scanner's lock, so it can query the scanner,
+// and Stop waits for a call in progress before returning.
+class CReentrantSink : public IBluetoothProximitySink
+{
+public:
+    explicit CReentrantSink(CBluetoothScanner *pScanner) :
+        _pScanner(pScanner)
+    {
+    }
+
+    void OnTargetDeviceInProximity(const BLUETOOTH_ADDRESS &address, DWORD dwRadio)
+    {
+        std::vector<BLUETOOTH_SIGHTING> sightings;
+        _pScanner->GetSightings(&sightings);
+        cSightingsSeen = static_cast<LONG>(sightings.size());
+        fRunningSeen = _pScanner->IsRunning();
+        fEntered = true;
+        Sleep(200);
+        fReturned = true;
+    }
+
+    void OnTargetDeviceDeparted()
+    {
+    }
+
+    std::atomic<LONG>   cSightingsSeen{0};
+    std::atomic<bool>   fRunningSeen{false};
+    std::atomic<bool>   fEntered{false};
+    std::atomic<bool>   fReturned{false};
+
+private:
+    CBluetoothScanner   *_pScanner;
+};
+
+static void SinkCanCallTheScanner()
+{
+    ShimResetRegistry();
+    CSimulatedRadioSource radios(2, c_dwInquiryMs);
+    radios.SetInRange(0, c_ullTargetAddress, c_szTarget, true);
+    radios.SetInRange(1, 0xB2, L"Keyboard", true);
+
+    CBluetoothScanner scanner(&radios);
+    CReentrantSink sink(&scanner);
+    CHECK(scanner.Start(c_szTarget, &sink) == S_OK);
+    CHECK(WaitUntil([&sink] { return sink.fEntered.load(); }, c_dwTimeoutMs));
+    scanner.Stop();
+    CHECK(sink.fReturned);
+    CHECK(sink.cSightingsSeen >= 1);
+    CHECK(sink.fRunningSeen);
+    _WaitForScanThreadsToExit();
+}
+
+// Without any radio there is nothing to scan with.
+static void FailsWithoutRadios()
+{
+    CSimulatedRadioSource radios(0, c_dwInquiryMs);
+    CTestSink sink;
+    CBluetoothScanner scanner(&radios);
+    CHECK(FAILED(scanner.Start(c_szTarget, &sink)));
+    CHECK(!scanner.IsRunning());
+    CHECK(!scanner.IsTracking(c_szTarget, &sink));
+}
+
+int main()
+{
+    RUN_TEST(MergesSightingsAcrossRadios);
+    RUN_TEST(ReportsTargetOnceWhenEveryRadioSeesIt);
+    RUN_TEST(RestartsForAnotherTarget);
+    RUN_TEST(ReportsDepartureAndPrunesSightings);
+    RUN_TEST(SinkCanCallTheScanner);
+    RUN_TEST(FailsWithoutRadios);
+    return TestExitCode();
+}
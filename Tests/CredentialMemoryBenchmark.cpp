@@ -0,0 +1,297 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Measures what each credential costs in memory, in the layout the sample had
+// and in the current one, by building the per-user state of CSampleCredential
+// the way each does and counting the CoTaskMem blocks through the shim. The
+// sample copied the field descriptors with FieldDescriptorCopy, a label string
+// each, and held every field string in its own SHStrDupW allocation. The
+// current layout points at the shared descriptors and keeps the field strings
+// in a CFieldStrings. Both hold the user SID and the qualified user name. Only
+// the members that differ are built; the rest of CSampleCredential is the same
+// in both, and the credentials themselves come from the slab pool.
+//
+// Heap bytes are counted at the size malloc gave each block, without its header.
+//
+//   CredentialMemoryBenchmark [users]
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "FieldStrings.h"
+#include "MockCredentialProviderUsers.h"
+
+// The fields of a tile, as SAMPLE_FIELD_ID in common.h.
+enum BENCH_FIELD_ID
+{
+    BFI_TILEIMAGE,
+    BFI_LABEL,
+    BFI_LARGE_TEXT,
+    BFI_FULLNAME_TEXT,
+    BFI_DISPLAYNAME_TEXT,
+    BFI_LOGONSTATUS_TEXT,
+    BFI_NUM_FIELDS,
+};
+
+// As FIELD_STATE_PAIR in common.h.
+struct BENCH_FIELD_STATE_PAIR
+{
+    CREDENTIAL_PROVIDER_FIELD_STATE             cpfs;
+    CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE cpfis;
+};
+
+// The labels of s_rgCredProvFieldDescriptors in common.h.
+static const PCWSTR c_rgpszLabels[BFI_NUM_FIELDS] =
+{
+    L"Image",
+    L"Log in with your AbsoluteID App",
+    L"AbsoluteID Credential Provider",
+    L"Full name: ",
+    L"Display name: ",
+    L"Logon status: ",
+};
+
+// The text each credential shows and holds for one user, formatted up front so
+// that reading the mock users does not count.
+struct USER_TEXT
+{
+    WCHAR   szSid[64];
+    WCHAR   szQualifiedUserName[64];
+    WCHAR   szFullName[128];
+    WCHAR   szDisplayName[128];
+    WCHAR   szLogonStatus[128];
+};
+
+// The members of the sample's CSampleCredential that the current layout replaced.
+struct SAMPLE_CREDENTIAL
+{
+    CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR    rgcpfd[BFI_NUM_FIELDS];     // Deep copies, a label allocation each
+    BENCH_FIELD_STATE_PAIR                  rgfsp[BFI_NUM_FIELDS];
+    PWSTR                                   rgpszFields[BFI_NUM_FIELDS];    // An allocation each
+    PWSTR                                   pszUserSid;
+    PWSTR                                   pszQualifiedUserName;
+};
+
+// The same members in the current CSampleCredential.
+struct PACKED_CREDENTIAL
+{
+    PACKED_CREDENTIAL() :
+        rgcpfd(nullptr),
+        fieldStrings(BFI_NUM_FIELDS),
+        pszUserSid(nullptr),
+        pszQualifiedUserName(nullptr)
+    {
+    }
+
+    CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR const  *rgcpfd;    // Shared by every credential
+    BENCH_FIELD_STATE_PAIR                      rgfsp[BFI_NUM_FIELDS];
+    CFieldStrings                               fieldStrings;
+    PWSTR                                       pszUserSid;
+    PWSTR                                       pszQualifiedUserName;
+};
+
+static CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR s_rgFieldDescriptors[BFI_NUM_FIELDS];
+static const BENCH_FIELD_STATE_PAIR s_rgFieldStatePairs[BFI_NUM_FIELDS] = {};
+
+// Sets a field as the sample's _UpdateFieldFromProperty did: a new copy only when the value differs.
+static void _SampleSetField(SAMPLE_CREDENTIAL *pCredential, DWORD dwField, PCWSTR pszValue)
+{
+    PWSTR &pszField = pCredential->rgpszFields[dwField];
+    if (pszField == nullptr || wcscmp(pszField, pszValue) != 0)
+    {
+        PWSTR pszCopy;
+        if (SUCCEEDED(MockStrDup(pszValue, &pszCopy)))
+        {
+            CoTaskMemFree(pszField);
+            pszField = pszCopy;
+        }
+    }
+}
+
+static void _SampleSetProperties(SAMPLE_CREDENTIAL *pCredential, const USER_TEXT &text, PCWSTR pszLogonStatus)
+{
+    _SampleSetField(pCredential, BFI_FULLNAME_TEXT, text.szFullName);
+    _SampleSetField(pCredential, BFI_DISPLAYNAME_TEXT, text.szDisplayName);
+    _SampleSetField(pCredential, BFI_LOGONSTATUS_TEXT, pszLogonStatus);
+}
+
+// As the sample's Initialize followed by _UpdateUserProperties.
+static SAMPLE_CREDENTIAL *_SampleCreate(const USER_TEXT &text)
+{
+    SAMPLE_CREDENTIAL *pCredential = new SAMPLE_CREDENTIAL();
+    for (DWORD i = 0; i < BFI_NUM_FIELDS; i++)
+    {
+        // FieldDescriptorCopy
+        pCredential->rgfsp[i] = s_rgFieldStatePairs[i];
+        pCredential->rgcpfd[i] = s_rgFieldDescriptors[i];
+        MockStrDup(s_rgFieldDescriptors[i].pszLabel, &pCredential->rgcpfd[i].pszLabel);
+    }
+    MockStrDup(L"AbsoluteID Credential", &pCredential->rgpszFields[BFI_LABEL]);
+    MockStrDup(L"AbsoluteID Credential Provider", &pCredential->rgpszFields[BFI_LARGE_TEXT]);
+    MockStrDup(text.szSid, &pCredential->pszUserSid);
+    MockStrDup(text.szQualifiedUserName, &pCredential->pszQualifiedUserName);
+    _SampleSetProperties(pCredential, text, text.szLogonStatus);
+    return pCredential;
+}
+
+static void _SampleDelete(SAMPLE_CREDENTIAL *pCredential)
+{
+    for (DWORD i = 0; i < BFI_NUM_FIELDS; i++)
+    {
+        CoTaskMemFree(pCredential->rgpszFields[i]);
+        CoTaskMemFree(pCredential->rgcpfd[i].pszLabel);
+    }
+    CoTaskMemFree(pCredential->pszUserSid);
+    CoTaskMemFree(pCredential->pszQualifiedUserName);
+    delete pCredential;
+}
+
+// As CSampleCredential::_ApplyDisplayText.
+static void _PackedSetProperties(PACKED_CREDENTIAL *pCredential, const USER_TEXT &text, PCWSTR pszLogonStatus)
+{
+    PCWSTR rgpszValues[BFI_NUM_FIELDS] = {};
+    rgpszValues[BFI_FULLNAME_TEXT] = text.szFullName;
+    rgpszValues[BFI_DISPLAYNAME_TEXT] = text.szDisplayName;
+    rgpszValues[BFI_LOGONSTATUS_TEXT] = pszLogonStatus;
+    DWORD dwChanged;
+    pCredential->fieldStrings.Update(rgpszValues, &dwChanged);
+}
+
+// As CSampleCredential::Initialize followed by SetUserProperties.
+static PACKED_CREDENTIAL *_PackedCreate(const USER_TEXT &text)
+{
+    PACKED_CREDENTIAL *pCredential = new PACKED_CREDENTIAL();
+    pCredential->rgcpfd = s_rgFieldDescriptors;
+    for (DWORD i = 0; i < BFI_NUM_FIELDS; i++)
+    {
+        pCredential->rgfsp[i] = s_rgFieldStatePairs[i];
+    }
+    PCWSTR rgpszValues[BFI_NUM_FIELDS] = {};
+    rgpszValues[BFI_LABEL] = L"AbsoluteID Credential";
+    rgpszValues[BFI_LARGE_TEXT] = L"AbsoluteID Credential Provider";
+    DWORD dwChanged;
+    pCredential->fieldStrings.Update(rgpszValues, &dwChanged);
+    MockStrDup(text.szSid, &pCredential->pszUserSid);
+    MockStrDup(text.szQualifiedUserName, &pCredential->pszQualifiedUserName);
+    _PackedSetProperties(pCredential, text, text.szLogonStatus);
+    return pCredential;
+}
+
+static void _PackedDelete(PACKED_CREDENTIAL *pCredential)
+{
+    CoTaskMemFree(pCredential->pszUserSid);
+    CoTaskMemFree(pCredential->pszQualifiedUserName);
+    delete pCredential;
+}
+
+static void _FormatProperty(ICredentialProviderUser *pUser, REFPROPERTYKEY key, PCWSTR pszPrefix, PCWSTR pszNullValue, PWSTR pszValue, size_t cchValue)
+{
+    PWSTR pszProperty = nullptr;
+    if (SUCCEEDED(pUser->GetStringValue(key, &pszProperty)) && pszProperty != nullptr)
+    {
+        swprintf(pszValue, cchValue, L"%ls%ls", pszPrefix, pszProperty);
+        CoTaskMemFree(pszProperty);
+    }
+    else
+    {
+        swprintf(pszValue, cchValue, L"%ls", pszNullValue);
+    }
+}
+
+static std::vector<USER_TEXT> _FormatUsers(CMockUserArray *pUsers, DWORD cUsers)
+{
+    std::vector<USER_TEXT> rgText(cUsers);
+    for (DWORD i = 0; i < cUsers; i++)
+    {
+        CMockUser *pUser = pUsers->User(i);
+        PWSTR psz = nullptr;
+        pUser->GetSid(&psz);
+        swprintf(rgText[i].szSid, ARRAYSIZE(rgText[i].szSid), L"%ls", psz);
+        CoTaskMemFree(psz);
+        pUser->GetStringValue(PKEY_Identity_QualifiedUserName, &psz);
+        swprintf(rgText[i].szQualifiedUserName, ARRAYSIZE(rgText[i].szQualifiedUserName), L"%ls", psz);
+        CoTaskMemFree(psz);
+        _FormatProperty(pUser, PKEY_Identity_UserName, L"User Name: ", L"User Name is NULL", rgText[i].szFullName, ARRAYSIZE(rgText[i].szFullName));
+        _FormatProperty(pUser, PKEY_Identity_DisplayName, L"Display Name: ", L"Display Name is NULL", rgText[i].szDisplayName, ARRAYSIZE(rgText[i].szDisplayName));
+        _FormatProperty(pUser, PKEY_Identity_LogonStatusString, L"Logon Status: ", L"Logon Status is NULL", rgText[i].szLogonStatus, ARRAYSIZE(rgText[i].szLogonStatus));
+    }
+    return rgText;
+}
+
+// Creates a credential per user, refreshes them with the same properties and then
+// with a new logon status, and prints the CoTaskMem use of each step per credential.
+template <typename TCredential, typename TCreate, typename TSetProperties, typename TDelete>
+static void _Measure(PCSTR pszLayout, const std::vector<USER_TEXT> &rgText, TCreate create, TSetProperties setProperties, TDelete destroy)
+{
+    double cUsers = static_cast<double>(rgText.size());
+    SHIM_COTASKMEM_STATS before, created, refreshed, changed;
+
+    ShimGetCoTaskMemStats(&before);
+    std::vector<TCredential*> rgpCredentials;
+    for (const USER_TEXT &text : rgText)
+    {
+        rgpCredentials.push_back(create(text));
+    }
+    ShimGetCoTaskMemStats(&created);
+
+    for (size_t i = 0; i < rgText.size(); i++)
+    {
+        setProperties(rgpCredentials[i], rgText[i], rgText[i].szLogonStatus);
+    }
+    ShimGetCoTaskMemStats(&refreshed);
+
+    for (size_t i = 0; i < rgText.size(); i++)
+    {
+        setProperties(rgpCredentials[i], rgText[i], L"Logon Status: Signed in");
+    }
+    ShimGetCoTaskMemStats(&changed);
+
+    double cbHeap = (created.cbInUse - before.cbInUse) / cUsers;
+    printf("%-8s %8zu %8.1f %8.0f %9.0f %10.1f %10.1f %10.1f %10.1f\n",
+           pszLayout,
+           sizeof(TCredential),
+           (created.cBlocksInUse - before.cBlocksInUse) / cUsers,
+           cbHeap,
+           sizeof(TCredential) + cbHeap,
+           (sizeof(TCredential) + cbHeap) * cUsers / 1024.0,
+           (created.cAllocations - before.cAllocations) / cUsers,
+           (refreshed.cAllocations - created.cAllocations) / cUsers,
+           (changed.cAllocations - refreshed.cAllocations) / cUsers);
+
+    for (TCredential *pCredential : rgpCredentials)
+    {
+        destroy(pCredential);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    DWORD cUsers = (argc >= 2) ? static_cast<DWORD>(atoi(argv[1])) : 500;
+
+    for (DWORD i = 0; i < BFI_NUM_FIELDS; i++)
+    {
+        s_rgFieldDescriptors[i].dwFieldID = i;
+        s_rgFieldDescriptors[i].cpft = (i == BFI_TILEIMAGE) ? CPFT_TILE_IMAGE : CPFT_SMALL_TEXT;
+        s_rgFieldDescriptors[i].pszLabel = const_cast<PWSTR>(c_rgpszLabels[i]);
+    }
+
+    CMockUserArray *pUsers = new CMockUserArray();
+    pUsers->AddDomainUsers(0, cUsers, 0);
+    std::vector<USER_TEXT> rgText = _FormatUsers(pUsers, cUsers);
+    pUsers->Release();
+
+    printf("%u users; per credential unless noted, allocations are CoTaskMem blocks\n\n", cUsers);
+    printf("%-8s %8s %8s %8s %9s %10s %10s %10s %10s\n",
+           "layout", "object B", "blocks", "heap B", "total B", "all KB", "allocs", "same", "changed");
+    _Measure<SAMPLE_CREDENTIAL>("sample", rgText, _SampleCreate, _SampleSetProperties, _SampleDelete);
+    _Measure<PACKED_CREDENTIAL>("packed", rgText, _PackedCreate, _PackedSetProperties, _PackedDelete);
+    printf("\nallocs: made creating it; same: made refreshing it with unchanged properties;\n"
+           "changed: made refreshing it with a new logon status\n");
+    return 0;
+}
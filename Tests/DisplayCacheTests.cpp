@@ -0,0 +1,259 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Runs CDisplayCache against a cache file in a private ProgramData directory:
+// lookups, sharing between mappings, layout resets, collisions, expiry and
+// lock-free reads racing a writer.
+
+#include <windows.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <strsafe.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DisplayCache.h"
+#include "TestHarness.h"
+
+static std::string s_strProgramData;
+static std::wstring s_strCacheFile;
+
+// Gives the process its own ProgramData, so runs do not see each other's cache.
+static void _UseFreshProgramData()
+{
+    char szTemplate[] = "/tmp/DisplayCacheTests.XXXXXX";
+    s_strProgramData = mkdtemp(szTemplate);
+    std::wstring strDirectory(s_strProgramData.begin(), s_strProgramData.end());
+    ShimSetProgramDataPath(strDirectory.c_str());
+    s_strCacheFile = strDirectory + L"/AbsoluteID/DisplayCache.dat";
+}
+
+static void _DeleteCacheFile()
+{
+    DeleteFileW(s_strCacheFile.c_str());
+}
+
+static void _DeleteProgramData()
+{
+    _DeleteCacheFile();
+    rmdir((s_strProgramData + "/AbsoluteID").c_str());
+    rmdir(s_strProgramData.c_str());
+}
+
+static DISPLAY_TEXT _Text(PCWSTR pszFullName, PCWSTR pszDisplayName, PCWSTR pszLogonStatus)
+{
+    DISPLAY_TEXT text = {};
+    StringCchCopyW(text.szFullName, ARRAYSIZE(text.szFullName), pszFullName);
+    StringCchCopyW(text.szDisplayName, ARRAYSIZE(text.szDisplayName), pszDisplayName);
+    StringCchCopyW(text.szLogonStatus, ARRAYSIZE(text.szLogonStatus), pszLogonStatus);
+    return text;
+}
+
+static std::wstring _Sid(DWORD iUser)
+{
+    WCHAR szSid[64];
+    StringCchPrintfW(szSid, ARRAYSIZE(szSid), L"S-1-5-21-3623811015-3361044348-30300820-%u", 1000 + iUser);
+    return szSid;
+}
+
+static void StoresAndLooksUpBySid()
+{
+    _DeleteCacheFile();
+    CDisplayCache cache;
+    CHECK(cache.Open() == S_OK);
+    CHECK(cache.Open() == S_FALSE);
+
+    DISPLAY_TEXT text;
+    bool fStale;
+    CHECK(!cache.Lookup(L"S-1-5-21-1-2-3-1001", &text, &fStale));
+
+    cache.Update(L"S-1-5-21-1-2-3-1001", _Text(L"Alice Smith", L"alice", L"Signed in"));
+    CHECK(cache.Lookup(L"s-1-5-21-1-2-3-1001", &text, &fStale));
+    CHECK(!fStale);
+    CHECK(wcscmp(text.szFullName, L"Alice Smith") == 0);
+    CHECK(wcscmp(text.szDisplayName, L"alice") == 0);
+    CHECK(wcscmp(text.szLogonStatus, L"Signed in") == 0);
+
+    cache.Update(L"S-1-5-21-1-2-3-1001", _Text(L"Alice Jones", L"alice", L""));
+    CHECK(cache.Lookup(L"S-1-5-21-1-2-3-1001", &text, &fStale));
+    CHECK(wcscmp(text.szFullName, L"Alice Jones") == 0);
+    CHECK(!cache.Lookup(L"S-1-5-21-1-2-3-1002", &text, &fStale));
+}
+
+// Another mapping of the file, as in another LogonUI process, sees the same entries.
+static void SharesEntriesBetweenMappings()
+{
+    _DeleteCacheFile();
+    CDisplayCache writer;
+    CDisplayCache reader;
+    CHECK_HR(writer.Open());
+    CHECK_HR(reader.Open());
+
+    writer.Update(_Sid(1).c_str(), _Text(L"User 1", L"user1", L""));
+    DISPLAY_TEXT text;
+    bool fStale;
+    CHECK(reader.Lookup(_Sid(1).c_str(), &text, &fStale));
+    CHECK(wcscmp(text.szFullName, L"User 1") == 0);
+
+    // And the entries outlive the mappings.
+    {
+        CDisplayCache reopened;
+        CHECK_HR(reopened.Open());
+        CHECK(reopened.Lookup(_Sid(1).c_str(), &text, &fStale));
+    }
+}
+
+static void ResetsAFileOfAnotherLayout()
+{
+    _DeleteCacheFile();
+    {
+        CDisplayCache cache;
+        CHECK_HR(cache.Open());
+        cache.Update(_Sid(2).c_str(), _Text(L"User 2", L"user2", L""));
+    }
+
+    // Overwrite the header, as an older build with another layout would have left it.
+    HANDLE hFile = CreateFileW(s_strCacheFile.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    CHECK(hFile != INVALID_HANDLE_VALUE);
+    DWORD rgdwHeader[2] = { 0x43444941, 0 };
+    DWORD cbWritten;
+    CHECK(WriteFile(hFile, rgdwHeader, sizeof(rgdwHeader), &cbWritten, nullptr));
+    CloseHandle(hFile);
+
+    CDisplayCache cache;
+    CHECK_HR(cache.Open());
+    DISPLAY_TEXT text;
+    bool fStale;
+    CHECK(!cache.Lookup(_Sid(2).c_str(), &text, &fStale));
+    cache.Update(_Sid(2).c_str(), _Text(L"User 2", L"user2", L""));
+    CHECK(cache.Lookup(_Sid(2).c_str(), &text, &fStale));
+}
+
+// Every slot can be filled through the probe sequence; one more user takes over
+// its home slot rather than failing.
+static void FillsEverySlot()
+{
+    _DeleteCacheFile();
+    CDisplayCache cache;
+    CHECK_HR(cache.Open());
+
+    const DWORD c_cSlots = 256;
+    for (DWORD i = 0; i < c_cSlots; i++)
+    {
+        WCHAR szName[32];
+        StringCchPrintfW(szName, ARRAYSIZE(szName), L"User %u", i);
+        cache.Update(_Sid(i).c_str(), _Text(szName, L"", L""));
+    }
+
+    DWORD cFound = 0;
+    for (DWORD i = 0; i < c_cSlots; i++)
+    {
+        DISPLAY_TEXT text;
+        bool fStale;
+        WCHAR szName[32];
+        StringCchPrintfW(szName, ARRAYSIZE(szName), L"User %u", i);
+        if (cache.Lookup(_Sid(i).c_str(), &text, &fStale) && wcscmp(text.szFullName, szName) == 0)
+        {
+            cFound++;
+        }
+    }
+    CHECK(cFound == c_cSlots);
+
+    cache.Update(_Sid(c_cSlots).c_str(), _Text(L"One too many", L"", L""));
+    DISPLAY_TEXT text;
+    bool fStale;
+    CHECK(cache.Lookup(_Sid(c_cSlots).c_str(), &text, &fStale));
+}
+
+static void FlagsEntriesOlderThanADay()
+{
+    _DeleteCacheFile();
+    CDisplayCache cache;
+    CHECK_HR(cache.Open());
+    cache.Update(_Sid(3).c_str(), _Text(L"User 3", L"user3", L""));
+
+    DISPLAY_TEXT text;
+    bool fStale;
+    ShimAdvanceSystemTime(23ULL * 60 * 60 * 10000000);
+    CHECK(cache.Lookup(_Sid(3).c_str(), &text, &fStale));
+    CHECK(!fStale);
+    ShimAdvanceSystemTime(2ULL * 60 * 60 * 10000000);
+    CHECK(cache.Lookup(_Sid(3).c_str(), &text, &fStale));
+    CHECK(fStale);
+
+    cache.Update(_Sid(3).c_str(), _Text(L"User 3", L"user3", L""));
+    CHECK(cache.Lookup(_Sid(3).c_str(), &text, &fStale));
+    CHECK(!fStale);
+}
+
+// Readers copy entries without a lock and retry when the version moved, so they
+// see one write or the other, never a mix. The copies race the writer by design,
+// which ThreadSanitizer reports, so the check only runs in the plain build.
+static void ReadersNeverSeeTornText()
+{
+#if !defined(__SANITIZE_THREAD__)
+    _DeleteCacheFile();
+    CDisplayCache writer;
+    CDisplayCache reader;
+    CHECK_HR(writer.Open());
+    CHECK_HR(reader.Open());
+
+    DISPLAY_TEXT rgTexts[2] =
+    {
+        _Text(L"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", L"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", L"A"),
+        _Text(L"BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB", L"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb", L"B"),
+    };
+    std::wstring strSid = _Sid(4);
+    writer.Update(strSid.c_str(), rgTexts[0]);
+
+    std::atomic<bool> fDone{false};
+    std::thread writerThread([&writer, &rgTexts, &strSid, &fDone]
+    {
+        for (DWORD i = 0; i < 200000; i++)
+        {
+            writer.Update(strSid.c_str(), rgTexts[i & 1]);
+        }
+        fDone = true;
+    });
+
+    DWORD cReads = 0;
+    DWORD cTorn = 0;
+    while (!fDone)
+    {
+        DISPLAY_TEXT text;
+        bool fStale;
+        if (reader.Lookup(strSid.c_str(), &text, &fStale))
+        {
+            cReads++;
+            bool fIsA = memcmp(&text, &rgTexts[0], sizeof(text)) == 0;
+            bool fIsB = memcmp(&text, &rgTexts[1], sizeof(text)) == 0;
+            if (!fIsA && !fIsB)
+            {
+                cTorn++;
+            }
+        }
+    }
+    writerThread.join();
+    CHECK(cReads > 0);
+    CHECK(cTorn == 0);
+#endif
+}
+
+int main()
+{
+    _UseFreshProgramData();
+    RUN_TEST(StoresAndLooksUpBySid);
+    RUN_TEST(SharesEntriesBetweenMappings);
+    RUN_TEST(ResetsAFileOfAnotherLayout);
+    RUN_TEST(FillsEverySlot);
+    RUN_TEST(FlagsEntriesOlderThanADay);
+    RUN_TEST(ReadersNeverSeeTornText);
+    _DeleteProgramData();
+    return TestExitCode();
+}
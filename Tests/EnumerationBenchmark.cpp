@@ -0,0 +1,194 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Measures how tile enumeration scales with the number of users. The loop is
+// the one in CSampleProvider::_EnumerateCredentials: walk the user array, take
+// the tile of each SID over from the last enumeration or allocate a new one from
+// the slab pool, index it by SID, and release the tiles of users that are gone.
+// Tiles here are plain blocks the size of a credential, since CSampleCredential
+// itself needs the Windows headers.
+
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SlabPool.h"
+#include "MockCredentialProviderUsers.h"
+
+static const SIZE_T c_cbTile = 1024;        // Rounded up from sizeof(CSampleCredential)
+static const DWORD c_cTilesPerSlab = 16;    // As c_cCredentialsPerSlab
+
+struct BENCH_TILE
+{
+    WCHAR   szSid[128];
+};
+
+typedef std::unordered_map<std::wstring, DWORD> SID_INDEX;
+
+struct TILE_SET
+{
+    std::vector<BENCH_TILE*>    rgpTiles;
+    std::vector<BENCH_TILE*>    rgpNextTiles;
+    SID_INDEX                   sidIndex;
+    std::wstring                strSidLookup;
+};
+
+static CSlabPool s_tilePool(c_cbTile, c_cTilesPerSlab);
+
+static void _MakeSidKey(PCWSTR pszSid, std::wstring *pstrKey)
+{
+    pstrKey->assign(pszSid);
+    for (WCHAR &ch : *pstrKey)
+    {
+        if (ch >= L'a' && ch <= L'z')
+        {
+            ch = static_cast<WCHAR>(ch - L'a' + L'A');
+        }
+    }
+}
+
+static BENCH_TILE *_TakeTileBySid(TILE_SET *pSet, PCWSTR pszSid)
+{
+    _MakeSidKey(pszSid, &pSet->strSidLookup);
+    auto it = pSet->sidIndex.find(pSet->strSidLookup);
+    if (it != pSet->sidIndex.end() && it->second < pSet->rgpTiles.size())
+    {
+        BENCH_TILE *pTile = pSet->rgpTiles[it->second];
+        pSet->rgpTiles[it->second] = nullptr;
+        return pTile;
+    }
+    return nullptr;
+}
+
+static void _Enumerate(TILE_SET *pSet, ICredentialProviderUserArray *pUsers)
+{
+    DWORD cUsers = 0;
+    pUsers->GetCount(&cUsers);
+    pSet->rgpNextTiles.clear();
+    pSet->rgpNextTiles.reserve(cUsers);
+
+    for (DWORD i = 0; i < cUsers; i++)
+    {
+        ICredentialProviderUser *pUser = nullptr;
+        if (SUCCEEDED(pUsers->GetAt(i, &pUser)))
+        {
+            PWSTR pszSid = nullptr;
+            if (SUCCEEDED(pUser->GetSid(&pszSid)))
+            {
+                BENCH_TILE *pTile = _TakeTileBySid(pSet, pszSid);
+                if (pTile == nullptr)
+                {
+                    pTile = static_cast<BENCH_TILE*>(s_tilePool.Allocate(c_cbTile));
+                    wcsncpy(pTile->szSid, pszSid, ARRAYSIZE(pTile->szSid) - 1);
+                    pTile->szSid[ARRAYSIZE(pTile->szSid) - 1] = L'\0';
+                }
+                _MakeSidKey(pszSid, &pSet->strSidLookup);
+                pSet->sidIndex[pSet->strSidLookup] = static_cast<DWORD>(pSet->rgpNextTiles.size());
+                pSet->rgpNextTiles.push_back(pTile);
+                CoTaskMemFree(pszSid);
+            }
+            pUser->Release();
+        }
+    }
+
+    for (BENCH_TILE *&pTile : pSet->rgpTiles)
+    {
+        if (pTile != nullptr)
+        {
+            _MakeSidKey(pTile->szSid, &pSet->strSidLookup);
+            pSet->sidIndex.erase(pSet->strSidLookup);
+            s_tilePool.Free(pTile);
+            pTile = nullptr;
+        }
+    }
+    pSet->rgpTiles.swap(pSet->rgpNextTiles);
+    pSet->rgpNextTiles.clear();
+}
+
+static void _ReleaseAll(TILE_SET *pSet)
+{
+    for (BENCH_TILE *pTile : pSet->rgpTiles)
+    {
+        s_tilePool.Free(pTile);
+    }
+    pSet->rgpTiles.clear();
+    pSet->sidIndex.clear();
+}
+
+static double _Microseconds(const LARGE_INTEGER &liStart, const LARGE_INTEGER &liEnd)
+{
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    return (liEnd.QuadPart - liStart.QuadPart) * 1e6 / liFrequency.QuadPart;
+}
+
+// Runs one kind of enumeration cRounds times and prints the mean time and the
+// slabs the pool had to allocate for it.
+template <typename TRound>
+static void _Measure(PCSTR pszName, DWORD cUsers, DWORD cRounds, TRound round)
+{
+    SLAB_POOL_STATS statsBefore;
+    s_tilePool.GetStats(&statsBefore);
+    LARGE_INTEGER liStart, liEnd;
+    QueryPerformanceCounter(&liStart);
+    for (DWORD i = 0; i < cRounds; i++)
+    {
+        round();
+    }
+    QueryPerformanceCounter(&liEnd);
+    SLAB_POOL_STATS statsAfter;
+    s_tilePool.GetStats(&statsAfter);
+
+    double dMicroseconds = _Microseconds(liStart, liEnd) / cRounds;
+    printf("%6u %-12s %12.1f %12.1f %10llu\n", cUsers, pszName, dMicroseconds, dMicroseconds * 1000.0 / cUsers,
+           statsAfter.cHeapAllocations - statsBefore.cHeapAllocations);
+}
+
+int main()
+{
+    static const DWORD c_rgcUsers[] = { 1, 10, 50, 200, 1000, 5000 };
+
+    printf("%6s %-12s %12s %12s %10s\n", "users", "enumeration", "us", "ns/user", "slabs");
+    for (DWORD cUsers : c_rgcUsers)
+    {
+        DWORD cRounds = (cUsers < 200) ? 2000 : 200000 / cUsers;
+        CMockUserArray *pUsers = new CMockUserArray();
+        pUsers->AddDomainUsers(0, cUsers, 0);
+
+        // Logon: every tile is new.
+        TILE_SET set;
+        _Measure("first", cUsers, cRounds, [&set, pUsers]
+        {
+            _ReleaseAll(&set);
+            _Enumerate(&set, pUsers);
+        });
+
+        // Re-enumeration with the same users keeps every tile.
+        _Measure("unchanged", cUsers, cRounds, [&set, pUsers]
+        {
+            _Enumerate(&set, pUsers);
+        });
+
+        // One user in ten replaced by a new one between enumerations.
+        CMockUserArray *pChurned = new CMockUserArray();
+        pChurned->AddDomainUsers(0, cUsers - cUsers / 10, 0);
+        pChurned->AddDomainUsers(cUsers * 2, cUsers / 10, 0);
+        bool fChurned = false;
+        _Measure("churn 10%", cUsers, cRounds, [&set, &fChurned, pUsers, pChurned]
+        {
+            _Enumerate(&set, fChurned ? pUsers : pChurned);
+            fChurned = !fChurned;
+        });
+
+        _ReleaseAll(&set);
+        pChurned->Release();
+        pUsers->Release();
+    }
+    return 0;
+}
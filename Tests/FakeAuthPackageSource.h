@@ -0,0 +1,111 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// An IAuthPackageSource for the tests and benchmarks that counts the LSA calls
+// a real lookup would make and can be made slow or failing. Include it once per
+// program: it also stands in for CLsaAuthPackageSource, which lives with the LSA
+// code in helpers.cpp.
+
+#pragma once
+
+#include <windows.h>
+#include "AuthPackageResolver.h"
+
+// LsaConnectUntrusted, LsaLookupAuthenticationPackage and LsaDeregisterLogonProcess.
+static const DWORD c_cLsaCallsPerLookup = 3;
+
+inline HRESULT CLsaAuthPackageSource::LookupNegotiatePackage(_Out_ ULONG *pulAuthPackage)
+{
+    *pulAuthPackage = 0;
+    return E_NOTIMPL;
+}
+
+class CFakeAuthPackageSource : public IAuthPackageSource
+{
+public:
+    explicit CFakeAuthPackageSource(ULONG ulAuthPackage) :
+        _ulAuthPackage(ulAuthPackage),
+        _dwLatencyMs(0),
+        _cFailuresLeft(0),
+        _cLookups(0),
+        _cActive(0),
+        _cPeakActive(0)
+    {
+    }
+
+    // Each lookup waits dwMs, the way the LSA round trips would.
+    void SetLatency(DWORD dwMs)
+    {
+        _dwLatencyMs = dwMs;
+    }
+
+    // The next cFailures lookups fail.
+    void FailNext(LONG cFailures)
+    {
+        InterlockedExchange(&_cFailuresLeft, cFailures);
+    }
+
+    LONG LookupCount() const
+    {
+        return ReadAcquire(&_cLookups);
+    }
+
+    ULONGLONG LsaCallCount() const
+    {
+        return static_cast<ULONGLONG>(LookupCount()) * c_cLsaCallsPerLookup;
+    }
+
+    // The most lookups that were in progress at once.
+    LONG PeakConcurrentLookups() const
+    {
+        return ReadAcquire(&_cPeakActive);
+    }
+
+    HRESULT LookupNegotiatePackage(_Out_ ULONG *pulAuthPackage)
+    {
+        InterlockedIncrement(&_cLookups);
+        LONG cActive = InterlockedIncrement(&_cActive);
+        LONG cPeak = ReadAcquire(&_cPeakActive);
+        while (cActive > cPeak)
+        {
+            LONG cSeen = InterlockedCompareExchange(&_cPeakActive, cActive, cPeak);
+            if (cSeen == cPeak)
+            {
+                break;
+            }
+            cPeak = cSeen;
+        }
+
+        if (_dwLatencyMs > 0)
+        {
+            Sleep(_dwLatencyMs);
+        }
+
+        HRESULT hr = S_OK;
+        *pulAuthPackage = _ulAuthPackage;
+        if (InterlockedDecrement(&_cFailuresLeft) >= 0)
+        {
+            *pulAuthPackage = 0;
+            hr = HRESULT_FROM_NT(0xC00000FE); // STATUS_NO_SUCH_PACKAGE
+        }
+        else
+        {
+            InterlockedIncrement(&_cFailuresLeft);
+        }
+        InterlockedDecrement(&_cActive);
+        return hr;
+    }
+
+private:
+    ULONG           _ulAuthPackage;
+    DWORD           _dwLatencyMs;
+    volatile LONG   _cFailuresLeft;
+    volatile LONG   _cLookups;
+    volatile LONG   _cActive;
+    volatile LONG   _cPeakActive;
+};
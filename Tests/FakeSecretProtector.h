@@ -0,0 +1,65 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// An ISecretProtector for the tests that marks a secret as protected by putting
+// a prefix in front of it, and counts its calls. Include it once per program: it
+// also stands in for CCredProtectSecretProtector, which lives with the CredProtect
+// code in helpers.cpp.
+
+#pragma once
+
+#include <windows.h>
+#include <strsafe.h>
+#include "ProtectedSecretCache.h"
+
+static const WCHAR c_szFakeProtectedPrefix[] = L"protected:";
+
+inline HRESULT CCredProtectSecretProtector::IsProtected(_In_ PWSTR pszSecret, _Out_ bool *pfProtected)
+{
+    *pfProtected = false;
+    return E_NOTIMPL;
+}
+
+inline HRESULT CCredProtectSecretProtector::Protect(_In_ PWSTR pszSecret, _Out_writes_(c_cchSecretSlot) PWSTR pszProtected)
+{
+    return E_NOTIMPL;
+}
+
+class CFakeSecretProtector : public ISecretProtector
+{
+public:
+    CFakeSecretProtector() :
+        _cProtects(0)
+    {
+    }
+
+    LONG ProtectCount() const
+    {
+        return ReadAcquire(&_cProtects);
+    }
+
+    HRESULT IsProtected(_In_ PWSTR pszSecret, _Out_ bool *pfProtected)
+    {
+        *pfProtected = (wcsncmp(pszSecret, c_szFakeProtectedPrefix, ARRAYSIZE(c_szFakeProtectedPrefix) - 1) == 0);
+        return S_OK;
+    }
+
+    HRESULT Protect(_In_ PWSTR pszSecret, _Out_writes_(c_cchSecretSlot) PWSTR pszProtected)
+    {
+        InterlockedIncrement(&_cProtects);
+        HRESULT hr = StringCchCopyW(pszProtected, c_cchSecretSlot, c_szFakeProtectedPrefix);
+        if (SUCCEEDED(hr))
+        {
+            hr = StringCchCatW(pszProtected, c_cchSecretSlot, pszSecret);
+        }
+        return hr;
+    }
+
+private:
+    volatile LONG   _cProtects;
+};
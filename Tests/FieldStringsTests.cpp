@@ -0,0 +1,208 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks that CFieldStrings only reports the fields whose value changed, that
+// LogonUI hears of them in a single BeginFieldUpdates/EndFieldUpdates batch and
+// of nothing when no value changed, and that values taken from the strings it
+// holds survive a repack.
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include "FieldStrings.h"
+#include "TestHarness.h"
+
+static const DWORD c_cFields = 6;
+
+// Stands in for the tile the field strings belong to.
+class CTestCredential final : public ICredentialProviderCredential
+{
+public:
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppv)
+    {
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef()
+    {
+        return 1;
+    }
+
+    ULONG STDMETHODCALLTYPE Release()
+    {
+        return 1;
+    }
+};
+
+// Records every call LogonUI would see, in order, as "begin", "end" or "<field>=<value>".
+class CMockCredentialEvents final : public ICredentialProviderCredentialEvents2
+{
+public:
+    CMockCredentialEvents() :
+        pcpcSeen(nullptr)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppv)
+    {
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef()
+    {
+        return 1;
+    }
+
+    ULONG STDMETHODCALLTYPE Release()
+    {
+        return 1;
+    }
+
+    HRESULT STDMETHODCALLTYPE SetFieldString(_In_ ICredentialProviderCredential *pcpc, DWORD dwFieldID, _In_opt_ PCWSTR psz)
+    {
+        pcpcSeen = pcpc;
+        rgCalls.push_back(std::to_wstring(dwFieldID) + L"=" + (psz ? psz : L"(null)"));
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE BeginFieldUpdates()
+    {
+        rgCalls.push_back(L"begin");
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE EndFieldUpdates()
+    {
+        rgCalls.push_back(L"end");
+        return S_OK;
+    }
+
+    // Returns the calls made since the last time and forgets them.
+    std::vector<std::wstring> TakeCalls()
+    {
+        std::vector<std::wstring> rgTaken;
+        rgTaken.swap(rgCalls);
+        return rgTaken;
+    }
+
+    ICredentialProviderCredential   *pcpcSeen;
+
+private:
+    std::vector<std::wstring>       rgCalls;
+};
+
+static CTestCredential s_credential;
+
+// Updates the fields as CSampleCredential::_UpdateFieldStrings does and returns what LogonUI saw.
+static std::vector<std::wstring> _Update(CFieldStrings *pFields, CMockCredentialEvents *pEvents, PCWSTR const *rgpszValues)
+{
+    DWORD dwChanged = 0xFFFFFFFF;
+    CHECK_HR(pFields->Update(rgpszValues, &dwChanged));
+    CFieldStrings::Notify(pEvents, &s_credential, rgpszValues, dwChanged);
+    return pEvents->TakeCalls();
+}
+
+static bool _FieldIs(const CFieldStrings &fields, DWORD dwField, PCWSTR pszExpected)
+{
+    PCWSTR psz = fields.Get(dwField);
+    return (psz == nullptr || pszExpected == nullptr) ? (psz == pszExpected) : (wcscmp(psz, pszExpected) == 0);
+}
+
+static void SendsOnlyChangedFields()
+{
+    CFieldStrings fields(c_cFields);
+    CMockCredentialEvents events;
+
+    PCWSTR rgpszValues[c_cFields] = {};
+    rgpszValues[1] = L"AbsoluteID Credential";
+    rgpszValues[2] = L"Full Name: Ada";
+    rgpszValues[4] = L"Logon Status: Away";
+    std::vector<std::wstring> rgExpected = { L"begin", L"1=AbsoluteID Credential", L"2=Full Name: Ada", L"4=Logon Status: Away", L"end" };
+    CHECK(_Update(&fields, &events, rgpszValues) == rgExpected);
+    CHECK(events.pcpcSeen == &s_credential);
+
+    // The same values again, even from other buffers, send nothing at all.
+    WCHAR szFullName[] = L"Full Name: Ada";
+    rgpszValues[2] = szFullName;
+    CHECK(_Update(&fields, &events, rgpszValues).empty());
+
+    // One changed value among unchanged ones is the only field in its batch.
+    rgpszValues[4] = L"Logon Status: Here";
+    rgExpected = { L"begin", L"4=Logon Status: Here", L"end" };
+    CHECK(_Update(&fields, &events, rgpszValues) == rgExpected);
+
+    CHECK(_FieldIs(fields, 0, nullptr));
+    CHECK(_FieldIs(fields, 1, L"AbsoluteID Credential"));
+    CHECK(_FieldIs(fields, 2, L"Full Name: Ada"));
+    CHECK(_FieldIs(fields, 4, L"Logon Status: Here"));
+    CHECK(_FieldIs(fields, c_cFields, nullptr));
+}
+
+// Null values leave their field as it is, and an empty string is a value like any other.
+static void LeavesFieldsWithoutValues()
+{
+    CFieldStrings fields(c_cFields);
+    CMockCredentialEvents events;
+
+    PCWSTR rgpszValues[c_cFields] = {};
+    rgpszValues[3] = L"Display Name: Ada";
+    rgpszValues[5] = L"";
+    _Update(&fields, &events, rgpszValues);
+
+    PCWSTR rgpszNone[c_cFields] = {};
+    CHECK(_Update(&fields, &events, rgpszNone).empty());
+    CHECK(_FieldIs(fields, 3, L"Display Name: Ada"));
+    CHECK(_FieldIs(fields, 5, L""));
+
+    PCWSTR rgpszOne[c_cFields] = {};
+    rgpszOne[5] = L"Logon Status: Away";
+    std::vector<std::wstring> rgExpected = { L"begin", L"5=Logon Status: Away", L"end" };
+    CHECK(_Update(&fields, &events, rgpszOne) == rgExpected);
+    CHECK(_FieldIs(fields, 3, L"Display Name: Ada"));
+}
+
+// Values may point into the strings held, which are freed as they are repacked.
+static void RepacksValuesItHolds()
+{
+    CFieldStrings fields(c_cFields);
+    CMockCredentialEvents events;
+
+    PCWSTR rgpszValues[c_cFields] = {};
+    rgpszValues[0] = L"First";
+    rgpszValues[1] = L"Second";
+    _Update(&fields, &events, rgpszValues);
+
+    // Moving a held value to another field repacks while reading from the old strings.
+    PCWSTR rgpszMoved[c_cFields] = {};
+    rgpszMoved[0] = fields.Get(1);
+    rgpszMoved[2] = fields.Get(0);
+    DWORD dwChanged = 0;
+    CHECK_HR(fields.Update(rgpszMoved, &dwChanged));
+    CHECK(dwChanged == ((1u << 0) | (1u << 2)));
+    CHECK(_FieldIs(fields, 0, L"Second"));
+    CHECK(_FieldIs(fields, 1, L"Second"));
+    CHECK(_FieldIs(fields, 2, L"First"));
+
+    // Held values are unchanged values.
+    PCWSTR rgpszHeld[c_cFields] = {};
+    for (DWORD i = 0; i < c_cFields; i++)
+    {
+        rgpszHeld[i] = fields.Get(i);
+    }
+    CHECK(_Update(&fields, &events, rgpszHeld).empty());
+}
+
+int main()
+{
+    RUN_TEST(SendsOnlyChangedFields);
+    RUN_TEST(LeavesFieldsWithoutValues);
+    RUN_TEST(RepacksValuesItHolds);
+    return TestExitCode();
+}
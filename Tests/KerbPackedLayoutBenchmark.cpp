@@ -0,0 +1,176 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Measures the throughput of packing, unpacking, converting and splitting a
+// logon, and the heap allocations each operation makes, counted by replacing
+// the global operator new. The copied split copies each part into a string, as
+// the sample's SplitDomainAndUsername did, for comparison.
+//
+//   KerbPackedLayoutBenchmark [operations]
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <string>
+#include <vector>
+#include "KerbPackedLayout.h"
+#include "QualifiedUserName.h"
+
+static volatile LONG s_cAllocations = 0;
+static volatile size_t s_cbSink = 0;
+
+void *operator new(size_t cb)
+{
+    InterlockedIncrement(&s_cAllocations);
+    void *pv = malloc(cb != 0 ? cb : 1);
+    if (pv == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return pv;
+}
+
+void *operator new[](size_t cb)
+{
+    return operator new(cb);
+}
+
+void operator delete(void *pv) noexcept
+{
+    free(pv);
+}
+
+void operator delete[](void *pv) noexcept
+{
+    free(pv);
+}
+
+void operator delete(void *pv, size_t) noexcept
+{
+    free(pv);
+}
+
+void operator delete[](void *pv, size_t) noexcept
+{
+    free(pv);
+}
+
+static double _Milliseconds(const LARGE_INTEGER &liStart, const LARGE_INTEGER &liEnd)
+{
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    return (liEnd.QuadPart - liStart.QuadPart) * 1e3 / liFrequency.QuadPart;
+}
+
+static KERB_STRING_VIEW _View(const std::u16string &str)
+{
+    KERB_STRING_VIEW view = { str.data(), str.size() };
+    return view;
+}
+
+// Runs op cOperations times and prints operations per second and allocations per
+// operation. What op returns goes to a volatile sink, so its work is not
+// optimized away.
+template <typename OPERATION>
+static void _Run(const char *pszName, DWORD cOperations, OPERATION op)
+{
+    LONG cAllocationsBefore = ReadAcquire(&s_cAllocations);
+    LARGE_INTEGER liStart, liEnd;
+    QueryPerformanceCounter(&liStart);
+    for (DWORD i = 0; i < cOperations; i++)
+    {
+        s_cbSink = s_cbSink + op();
+    }
+    QueryPerformanceCounter(&liEnd);
+    LONG cAllocations = ReadAcquire(&s_cAllocations) - cAllocationsBefore;
+
+    double dMs = _Milliseconds(liStart, liEnd);
+    printf("%-20s %14.0f %12.2f\n", pszName, cOperations / (dMs / 1e3),
+        static_cast<double>(cAllocations) / cOperations);
+}
+
+int main(int argc, char **argv)
+{
+    DWORD cOperations = (argc >= 2) ? static_cast<DWORD>(atoi(argv[1])) : 2000000;
+
+    std::u16string qualified = u"CONTOSO\\averagelengthuser";
+    std::u16string upn = u"averagelengthuser@contoso.com";
+    std::u16string password = u"Correct-Horse-Battery-Staple-42";
+    KERB_STRING_VIEW domain, userName;
+    KerbSplitQualifiedUserName(_View(qualified), &domain, &userName);
+
+    KERB_UNLOCK_LOGON_VIEW logon;
+    logon.ulMessageType = 7;
+    logon.ullLogonId = 0;
+    logon.domain = domain;
+    logon.userName = userName;
+    logon.password = _View(password);
+
+    std::vector<uint8_t> rgbWow(KerbPackedUnlockLogonSize(KERB_PACKED_LAYOUT_32, logon));
+    std::vector<uint8_t> rgbNative(KerbPackedUnlockLogonSize(KERB_PACKED_LAYOUT_64, logon));
+    KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT_32, logon, rgbWow.data(), rgbWow.size());
+    KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT_64, logon, rgbNative.data(), rgbNative.size());
+
+    printf("%u operations, %zu byte native logon\n\n", cOperations, rgbNative.size());
+    printf("%-20s %14s %12s\n", "operation", "ops/s", "allocs/op");
+
+    _Run("pack 32-bit", cOperations, [&]()
+    {
+        KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT_32, logon, rgbWow.data(), rgbWow.size());
+        return static_cast<size_t>(rgbWow[rgbWow.size() - 1]);
+    });
+    _Run("pack 64-bit", cOperations, [&]()
+    {
+        KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT_64, logon, rgbNative.data(), rgbNative.size());
+        return static_cast<size_t>(rgbNative[rgbNative.size() - 1]);
+    });
+    _Run("unpack 32-bit", cOperations, [&]()
+    {
+        KERB_UNLOCK_LOGON_VIEW unpacked;
+        KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, rgbWow.data(), rgbWow.size(), &unpacked);
+        return unpacked.password.cch;
+    });
+    _Run("unpack 64-bit", cOperations, [&]()
+    {
+        KERB_UNLOCK_LOGON_VIEW unpacked;
+        KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_64, rgbNative.data(), rgbNative.size(), &unpacked);
+        return unpacked.password.cch;
+    });
+    _Run("WOW64 to native", cOperations, [&]()
+    {
+        KerbPackedUnlockLogonWowToNative(rgbWow.data(), rgbWow.size(), rgbNative.data(), rgbNative.size());
+        return static_cast<size_t>(rgbNative[rgbNative.size() - 1]);
+    });
+    _Run("split", cOperations, [&]()
+    {
+        KERB_STRING_VIEW splitDomain, splitUserName;
+        KerbSplitQualifiedUserName(_View(qualified), &splitDomain, &splitUserName);
+        return splitUserName.cch;
+    });
+    _Run("split, copied", cOperations, [&]()
+    {
+        size_t ich = qualified.find(u'\\');
+        std::u16string copiedDomain = qualified.substr(0, ich);
+        std::u16string copiedUserName = qualified.substr(ich + 1);
+        return copiedUserName.size();
+    });
+    _Run("parse DOMAIN\\user", cOperations, [&]()
+    {
+        QUALIFIED_NAME_PARTS parts;
+        ParseQualifiedUserName(qualified, &parts);
+        return parts.cchUserName;
+    });
+    _Run("parse user@domain", cOperations, [&]()
+    {
+        QUALIFIED_NAME_PARTS parts;
+        ParseQualifiedUserName(upn, &parts);
+        return parts.cchUserName;
+    });
+    return 0;
+}
@@ -0,0 +1,417 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks the packed logon layouts against known bytes, round-trips logons through
+// both layouts and the WOW64 converter, and fuzzes the unpacker and the converter
+// with damaged buffers: whatever the input, a view may only ever point into the
+// buffer it came from.
+//
+//   KerbPackedLayoutTests [fuzz iterations] [seed]
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "KerbPackedLayout.h"
+#include "TestHarness.h"
+
+static const uint32_t c_ulUnlockLogon = 7;     // KerbWorkstationUnlockLogon
+static const uint64_t c_ullLogonId = 0x0000000100000002ull;
+
+static DWORD s_cFuzzIterations = 200000;
+static DWORD s_dwSeed = 1;
+
+static KERB_STRING_VIEW _View(const std::u16string &str)
+{
+    KERB_STRING_VIEW view = { str.data(), str.size() };
+    return view;
+}
+
+static std::u16string _String(const KERB_STRING_VIEW &view)
+{
+    return std::u16string(view.pch != nullptr ? view.pch : u"", view.cch);
+}
+
+static KERB_UNLOCK_LOGON_VIEW _Logon(const std::u16string &domain, const std::u16string &userName,
+                                     const std::u16string &password)
+{
+    KERB_UNLOCK_LOGON_VIEW logon;
+    logon.ulMessageType = c_ulUnlockLogon;
+    logon.ullLogonId = c_ullLogonId;
+    logon.domain = _View(domain);
+    logon.userName = _View(userName);
+    logon.password = _View(password);
+    return logon;
+}
+
+static std::vector<uint8_t> _Pack(KERB_PACKED_LAYOUT layout, const KERB_UNLOCK_LOGON_VIEW &logon)
+{
+    std::vector<uint8_t> rgb(KerbPackedUnlockLogonSize(layout, logon));
+    CHECK(!rgb.empty());
+    CHECK(KerbPackedUnlockLogonPack(layout, logon, rgb.data(), rgb.size()));
+    return rgb;
+}
+
+// Whether a view is empty or lies wholly in the string area of the buffer.
+static bool _IsWithin(const KERB_STRING_VIEW &view, const uint8_t *pb, size_t cb, size_t cbHeader)
+{
+    if (view.cch == 0)
+    {
+        return view.pch == nullptr;
+    }
+    const uint8_t *pbString = reinterpret_cast<const uint8_t*>(view.pch);
+    return pbString >= pb + cbHeader && pbString <= pb + cb &&
+           view.cch * sizeof(char16_t) <= static_cast<size_t>(pb + cb - pbString) &&
+           ((pbString - pb) % 2) == 0;
+}
+
+static bool _IsWithin(const KERB_UNLOCK_LOGON_VIEW &logon, const uint8_t *pb, size_t cb, size_t cbHeader)
+{
+    return _IsWithin(logon.domain, pb, cb, cbHeader) &&
+           _IsWithin(logon.userName, pb, cb, cbHeader) &&
+           _IsWithin(logon.password, pb, cb, cbHeader);
+}
+
+static void PacksTheWowLayout()
+{
+    std::u16string domain = u"D", userName = u"ab", password = u"";
+    std::vector<uint8_t> rgb = _Pack(KERB_PACKED_LAYOUT_32, _Logon(domain, userName, password));
+    CHECK(rgb.size() == 36 + 6);
+
+    static const uint8_t c_rgbExpected[] =
+    {
+        7, 0, 0, 0,                             // MessageType
+        2, 0, 2, 0, 36, 0, 0, 0,                // LogonDomainName
+        4, 0, 4, 0, 38, 0, 0, 0,                // UserName
+        0, 0, 0, 0, 42, 0, 0, 0,                // Password
+        2, 0, 0, 0, 1, 0, 0, 0,                 // LogonId
+        'D', 0, 'a', 0, 'b', 0,
+    };
+    CHECK(rgb.size() == sizeof(c_rgbExpected) && memcmp(rgb.data(), c_rgbExpected, rgb.size()) == 0);
+}
+
+static void PacksTheNativeLayout()
+{
+    std::u16string domain = u"D", userName = u"ab", password = u"p";
+    std::vector<uint8_t> rgb = _Pack(KERB_PACKED_LAYOUT_64, _Logon(domain, userName, password));
+    CHECK(rgb.size() == 64 + 8);
+
+    static const uint8_t c_rgbExpected[] =
+    {
+        7, 0, 0, 0, 0, 0, 0, 0,                 // MessageType
+        2, 0, 2, 0, 0, 0, 0, 0, 64, 0, 0, 0, 0, 0, 0, 0,
+        4, 0, 4, 0, 0, 0, 0, 0, 66, 0, 0, 0, 0, 0, 0, 0,
+        2, 0, 2, 0, 0, 0, 0, 0, 70, 0, 0, 0, 0, 0, 0, 0,
+        2, 0, 0, 0, 1, 0, 0, 0,                 // LogonId
+        'D', 0, 'a', 0, 'b', 0, 'p', 0,
+    };
+    CHECK(rgb.size() == sizeof(c_rgbExpected) && memcmp(rgb.data(), c_rgbExpected, rgb.size()) == 0);
+}
+
+static void RefusesWrongSizes()
+{
+    std::u16string domain = u"D", userName = u"user", password = u"secret";
+    KERB_UNLOCK_LOGON_VIEW logon = _Logon(domain, userName, password);
+    size_t cb = KerbPackedUnlockLogonSize(KERB_PACKED_LAYOUT_64, logon);
+    std::vector<uint8_t> rgb(cb + 1, 0xCC);
+    CHECK(!KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT_64, logon, rgb.data(), cb - 1));
+    CHECK(!KerbPackedUnlockLogonPack(KERB_PACKED_LAYOUT_64, logon, rgb.data(), cb + 1));
+    CHECK(rgb[0] == 0xCC);
+
+    // A UNICODE_STRING cannot describe more than 0xFFFE bytes.
+    std::u16string tooLong(0x8000, u'x');
+    logon.password = _View(tooLong);
+    CHECK(KerbPackedUnlockLogonSize(KERB_PACKED_LAYOUT_32, logon) == 0);
+    CHECK(KerbPackedUnlockLogonSize(KERB_PACKED_LAYOUT_64, logon) == 0);
+}
+
+static void RejectsBadStrings()
+{
+    std::u16string domain = u"D", userName = u"ab", password = u"pw";
+    std::vector<uint8_t> rgbGood = _Pack(KERB_PACKED_LAYOUT_32, _Logon(domain, userName, password));
+    KERB_UNLOCK_LOGON_VIEW logon;
+    CHECK(KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, rgbGood.data(), rgbGood.size(), &logon));
+    CHECK(!KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, rgbGood.data(), 35, &logon));
+    CHECK(!KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, rgbGood.data(), rgbGood.size() - 1, &logon));
+    CHECK(!KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, nullptr, rgbGood.size(), &logon));
+
+    // The password is the last string: its length, maximum and offset are at 20.
+    struct DAMAGE
+    {
+        size_t  ib;
+        uint8_t b;
+    };
+    static const DAMAGE c_rgDamage[] =
+    {
+        { 20, 3 },          // Odd length
+        { 20, 6 },          // Longer than its maximum
+        { 24, 43 },         // Odd offset
+        { 24, 2 },          // Inside the structure
+        { 24, 44 },         // Runs past the end
+        { 27, 0x80 },       // Far past the end
+    };
+    for (const DAMAGE &damage : c_rgDamage)
+    {
+        std::vector<uint8_t> rgb = rgbGood;
+        rgb[damage.ib] = damage.b;
+        CHECK(!KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, rgb.data(), rgb.size(), &logon));
+        CHECK(KerbPackedUnlockLogonWowToNativeSize(rgb.data(), rgb.size()) == 0);
+    }
+
+    // An empty string reads nothing, so its offset does not matter.
+    std::vector<uint8_t> rgb = rgbGood;
+    rgb[20] = 0;
+    rgb[27] = 0x80;
+    CHECK(KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, rgb.data(), rgb.size(), &logon));
+    CHECK(logon.password.pch == nullptr && logon.password.cch == 0);
+}
+
+static bool _IsSameLogon(const KERB_UNLOCK_LOGON_VIEW &logon, const KERB_UNLOCK_LOGON_VIEW &unpacked)
+{
+    return unpacked.ulMessageType == logon.ulMessageType && unpacked.ullLogonId == logon.ullLogonId &&
+           _String(unpacked.domain) == _String(logon.domain) &&
+           _String(unpacked.userName) == _String(logon.userName) &&
+           _String(unpacked.password) == _String(logon.password);
+}
+
+// Packs logon in both layouts and checks that each unpacks to the same fields and
+// that converting the 32-bit form gives exactly the bytes of the 64-bit one.
+static void _CheckRoundTrip(const KERB_UNLOCK_LOGON_VIEW &logon)
+{
+    std::vector<uint8_t> rgbWow = _Pack(KERB_PACKED_LAYOUT_32, logon);
+    std::vector<uint8_t> rgbNative = _Pack(KERB_PACKED_LAYOUT_64, logon);
+    CHECK(rgbNative.size() == rgbWow.size() + 64 - 36);
+
+    KERB_UNLOCK_LOGON_VIEW unpacked;
+    CHECK(KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, rgbWow.data(), rgbWow.size(), &unpacked));
+    CHECK(_IsSameLogon(logon, unpacked));
+    CHECK(KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_64, rgbNative.data(), rgbNative.size(), &unpacked));
+    CHECK(_IsSameLogon(logon, unpacked));
+
+    CHECK(KerbPackedUnlockLogonWowToNativeSize(rgbWow.data(), rgbWow.size()) == rgbNative.size());
+    std::vector<uint8_t> rgbConverted(rgbNative.size());
+    CHECK(KerbPackedUnlockLogonWowToNative(rgbWow.data(), rgbWow.size(), rgbConverted.data(), rgbConverted.size()));
+    CHECK(rgbConverted == rgbNative);
+}
+
+static void RoundTripsBetweenLayouts()
+{
+    std::u16string domain = u"CONTOSO", userName = u"user", password = u"p\u00e4ss\U0001F511";
+    _CheckRoundTrip(_Logon(domain, userName, password));
+
+    std::u16string empty;
+    _CheckRoundTrip(_Logon(empty, empty, empty));
+
+    // The longest strings a UNICODE_STRING holds, which put the last offset past
+    // 64K in both layouts.
+    std::u16string longest(0x7FFF, u'x');
+    KERB_UNLOCK_LOGON_VIEW logon = _Logon(longest, longest, longest);
+    logon.ulMessageType = 0xFFFFFFFF;
+    logon.ullLogonId = 0xFFFFFFFFFFFFFFFFull;
+    _CheckRoundTrip(logon);
+}
+
+static void SplitsAndJoinsNames()
+{
+    std::u16string qualified = u"CONTOSO\\user\\x";
+    KERB_STRING_VIEW domain, userName;
+    CHECK(KerbSplitQualifiedUserName(_View(qualified), &domain, &userName));
+    CHECK(_String(domain) == u"CONTOSO");
+    CHECK(_String(userName) == u"user\\x");
+
+    char16_t szJoined[32];
+    size_t cch = KerbJoinQualifiedUserName(domain, userName, szJoined, ARRAYSIZE(szJoined));
+    CHECK(cch == qualified.size() + 1);
+    CHECK(szJoined == qualified);
+    CHECK(KerbJoinQualifiedUserName(domain, userName, nullptr, 0) == cch);
+
+    std::u16string bare = u"user";
+    CHECK(!KerbSplitQualifiedUserName(_View(bare), &domain, &userName));
+}
+
+// Damages a valid packed logon the ways a hostile or confused caller might: bytes
+// of the structure set to random or boundary values, the buffer cut short or
+// padded, or random bytes throughout.
+static std::vector<uint8_t> _Mutate(std::mt19937 &random, std::vector<uint8_t> rgb, size_t cbHeader)
+{
+    static const uint8_t c_rgbBoundary[] = { 0x00, 0x01, 0x02, 0x7F, 0x80, 0xFE, 0xFF };
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    DWORD cMutations = 1 + random() % 4;
+    for (DWORD i = 0; i < cMutations; i++)
+    {
+        switch (random() % 5)
+        {
+        case 0:
+            rgb[random() % cbHeader] = static_cast<uint8_t>(byte(random));
+            break;
+        case 1:
+            rgb[random() % cbHeader] = c_rgbBoundary[random() % ARRAYSIZE(c_rgbBoundary)];
+            break;
+        case 2:
+            rgb.resize(random() % (rgb.size() + 1));
+            break;
+        case 3:
+            rgb.resize(rgb.size() + 1 + random() % 16, static_cast<uint8_t>(byte(random)));
+            break;
+        default:
+            if (!rgb.empty())
+            {
+                rgb[random() % rgb.size()] = static_cast<uint8_t>(byte(random));
+            }
+            break;
+        }
+        if (rgb.size() < cbHeader)
+        {
+            break;
+        }
+    }
+    return rgb;
+}
+
+static std::u16string _RandomString(std::mt19937 &random, size_t cchMax)
+{
+    std::u16string str(random() % (cchMax + 1), u'\0');
+    for (char16_t &ch : str)
+    {
+        ch = static_cast<char16_t>(random());
+    }
+    return str;
+}
+
+// Random logons, with any UTF-16 units including unpaired surrogates and nulls,
+// survive both layouts, the converter, and a split and join of the names.
+static void FuzzesRoundTrips()
+{
+    std::mt19937 random(s_dwSeed + 2);
+    for (DWORD iIteration = 0; iIteration < s_cFuzzIterations / 10; iIteration++)
+    {
+        std::u16string domain = _RandomString(random, 16);
+        std::u16string userName = _RandomString(random, 64);
+        std::u16string password = _RandomString(random, 256);
+        KERB_UNLOCK_LOGON_VIEW logon = _Logon(domain, userName, password);
+        logon.ulMessageType = static_cast<uint32_t>(random());
+        logon.ullLogonId = (static_cast<uint64_t>(random()) << 32) | random();
+        _CheckRoundTrip(logon);
+
+        for (char16_t &ch : domain)
+        {
+            if (ch == u'\\')
+            {
+                ch = u'.';
+            }
+        }
+        std::vector<char16_t> rgchJoined(KerbJoinQualifiedUserName(_View(domain), _View(userName), nullptr, 0));
+        KerbJoinQualifiedUserName(_View(domain), _View(userName), rgchJoined.data(), rgchJoined.size());
+        KERB_STRING_VIEW joined = { rgchJoined.data(), rgchJoined.size() - 1 };
+        KERB_STRING_VIEW splitDomain, splitUserName;
+        CHECK(KerbSplitQualifiedUserName(joined, &splitDomain, &splitUserName));
+        CHECK(_String(splitDomain) == domain && _String(splitUserName) == userName);
+    }
+}
+
+static void FuzzesUnpack()
+{
+    std::mt19937 random(s_dwSeed);
+    DWORD rgcAccepted[2] = {};
+    for (DWORD iIteration = 0; iIteration < s_cFuzzIterations; iIteration++)
+    {
+        KERB_PACKED_LAYOUT layout = (iIteration % 2) ? KERB_PACKED_LAYOUT_64 : KERB_PACKED_LAYOUT_32;
+        size_t cbHeader = (layout == KERB_PACKED_LAYOUT_64) ? 64 : 36;
+        std::u16string domain = _RandomString(random, 8);
+        std::u16string userName = _RandomString(random, 16);
+        std::u16string password = _RandomString(random, 16);
+        std::vector<uint8_t> rgbGood = _Pack(layout, _Logon(domain, userName, password));
+
+        // An exactly sized heap copy, so an overrun shows up under a sanitizer too.
+        std::vector<uint8_t> rgb = _Mutate(random, rgbGood, cbHeader);
+        uint8_t *pb = rgb.empty() ? nullptr : new uint8_t[rgb.size()];
+        if (pb != nullptr)
+        {
+            memcpy(pb, rgb.data(), rgb.size());
+        }
+
+        KERB_UNLOCK_LOGON_VIEW logon;
+        if (KerbPackedUnlockLogonUnpack(layout, pb, rgb.size(), &logon))
+        {
+            rgcAccepted[layout]++;
+            CHECK(_IsWithin(logon, pb, rgb.size(), cbHeader));
+            volatile char16_t chSum = 0;
+            for (const KERB_STRING_VIEW *pView : { &logon.domain, &logon.userName, &logon.password })
+            {
+                for (size_t ich = 0; ich < pView->cch; ich++)
+                {
+                    chSum += pView->pch[ich];
+                }
+            }
+        }
+        delete[] pb;
+    }
+
+    // Plenty of the damaged buffers should still be valid, or the fuzzing only ever
+    // reaches the first check.
+    CHECK(rgcAccepted[KERB_PACKED_LAYOUT_32] > s_cFuzzIterations / 20);
+    CHECK(rgcAccepted[KERB_PACKED_LAYOUT_64] > s_cFuzzIterations / 20);
+}
+
+static void FuzzesWowToNative()
+{
+    std::mt19937 random(s_dwSeed + 1);
+    for (DWORD iIteration = 0; iIteration < s_cFuzzIterations; iIteration++)
+    {
+        std::u16string domain = _RandomString(random, 8);
+        std::u16string userName = _RandomString(random, 16);
+        std::u16string password = _RandomString(random, 16);
+        std::vector<uint8_t> rgbWow = _Mutate(random, _Pack(KERB_PACKED_LAYOUT_32, _Logon(domain, userName, password)), 36);
+
+        KERB_UNLOCK_LOGON_VIEW logon;
+        bool fValid = KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_32, rgbWow.data(), rgbWow.size(), &logon);
+        size_t cbNative = KerbPackedUnlockLogonWowToNativeSize(rgbWow.data(), rgbWow.size());
+        CHECK(fValid == (cbNative != 0));
+        if (!fValid)
+        {
+            uint8_t rgbUntouched[64 + 8];
+            memset(rgbUntouched, 0xCC, sizeof(rgbUntouched));
+            CHECK(!KerbPackedUnlockLogonWowToNative(rgbWow.data(), rgbWow.size(), rgbUntouched, sizeof(rgbUntouched)));
+            CHECK(rgbUntouched[0] == 0xCC);
+            continue;
+        }
+
+        std::vector<uint8_t> rgbNative(cbNative);
+        CHECK(!KerbPackedUnlockLogonWowToNative(rgbWow.data(), rgbWow.size(), rgbNative.data(), cbNative - 1));
+        CHECK(KerbPackedUnlockLogonWowToNative(rgbWow.data(), rgbWow.size(), rgbNative.data(), cbNative));
+        KERB_UNLOCK_LOGON_VIEW native;
+        CHECK(KerbPackedUnlockLogonUnpack(KERB_PACKED_LAYOUT_64, rgbNative.data(), rgbNative.size(), &native));
+        CHECK(_IsWithin(native, rgbNative.data(), rgbNative.size(), 64));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2)
+    {
+        s_cFuzzIterations = static_cast<DWORD>(strtoul(argv[1], nullptr, 10));
+    }
+    if (argc >= 3)
+    {
+        s_dwSeed = static_cast<DWORD>(strtoul(argv[2], nullptr, 10));
+    }
+
+    RUN_TEST(PacksTheWowLayout);
+    RUN_TEST(PacksTheNativeLayout);
+    RUN_TEST(RefusesWrongSizes);
+    RUN_TEST(RejectsBadStrings);
+    RUN_TEST(RoundTripsBetweenLayouts);
+    RUN_TEST(SplitsAndJoinsNames);
+    RUN_TEST(FuzzesRoundTrips);
+    RUN_TEST(FuzzesUnpack);
+    RUN_TEST(FuzzesWowToNative);
+    return TestExitCode();
+}
@@ -0,0 +1,276 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// In-memory ICredentialProviderUser and ICredentialProviderUserArray for the
+// tests and benchmarks. Each property read can be made to take a while, to
+// stand in for the directory lookups behind the real users.
+
+#pragma once
+
+#include <windows.h>
+#include <credentialprovider.h>
+#include <propkey.h>
+#include <string>
+#include <vector>
+
+// Counts the property reads in progress across users, and the most seen at once.
+struct MOCK_READ_TRACKER
+{
+    volatile LONG   cActive;
+    volatile LONG   cPeak;
+};
+
+inline HRESULT MockStrDup(PCWSTR psz, _Outptr_result_nullonfailure_ PWSTR *ppsz)
+{
+    size_t cb = (wcslen(psz) + 1) * sizeof(WCHAR);
+    *ppsz = static_cast<PWSTR>(CoTaskMemAlloc(cb));
+    if (*ppsz == nullptr)
+    {
+        return E_OUTOFMEMORY;
+    }
+    memcpy(*ppsz, psz, cb);
+    return S_OK;
+}
+
+class CMockUser final : public ICredentialProviderUser
+{
+public:
+    // The names and the logon status may be nullptr for a user without them.
+    CMockUser(PCWSTR pszSid, PCWSTR pszQualifiedUserName, PCWSTR pszDisplayName, PCWSTR pszLogonStatus) :
+        _cRef(1),
+        _strSid(pszSid),
+        _strQualifiedUserName(pszQualifiedUserName ? pszQualifiedUserName : L""),
+        _strDisplayName(pszDisplayName ? pszDisplayName : L""),
+        _strLogonStatus(pszLogonStatus ? pszLogonStatus : L""),
+        _fHasQualifiedUserName(pszQualifiedUserName != nullptr),
+        _fHasDisplayName(pszDisplayName != nullptr),
+        _fHasLogonStatus(pszLogonStatus != nullptr),
+        _dwReadLatencyMs(0),
+        _pTracker(nullptr),
+        _cReads(0)
+    {
+    }
+
+    void SetReadTracker(MOCK_READ_TRACKER *pTracker)
+    {
+        _pTracker = pTracker;
+    }
+
+    // Each GetStringValue call sleeps for dwMs first.
+    void SetReadLatency(DWORD dwMs)
+    {
+        _dwReadLatencyMs = dwMs;
+    }
+
+    LONG GetReadCount() const
+    {
+        return ReadAcquire(&_cReads);
+    }
+
+    LONG GetRefCount() const
+    {
+        return ReadAcquire(&_cRef);
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppv)
+    {
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(ICredentialProviderUser))
+        {
+            *ppv = static_cast<ICredentialProviderUser*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef()
+    {
+        return InterlockedIncrement(&_cRef);
+    }
+
+    ULONG STDMETHODCALLTYPE Release()
+    {
+        LONG cRef = InterlockedDecrement(&_cRef);
+        if (cRef == 0)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetSid(_Outptr_result_nullonfailure_ PWSTR *ppszSid)
+    {
+        return MockStrDup(_strSid.c_str(), ppszSid);
+    }
+
+    HRESULT STDMETHODCALLTYPE GetStringValue(_In_ REFPROPERTYKEY key, _Outptr_result_nullonfailure_ PWSTR *ppszStringValue)
+    {
+        *ppszStringValue = nullptr;
+        InterlockedIncrement(&_cReads);
+        if (_pTracker != nullptr)
+        {
+            LONG cActive = InterlockedIncrement(&_pTracker->cActive);
+            LONG cPeak = ReadAcquire(&_pTracker->cPeak);
+            while (cActive > cPeak && InterlockedCompareExchange(&_pTracker->cPeak, cActive, cPeak) != cPeak)
+            {
+                cPeak = ReadAcquire(&_pTracker->cPeak);
+            }
+        }
+        if (_dwReadLatencyMs > 0)
+        {
+            Sleep(_dwReadLatencyMs);
+        }
+        if (_pTracker != nullptr)
+        {
+            InterlockedDecrement(&_pTracker->cActive);
+        }
+
+        if (!_fHasQualifiedUserName)
+        {
+            return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+        }
+        if (key == PKEY_Identity_QualifiedUserName)
+        {
+            return MockStrDup(_strQualifiedUserName.c_str(), ppszStringValue);
+        }
+        if (key == PKEY_Identity_UserName)
+        {
+            size_t iSeparator = _strQualifiedUserName.find(L'\\');
+            return MockStrDup(_strQualifiedUserName.c_str() + ((iSeparator == std::wstring::npos) ? 0 : iSeparator + 1), ppszStringValue);
+        }
+        if (key == PKEY_Identity_DisplayName && _fHasDisplayName)
+        {
+            return MockStrDup(_strDisplayName.c_str(), ppszStringValue);
+        }
+        if (key == PKEY_Identity_LogonStatusString && _fHasLogonStatus)
+        {
+            return MockStrDup(_strLogonStatus.c_str(), ppszStringValue);
+        }
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+    }
+
+private:
+    ~CMockUser()
+    {
+    }
+
+    volatile LONG         _cRef;
+    std::wstring          _strSid;
+    std::wstring          _strQualifiedUserName;
+    std::wstring          _strDisplayName;
+    std::wstring          _strLogonStatus;
+    bool                  _fHasQualifiedUserName;
+    bool                  _fHasDisplayName;
+    bool                  _fHasLogonStatus;
+    DWORD                 _dwReadLatencyMs;
+    MOCK_READ_TRACKER     *_pTracker;
+    volatile LONG         _cReads;
+};
+
+class CMockUserArray final : public ICredentialProviderUserArray
+{
+public:
+    CMockUserArray() :
+        _cRef(1)
+    {
+    }
+
+    // Adds cUsers domain users numbered from iFirst, with SIDs that share the
+    // domain part the way the SIDs of one domain do.
+    void AddDomainUsers(DWORD iFirst, DWORD cUsers, DWORD dwReadLatencyMs)
+    {
+        for (DWORD i = iFirst; i < iFirst + cUsers; i++)
+        {
+            WCHAR szSid[64];
+            WCHAR szQualifiedUserName[64];
+            WCHAR szDisplayName[64];
+            swprintf(szSid, ARRAYSIZE(szSid), L"S-1-5-21-3623811015-3361044348-30300820-%u", 1000 + i);
+            swprintf(szQualifiedUserName, ARRAYSIZE(szQualifiedUserName), L"CONTOSO\\user%u", i);
+            swprintf(szDisplayName, ARRAYSIZE(szDisplayName), L"User %u", i);
+            CMockUser *pUser = new CMockUser(szSid, szQualifiedUserName, szDisplayName, nullptr);
+            pUser->SetReadLatency(dwReadLatencyMs);
+            _rgpUsers.push_back(pUser);
+        }
+    }
+
+    // Takes over the caller's reference.
+    void Add(CMockUser *pUser)
+    {
+        _rgpUsers.push_back(pUser);
+    }
+
+    // Drops the user at iUser, as when an account is removed.
+    void RemoveAt(DWORD iUser)
+    {
+        _rgpUsers[iUser]->Release();
+        _rgpUsers.erase(_rgpUsers.begin() + iUser);
+    }
+
+    CMockUser *User(DWORD iUser) const
+    {
+        return _rgpUsers[iUser];
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppv)
+    {
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(ICredentialProviderUserArray))
+        {
+            *ppv = static_cast<ICredentialProviderUserArray*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef()
+    {
+        return InterlockedIncrement(&_cRef);
+    }
+
+    ULONG STDMETHODCALLTYPE Release()
+    {
+        LONG cRef = InterlockedDecrement(&_cRef);
+        if (cRef == 0)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetCount(_Out_ DWORD *pdwUserCount)
+    {
+        *pdwUserCount = static_cast<DWORD>(_rgpUsers.size());
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetAt(DWORD dwIndex, _COM_Outptr_ ICredentialProviderUser **ppUser)
+    {
+        *ppUser = nullptr;
+        if (dwIndex >= _rgpUsers.size())
+        {
+            return E_INVALIDARG;
+        }
+        _rgpUsers[dwIndex]->AddRef();
+        *ppUser = _rgpUsers[dwIndex];
+        return S_OK;
+    }
+
+private:
+    ~CMockUserArray()
+    {
+        for (CMockUser *pUser : _rgpUsers)
+        {
+            pUser->Release();
+        }
+    }
+
+    volatile LONG               _cRef;
+    std::vector<CMockUser*>     _rgpUsers;
+};
@@ -0,0 +1,82 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Compares reading the identity properties of every user one after another
+// with UserPropertiesPrefetch, when each property read waits on a simulated
+// directory lookup.
+//
+//   PrefetchBenchmark [read latency ms]
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "UserPropertyPrefetch.h"
+#include "MockCredentialProviderUsers.h"
+
+static double _Milliseconds(const LARGE_INTEGER &liStart, const LARGE_INTEGER &liEnd)
+{
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    return (liEnd.QuadPart - liStart.QuadPart) * 1e3 / liFrequency.QuadPart;
+}
+
+int main(int argc, char **argv)
+{
+    static const DWORD c_rgcUsers[] = { 10, 50, 200 };
+    static const DWORD c_rgcWorkers[] = { 4, 8, 16 };
+    DWORD dwLatencyMs = (argc >= 2) ? static_cast<DWORD>(atoi(argv[1])) : 2;
+
+    printf("read latency %u ms, four reads per user\n\n", dwLatencyMs);
+    printf("%6s %10s %10s %10s %10s\n", "users", "serial ms", "4 workers", "8 workers", "16 workers");
+    for (DWORD cUsers : c_rgcUsers)
+    {
+        CMockUserArray *pArray = new CMockUserArray();
+        pArray->AddDomainUsers(0, cUsers, dwLatencyMs);
+        std::vector<ICredentialProviderUser*> users(cUsers);
+        for (DWORD i = 0; i < cUsers; i++)
+        {
+            pArray->GetAt(i, &users[i]);
+        }
+        std::vector<USER_PROPERTIES> properties(cUsers);
+        std::vector<HRESULT> results(cUsers);
+
+        LARGE_INTEGER liStart, liEnd;
+        QueryPerformanceCounter(&liStart);
+        for (DWORD i = 0; i < cUsers; i++)
+        {
+            UserPropertiesFetch(users[i], &properties[i]);
+        }
+        QueryPerformanceCounter(&liEnd);
+        printf("%6u %10.1f", cUsers, _Milliseconds(liStart, liEnd));
+        for (USER_PROPERTIES &userProperties : properties)
+        {
+            UserPropertiesFree(&userProperties);
+        }
+
+        for (DWORD cWorkers : c_rgcWorkers)
+        {
+            QueryPerformanceCounter(&liStart);
+            UserPropertiesPrefetch(users.data(), cUsers, cWorkers, properties.data(), results.data());
+            QueryPerformanceCounter(&liEnd);
+            printf(" %10.1f", _Milliseconds(liStart, liEnd));
+            for (USER_PROPERTIES &userProperties : properties)
+            {
+                UserPropertiesFree(&userProperties);
+            }
+        }
+        printf("\n");
+
+        for (ICredentialProviderUser *pUser : users)
+        {
+            pUser->Release();
+        }
+        pArray->Release();
+    }
+    return 0;
+}
@@ -0,0 +1,300 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Replays a presence journal, a list of times the phone arrived and departed,
+// through the scan schedule the scanner would have followed, and reports how
+// many inquiry passes each scheduling policy costs and how late it notices
+// arrivals and departures. The model learns from the journal as it is replayed,
+// the way the scanner's model learns from what it sees.
+//
+//   PresenceEvaluator <journal.csv> [absence window seconds]
+//   PresenceEvaluator --synthesize <weeks> [seed] > journal.csv
+//
+// Journal lines are "YYYY-MM-DD HH:MM:SS,arrived" or "...,departed" in local
+// time, in order; lines starting with # are comments.
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "PresenceModel.h"
+
+// An inquiry pass takes about 6.4 seconds, see CSystemBluetoothRadio::Inquire.
+static const double c_dInquirySeconds = 6.4;
+static const double c_dFixedIntervalSeconds = 10.0;
+
+struct PRESENCE_EVENT
+{
+    time_t  tTime;      // Seconds, with the local time read as UTC
+    bool    fArrived;
+};
+
+enum SCHEDULE_POLICY
+{
+    SP_FIXED,           // The interval before the presence model
+    SP_ARRIVALS_ONLY,   // The model paces the scans while away only
+    SP_MODEL,           // The model paces both, using the departure histogram
+};
+
+static const char *const c_rgszPolicyNames[] = { "fixed", "arrivals-only", "model" };
+
+struct POLICY_RESULT
+{
+    ULONGLONG           cPasses;
+    std::vector<double> arrivalLatencies;
+    std::vector<double> departureLatencies;
+};
+
+static SYSTEMTIME _SystemTimeFromTime(time_t t)
+{
+    struct tm tmTime;
+    gmtime_r(&t, &tmTime);
+    SYSTEMTIME st = {};
+    st.wYear = static_cast<WORD>(tmTime.tm_year + 1900);
+    st.wMonth = static_cast<WORD>(tmTime.tm_mon + 1);
+    st.wDayOfWeek = static_cast<WORD>(tmTime.tm_wday);
+    st.wDay = static_cast<WORD>(tmTime.tm_mday);
+    st.wHour = static_cast<WORD>(tmTime.tm_hour);
+    st.wMinute = static_cast<WORD>(tmTime.tm_min);
+    st.wSecond = static_cast<WORD>(tmTime.tm_sec);
+    return st;
+}
+
+static bool _LoadJournal(const char *pszPath, std::vector<PRESENCE_EVENT> *pEvents)
+{
+    FILE *pFile = fopen(pszPath, "r");
+    if (pFile == nullptr)
+    {
+        fprintf(stderr, "Cannot open %s\n", pszPath);
+        return false;
+    }
+
+    bool fOk = true;
+    char szLine[256];
+    DWORD iLine = 0;
+    while (fOk && fgets(szLine, sizeof(szLine), pFile) != nullptr)
+    {
+        iLine++;
+        if (szLine[0] == '#' || szLine[0] == '\n' || szLine[0] == '\r')
+        {
+            continue;
+        }
+
+        struct tm tmTime = {};
+        char szEvent[32];
+        if (sscanf(szLine, "%d-%d-%d %d:%d:%d,%31s", &tmTime.tm_year, &tmTime.tm_mon, &tmTime.tm_mday,
+                   &tmTime.tm_hour, &tmTime.tm_min, &tmTime.tm_sec, szEvent) != 7 ||
+            (strcmp(szEvent, "arrived") != 0 && strcmp(szEvent, "departed") != 0))
+        {
+            fprintf(stderr, "%s(%u): expected \"YYYY-MM-DD HH:MM:SS,arrived|departed\"\n", pszPath, iLine);
+            fOk = false;
+            break;
+        }
+        tmTime.tm_year -= 1900;
+        tmTime.tm_mon -= 1;
+
+        PRESENCE_EVENT event = { timegm(&tmTime), strcmp(szEvent, "arrived") == 0 };
+        if (!pEvents->empty() && (event.tTime < pEvents->back().tTime || event.fArrived == pEvents->back().fArrived))
+        {
+            fprintf(stderr, "%s(%u): events must alternate and be in order\n", pszPath, iLine);
+            fOk = false;
+        }
+        pEvents->push_back(event);
+    }
+    fclose(pFile);
+
+    if (fOk && (pEvents->empty() || !pEvents->front().fArrived))
+    {
+        fprintf(stderr, "%s: the journal must start with an arrival\n", pszPath);
+        fOk = false;
+    }
+    return fOk;
+}
+
+//
+// Runs the scan schedule of one radio over the journal. A pass sees the phone if
+// it ends while the phone is there; the arrival is noticed by the first pass that
+// sees it and the departure by the first pass that ends more than the absence
+// window after the last one that saw it, as in CBluetoothScanner.
+//
+static POLICY_RESULT _Simulate(const std::vector<PRESENCE_EVENT> &events, SCHEDULE_POLICY policy, DWORD dwAbsenceWindowMs)
+{
+    POLICY_RESULT result = {};
+    CPresenceModel model;
+    double dAbsenceWindow = dwAbsenceWindowMs / 1000.0;
+
+    double dNow = static_cast<double>(events.front().tTime) - 3600.0;
+    double dEnd = static_cast<double>(events.back().tTime) + 3600.0;
+    size_t iNext = 0;           // The next journal event
+    bool fPhoneThere = false;   // Where the journal says the phone is
+    bool fTracking = false;     // Where the scanner thinks it is
+    double dLastSeen = 0.0;
+    double dArrived = 0.0;
+    double dDeparted = 0.0;
+
+    while (dNow < dEnd)
+    {
+        // Run one inquiry pass.
+        dNow += c_dInquirySeconds;
+        result.cPasses++;
+        while (iNext < events.size() && events[iNext].tTime <= dNow)
+        {
+            fPhoneThere = events[iNext].fArrived;
+            (fPhoneThere ? dArrived : dDeparted) = static_cast<double>(events[iNext].tTime);
+            iNext++;
+        }
+
+        SYSTEMTIME stNow = _SystemTimeFromTime(static_cast<time_t>(dNow));
+        if (fPhoneThere)
+        {
+            dLastSeen = dNow;
+            if (!fTracking)
+            {
+                fTracking = true;
+                result.arrivalLatencies.push_back(dNow - dArrived);
+                model.RecordArrival(stNow);
+            }
+        }
+        else if (fTracking && dNow - dLastSeen > dAbsenceWindow)
+        {
+            fTracking = false;
+            result.departureLatencies.push_back(dNow - dDeparted);
+            model.RecordDeparture(stNow);
+        }
+
+        // Wait as the scanner would.
+        DWORD dwIntervalMs;
+        if (fTracking)
+        {
+            dwIntervalMs = (policy == SP_MODEL) ? model.GetTrackingIntervalMs(stNow, dwAbsenceWindowMs) :
+                (std::min)(static_cast<DWORD>(c_dFixedIntervalSeconds * 1000), dwAbsenceWindowMs / 3);
+        }
+        else
+        {
+            dwIntervalMs = (policy == SP_FIXED) ? static_cast<DWORD>(c_dFixedIntervalSeconds * 1000) : model.GetScanIntervalMs(stNow);
+        }
+        dNow += dwIntervalMs / 1000.0;
+    }
+    return result;
+}
+
+static double _Mean(const std::vector<double> &values)
+{
+    double dSum = 0.0;
+    for (double d : values)
+    {
+        dSum += d;
+    }
+    return values.empty() ? 0.0 : dSum / values.size();
+}
+
+static double _Percentile(std::vector<double> values, double dFraction)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(dFraction * (values.size() - 1))];
+}
+
+static int _Evaluate(const char *pszJournal, DWORD dwAbsenceWindowMs)
+{
+    std::vector<PRESENCE_EVENT> events;
+    if (!_LoadJournal(pszJournal, &events))
+    {
+        return 1;
+    }
+
+    double dDays = (events.back().tTime - events.front().tTime) / 86400.0 + 2.0 / 24.0;
+    printf("%zu events over %.1f days, absence window %u s\n\n", events.size(), dDays, dwAbsenceWindowMs / 1000);
+    printf("%-14s %12s %14s %14s %16s %16s\n", "policy", "passes/day", "arrival mean", "arrival p95", "departure mean", "departure p95");
+    for (DWORD iPolicy = SP_FIXED; iPolicy <= SP_MODEL; iPolicy++)
+    {
+        POLICY_RESULT result = _Simulate(events, static_cast<SCHEDULE_POLICY>(iPolicy), dwAbsenceWindowMs);
+        printf("%-14s %12.0f %13.1fs %13.1fs %15.1fs %15.1fs\n", c_rgszPolicyNames[iPolicy],
+               result.cPasses / dDays,
+               _Mean(result.arrivalLatencies), _Percentile(result.arrivalLatencies, 0.95),
+               _Mean(result.departureLatencies), _Percentile(result.departureLatencies, 0.95));
+    }
+    return 0;
+}
+
+//
+// Writes a journal of office weeks: arrivals around 8:30 and departures around
+// 17:30 on weekdays, a lunch break on some days and the odd weekend visit.
+//
+static int _Synthesize(DWORD cWeeks, DWORD dwSeed)
+{
+    std::mt19937 random(dwSeed);
+    std::normal_distribution<double> arrival(8.5 * 3600, 1200);
+    std::normal_distribution<double> departure(17.5 * 3600, 1800);
+    std::uniform_real_distribution<double> lunch(11.75 * 3600, 13.0 * 3600);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    // Monday 2026-01-05
+    struct tm tmStart = {};
+    tmStart.tm_year = 2026 - 1900;
+    tmStart.tm_mon = 0;
+    tmStart.tm_mday = 5;
+    time_t tStart = timegm(&tmStart);
+
+    printf("# Synthetic presence journal, %u weeks, seed %u\n", cWeeks, dwSeed);
+    for (DWORD iDay = 0; iDay < cWeeks * 7; iDay++)
+    {
+        time_t tDay = tStart + static_cast<time_t>(iDay) * 86400;
+        std::vector<std::pair<double, bool>> dayEvents;
+        if (iDay % 7 < 5)
+        {
+            dayEvents.push_back({ arrival(random), true });
+            if (chance(random) < 0.4)
+            {
+                double dLunch = lunch(random);
+                dayEvents.push_back({ dLunch, false });
+                dayEvents.push_back({ dLunch + 2400 + chance(random) * 1800, true });
+            }
+            dayEvents.push_back({ departure(random), false });
+        }
+        else if (chance(random) < 0.15)
+        {
+            double dVisit = 10 * 3600 + chance(random) * 5 * 3600;
+            dayEvents.push_back({ dVisit, true });
+            dayEvents.push_back({ dVisit + 3600 + chance(random) * 7200, false });
+        }
+
+        for (const auto &event : dayEvents)
+        {
+            time_t t = tDay + static_cast<time_t>(event.first);
+            struct tm tmEvent;
+            gmtime_r(&t, &tmEvent);
+            printf("%04d-%02d-%02d %02d:%02d:%02d,%s\n", tmEvent.tm_year + 1900, tmEvent.tm_mon + 1, tmEvent.tm_mday,
+                   tmEvent.tm_hour, tmEvent.tm_min, tmEvent.tm_sec, event.second ? "arrived" : "departed");
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "--synthesize") == 0)
+    {
+        return _Synthesize(static_cast<DWORD>(atoi(argv[2])), (argc >= 4) ? static_cast<DWORD>(atoi(argv[3])) : 1);
+    }
+    if (argc >= 2 && argv[1][0] != '-')
+    {
+        DWORD dwAbsenceWindowSeconds = (argc >= 3) ? static_cast<DWORD>(atoi(argv[2])) : 60;
+        return _Evaluate(argv[1], (dwAbsenceWindowSeconds > 0 ? dwAbsenceWindowSeconds : 60) * 1000);
+    }
+    fprintf(stderr, "usage: %s <journal.csv> [absence window seconds]\n"
+                    "       %s --synthesize <weeks> [seed]\n", argv[0], argv[0]);
+    return 2;
+}
@@ -0,0 +1,129 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks the scan intervals CPresenceModel derives from its histograms.
+
+#include <windows.h>
+#include "PresenceModel.h"
+#include "TestHarness.h"
+
+static const DWORD c_dwAbsenceWindowMs = 60 * 1000;
+
+static SYSTEMTIME _Time(WORD wDayOfWeek, WORD wHour)
+{
+    SYSTEMTIME st = {};
+    st.wDayOfWeek = wDayOfWeek;
+    st.wHour = wHour;
+    return st;
+}
+
+// Weekday mornings at 8 and evenings at 17.
+static void _TrainOfficeHours(CPresenceModel *pModel, DWORD cWeeks)
+{
+    for (DWORD iWeek = 0; iWeek < cWeeks; iWeek++)
+    {
+        for (WORD wDay = 1; wDay <= 5; wDay++)
+        {
+            pModel->RecordArrival(_Time(wDay, 8));
+            pModel->RecordDeparture(_Time(wDay, 17));
+        }
+    }
+}
+
+static void UsesDefaultsUntilTrained()
+{
+    CPresenceModel model;
+    model.RecordArrival(_Time(1, 8));
+    model.RecordDeparture(_Time(1, 17));
+    CHECK(model.GetScanIntervalMs(_Time(1, 8)) == 10 * 1000);
+    CHECK(model.GetScanIntervalMs(_Time(0, 3)) == 10 * 1000);
+    CHECK(model.GetTrackingIntervalMs(_Time(1, 17), c_dwAbsenceWindowMs) == 10 * 1000);
+    CHECK(model.GetTrackingIntervalMs(_Time(1, 17), 9 * 1000) == 3 * 1000);
+}
+
+static void ScansOftenAroundArrivals()
+{
+    CPresenceModel model;
+    _TrainOfficeHours(&model, 4);
+    CHECK(model.GetScanIntervalMs(_Time(2, 8)) == 2 * 1000);
+    CHECK(model.GetScanIntervalMs(_Time(2, 7)) == 2 * 1000);
+    CHECK(model.GetScanIntervalMs(_Time(6, 8)) == 60 * 1000);
+    CHECK(model.GetScanIntervalMs(_Time(2, 3)) == 60 * 1000);
+}
+
+static void RelaxesTrackingAwayFromDepartures()
+{
+    CPresenceModel model;
+    _TrainOfficeHours(&model, 4);
+
+    // Around the usual departure the default interval is kept.
+    CHECK(model.GetTrackingIntervalMs(_Time(3, 17), c_dwAbsenceWindowMs) == 10 * 1000);
+    CHECK(model.GetTrackingIntervalMs(_Time(3, 18), c_dwAbsenceWindowMs) == 10 * 1000);
+
+    // When the device never leaves, polling only has to keep up with the window.
+    CHECK(model.GetTrackingIntervalMs(_Time(3, 11), c_dwAbsenceWindowMs) == c_dwAbsenceWindowMs / 3);
+    CHECK(model.GetTrackingIntervalMs(_Time(3, 11), 3 * 1000) == 1000);
+
+    // Arrivals say nothing about departures and the other way around.
+    CHECK(model.GetTrackingIntervalMs(_Time(3, 8), c_dwAbsenceWindowMs) == c_dwAbsenceWindowMs / 3);
+    CHECK(model.GetScanIntervalMs(_Time(3, 17)) == 60 * 1000);
+}
+
+static void TypicalWindowsUseTheDefault()
+{
+    CPresenceModel model;
+    for (WORD wHour = 0; wHour < 24; wHour++)
+    {
+        for (WORD wDay = 0; wDay < 7; wDay++)
+        {
+            model.RecordDeparture(_Time(wDay, wHour));
+        }
+    }
+    CHECK(model.GetTrackingIntervalMs(_Time(4, 12), c_dwAbsenceWindowMs) == 10 * 1000);
+}
+
+static void SavesAndLoadsHistograms()
+{
+    ShimResetRegistry();
+    CPresenceModel model;
+    _TrainOfficeHours(&model, 2);
+    CHECK_HR(model.Save(L"Phone"));
+
+    CPresenceModel loaded;
+    CHECK_HR(loaded.Load(L"Phone"));
+    CHECK(loaded.GetScanIntervalMs(_Time(1, 8)) == 2 * 1000);
+    CHECK(loaded.GetTrackingIntervalMs(_Time(1, 12), c_dwAbsenceWindowMs) == c_dwAbsenceWindowMs / 3);
+
+    CPresenceModel missing;
+    CHECK(FAILED(missing.Load(L"Other Phone")));
+    CHECK(missing.GetScanIntervalMs(_Time(1, 8)) == 10 * 1000);
+}
+
+// A full bucket halves the histogram instead of wrapping.
+static void SaturatedBucketsDecay()
+{
+    CPresenceModel model;
+    for (DWORD i = 0; i < 1000; i++)
+    {
+        model.RecordArrival(_Time(5, 8));
+    }
+    model.RecordArrival(_Time(1, 9));
+    CHECK(model.GetScanIntervalMs(_Time(5, 8)) == 2 * 1000);
+    CHECK(model.GetScanIntervalMs(_Time(1, 9)) == 10 * 1000);
+}
+
+int main()
+{
+    RUN_TEST(UsesDefaultsUntilTrained);
+    RUN_TEST(ScansOftenAroundArrivals);
+    RUN_TEST(RelaxesTrackingAwayFromDepartures);
+    RUN_TEST(TypicalWindowsUseTheDefault);
+    RUN_TEST(SavesAndLoadsHistograms);
+    RUN_TEST(SaturatedBucketsDecay);
+    return TestExitCode();
+}
@@ -0,0 +1,258 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks that CProtectedSecretCache only serves an entry for the scenario and
+// secret version it was made for, protects each password once, and keeps few
+// enough entries that a machine with hundreds of users never runs the secret
+// arena out of slots. A password too long to protect within a slot is used as
+// it is.
+
+#include <windows.h>
+#include <string>
+#include "ProtectedSecretCache.h"
+#include "FakeSecretProtector.h"
+#include "TestHarness.h"
+
+static const WCHAR c_szPassword[] = L"Correct-Horse-42";
+
+// Loads a user's password into pszSecret the way GetSerialization does: from the
+// cache, or from the plain password, which is then protected and cached. Returns
+// whether the cache served it.
+static bool _Load(CProtectedSecretCache *pCache, PCWSTR pszSid, CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+                  DWORD dwSecretVersion, _Out_writes_(c_cchSecretSlot) PWSTR pszSecret, PCWSTR pszPassword = c_szPassword)
+{
+    HRESULT hr = pCache->Lookup(pszSid, cpus, dwSecretVersion, pszSecret);
+    CHECK_HR(hr);
+    if (hr == S_FALSE)
+    {
+        CHECK_HR(CSecretArena::Instance().CopyInto(pszSecret, pszPassword));
+        CHECK_HR(pCache->Protect(pszSid, cpus, dwSecretVersion, pszSecret));
+    }
+    return hr == S_OK;
+}
+
+static std::wstring _Protected(PCWSTR pszPassword)
+{
+    return std::wstring(c_szFakeProtectedPrefix) + pszPassword;
+}
+
+static DWORD _ArenaSlotsInUse()
+{
+    SECRET_ARENA_STATS stats;
+    CSecretArena::Instance().GetStats(&stats);
+    return stats.cInUse;
+}
+
+static std::wstring _Sid(DWORD iUser)
+{
+    return L"S-1-5-21-1000-2000-3000-" + std::to_wstring(1000 + iUser);
+}
+
+static void HitsForTheSameScenarioAndVersion()
+{
+    CFakeSecretProtector protector;
+    PWSTR pszSecret = nullptr;
+    CHECK_HR(CSecretArena::Instance().Allocate(&pszSecret));
+    {
+        CProtectedSecretCache cache(&protector);
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(pszSecret == _Protected(c_szPassword));
+        CHECK(_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(pszSecret == _Protected(c_szPassword));
+
+        // SIDs compare without regard to case.
+        CHECK(_Load(&cache, L"s-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(protector.ProtectCount() == 1);
+
+        PROTECTED_SECRET_CACHE_STATS stats;
+        cache.GetStats(&stats);
+        CHECK(stats.cHits == 2);
+        CHECK(stats.cProtects == 1);
+        CHECK(stats.cEntries == 1);
+    }
+    CSecretArena::Instance().Free(pszSecret);
+    CHECK(_ArenaSlotsInUse() == 0);
+}
+
+static void MissesOnANewSecretVersion()
+{
+    CFakeSecretProtector protector;
+    PWSTR pszSecret = nullptr;
+    CHECK_HR(CSecretArena::Instance().Allocate(&pszSecret));
+    {
+        CProtectedSecretCache cache(&protector);
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 2, pszSecret, L"Changed-43"));
+        CHECK(pszSecret == _Protected(L"Changed-43"));
+        CHECK(_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 2, pszSecret));
+        CHECK(pszSecret == _Protected(L"Changed-43"));
+
+        // The old version's entry was replaced, not kept beside the new one.
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(protector.ProtectCount() == 3);
+
+        PROTECTED_SECRET_CACHE_STATS stats;
+        cache.GetStats(&stats);
+        CHECK(stats.cEntries == 1);
+    }
+    CSecretArena::Instance().Free(pszSecret);
+    CHECK(_ArenaSlotsInUse() == 0);
+}
+
+static void MissesOnAnotherScenario()
+{
+    CFakeSecretProtector protector;
+    PWSTR pszSecret = nullptr;
+    CHECK_HR(CSecretArena::Instance().Allocate(&pszSecret));
+    {
+        CProtectedSecretCache cache(&protector);
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_LOGON, 1, pszSecret));
+        CHECK(protector.ProtectCount() == 2);
+
+        // CredUI gets the password as it is, never the protected form cached for logon.
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_CREDUI, 1, pszSecret));
+        CHECK(pszSecret == std::wstring(c_szPassword));
+        CHECK(protector.ProtectCount() == 2);
+        CHECK(_Load(&cache, L"S-1-5-21-1", CPUS_CREDUI, 1, pszSecret));
+        CHECK(pszSecret == std::wstring(c_szPassword));
+    }
+    CSecretArena::Instance().Free(pszSecret);
+    CHECK(_ArenaSlotsInUse() == 0);
+}
+
+static void DoesNotProtectTwice()
+{
+    CFakeSecretProtector protector;
+    PWSTR pszSecret = nullptr;
+    CHECK_HR(CSecretArena::Instance().Allocate(&pszSecret));
+    {
+        CProtectedSecretCache cache(&protector);
+        std::wstring strProtected = _Protected(c_szPassword);
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret, strProtected.c_str()));
+        CHECK(pszSecret == strProtected);
+        CHECK(protector.ProtectCount() == 0);
+    }
+    CSecretArena::Instance().Free(pszSecret);
+}
+
+static void EvictsTheLeastRecentlyUsed()
+{
+    CFakeSecretProtector protector;
+    PWSTR pszSecret = nullptr;
+    CHECK_HR(CSecretArena::Instance().Allocate(&pszSecret));
+    {
+        CProtectedSecretCache cache(&protector);
+        for (DWORD iUser = 0; iUser < c_cMaxProtectedSecrets; iUser++)
+        {
+            CHECK(!_Load(&cache, _Sid(iUser).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        }
+        CHECK(_ArenaSlotsInUse() == 1 + c_cMaxProtectedSecrets);
+
+        // User 0 is used again, so user 1 is the one that makes way.
+        CHECK(_Load(&cache, _Sid(0).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(!_Load(&cache, _Sid(c_cMaxProtectedSecrets).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(_Load(&cache, _Sid(0).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(_Load(&cache, _Sid(2).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(!_Load(&cache, _Sid(1).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+
+        PROTECTED_SECRET_CACHE_STATS stats;
+        cache.GetStats(&stats);
+        CHECK(stats.cEntries == c_cMaxProtectedSecrets);
+        CHECK(stats.cEvictions == 2);
+    }
+    CSecretArena::Instance().Free(pszSecret);
+    CHECK(_ArenaSlotsInUse() == 0);
+}
+
+// Many users unlocking in turn never hold more than the cache's share of the
+// arena, so a password can always be loaded.
+static void LeavesArenaSlotsForManyUsers()
+{
+    static const DWORD c_cUsers = 250;
+
+    CFakeSecretProtector protector;
+    PWSTR pszSecret = nullptr;
+    CHECK_HR(CSecretArena::Instance().Allocate(&pszSecret));
+    {
+        CProtectedSecretCache cache(&protector);
+        DWORD cPeakInUse = 0;
+        for (DWORD iRound = 0; iRound < 2; iRound++)
+        {
+            for (DWORD iUser = 0; iUser < c_cUsers; iUser++)
+            {
+                _Load(&cache, _Sid(iUser).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret);
+                DWORD cInUse = _ArenaSlotsInUse();
+                cPeakInUse = (cInUse > cPeakInUse) ? cInUse : cPeakInUse;
+            }
+        }
+        CHECK(cPeakInUse == 1 + c_cMaxProtectedSecrets);
+        CHECK(cPeakInUse < c_cSecretSlots);
+    }
+    CSecretArena::Instance().Free(pszSecret);
+    CHECK(_ArenaSlotsInUse() == 0);
+}
+
+static void ForgetsInvalidatedUsers()
+{
+    CFakeSecretProtector protector;
+    PWSTR pszSecret = nullptr;
+    CHECK_HR(CSecretArena::Instance().Allocate(&pszSecret));
+    {
+        CProtectedSecretCache cache(&protector);
+        CHECK(!_Load(&cache, _Sid(0).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(!_Load(&cache, _Sid(1).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        cache.Invalidate(_Sid(0).c_str());
+        cache.Invalidate(nullptr);
+        CHECK(_ArenaSlotsInUse() == 2);
+        CHECK(!_Load(&cache, _Sid(0).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(_Load(&cache, _Sid(1).c_str(), CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+
+        cache.InvalidateAll();
+        CHECK(_ArenaSlotsInUse() == 1);
+    }
+    CSecretArena::Instance().Free(pszSecret);
+}
+
+// A password whose protected form would not fit in a slot is used as it is, and
+// the cache serves that form from then on.
+static void UsesLongPasswordsAsTheyAre()
+{
+    CFakeSecretProtector protector;
+    PWSTR pszSecret = nullptr;
+    CHECK_HR(CSecretArena::Instance().Allocate(&pszSecret));
+    {
+        CProtectedSecretCache cache(&protector);
+        std::wstring strLong(c_cchSecretSlot - 1, L'x');
+        CHECK(!_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret, strLong.c_str()));
+        CHECK(pszSecret == strLong);
+        CHECK(_Load(&cache, L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1, pszSecret));
+        CHECK(pszSecret == strLong);
+
+        // The longest that still fits is protected.
+        std::wstring strFits(c_cchSecretSlot - ARRAYSIZE(c_szFakeProtectedPrefix), L'y');
+        CHECK(!_Load(&cache, L"S-1-5-21-2", CPUS_UNLOCK_WORKSTATION, 1, pszSecret, strFits.c_str()));
+        CHECK(pszSecret == _Protected(strFits.c_str()));
+        CHECK(protector.ProtectCount() == 2);
+    }
+    CSecretArena::Instance().Free(pszSecret);
+    CHECK(_ArenaSlotsInUse() == 0);
+}
+
+int main()
+{
+    RUN_TEST(HitsForTheSameScenarioAndVersion);
+    RUN_TEST(MissesOnANewSecretVersion);
+    RUN_TEST(MissesOnAnotherScenario);
+    RUN_TEST(DoesNotProtectTwice);
+    RUN_TEST(EvictsTheLeastRecentlyUsed);
+    RUN_TEST(LeavesArenaSlotsForManyUsers);
+    RUN_TEST(ForgetsInvalidatedUsers);
+    RUN_TEST(UsesLongPasswordsAsTheyAre);
+    return TestExitCode();
+}
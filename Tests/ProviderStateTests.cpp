@@ -0,0 +1,227 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks the provider state over stand-in tiles: an approval reaches only the
+// approving user's tile and makes it the default, and the states published for
+// phone events share the tiles without taking references of their own, which
+// are only dropped once the last state holding the tiles is reclaimed.
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include "ProviderState.h"
+#include "TestHarness.h"
+
+// Records what the provider state does to a tile.
+class CTestTile
+{
+public:
+    explicit CTestTile(PCWSTR pszSid) :
+        cRef(1),
+        cApprovals(0),
+        cSerializations(0),
+        cOtherEvents(0),
+        cRevoked(0),
+        _strSid(pszSid)
+    {
+    }
+
+    ULONG AddRef()
+    {
+        return InterlockedIncrement(&cRef);
+    }
+
+    ULONG Release()
+    {
+        return InterlockedDecrement(&cRef);
+    }
+
+    PCWSTR UserSid() const
+    {
+        return _strSid.c_str();
+    }
+
+    void OnAuthEvent(AUTH_EVENT event)
+    {
+        if (event == AUTH_EVENT_APP_APPROVED)
+        {
+            cApprovals++;
+        }
+        else
+        {
+            cOtherEvents++;
+        }
+    }
+
+    void QueuePrepareSerialization()
+    {
+        cSerializations++;
+    }
+
+    void OnProviderStateChange(bool fLoggedIn)
+    {
+        cRevoked += fLoggedIn ? 0 : 1;
+    }
+
+    // Whether the tile has heard of no approval at all.
+    bool Untouched() const
+    {
+        return cApprovals == 0 && cSerializations == 0 && cOtherEvents == 0 && cRevoked == 0;
+    }
+
+    volatile LONG   cRef;
+    DWORD           cApprovals;
+    DWORD           cSerializations;
+    DWORD           cOtherEvents;
+    DWORD           cRevoked;
+
+private:
+    std::wstring    _strSid;
+};
+
+typedef CProviderStateCellT<CTestTile> TEST_STATE_CELL;
+typedef PROVIDER_STATE_T<CTestTile> TEST_STATE;
+
+// Publishes the tiles with their SID index, as CSampleProvider::_PublishCredentials does.
+static void _Publish(TEST_STATE_CELL *pCell, const std::vector<CTestTile*> &rgpTiles)
+{
+    std::shared_ptr<const CTileList<CTestTile>> spCredentials = std::make_shared<const CTileList<CTestTile>>(rgpTiles);
+    SID_INDEX index;
+    std::wstring strKey;
+    for (DWORD i = 0; i < rgpTiles.size(); i++)
+    {
+        TEST_STATE_CELL::MakeSidKey(rgpTiles[i]->UserSid(), &strKey);
+        index[strKey] = i;
+    }
+    std::shared_ptr<const SID_INDEX> spSidIndex = std::make_shared<const SID_INDEX>(index);
+    CHECK_HR(pCell->Update([&spCredentials, &spSidIndex](TEST_STATE &state)
+    {
+        state.spCredentials.swap(spCredentials);
+        state.spSidIndex.swap(spSidIndex);
+    }));
+}
+
+static DWORD _Default(TEST_STATE_CELL *pCell)
+{
+    const TEST_STATE *pState = pCell->Acquire();
+    DWORD dwDefault = pState->dwDefault;
+    TEST_STATE_CELL::Release(pState);
+    return dwDefault;
+}
+
+static void _ReclaimAll(TEST_STATE_CELL *pCell)
+{
+    while (pCell->Reclaim() != 0)
+    {
+    }
+}
+
+static void ApprovalReachesOnlyItsTile()
+{
+    CTestTile tileA(L"S-1-5-21-1000");
+    CTestTile tileB(L"S-1-5-21-1001");
+    CTestTile tileC(L"S-1-5-21-1002");
+    {
+        TEST_STATE_CELL cell;
+        _Publish(&cell, { &tileA, &tileB, &tileC });
+        CHECK(_Default(&cell) == CREDENTIAL_PROVIDER_NO_DEFAULT);
+
+        // SIDs compare without regard to case.
+        CHECK(cell.Approve(L"s-1-5-21-1001") == S_OK);
+        CHECK(_Default(&cell) == 1);
+        CHECK(tileB.cApprovals == 1 && tileB.cSerializations == 1);
+        CHECK(tileB.cOtherEvents == 0 && tileB.cRevoked == 0);
+        CHECK(tileA.Untouched());
+        CHECK(tileC.Untouched());
+
+        // Approving the same user again only repeats the approval.
+        CHECK(cell.Approve(L"S-1-5-21-1001") == S_OK);
+        CHECK(tileB.cApprovals == 2 && tileB.cRevoked == 0);
+
+        // Another user's approval takes over, and the previous tile is told.
+        CHECK(cell.Approve(L"S-1-5-21-1002") == S_OK);
+        CHECK(_Default(&cell) == 2);
+        CHECK(tileC.cApprovals == 1 && tileC.cSerializations == 1);
+        CHECK(tileB.cRevoked == 1 && tileB.cApprovals == 2);
+        CHECK(tileA.Untouched());
+        _ReclaimAll(&cell);
+    }
+    CHECK(tileA.cRef == 1 && tileB.cRef == 1 && tileC.cRef == 1);
+}
+
+static void ApprovalWithoutTileReachesNone()
+{
+    CTestTile tileA(L"S-1-5-21-1000");
+    CTestTile tileB(L"S-1-5-21-1001");
+    {
+        TEST_STATE_CELL cell;
+        _Publish(&cell, { &tileA, &tileB });
+        CHECK(cell.Approve(L"S-1-5-21-9999") == S_FALSE);
+        CHECK(_Default(&cell) == CREDENTIAL_PROVIDER_NO_DEFAULT);
+        CHECK(tileA.Untouched());
+        CHECK(tileB.Untouched());
+
+        // A user enumerated after the approval gets the default as the tiles are published.
+        CTestTile tileLate(L"S-1-5-21-9999");
+        _Publish(&cell, { &tileA, &tileB, &tileLate });
+        CHECK(_Default(&cell) == 2);
+        _Publish(&cell, { &tileA, &tileB });
+        _ReclaimAll(&cell);
+        CHECK(tileLate.cRef == 1);
+
+        CHECK(cell.Approve(L"") == S_FALSE);
+        CHECK(_Default(&cell) == CREDENTIAL_PROVIDER_NO_DEFAULT);
+        CHECK(tileA.Untouched());
+        CHECK(tileB.Untouched());
+    }
+}
+
+static void StatesShareTheTiles()
+{
+    CTestTile tileA(L"S-1-5-21-1000");
+    CTestTile tileB(L"S-1-5-21-1001");
+    {
+        TEST_STATE_CELL cell;
+        _Publish(&cell, { &tileA, &tileB });
+        CHECK(tileA.cRef == 2 && tileB.cRef == 2);
+
+        // Phone events publish new states without touching the tiles' references.
+        for (DWORD i = 0; i < 100; i++)
+        {
+            CHECK_HR(cell.Update([i](TEST_STATE &state)
+            {
+                state.fDeviceInProximity = (i % 2) == 0;
+            }));
+            CHECK(tileA.cRef == 2 && tileB.cRef == 2);
+        }
+        _ReclaimAll(&cell);
+        CHECK(tileA.cRef == 2 && tileB.cRef == 2);
+
+        // A state still held keeps the replaced tiles until it is released and reclaimed.
+        const TEST_STATE *pHeld = cell.Acquire();
+        _Publish(&cell, { &tileB });
+        CHECK(tileA.cRef == 2 && tileB.cRef == 3);
+        _ReclaimAll(&cell);
+        CHECK(tileA.cRef == 2 && pHeld->Credential(0) == &tileA);
+        TEST_STATE_CELL::Release(pHeld);
+        _ReclaimAll(&cell);
+        CHECK(tileA.cRef == 1 && tileB.cRef == 2);
+
+        // With a single tile and no approval, that tile is the default.
+        CHECK(_Default(&cell) == 0);
+    }
+    CHECK(tileA.cRef == 1 && tileB.cRef == 1);
+}
+
+int main()
+{
+    RUN_TEST(ApprovalReachesOnlyItsTile);
+    RUN_TEST(ApprovalWithoutTileReachesNone);
+    RUN_TEST(StatesShareTheTiles);
+    return TestExitCode();
+}
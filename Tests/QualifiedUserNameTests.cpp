@@ -0,0 +1,85 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks how ParseQualifiedUserName classifies and splits names, and that the
+// names routed to the unlock logon are those the sample routed there: the ones
+// with an '@' in them.
+
+#include <windows.h>
+#include <string>
+#include "QualifiedUserName.h"
+#include "TestHarness.h"
+
+struct NAME_CASE
+{
+    const char16_t      *pszName;
+    QUALIFIED_NAME_FORM form;
+    const char16_t      *pszDomain;
+    const char16_t      *pszUserName;
+    bool                fUserPrincipalName;
+};
+
+static const NAME_CASE c_rgCases[] =
+{
+    { u"user",                                  QNF_USER_ONLY,          u"",                    u"user",                        false },
+    { u"CONTOSO\\user",                         QNF_DOWN_LEVEL,         u"CONTOSO",             u"user",                        false },
+    { u".\\user",                               QNF_LOCAL,              u".",                   u"user",                        false },
+    { u"user@contoso.com",                      QNF_UPN,                u"",                    u"user@contoso.com",            true },
+    { u"MicrosoftAccount\\user@outlook.com",    QNF_MICROSOFT_ACCOUNT,  u"MicrosoftAccount",    u"user@outlook.com",            true },
+    { u"microsoftaccount\\user@outlook.com",    QNF_MICROSOFT_ACCOUNT,  u"microsoftaccount",    u"user@outlook.com",            true },
+    { u"AzureAD\\user@contoso.com",             QNF_DOWN_LEVEL,         u"AzureAD",             u"user@contoso.com",            true },
+    { u"MicrosoftAccount\\user",                QNF_MICROSOFT_ACCOUNT,  u"MicrosoftAccount",    u"user",                        false },
+    { u"CONTOSO\\user\\x",                      QNF_DOWN_LEVEL,         u"CONTOSO",             u"user\\x",                     false },
+    { u"averylongdomainname\\averylonguser",    QNF_DOWN_LEVEL,         u"averylongdomainname", u"averylonguser",               false },
+    { u"averylongusername@averylongdomain.com", QNF_UPN,                u"",                    u"averylongusername@averylongdomain.com", true },
+};
+
+static void ClassifiesNames()
+{
+    for (const NAME_CASE &nameCase : c_rgCases)
+    {
+        std::u16string_view name = nameCase.pszName;
+        QUALIFIED_NAME_PARTS parts;
+        CHECK(ParseQualifiedUserName(name, &parts));
+        CHECK(parts.form == nameCase.form);
+        CHECK(parts.Domain(name) == nameCase.pszDomain);
+        CHECK(parts.UserName(name) == nameCase.pszUserName);
+    }
+}
+
+// An Azure AD name is down-level in form but has an '@', so it still goes into the
+// unlock logon as it did in the sample, split at the backslash.
+static void RoutesNamesWithAnAtToTheUnlockLogon()
+{
+    for (const NAME_CASE &nameCase : c_rgCases)
+    {
+        QUALIFIED_NAME_PARTS parts;
+        ParseQualifiedUserName(nameCase.pszName, &parts);
+        CHECK(IsUserPrincipalName(parts) == nameCase.fUserPrincipalName);
+        CHECK(IsUserPrincipalName(parts) == (std::u16string_view(nameCase.pszName).find(u'@') != std::u16string_view::npos));
+    }
+}
+
+static void RejectsIncompleteNames()
+{
+    static const char16_t *c_rgpszInvalid[] = { u"", u"CONTOSO\\", u"@contoso.com", u"user@" };
+    for (const char16_t *pszName : c_rgpszInvalid)
+    {
+        QUALIFIED_NAME_PARTS parts;
+        CHECK(!ParseQualifiedUserName(pszName, &parts));
+        CHECK(parts.form == QNF_INVALID);
+    }
+}
+
+int main()
+{
+    RUN_TEST(ClassifiesNames);
+    RUN_TEST(RoutesNamesWithAnAtToTheUnlockLogon);
+    RUN_TEST(RejectsIncompleteNames);
+    return TestExitCode();
+}
@@ -0,0 +1,282 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Signs requests the way the phone app does and checks which ones
+// CRequestAuthenticator lets through: good tags, replays, tampering, malformed
+// headers and an unpaired machine. Also checks the incremental MAC against
+// ChaCha20Poly1305Seal.
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <random>
+#include <string>
+#include "RequestAuth.h"
+#include "SealedKey.h"
+#include "TestHarness.h"
+
+static const WCHAR c_szSettingsKey[] = L"SOFTWARE\\AbsoluteID";
+static const char c_szApprovalLine[] = "POST /event?sid=S-1-5-21-1-2-3-1001 HTTP/1.1";
+static const char c_szApprovalBody[] = "User logged in";
+
+static std::string s_strProgramData;
+static BYTE s_rgbKey[c_cbChaChaKey];
+
+// Pairs a private ProgramData, as the admin tool would.
+static void _Pair()
+{
+    char szTemplate[] = "/tmp/RequestAuthTests.XXXXXX";
+    s_strProgramData = mkdtemp(szTemplate);
+    std::wstring strDirectory(s_strProgramData.begin(), s_strProgramData.end());
+    ShimSetProgramDataPath(strDirectory.c_str());
+    ShimResetRegistry();
+    CHECK_HR(SealedKeyCreate(c_szPairingKeyFile, s_rgbKey, sizeof(s_rgbKey)));
+}
+
+static std::wstring _KeyPath()
+{
+    WCHAR szPath[MAX_PATH];
+    SealedKeyGetPath(c_szPairingKeyFile, szPath, ARRAYSIZE(szPath));
+    return szPath;
+}
+
+static void _Unpair()
+{
+    DeleteFileW(_KeyPath().c_str());
+    rmdir((s_strProgramData + "/AbsoluteID").c_str());
+    rmdir(s_strProgramData.c_str());
+}
+
+static ULONGLONG _LastCounter()
+{
+    ULONGLONG ullCounter = 0;
+    DWORD cbData = sizeof(ullCounter);
+    RegGetValueW(HKEY_LOCAL_MACHINE, c_szSettingsKey, c_szPairingCounterValue, RRF_RT_REG_QWORD, nullptr, &ullCounter, &cbData);
+    return ullCounter;
+}
+
+// The Authorization header the phone app sends for the request line and body.
+static std::string _Authorization(ULONGLONG ullCounter, const std::string &strLine, const std::string &strBody)
+{
+    BYTE rgbNonce[c_cbChaChaNonce] = {};
+    for (size_t i = 0; i < 8; i++)
+    {
+        rgbNonce[4 + i] = static_cast<BYTE>(ullCounter >> (8 * i));
+    }
+    std::string strAad = strLine + "\n" + strBody;
+    BYTE rgbTag[c_cbPoly1305Tag];
+    ChaCha20Poly1305Seal(s_rgbKey, rgbNonce, reinterpret_cast<const uint8_t*>(strAad.data()), strAad.size(), nullptr, 0, nullptr, rgbTag);
+
+    char szHeader[128];
+    int cch = snprintf(szHeader, sizeof(szHeader), "Authorization: AbsoluteID %llu:", ullCounter);
+    for (size_t i = 0; i < sizeof(rgbTag); i++)
+    {
+        cch += snprintf(szHeader + cch, sizeof(szHeader) - cch, "%02x", rgbTag[i]);
+    }
+    return szHeader;
+}
+
+static std::string _Headers(const std::string &strLine, const std::string &strAuthorization, size_t cbBody)
+{
+    return strLine + "\r\nHost: 192.168.1.20:32808\r\n" + strAuthorization + "\r\nContent-Length: " + std::to_string(cbBody) + "\r\n\r\n";
+}
+
+// Runs a request through the authenticator, passing the body in pieces of cbPiece bytes.
+static HRESULT _Check(const std::string &strHeaders, const std::string &strBody, size_t cbPiece = 7)
+{
+    REQUEST_MAC mac;
+    HRESULT hr = CRequestAuthenticator::Instance().Begin(strHeaders.data(), strHeaders.size(), &mac);
+    if (SUCCEEDED(hr))
+    {
+        for (size_t ib = 0; ib < strBody.size(); ib += cbPiece)
+        {
+            CRequestAuthenticator::Update(&mac, strBody.data() + ib, (std::min)(cbPiece, strBody.size() - ib));
+        }
+        hr = CRequestAuthenticator::Instance().Complete(&mac);
+    }
+    return hr;
+}
+
+static HRESULT _CheckSigned(ULONGLONG ullCounter, const std::string &strLine, const std::string &strBody)
+{
+    return _Check(_Headers(strLine, _Authorization(ullCounter, strLine, strBody), strBody.size()), strBody);
+}
+
+static void AcceptsSignedRequests()
+{
+    ShimResetRegistry();
+    CHECK_HR(_CheckSigned(1, c_szApprovalLine, c_szApprovalBody));
+    CHECK(_LastCounter() == 1);
+
+    // Counters may skip, for requests the phone gave up on.
+    CHECK_HR(_CheckSigned(5, c_szApprovalLine, c_szApprovalBody));
+    CHECK_HR(_CheckSigned(6, c_szApprovalLine, ""));
+    CHECK(_LastCounter() == 6);
+}
+
+static void RefusesReplays()
+{
+    ShimResetRegistry();
+    std::string strHeaders = _Headers(c_szApprovalLine, _Authorization(10, c_szApprovalLine, c_szApprovalBody), ARRAYSIZE(c_szApprovalBody) - 1);
+    CHECK_HR(_Check(strHeaders, c_szApprovalBody));
+    CHECK(_Check(strHeaders, c_szApprovalBody) == E_ACCESSDENIED);
+    CHECK(_CheckSigned(9, c_szApprovalLine, c_szApprovalBody) == E_ACCESSDENIED);
+    CHECK(_LastCounter() == 10);
+}
+
+// A changed request line, body or counter fails the tag and does not use up the counter.
+static void RefusesTamperedRequests()
+{
+    ShimResetRegistry();
+    std::string strAuthorization = _Authorization(3, c_szApprovalLine, c_szApprovalBody);
+    std::string strOtherLine = "POST /event?sid=S-1-5-21-1-2-3-1002 HTTP/1.1";
+    CHECK(_Check(_Headers(strOtherLine, strAuthorization, 14), c_szApprovalBody) == E_ACCESSDENIED);
+    CHECK(_Check(_Headers(c_szApprovalLine, strAuthorization, 14), "User logged iN") == E_ACCESSDENIED);
+    CHECK(_Check(_Headers(c_szApprovalLine, strAuthorization, 15), "User logged in!") == E_ACCESSDENIED);
+
+    std::string strOtherCounter = strAuthorization;
+    strOtherCounter.replace(strOtherCounter.find(" 3:"), 3, " 4:");
+    CHECK(_Check(_Headers(c_szApprovalLine, strOtherCounter, 14), c_szApprovalBody) == E_ACCESSDENIED);
+    CHECK(_LastCounter() == 0);
+
+    // Headers outside the tag may change on the way.
+    std::string strHeaders = _Headers(c_szApprovalLine, strAuthorization, 14);
+    strHeaders.replace(strHeaders.find("Host"), 4, "HOST");
+    CHECK_HR(_Check(strHeaders, c_szApprovalBody));
+    CHECK(_LastCounter() == 3);
+}
+
+static void RefusesMalformedAuthorization()
+{
+    ShimResetRegistry();
+    std::string strGood = _Authorization(1, c_szApprovalLine, c_szApprovalBody);
+    std::string strTag = strGood.substr(strGood.find(':', 15) + 1);
+    const std::string rgstrBad[] =
+    {
+        "X-Other: 1",
+        "Authorization: Bearer 1:" + strTag,
+        "Authorization: AbsoluteID :" + strTag,
+        "Authorization: AbsoluteID 1" + strTag,
+        "Authorization: AbsoluteID 1:" + strTag.substr(2),
+        "Authorization: AbsoluteID 1:" + strTag + "00",
+        "Authorization: AbsoluteID 1:" + strTag.substr(2) + "zz",
+        "Authorization: AbsoluteID 00000000000000000001:" + strTag,
+        "Authorization: AbsoluteID 18446744073709551617:" + strTag,
+    };
+    for (const std::string &strBad : rgstrBad)
+    {
+        CHECK(_Check(_Headers(c_szApprovalLine, strBad, 14), c_szApprovalBody) == E_ACCESSDENIED);
+    }
+
+    // The header name and scheme are case-insensitive and the line may end in a bare LF.
+    std::string strLower = strGood;
+    strLower.replace(0, 25, "authorization:  ABSOLUTEID");
+    CHECK_HR(_Check(std::string(c_szApprovalLine) + "\n" + strLower + "\n\n", c_szApprovalBody));
+}
+
+static void RefusesEverythingWhenNotPaired()
+{
+    ShimResetRegistry();
+    std::string strKeyFile = ShimNarrowPath(_KeyPath().c_str());
+    CHECK(rename(strKeyFile.c_str(), (strKeyFile + ".moved").c_str()) == 0);
+    CHECK(_CheckSigned(1, c_szApprovalLine, c_szApprovalBody) == E_ACCESSDENIED);
+
+    // A key file that was not sealed is not used either.
+    FILE *pFile = fopen(strKeyFile.c_str(), "wb");
+    fwrite(s_rgbKey, 1, sizeof(s_rgbKey), pFile);
+    fclose(pFile);
+    CHECK(_CheckSigned(1, c_szApprovalLine, c_szApprovalBody) == E_ACCESSDENIED);
+
+    CHECK(rename((strKeyFile + ".moved").c_str(), strKeyFile.c_str()) == 0);
+    CHECK_HR(_CheckSigned(1, c_szApprovalLine, c_szApprovalBody));
+}
+
+// Pairing again replaces the key, and requests signed with the old one fail.
+static void PairingAgainRevokesTheOldKey()
+{
+    ShimResetRegistry();
+    BYTE rgbOldKey[c_cbChaChaKey];
+    memcpy(rgbOldKey, s_rgbKey, sizeof(rgbOldKey));
+    std::string strOld = _Headers(c_szApprovalLine, _Authorization(1, c_szApprovalLine, c_szApprovalBody), 14);
+
+    CHECK_HR(SealedKeyCreate(c_szPairingKeyFile, s_rgbKey, sizeof(s_rgbKey)));
+    CHECK(memcmp(rgbOldKey, s_rgbKey, sizeof(rgbOldKey)) != 0);
+    CHECK(_Check(strOld, c_szApprovalBody) == E_ACCESSDENIED);
+    CHECK_HR(_CheckSigned(1, c_szApprovalLine, c_szApprovalBody));
+}
+
+// Large bodies, like avatar uploads, in pieces of every alignment.
+static void AcceptsBodiesInAnyPieces()
+{
+    ShimResetRegistry();
+    std::mt19937 random(7);
+    std::string strLine = "POST /avatar?sid=S-1-5-21-1-2-3-1001 HTTP/1.1";
+    std::string strBody(70000, '\0');
+    for (char &ch : strBody)
+    {
+        ch = static_cast<char>(random());
+    }
+    std::string strHeaders = _Headers(strLine, _Authorization(1, strLine, strBody), strBody.size());
+
+    ULONGLONG ullCounter = 1;
+    for (size_t cbPiece : { 1, 15, 16, 17, 4096, 100000 })
+    {
+        strHeaders = _Headers(strLine, _Authorization(ullCounter, strLine, strBody), strBody.size());
+        CHECK_HR(_Check(strHeaders, strBody, cbPiece));
+        ullCounter++;
+    }
+}
+
+// The incremental MAC gives the tag Seal gives an empty plaintext, however the AAD is split.
+static void MacMatchesSeal()
+{
+    std::mt19937 random(11);
+    uint8_t rgbKey[c_cbChaChaKey];
+    uint8_t rgbNonce[c_cbChaChaNonce];
+    uint8_t rgbAad[200];
+    for (uint8_t &b : rgbKey) b = static_cast<uint8_t>(random());
+    for (uint8_t &b : rgbNonce) b = static_cast<uint8_t>(random());
+    for (uint8_t &b : rgbAad) b = static_cast<uint8_t>(random());
+
+    for (size_t cbAad = 0; cbAad <= sizeof(rgbAad); cbAad++)
+    {
+        uint8_t rgbTag[c_cbPoly1305Tag];
+        ChaCha20Poly1305Seal(rgbKey, rgbNonce, rgbAad, cbAad, nullptr, 0, nullptr, rgbTag);
+
+        CHACHA20_POLY1305_MAC mac;
+        ChaCha20Poly1305MacInit(&mac, rgbKey, rgbNonce);
+        for (size_t ib = 0; ib < cbAad; )
+        {
+            size_t cb = (std::min)(static_cast<size_t>(random() % 40), cbAad - ib);
+            ChaCha20Poly1305MacUpdate(&mac, rgbAad + ib, cb);
+            ib += cb;
+        }
+        CHECK(ChaCha20Poly1305MacVerify(&mac, rgbTag));
+
+        ChaCha20Poly1305MacInit(&mac, rgbKey, rgbNonce);
+        ChaCha20Poly1305MacUpdate(&mac, rgbAad, cbAad);
+        rgbTag[cbAad % c_cbPoly1305Tag] ^= 0x01;
+        CHECK(!ChaCha20Poly1305MacVerify(&mac, rgbTag));
+    }
+}
+
+int main()
+{
+    _Pair();
+    RUN_TEST(AcceptsSignedRequests);
+    RUN_TEST(RefusesReplays);
+    RUN_TEST(RefusesTamperedRequests);
+    RUN_TEST(RefusesMalformedAuthorization);
+    RUN_TEST(RefusesEverythingWhenNotPaired);
+    RUN_TEST(PairingAgainRevokesTheOldKey);
+    RUN_TEST(AcceptsBodiesInAnyPieces);
+    RUN_TEST(MacMatchesSeal);
+    _Unpair();
+    return TestExitCode();
+}
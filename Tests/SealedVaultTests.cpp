@@ -0,0 +1,356 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks ChaCha20-Poly1305 against the AEAD test vector of RFC 8439, then that
+// the sealed vault gives back each user's secret, tells users apart by their
+// whole SID, and refuses records that were changed, sealed under another key,
+// moved to another user or taken from an older generation of the vault.
+
+#include <windows.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "SealedVault.h"
+#include "TestHarness.h"
+
+static const uint32_t c_cRecords = 64;
+static const uint32_t c_dwGeneration = 7;
+
+// RFC 8439, section 2.8.2.
+static const uint8_t c_rgbRfcKey[c_cbChaChaKey] =
+{
+    0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+    0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+};
+static const uint8_t c_rgbRfcNonce[c_cbChaChaNonce] =
+{
+    0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+};
+static const uint8_t c_rgbRfcAad[] =
+{
+    0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+};
+static const char c_szRfcPlain[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+static const uint8_t c_rgbRfcCipher[] =
+{
+    0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+    0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+    0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+    0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+    0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+    0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+    0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+    0x61, 0x16,
+};
+static const uint8_t c_rgbRfcTag[c_cbPoly1305Tag] =
+{
+    0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91,
+};
+
+static_assert(sizeof(c_rgbRfcCipher) == sizeof(c_szRfcPlain) - 1, "The vector's plaintext and ciphertext are the same length");
+
+static uint8_t s_rgbKey[c_cbChaChaKey];
+
+static std::u16string _Sid(uint32_t iUser)
+{
+    std::string str = "S-1-5-21-1000-2000-3000-" + std::to_string(1000 + iUser);
+    return std::u16string(str.begin(), str.end());
+}
+
+static std::u16string _Password(uint32_t iUser)
+{
+    std::string str = "Correct-Horse-" + std::to_string(iUser);
+    return std::u16string(str.begin(), str.end());
+}
+
+// A nonce no other record in the tests uses.
+static const uint8_t *_Nonce()
+{
+    static uint8_t s_rgbNonce[c_cbChaChaNonce];
+    static uint32_t s_iNonce = 0;
+    s_iNonce++;
+    memcpy(s_rgbNonce, &s_iNonce, sizeof(s_iNonce));
+    return s_rgbNonce;
+}
+
+// A vault of c_cRecords records at c_dwGeneration holding cUsers users.
+static std::vector<uint8_t> _Vault(uint32_t cUsers)
+{
+    std::vector<uint8_t> rgbVault(SealedVaultSize(c_cRecords));
+    CHECK(SealedVaultInitialize(rgbVault.data(), rgbVault.size(), c_cRecords, c_dwGeneration));
+    for (uint32_t iUser = 0; iUser < cUsers; iUser++)
+    {
+        std::u16string sid = _Sid(iUser);
+        std::u16string password = _Password(iUser);
+        CHECK(SealedVaultStore(rgbVault.data(), rgbVault.size(), s_rgbKey, _Nonce(),
+                               sid.data(), sid.size(), iUser + 1, password.data(), password.size()));
+    }
+    return rgbVault;
+}
+
+static uint32_t _UsedRecords(const std::vector<uint8_t> &rgbVault)
+{
+    static const uint8_t c_rgbUnused[8] = {};
+    const SEALED_VAULT_RECORD *rgRecords = reinterpret_cast<const SEALED_VAULT_RECORD*>(rgbVault.data() + sizeof(SEALED_VAULT_HEADER));
+    uint32_t cUsed = 0;
+    for (uint32_t i = 0; i < c_cRecords; i++)
+    {
+        cUsed += (memcmp(rgRecords[i].SidHash, c_rgbUnused, sizeof(c_rgbUnused)) != 0) ? 1 : 0;
+    }
+    return cUsed;
+}
+
+static SEALED_VAULT_RECORD *_Find(std::vector<uint8_t> &rgbVault, const std::u16string &sid)
+{
+    return const_cast<SEALED_VAULT_RECORD*>(SealedVaultFind(rgbVault.data(), rgbVault.size(), sid.data(), sid.size()));
+}
+
+// Returns whether the record opens under the key at the generation, and that a
+// record that does not open leaves nothing behind.
+static bool _Opens(const SEALED_VAULT_RECORD &record, const uint8_t *pbKey = s_rgbKey, uint32_t dwGeneration = c_dwGeneration)
+{
+    char16_t rgchSecret[c_cchVaultSecret];
+    memset(rgchSecret, 0xcc, sizeof(rgchSecret));
+    bool fOpened = SealedVaultOpen(pbKey, dwGeneration, record, rgchSecret);
+    if (!fOpened)
+    {
+        for (char16_t ch : rgchSecret)
+        {
+            CHECK(ch == u'\0');
+        }
+    }
+    return fOpened;
+}
+
+static void MatchesTheRfc8439Vector()
+{
+    const uint8_t *pbPlain = reinterpret_cast<const uint8_t*>(c_szRfcPlain);
+    uint8_t rgbCipher[sizeof(c_rgbRfcCipher)];
+    uint8_t rgbTag[c_cbPoly1305Tag];
+    ChaCha20Poly1305Seal(c_rgbRfcKey, c_rgbRfcNonce, c_rgbRfcAad, sizeof(c_rgbRfcAad), pbPlain, sizeof(rgbCipher), rgbCipher, rgbTag);
+    CHECK(memcmp(rgbCipher, c_rgbRfcCipher, sizeof(rgbCipher)) == 0);
+    CHECK(memcmp(rgbTag, c_rgbRfcTag, sizeof(rgbTag)) == 0);
+
+    uint8_t rgbPlain[sizeof(c_rgbRfcCipher)];
+    CHECK(ChaCha20Poly1305Open(c_rgbRfcKey, c_rgbRfcNonce, c_rgbRfcAad, sizeof(c_rgbRfcAad), c_rgbRfcCipher, sizeof(rgbPlain), c_rgbRfcTag, rgbPlain));
+    CHECK(memcmp(rgbPlain, pbPlain, sizeof(rgbPlain)) == 0);
+
+    // A changed byte anywhere the tag covers fails it.
+    uint8_t rgbAad[sizeof(c_rgbRfcAad)];
+    memcpy(rgbAad, c_rgbRfcAad, sizeof(rgbAad));
+    rgbAad[11] ^= 1;
+    CHECK(!ChaCha20Poly1305Open(c_rgbRfcKey, c_rgbRfcNonce, rgbAad, sizeof(rgbAad), c_rgbRfcCipher, sizeof(rgbPlain), c_rgbRfcTag, rgbPlain));
+    memcpy(rgbCipher, c_rgbRfcCipher, sizeof(rgbCipher));
+    rgbCipher[113] ^= 0x80;
+    CHECK(!ChaCha20Poly1305Open(c_rgbRfcKey, c_rgbRfcNonce, c_rgbRfcAad, sizeof(c_rgbRfcAad), rgbCipher, sizeof(rgbPlain), c_rgbRfcTag, rgbPlain));
+    memcpy(rgbTag, c_rgbRfcTag, sizeof(rgbTag));
+    rgbTag[0] ^= 1;
+    CHECK(!ChaCha20Poly1305Open(c_rgbRfcKey, c_rgbRfcNonce, c_rgbRfcAad, sizeof(c_rgbRfcAad), c_rgbRfcCipher, sizeof(rgbPlain), rgbTag, rgbPlain));
+}
+
+static void RoundTripsSecrets()
+{
+    std::vector<uint8_t> rgbVault = _Vault(50);
+    CHECK(SealedVaultIsValid(rgbVault.data(), rgbVault.size()));
+    CHECK(SealedVaultGeneration(rgbVault.data(), rgbVault.size()) == c_dwGeneration);
+    for (uint32_t iUser = 0; iUser < 50; iUser++)
+    {
+        // SIDs are looked up without regard to case.
+        std::u16string sid = _Sid(iUser);
+        sid[0] = u's';
+        const SEALED_VAULT_RECORD *pRecord = _Find(rgbVault, sid);
+        CHECK(pRecord != nullptr);
+        if (pRecord != nullptr)
+        {
+            CHECK(SealedVaultRecordVersion(*pRecord) == iUser + 1);
+            char16_t rgchSecret[c_cchVaultSecret];
+            CHECK(SealedVaultOpen(s_rgbKey, c_dwGeneration, *pRecord, rgchSecret));
+            CHECK(rgchSecret == _Password(iUser));
+        }
+    }
+    CHECK(_Find(rgbVault, u"S-1-5-21-1000-2000-3000-999") == nullptr);
+    CHECK(_Find(rgbVault, u"S-1-5-21-1000-2000-3000-100") == nullptr);
+
+    // Storing again replaces the user's record rather than adding one.
+    std::u16string sid = _Sid(3);
+    CHECK(SealedVaultStore(rgbVault.data(), rgbVault.size(), s_rgbKey, _Nonce(), sid.data(), sid.size(), 9, u"Changed", 7));
+    char16_t rgchSecret[c_cchVaultSecret];
+    CHECK(SealedVaultOpen(s_rgbKey, c_dwGeneration, *_Find(rgbVault, sid), rgchSecret));
+    CHECK(rgchSecret == std::u16string(u"Changed"));
+    CHECK(SealedVaultRecordVersion(*_Find(rgbVault, sid)) == 9);
+    CHECK(_UsedRecords(rgbVault) == 50);
+}
+
+static void RefusesTamperedRecords()
+{
+    std::vector<uint8_t> rgbVault = _Vault(1);
+    std::u16string sid = _Sid(0);
+    SEALED_VAULT_RECORD *pRecord = _Find(rgbVault, sid);
+    CHECK(_Opens(*pRecord));
+
+    // Every byte the tag covers, from the SID hash to the end of the secret.
+    const SEALED_VAULT_RECORD original = *pRecord;
+    uint8_t *pbRecord = reinterpret_cast<uint8_t*>(pRecord);
+    for (size_t ib = 0; ib < sizeof(SEALED_VAULT_RECORD); ib++)
+    {
+        pbRecord[ib] ^= 0x20;
+        CHECK(!_Opens(*pRecord));
+        *pRecord = original;
+    }
+    CHECK(_Opens(*pRecord));
+}
+
+static void RefusesOtherKeys()
+{
+    std::vector<uint8_t> rgbVault = _Vault(1);
+    uint8_t rgbOtherKey[c_cbChaChaKey];
+    memcpy(rgbOtherKey, s_rgbKey, sizeof(rgbOtherKey));
+    rgbOtherKey[31] ^= 1;
+    CHECK(!_Opens(*_Find(rgbVault, _Sid(0)), rgbOtherKey));
+}
+
+// A record copied over another user's, with the SID fields rewritten so that it
+// is found for that user, still fails: the SID is authenticated.
+static void RefusesMovedRecords()
+{
+    std::vector<uint8_t> rgbVault = _Vault(2);
+    SEALED_VAULT_RECORD *pVictim = _Find(rgbVault, _Sid(1));
+    SEALED_VAULT_RECORD victim = *pVictim;
+    *pVictim = *_Find(rgbVault, _Sid(0));
+    memcpy(pVictim->SidHash, victim.SidHash, sizeof(victim.SidHash));
+    memcpy(pVictim->Sid, victim.Sid, sizeof(victim.Sid));
+    CHECK(_Find(rgbVault, _Sid(1)) == pVictim);
+    CHECK(!_Opens(*pVictim));
+}
+
+// Two SIDs with the same hash each find their own record. No real collision is
+// at hand, so the second user's hash is written into the first user's record.
+static void ComparesTheWholeSid()
+{
+    std::vector<uint8_t> rgbVault = _Vault(1);
+    std::u16string other = _Sid(1);
+    uint64_t ullOtherHash = SealedVaultHashSid(other.data(), other.size());
+    SEALED_VAULT_RECORD *pRecord = _Find(rgbVault, _Sid(0));
+    for (size_t i = 0; i < sizeof(pRecord->SidHash); i++)
+    {
+        pRecord->SidHash[i] = static_cast<uint8_t>(ullOtherHash >> (8 * i));
+    }
+    CHECK(_Find(rgbVault, other) == nullptr);
+
+    CHECK(SealedVaultStore(rgbVault.data(), rgbVault.size(), s_rgbKey, _Nonce(), other.data(), other.size(), 1, u"Other", 5));
+    SEALED_VAULT_RECORD *pOther = _Find(rgbVault, other);
+    CHECK(pOther != nullptr && pOther != pRecord);
+    CHECK(pOther != nullptr && _Opens(*pOther));
+}
+
+static void RefusesBadSids()
+{
+    std::vector<uint8_t> rgbVault = _Vault(0);
+    std::u16string tooLong(c_cchVaultSid, u'1');
+    std::u16string longest(c_cchVaultSid - 1, u'1');
+    std::u16string rgBad[] = { u"", u"S-1-5-21-\u00e9", std::u16string(u"S-1\0-5", 6), tooLong };
+    for (const std::u16string &sid : rgBad)
+    {
+        CHECK(!SealedVaultStore(rgbVault.data(), rgbVault.size(), s_rgbKey, _Nonce(), sid.data(), sid.size(), 1, u"x", 1));
+        CHECK(_Find(rgbVault, sid) == nullptr);
+    }
+    CHECK(SealedVaultStore(rgbVault.data(), rgbVault.size(), s_rgbKey, _Nonce(), longest.data(), longest.size(), 1, u"x", 1));
+    CHECK(_Find(rgbVault, longest) != nullptr);
+    CHECK(_Find(rgbVault, longest.substr(1)) == nullptr);
+}
+
+static void RefusesLongSecretsAndFullVaults()
+{
+    std::vector<uint8_t> rgbVault = _Vault(c_cRecords - 1);
+    std::u16string sid = _Sid(c_cRecords - 1);
+    std::u16string tooLong(c_cchVaultSecret, u'x');
+    CHECK(!SealedVaultStore(rgbVault.data(), rgbVault.size(), s_rgbKey, _Nonce(), sid.data(), sid.size(), 1, tooLong.data(), tooLong.size()));
+    CHECK(SealedVaultStore(rgbVault.data(), rgbVault.size(), s_rgbKey, _Nonce(), sid.data(), sid.size(), 1, tooLong.data(), tooLong.size() - 1));
+    CHECK(_Opens(*_Find(rgbVault, sid)));
+
+    std::u16string oneTooMany = _Sid(c_cRecords);
+    CHECK(!SealedVaultStore(rgbVault.data(), rgbVault.size(), s_rgbKey, _Nonce(), oneTooMany.data(), oneTooMany.size(), 1, u"x", 1));
+    CHECK(_Find(rgbVault, oneTooMany) == nullptr);
+}
+
+static void RefusesOtherSizesAndLayouts()
+{
+    std::vector<uint8_t> rgbVault = _Vault(1);
+    std::u16string sid = _Sid(0);
+    CHECK(SealedVaultFind(rgbVault.data(), rgbVault.size() - 1, sid.data(), sid.size()) == nullptr);
+    CHECK(SealedVaultGeneration(rgbVault.data(), rgbVault.size() + 1) == 0);
+    CHECK(SealedVaultSize(48) == 0);
+
+    rgbVault[4] = 1;
+    CHECK(!SealedVaultIsValid(rgbVault.data(), rgbVault.size()));
+    CHECK(_Find(rgbVault, sid) == nullptr);
+}
+
+// Raising the generation reseals every record at it, so records kept from the
+// older vault no longer open against the new one.
+static void ResealsAtANewGeneration()
+{
+    std::vector<uint8_t> rgbVault = _Vault(20);
+    std::vector<uint8_t> rgbOldVault = rgbVault;
+    std::vector<uint8_t> rgbNonces(c_cRecords * c_cbChaChaNonce);
+    for (size_t i = 0; i < rgbNonces.size(); i += c_cbChaChaNonce)
+    {
+        memcpy(&rgbNonces[i], _Nonce(), c_cbChaChaNonce);
+    }
+
+    CHECK(!SealedVaultReseal(rgbVault.data(), rgbVault.size(), s_rgbKey, c_dwGeneration, rgbNonces.data()));
+    CHECK(SealedVaultReseal(rgbVault.data(), rgbVault.size(), s_rgbKey, c_dwGeneration + 1, rgbNonces.data()));
+    CHECK(SealedVaultGeneration(rgbVault.data(), rgbVault.size()) == c_dwGeneration + 1);
+
+    for (uint32_t iUser = 0; iUser < 20; iUser++)
+    {
+        SEALED_VAULT_RECORD *pRecord = _Find(rgbVault, _Sid(iUser));
+        SEALED_VAULT_RECORD *pOldRecord = _Find(rgbOldVault, _Sid(iUser));
+        CHECK(SealedVaultRecordVersion(*pRecord) == iUser + 1);
+        CHECK(memcmp(pRecord->Nonce, pOldRecord->Nonce, c_cbChaChaNonce) != 0);
+        char16_t rgchSecret[c_cchVaultSecret];
+        CHECK(SealedVaultOpen(s_rgbKey, c_dwGeneration + 1, *pRecord, rgchSecret));
+        CHECK(rgchSecret == _Password(iUser));
+        CHECK(!_Opens(*pRecord));
+
+        // An old record put back, with or without its generation raised.
+        CHECK(!_Opens(*pOldRecord, s_rgbKey, c_dwGeneration + 1));
+        pOldRecord->Generation[0]++;
+        CHECK(!_Opens(*pOldRecord, s_rgbKey, c_dwGeneration + 1));
+    }
+
+    // A vault that does not open under the key is not resealed.
+    std::vector<uint8_t> rgbTampered = _Vault(2);
+    _Find(rgbTampered, _Sid(1))->Secret[0] ^= 1;
+    CHECK(!SealedVaultReseal(rgbTampered.data(), rgbTampered.size(), s_rgbKey, c_dwGeneration + 1, rgbNonces.data()));
+    uint8_t rgbOtherKey[c_cbChaChaKey] = {};
+    std::vector<uint8_t> rgbOtherKeyVault = _Vault(2);
+    CHECK(!SealedVaultReseal(rgbOtherKeyVault.data(), rgbOtherKeyVault.size(), rgbOtherKey, c_dwGeneration + 1, rgbNonces.data()));
+    CHECK(SealedVaultGeneration(rgbOtherKeyVault.data(), rgbOtherKeyVault.size()) == c_dwGeneration);
+}
+
+int main()
+{
+    for (size_t i = 0; i < sizeof(s_rgbKey); i++)
+    {
+        s_rgbKey[i] = static_cast<uint8_t>(i * 7 + 1);
+    }
+
+    RUN_TEST(MatchesTheRfc8439Vector);
+    RUN_TEST(RoundTripsSecrets);
+    RUN_TEST(RefusesTamperedRecords);
+    RUN_TEST(RefusesOtherKeys);
+    RUN_TEST(RefusesMovedRecords);
+    RUN_TEST(ComparesTheWholeSid);
+    RUN_TEST(RefusesBadSids);
+    RUN_TEST(RefusesLongSecretsAndFullVaults);
+    RUN_TEST(RefusesOtherSizesAndLayouts);
+    RUN_TEST(ResealsAtANewGeneration);
+    return TestExitCode();
+}
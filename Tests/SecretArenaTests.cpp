@@ -0,0 +1,123 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks that CSecretArena hands out and zeroes its slots, that reading its
+// stats leaves the copy count alone, and that freeing anything but a slot in use
+// ends the process rather than zeroing memory the arena does not own.
+
+#include <windows.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include "SecretArena.h"
+#include "TestHarness.h"
+
+static const DWORD c_cSlots = 16;
+
+static void FillsAndZeroesSlots()
+{
+    CSecretArena &arena = CSecretArena::Instance();
+    std::vector<PWSTR> rgpsz;
+    for (DWORD i = 0; i < c_cSlots; i++)
+    {
+        PWSTR psz = nullptr;
+        CHECK_HR(arena.Allocate(&psz));
+        CHECK(psz != nullptr && psz[0] == L'\0');
+        rgpsz.push_back(psz);
+    }
+    PWSTR pszNone = nullptr;
+    CHECK(arena.Allocate(&pszNone) == E_OUTOFMEMORY);
+    CHECK(pszNone == nullptr);
+
+    SECRET_ARENA_STATS stats;
+    arena.GetStats(&stats);
+    CHECK(stats.cSlots == c_cSlots);
+    CHECK(stats.cInUse == c_cSlots);
+    CHECK(stats.cPeakInUse == c_cSlots);
+
+    CHECK_HR(arena.CopyInto(rgpsz[3], L"secret"));
+    arena.Free(rgpsz[3]);
+    CHECK(rgpsz[3][0] == L'\0' && rgpsz[3][5] == L'\0');
+    PWSTR pszAgain = nullptr;
+    CHECK_HR(arena.Allocate(&pszAgain));
+    CHECK(pszAgain == rgpsz[3]);
+
+    for (PWSTR psz : rgpsz)
+    {
+        arena.Free(psz);
+    }
+    arena.Free(nullptr);
+    arena.GetStats(&stats);
+    CHECK(stats.cInUse == 0);
+}
+
+static void ReadsStatsWithoutResettingThem()
+{
+    CSecretArena &arena = CSecretArena::Instance();
+    SECRET_ARENA_STATS before, first, second;
+    arena.GetStats(&before);
+    arena.RecordCopy();
+    arena.RecordCopy();
+    arena.GetStats(&first);
+    arena.GetStats(&second);
+    CHECK(first.cCopies == before.cCopies + 2);
+    CHECK(second.cCopies == first.cCopies);
+}
+
+// Runs badFree in a child process and checks that it ends with the abort the
+// shim's __fastfail raises.
+template <typename FREE>
+static bool _FailsFast(FREE badFree)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(STDERR_FILENO);
+        badFree(CSecretArena::Instance());
+        _exit(0);
+    }
+    int nStatus = 0;
+    return pid > 0 && waitpid(pid, &nStatus, 0) == pid && WIFSIGNALED(nStatus) && WTERMSIG(nStatus) == SIGABRT;
+}
+
+static void FailsFastOnBadFrees()
+{
+    CSecretArena &arena = CSecretArena::Instance();
+    PWSTR psz = nullptr;
+    CHECK_HR(arena.Allocate(&psz));
+
+    // Inside a slot, just before the slots, past the last one, and not from the arena.
+    CHECK(_FailsFast([psz](CSecretArena &arenaChild) { arenaChild.Free(psz + 1); }));
+    CHECK(_FailsFast([psz](CSecretArena &arenaChild) { arenaChild.Free(psz - c_cchSecretSlot); }));
+    CHECK(_FailsFast([psz](CSecretArena &arenaChild) { arenaChild.Free(psz + c_cSlots * c_cchSecretSlot); }));
+    CHECK(_FailsFast([](CSecretArena &arenaChild)
+    {
+        static WCHAR s_szNotASlot[c_cchSecretSlot];
+        arenaChild.Free(s_szNotASlot);
+    }));
+
+    // A slot that is not in use, including one freed twice.
+    CHECK(_FailsFast([psz](CSecretArena &arenaChild) { arenaChild.Free(psz + c_cchSecretSlot); }));
+    CHECK(_FailsFast([psz](CSecretArena &arenaChild)
+    {
+        arenaChild.Free(psz);
+        arenaChild.Free(psz);
+    }));
+
+    arena.Free(psz);
+}
+
+int main()
+{
+    RUN_TEST(FillsAndZeroesSlots);
+    RUN_TEST(ReadsStatsWithoutResettingThem);
+    RUN_TEST(FailsFastOnBadFrees);
+    return TestExitCode();
+}
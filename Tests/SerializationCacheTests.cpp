@@ -0,0 +1,167 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks that CSerializationCache only serves a buffer for the scenario and
+// secret version it was packed for, counts its hits and misses, and zeroes every
+// buffer it drops, watched through the shim's heap free hook.
+
+#include <windows.h>
+#include <string.h>
+#include <mutex>
+#include <vector>
+#include "SerializationCache.h"
+#include "TestHarness.h"
+
+static const char c_szLogon[] = "packed logon with a password in it";
+static const ULONG c_ulPackage = 7;
+
+static std::mutex s_lockFreed;
+static DWORD s_cFreed = 0;
+static DWORD s_cFreedDirty = 0;
+
+// Counts the heap blocks freed, and those freed with anything left in them.
+static void _OnHeapFree(PVOID pv, SIZE_T cb)
+{
+    bool fDirty = false;
+    for (SIZE_T ib = 0; ib < cb; ib++)
+    {
+        fDirty = fDirty || (static_cast<BYTE*>(pv)[ib] != 0);
+    }
+    std::lock_guard<std::mutex> lock(s_lockFreed);
+    s_cFreed++;
+    s_cFreedDirty += fDirty ? 1 : 0;
+}
+
+static void _ResetFreed()
+{
+    std::lock_guard<std::mutex> lock(s_lockFreed);
+    s_cFreed = 0;
+    s_cFreedDirty = 0;
+}
+
+static HRESULT _Store(PCWSTR pszSid, CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus, DWORD dwSecretVersion)
+{
+    CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION cpcs = {};
+    cpcs.ulAuthenticationPackage = c_ulPackage;
+    cpcs.rgbSerialization = reinterpret_cast<BYTE*>(const_cast<char*>(c_szLogon));
+    cpcs.cbSerialization = sizeof(c_szLogon);
+    return CSerializationCache::Instance().Store(pszSid, cpus, dwSecretVersion, cpcs);
+}
+
+// Looks the user up, checks that a hit copies the buffer out, and returns whether it hit.
+static bool _Hits(PCWSTR pszSid, CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus, DWORD dwSecretVersion)
+{
+    CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION cpcs;
+    HRESULT hr = CSerializationCache::Instance().Lookup(pszSid, cpus, dwSecretVersion, &cpcs);
+    CHECK_HR(hr);
+    if (hr == S_OK)
+    {
+        CHECK(cpcs.ulAuthenticationPackage == c_ulPackage);
+        CHECK(cpcs.cbSerialization == sizeof(c_szLogon));
+        CHECK(cpcs.rgbSerialization != nullptr && memcmp(cpcs.rgbSerialization, c_szLogon, sizeof(c_szLogon)) == 0);
+        CoTaskMemFree(cpcs.rgbSerialization);
+    }
+    else
+    {
+        CHECK(cpcs.rgbSerialization == nullptr && cpcs.cbSerialization == 0);
+    }
+    return hr == S_OK;
+}
+
+static SERIALIZATION_CACHE_STATS _Stats()
+{
+    SERIALIZATION_CACHE_STATS stats;
+    CSerializationCache::Instance().GetStats(&stats);
+    return stats;
+}
+
+static void CountsHitsAndMisses()
+{
+    CSerializationCache::Instance().InvalidateAll();
+    SERIALIZATION_CACHE_STATS before = _Stats();
+    CHECK(!_Hits(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK_HR(_Store(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK(_Hits(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+
+    // SIDs compare without regard to case.
+    CHECK(_Hits(L"s-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK(!_Hits(L"S-1-5-21-2", CPUS_UNLOCK_WORKSTATION, 1));
+
+    // A tile without a SID is never cached.
+    CHECK(_Store(nullptr, CPUS_UNLOCK_WORKSTATION, 1) == S_FALSE);
+    CHECK(!_Hits(nullptr, CPUS_UNLOCK_WORKSTATION, 1));
+
+    SERIALIZATION_CACHE_STATS after = _Stats();
+    CHECK(after.cHits - before.cHits == 2);
+    CHECK(after.cMisses - before.cMisses == 3);
+    CHECK(after.cEntries == 1);
+}
+
+// An entry for another scenario or an older secret misses, and is dropped, zeroed,
+// since it can never be served.
+static void MissesOnAnotherScenarioOrVersion()
+{
+    CSerializationCache::Instance().InvalidateAll();
+    _ResetFreed();
+    CHECK_HR(_Store(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK(!_Hits(L"S-1-5-21-1", CPUS_LOGON, 1));
+    CHECK(_Stats().cEntries == 0);
+
+    CHECK_HR(_Store(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK(!_Hits(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 2));
+    CHECK(_Stats().cEntries == 0);
+    CHECK(!_Hits(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+
+    // Storing again replaces the entry, and the old buffer is zeroed too.
+    CHECK_HR(_Store(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 2));
+    CHECK_HR(_Store(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 3));
+    CHECK(!_Hits(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 2));
+    CHECK(_Stats().cEntries == 0);
+
+    std::lock_guard<std::mutex> lock(s_lockFreed);
+    CHECK(s_cFreed == 4);
+    CHECK(s_cFreedDirty == 0);
+}
+
+static void ZeroesInvalidatedEntries()
+{
+    CSerializationCache::Instance().InvalidateAll();
+    _ResetFreed();
+    CHECK_HR(_Store(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK_HR(_Store(L"S-1-5-21-2", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK_HR(_Store(L"S-1-5-21-3", CPUS_LOGON, 1));
+
+    // Another user's SID, or none, drops nothing.
+    CSerializationCache::Instance().Invalidate(L"S-1-5-21-4");
+    CSerializationCache::Instance().Invalidate(nullptr);
+    CHECK(_Stats().cEntries == 3);
+
+    CSerializationCache::Instance().Invalidate(L"s-1-5-21-1");
+    CHECK(_Stats().cEntries == 2);
+    CHECK(!_Hits(L"S-1-5-21-1", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK(_Hits(L"S-1-5-21-2", CPUS_UNLOCK_WORKSTATION, 1));
+
+    CSerializationCache::Instance().InvalidateAll();
+    CHECK(_Stats().cEntries == 0);
+    CHECK(!_Hits(L"S-1-5-21-2", CPUS_UNLOCK_WORKSTATION, 1));
+    CHECK(!_Hits(L"S-1-5-21-3", CPUS_LOGON, 1));
+
+    std::lock_guard<std::mutex> lock(s_lockFreed);
+    CHECK(s_cFreed == 3);
+    CHECK(s_cFreedDirty == 0);
+}
+
+int main()
+{
+    ShimSetHeapFreeHook(_OnHeapFree);
+    RUN_TEST(CountsHitsAndMisses);
+    RUN_TEST(MissesOnAnotherScenarioOrVersion);
+    RUN_TEST(ZeroesInvalidatedEntries);
+    ShimSetHeapFreeHook(nullptr);
+    return TestExitCode();
+}
@@ -0,0 +1,141 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CSimulatedRadioSource stands in for the radios of the machine. Each simulated
+// radio has its own set of devices in range, which the test changes while the
+// scan runs, and an inquiry pass takes a fixed time and then reports them.
+
+#pragma once
+
+#include <windows.h>
+#include <strsafe.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "BluetoothScanner.h"
+
+class CSimulatedRadioSource : public IBluetoothRadioSource
+{
+public:
+    CSimulatedRadioSource(DWORD cRadios, DWORD dwInquiryMs) :
+        _spShared(std::make_shared<SHARED>())
+    {
+        _spShared->dwInquiryMs = dwInquiryMs;
+        _spShared->radios.resize(cRadios);
+    }
+
+    // Puts the device in or out of range of one radio.
+    void SetInRange(DWORD dwRadio, ULONGLONG ullAddress, PCWSTR pszName, bool fInRange)
+    {
+        std::lock_guard<std::mutex> lock(_spShared->lock);
+        std::vector<DEVICE> &devices = _spShared->radios[dwRadio].devices;
+        for (auto it = devices.begin(); it != devices.end(); ++it)
+        {
+            if (it->ullAddress == ullAddress)
+            {
+                devices.erase(it);
+                break;
+            }
+        }
+        if (fInRange)
+        {
+            devices.push_back({ ullAddress, pszName });
+        }
+    }
+
+    // Takes the device out of range of every radio.
+    void SetOutOfRange(ULONGLONG ullAddress)
+    {
+        for (DWORD i = 0; i < _spShared->radios.size(); i++)
+        {
+            SetInRange(i, ullAddress, L"", false);
+        }
+    }
+
+    DWORD GetInquiryCount(DWORD dwRadio) const
+    {
+        std::lock_guard<std::mutex> lock(_spShared->lock);
+        return _spShared->radios[dwRadio].cInquiries;
+    }
+
+    HRESULT OpenRadios(_Out_ std::vector<std::unique_ptr<IBluetoothRadio>> *pRadios)
+    {
+        pRadios->clear();
+        for (DWORD i = 0; i < _spShared->radios.size(); i++)
+        {
+            pRadios->push_back(std::unique_ptr<IBluetoothRadio>(new CSimulatedRadio(_spShared, i)));
+        }
+        return S_OK;
+    }
+
+private:
+    struct DEVICE
+    {
+        ULONGLONG       ullAddress;
+        std::wstring    strName;
+    };
+
+    struct RADIO
+    {
+        std::vector<DEVICE> devices;
+        DWORD               cInquiries = 0;
+    };
+
+    // Shared with the radios, which the scan threads may hold after the source is gone.
+    struct SHARED
+    {
+        mutable std::mutex  lock;
+        DWORD               dwInquiryMs = 0;
+        std::vector<RADIO>  radios;
+    };
+
+    class CSimulatedRadio : public IBluetoothRadio
+    {
+    public:
+        CSimulatedRadio(const std::shared_ptr<SHARED> &spShared, DWORD dwRadio) :
+            _spShared(spShared),
+            _dwRadio(dwRadio)
+        {
+        }
+
+        HRESULT GetInfo(_Out_ BLUETOOTH_ADDRESS *pAddress, _Out_writes_(cchName) PWSTR pszName, size_t cchName)
+        {
+            pAddress->ullLong = 0xA000 + _dwRadio;
+            return StringCchPrintfW(pszName, cchName, L"Simulated radio %u", _dwRadio);
+        }
+
+        void Inquire(const std::function<bool(const BLUETOOTH_DEVICE_INFO &)> &onDevice)
+        {
+            Sleep(_spShared->dwInquiryMs);
+
+            std::vector<DEVICE> devices;
+            {
+                std::lock_guard<std::mutex> lock(_spShared->lock);
+                devices = _spShared->radios[_dwRadio].devices;
+                _spShared->radios[_dwRadio].cInquiries++;
+            }
+            for (const DEVICE &device : devices)
+            {
+                BLUETOOTH_DEVICE_INFO btdi = { sizeof(BLUETOOTH_DEVICE_INFO) };
+                btdi.Address.ullLong = device.ullAddress;
+                StringCchCopyW(btdi.szName, ARRAYSIZE(btdi.szName), device.strName.c_str());
+                if (onDevice(btdi))
+                {
+                    break;
+                }
+            }
+        }
+
+    private:
+        std::shared_ptr<SHARED> _spShared;
+        DWORD                   _dwRadio;
+    };
+
+    std::shared_ptr<SHARED> _spShared;
+};
@@ -0,0 +1,127 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks block reuse, alignment and accounting of CSlabPool, alone and with
+// several threads allocating and freeing at once.
+
+#include <windows.h>
+#include <set>
+#include <thread>
+#include <vector>
+#include "SlabPool.h"
+#include "TestHarness.h"
+
+static void ReusesFreedBlocks()
+{
+    CSlabPool pool(200, 4);
+    void *rgpv[4];
+    for (void *&pv : rgpv)
+    {
+        pv = pool.Allocate(200);
+        CHECK(pv != nullptr);
+        CHECK(reinterpret_cast<ULONG_PTR>(pv) % MEMORY_ALLOCATION_ALIGNMENT == 0);
+    }
+
+    SLAB_POOL_STATS stats;
+    pool.GetStats(&stats);
+    CHECK(stats.cbSlot == 208);
+    CHECK(stats.cSlabs == 1);
+    CHECK(stats.cInUse == 4);
+
+    // The most recently freed block is handed out first, without a new slab.
+    pool.Free(rgpv[2]);
+    CHECK(pool.Allocate(10) == rgpv[2]);
+    pool.GetStats(&stats);
+    CHECK(stats.cSlabs == 1);
+    CHECK(stats.cAllocations == 5);
+
+    void *pvFifth = pool.Allocate(1);
+    CHECK(pvFifth != nullptr);
+    pool.GetStats(&stats);
+    CHECK(stats.cSlabs == 2);
+    CHECK(stats.cHeapAllocations == 2);
+
+    pool.Free(pvFifth);
+    for (void *pv : rgpv)
+    {
+        pool.Free(pv);
+    }
+    pool.Free(nullptr);
+    pool.GetStats(&stats);
+    CHECK(stats.cInUse == 0);
+}
+
+static void RejectsOversizedBlocks()
+{
+    CSlabPool pool(64, 8);
+    CHECK(pool.Allocate(65) == nullptr);
+    CHECK(pool.Allocate(64) != nullptr);
+}
+
+// Blocks handed out at the same time never overlap, however the threads interleave.
+static void ConcurrentAllocationsAreDistinct()
+{
+    const DWORD c_cThreads = 8;
+    const DWORD c_cRounds = 2000;
+    const DWORD c_cHeld = 16;
+    CSlabPool pool(96, 32);
+    volatile LONG cFailures = 0;
+
+    std::vector<std::thread> threads;
+    for (DWORD iThread = 0; iThread < c_cThreads; iThread++)
+    {
+        threads.emplace_back([&pool, &cFailures, iThread]
+        {
+            for (DWORD iRound = 0; iRound < c_cRounds; iRound++)
+            {
+                BYTE *rgpb[c_cHeld];
+                for (DWORD i = 0; i < c_cHeld; i++)
+                {
+                    rgpb[i] = static_cast<BYTE*>(pool.Allocate(96));
+                    memset(rgpb[i], static_cast<int>(iThread + 1), 96);
+                }
+                for (DWORD i = 0; i < c_cHeld; i++)
+                {
+                    if (rgpb[i][0] != iThread + 1 || rgpb[i][95] != iThread + 1)
+                    {
+                        InterlockedIncrement(&cFailures);
+                    }
+                    pool.Free(rgpb[i]);
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    CHECK(cFailures == 0);
+
+    SLAB_POOL_STATS stats;
+    pool.GetStats(&stats);
+    CHECK(stats.cInUse == 0);
+    CHECK(stats.cAllocations == static_cast<ULONGLONG>(c_cThreads) * c_cRounds * c_cHeld);
+    CHECK(stats.cSlabs <= (c_cThreads * c_cHeld + 31) / 32 + c_cThreads);
+
+    // After the storm every block is free and distinct.
+    std::set<void*> blocks;
+    for (DWORD i = 0; i < stats.cSlabs * 32; i++)
+    {
+        blocks.insert(pool.Allocate(96));
+    }
+    CHECK(blocks.size() == stats.cSlabs * 32);
+    CHECK(blocks.count(nullptr) == 0);
+}
+
+int main()
+{
+    RUN_TEST(ReusesFreedBlocks);
+    RUN_TEST(RejectsOversizedBlocks);
+    RUN_TEST(ConcurrentAllocationsAreDistinct);
+    return TestExitCode();
+}
@@ -0,0 +1,194 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks that CSnapshotCell only reclaims values nobody holds, only on the thread
+// that calls Reclaim, and that readers never see a torn or reclaimed value while
+// writers publish and LogonUI's thread reclaims. Run it under make tsan as well.
+
+#include <windows.h>
+#include <thread>
+#include <vector>
+#include "SnapshotCell.h"
+#include "TestHarness.h"
+
+static volatile LONG s_cLive = 0;
+static volatile LONG s_cWrongThread = 0;
+static DWORD s_dwReclaimThread = 0;
+
+// Both halves are written by one update, so a reader must always see them equal.
+struct TEST_VALUE
+{
+    TEST_VALUE() :
+        lFirst(0),
+        lSecond(0),
+        fReclaimed(false)
+    {
+    }
+
+    void OnPublish()
+    {
+        lSecond = lFirst;
+        InterlockedIncrement(&s_cLive);
+    }
+
+    void OnReclaim()
+    {
+        if (GetCurrentThreadId() != s_dwReclaimThread)
+        {
+            InterlockedIncrement(&s_cWrongThread);
+        }
+        CHECK(!fReclaimed);
+        fReclaimed = true;
+        InterlockedDecrement(&s_cLive);
+    }
+
+    LONG    lFirst;
+    LONG    lSecond;
+    bool    fReclaimed;
+};
+
+typedef CSnapshotCell<TEST_VALUE> TEST_CELL;
+
+static void _Increment(TEST_CELL *pCell)
+{
+    pCell->Update([](TEST_VALUE &value)
+    {
+        value.lFirst++;
+    });
+}
+
+static void PublishesUpdates()
+{
+    s_dwReclaimThread = GetCurrentThreadId();
+    {
+        TEST_CELL cell;
+        const TEST_VALUE *pValue = cell.Acquire();
+        CHECK(pValue->lFirst == 0);
+        TEST_CELL::Release(pValue);
+
+        _Increment(&cell);
+        _Increment(&cell);
+        pValue = cell.Acquire();
+        CHECK(pValue->lFirst == 2 && pValue->lSecond == 2);
+        TEST_CELL::Release(pValue);
+
+        // Without readers the first copy is unreachable as soon as it is replaced.
+        CHECK(cell.Reclaim() == 1);
+        CHECK(cell.Reclaim() == 0);
+        CHECK(s_cLive == 1);
+    }
+    CHECK(s_cLive == 0);
+}
+
+static void KeepsHeldValues()
+{
+    s_dwReclaimThread = GetCurrentThreadId();
+    {
+        TEST_CELL cell;
+        _Increment(&cell);
+        const TEST_VALUE *pHeld = cell.Acquire();
+        _Increment(&cell);
+        _Increment(&cell);
+
+        CHECK(cell.Reclaim() == 1);
+        CHECK(pHeld->lFirst == 1 && !pHeld->fReclaimed);
+
+        // The last reference goes on another thread, but the value is still
+        // only reclaimed by the next Reclaim.
+        std::thread([pHeld]()
+        {
+            TEST_CELL::Release(pHeld);
+        }).join();
+        CHECK(s_cLive == 2);
+        CHECK(cell.Reclaim() == 1);
+        CHECK(s_cLive == 1);
+    }
+    CHECK(s_cLive == 0);
+    CHECK(s_cWrongThread == 0);
+}
+
+static void StressesReadersAndWriters()
+{
+    static const DWORD c_cReaders = 4;
+    static const DWORD c_cWriters = 2;
+    static const DWORD c_cUpdatesPerWriter = 20000;
+
+    s_dwReclaimThread = GetCurrentThreadId();
+    {
+        TEST_CELL cell;
+        volatile LONG cTorn = 0;
+        volatile LONG cBackwards = 0;
+        volatile LONG cWritersLeft = c_cWriters;
+
+        std::vector<std::thread> rgThreads;
+        for (DWORD i = 0; i < c_cReaders; i++)
+        {
+            rgThreads.emplace_back([&]()
+            {
+                LONG lLast = 0;
+                while (ReadAcquire(&cWritersLeft) != 0)
+                {
+                    const TEST_VALUE *pValue = cell.Acquire();
+                    if (pValue->lFirst != pValue->lSecond || pValue->fReclaimed)
+                    {
+                        InterlockedIncrement(&cTorn);
+                    }
+                    if (pValue->lFirst < lLast)
+                    {
+                        InterlockedIncrement(&cBackwards);
+                    }
+                    lLast = pValue->lFirst;
+                    TEST_CELL::Release(pValue);
+                }
+            });
+        }
+        for (DWORD i = 0; i < c_cWriters; i++)
+        {
+            rgThreads.emplace_back([&]()
+            {
+                for (DWORD iUpdate = 0; iUpdate < c_cUpdatesPerWriter; iUpdate++)
+                {
+                    _Increment(&cell);
+                }
+                InterlockedDecrement(&cWritersLeft);
+            });
+        }
+
+        // This thread plays LogonUI, reclaiming while the others run.
+        DWORD cReclaimed = 0;
+        while (ReadAcquire(&cWritersLeft) != 0)
+        {
+            cReclaimed += cell.Reclaim();
+        }
+        for (std::thread &thread : rgThreads)
+        {
+            thread.join();
+        }
+        cReclaimed += cell.Reclaim();
+
+        const TEST_VALUE *pValue = cell.Acquire();
+        CHECK(pValue->lFirst == static_cast<LONG>(c_cWriters * c_cUpdatesPerWriter));
+        TEST_CELL::Release(pValue);
+        CHECK(cTorn == 0);
+        CHECK(cBackwards == 0);
+
+        // Everything but the current value is gone once the readers have stopped.
+        CHECK(cReclaimed == c_cWriters * c_cUpdatesPerWriter - 1);
+        CHECK(s_cLive == 1);
+    }
+    CHECK(s_cLive == 0);
+    CHECK(s_cWrongThread == 0);
+}
+
+int main()
+{
+    RUN_TEST(PublishesUpdates);
+    RUN_TEST(KeepsHeldValues);
+    RUN_TEST(StressesReadersAndWriters);
+    return TestExitCode();
+}
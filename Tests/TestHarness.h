@@ -0,0 +1,62 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The checks the Linux tests are written with. Each test program runs its tests
+// in main and exits with the number of failed checks.
+
+#pragma once
+
+#include <windows.h>
+#include <stdio.h>
+
+inline int &TestFailureCount()
+{
+    static int s_cFailures = 0;
+    return s_cFailures;
+}
+
+#define CHECK(expr) \
+    do \
+    { \
+        if (!(expr)) \
+        { \
+            fprintf(stderr, "%s(%d): CHECK failed: %s\n", __FILE__, __LINE__, #expr); \
+            TestFailureCount()++; \
+        } \
+    } while (0)
+
+#define CHECK_HR(expr) CHECK(SUCCEEDED(expr))
+
+#define RUN_TEST(test) \
+    do \
+    { \
+        int cFailuresBefore = TestFailureCount(); \
+        test(); \
+        printf("%s %s\n", (TestFailureCount() == cFailuresBefore) ? "passed" : "FAILED", #test); \
+    } while (0)
+
+inline int TestExitCode()
+{
+    return (TestFailureCount() == 0) ? 0 : 1;
+}
+
+// Polls fnDone until it returns true or dwTimeoutMs passes; returns its last answer.
+template <typename TDone>
+bool WaitUntil(TDone fnDone, DWORD dwTimeoutMs)
+{
+    ULONGLONG ullDeadline = GetTickCount64() + dwTimeoutMs;
+    while (!fnDone())
+    {
+        if (GetTickCount64() > ullDeadline)
+        {
+            return fnDone();
+        }
+        Sleep(1);
+    }
+    return true;
+}
@@ -0,0 +1,170 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Checks that a batched prefetch of identity properties reads the same values
+// as one UserPropertiesFetch per user, stays within its worker limit and
+// cleans up after the users it could not read.
+
+#include <windows.h>
+#include <vector>
+#include "UserPropertyPrefetch.h"
+#include "MockCredentialProviderUsers.h"
+#include "TestHarness.h"
+
+static bool _StringsEqual(PCWSTR psz1, PCWSTR psz2)
+{
+    return (psz1 == nullptr || psz2 == nullptr) ? (psz1 == psz2) : (wcscmp(psz1, psz2) == 0);
+}
+
+static std::vector<ICredentialProviderUser*> _Users(CMockUserArray *pArray)
+{
+    DWORD cUsers = 0;
+    pArray->GetCount(&cUsers);
+    std::vector<ICredentialProviderUser*> users(cUsers);
+    for (DWORD i = 0; i < cUsers; i++)
+    {
+        pArray->GetAt(i, &users[i]);
+    }
+    return users;
+}
+
+static void _ReleaseUsers(std::vector<ICredentialProviderUser*> *pUsers)
+{
+    for (ICredentialProviderUser *pUser : *pUsers)
+    {
+        pUser->Release();
+    }
+    pUsers->clear();
+}
+
+static void FetchesEveryProperty()
+{
+    CMockUser *pUser = new CMockUser(L"S-1-5-21-1-2-3-1001", L"CONTOSO\\alice", L"Alice Smith", nullptr);
+    USER_PROPERTIES properties;
+    CHECK_HR(UserPropertiesFetch(pUser, &properties));
+    CHECK(_StringsEqual(properties.pszQualifiedUserName, L"CONTOSO\\alice"));
+    CHECK(_StringsEqual(properties.pszUserName, L"alice"));
+    CHECK(_StringsEqual(properties.pszDisplayName, L"Alice Smith"));
+    CHECK(properties.pszLogonStatus == nullptr);
+    UserPropertiesFree(&properties);
+    CHECK(properties.pszQualifiedUserName == nullptr);
+
+    // Without a qualified user name there is nothing to log on with.
+    CMockUser *pNameless = new CMockUser(L"S-1-5-21-1-2-3-1002", nullptr, L"Nameless", nullptr);
+    CHECK(FAILED(UserPropertiesFetch(pNameless, &properties)));
+    CHECK(pNameless->GetReadCount() == 1);
+    UserPropertiesFree(&properties);
+
+    pNameless->Release();
+    pUser->Release();
+}
+
+static void PrefetchMatchesSerialFetch()
+{
+    const DWORD c_cUsers = 50;
+    CMockUserArray *pArray = new CMockUserArray();
+    pArray->AddDomainUsers(0, c_cUsers, 0);
+    pArray->Add(new CMockUser(L"S-1-5-21-1-2-3-2000", L"AzureAD\\bob@contoso.com", nullptr, L"Locked"));
+    std::vector<ICredentialProviderUser*> users = _Users(pArray);
+
+    std::vector<USER_PROPERTIES> prefetched(users.size());
+    std::vector<HRESULT> results(users.size());
+    CHECK(UserPropertiesPrefetch(users.data(), static_cast<DWORD>(users.size()), 8, prefetched.data(), results.data()) == S_OK);
+
+    for (DWORD i = 0; i < users.size(); i++)
+    {
+        USER_PROPERTIES serial;
+        CHECK(results[i] == S_OK);
+        CHECK_HR(UserPropertiesFetch(users[i], &serial));
+        CHECK(_StringsEqual(prefetched[i].pszQualifiedUserName, serial.pszQualifiedUserName));
+        CHECK(_StringsEqual(prefetched[i].pszUserName, serial.pszUserName));
+        CHECK(_StringsEqual(prefetched[i].pszDisplayName, serial.pszDisplayName));
+        CHECK(_StringsEqual(prefetched[i].pszLogonStatus, serial.pszLogonStatus));
+        UserPropertiesFree(&serial);
+        UserPropertiesFree(&prefetched[i]);
+
+        // Each user was read once by the prefetch and once here, four properties each.
+        CHECK(pArray->User(i)->GetReadCount() == 8);
+    }
+
+    CHECK(ShimOutstandingMarshalStreams() == 0);
+    _ReleaseUsers(&users);
+    for (DWORD i = 0; i <= c_cUsers; i++)
+    {
+        CHECK(pArray->User(i)->GetRefCount() == 1);
+    }
+    pArray->Release();
+}
+
+// A user that cannot be read fails on its own; the others are still filled in.
+static void PrefetchReportsEachUser()
+{
+    CMockUserArray *pArray = new CMockUserArray();
+    pArray->AddDomainUsers(0, 3, 0);
+    pArray->Add(new CMockUser(L"S-1-5-21-1-2-3-3000", nullptr, nullptr, nullptr));
+    pArray->AddDomainUsers(3, 3, 0);
+    std::vector<ICredentialProviderUser*> users = _Users(pArray);
+
+    std::vector<USER_PROPERTIES> prefetched(users.size());
+    std::vector<HRESULT> results(users.size());
+    CHECK(UserPropertiesPrefetch(users.data(), static_cast<DWORD>(users.size()), 2, prefetched.data(), results.data()) == S_OK);
+    for (DWORD i = 0; i < users.size(); i++)
+    {
+        CHECK((i == 3) ? FAILED(results[i]) : (results[i] == S_OK && prefetched[i].pszQualifiedUserName != nullptr));
+        UserPropertiesFree(&prefetched[i]);
+    }
+
+    CHECK(ShimOutstandingMarshalStreams() == 0);
+    _ReleaseUsers(&users);
+    pArray->Release();
+}
+
+static void PrefetchOfNoUsers()
+{
+    USER_PROPERTIES properties;
+    HRESULT hr;
+    CHECK(UserPropertiesPrefetch(nullptr, 0, 4, &properties, &hr) == S_OK);
+}
+
+// No more reads run at once than the prefetch has workers.
+static void StaysWithinWorkerLimit()
+{
+    const DWORD c_cWorkers = 4;
+    MOCK_READ_TRACKER tracker = {};
+    CMockUserArray *pArray = new CMockUserArray();
+    pArray->AddDomainUsers(0, 24, 2);
+    for (DWORD i = 0; i < 24; i++)
+    {
+        pArray->User(i)->SetReadTracker(&tracker);
+    }
+    std::vector<ICredentialProviderUser*> users = _Users(pArray);
+
+    std::vector<USER_PROPERTIES> prefetched(users.size());
+    std::vector<HRESULT> results(users.size());
+    CHECK(UserPropertiesPrefetch(users.data(), static_cast<DWORD>(users.size()), c_cWorkers, prefetched.data(), results.data()) == S_OK);
+    CHECK(tracker.cActive == 0);
+    CHECK(tracker.cPeak > 1);
+    CHECK(tracker.cPeak <= static_cast<LONG>(c_cWorkers));
+    for (USER_PROPERTIES &properties : prefetched)
+    {
+        UserPropertiesFree(&properties);
+    }
+
+    _ReleaseUsers(&users);
+    pArray->Release();
+}
+
+int main()
+{
+    RUN_TEST(FetchesEveryProperty);
+    RUN_TEST(PrefetchMatchesSerialFetch);
+    RUN_TEST(PrefetchReportsEachUser);
+    RUN_TEST(PrefetchOfNoUsers);
+    RUN_TEST(StaysWithinWorkerLimit);
+    return TestExitCode();
+}
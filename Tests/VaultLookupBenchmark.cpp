@@ -0,0 +1,106 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Measures what a vault lookup costs GetSecretVersion and GetSecret: finding a
+// user's record, which hashes and compares the SID, and finding and opening it,
+// which decrypts the secret. Vaults of several sizes are filled to three
+// quarters, so that probe sequences run long. Lookups of users not in the vault
+// are measured as well, since they probe to the end of a sequence.
+//
+//   VaultLookupBenchmark [lookups]
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "SealedVault.h"
+
+static const uint32_t c_dwGeneration = 1;
+
+static volatile size_t s_cSink = 0;
+
+static double _Milliseconds(const LARGE_INTEGER &liStart, const LARGE_INTEGER &liEnd)
+{
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    return (liEnd.QuadPart - liStart.QuadPart) * 1e3 / liFrequency.QuadPart;
+}
+
+static std::u16string _Sid(uint32_t iUser)
+{
+    std::string str = "S-1-5-21-3623811015-3361044348-30300820-" + std::to_string(1000 + iUser);
+    return std::u16string(str.begin(), str.end());
+}
+
+// Runs op cLookups times, once for each SID in turn, and returns nanoseconds per lookup.
+template <typename LOOKUP>
+static double _Run(const std::vector<std::u16string> &rgSids, DWORD cLookups, LOOKUP op)
+{
+    LARGE_INTEGER liStart, liEnd;
+    QueryPerformanceCounter(&liStart);
+    for (DWORD i = 0; i < cLookups; i++)
+    {
+        s_cSink = s_cSink + op(rgSids[i % rgSids.size()]);
+    }
+    QueryPerformanceCounter(&liEnd);
+    return _Milliseconds(liStart, liEnd) * 1e6 / cLookups;
+}
+
+int main(int argc, char **argv)
+{
+    DWORD cLookups = (argc >= 2) ? static_cast<DWORD>(atoi(argv[1])) : 200000;
+
+    uint8_t rgbKey[c_cbChaChaKey];
+    for (size_t i = 0; i < sizeof(rgbKey); i++)
+    {
+        rgbKey[i] = static_cast<uint8_t>(i * 7 + 1);
+    }
+    uint8_t rgbNonce[c_cbChaChaNonce] = {};
+    std::u16string password = u"Correct-Horse-Battery-Staple-42";
+
+    printf("%u lookups\n\n", cLookups);
+    printf("%8s %8s %12s %14s %12s\n", "records", "users", "find ns", "find+open ns", "miss ns");
+
+    static const uint32_t c_rgcRecords[] = { 64, 1024, 16384 };
+    for (uint32_t cRecords : c_rgcRecords)
+    {
+        std::vector<uint8_t> rgbVault(SealedVaultSize(cRecords));
+        SealedVaultInitialize(rgbVault.data(), rgbVault.size(), cRecords, c_dwGeneration);
+
+        uint32_t cUsers = cRecords / 4 * 3;
+        std::vector<std::u16string> rgSids, rgMissingSids;
+        for (uint32_t iUser = 0; iUser < cUsers; iUser++)
+        {
+            rgSids.push_back(_Sid(iUser));
+            rgMissingSids.push_back(_Sid(cUsers + iUser));
+            memcpy(rgbNonce, &iUser, sizeof(iUser));
+            SealedVaultStore(rgbVault.data(), rgbVault.size(), rgbKey, rgbNonce, rgSids.back().data(), rgSids.back().size(),
+                             1, password.data(), password.size());
+        }
+
+        double dFindNs = _Run(rgSids, cLookups, [&](const std::u16string &sid)
+        {
+            const SEALED_VAULT_RECORD *pRecord = SealedVaultFind(rgbVault.data(), rgbVault.size(), sid.data(), sid.size());
+            return (pRecord != nullptr) ? static_cast<size_t>(SealedVaultRecordVersion(*pRecord)) : 0;
+        });
+        double dOpenNs = _Run(rgSids, cLookups, [&](const std::u16string &sid)
+        {
+            char16_t rgchSecret[c_cchVaultSecret];
+            const SEALED_VAULT_RECORD *pRecord = SealedVaultFind(rgbVault.data(), rgbVault.size(), sid.data(), sid.size());
+            return (pRecord != nullptr && SealedVaultOpen(rgbKey, c_dwGeneration, *pRecord, rgchSecret)) ? static_cast<size_t>(rgchSecret[0]) : 0;
+        });
+        double dMissNs = _Run(rgMissingSids, cLookups, [&](const std::u16string &sid)
+        {
+            return static_cast<size_t>(SealedVaultFind(rgbVault.data(), rgbVault.size(), sid.data(), sid.size()) != nullptr);
+        });
+        printf("%8u %8u %12.0f %14.0f %12.0f\n", cRecords, cUsers, dFindNs, dOpenNs, dMissNs);
+    }
+    return 0;
+}
@@ -0,0 +1,1590 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// POSIX implementation of the Win32 subset declared by the shim headers.
+
+#include <windows.h>
+#include <strsafe.h>
+#include <shlobj.h>
+#include <sddl.h>
+#include <bcrypt.h>
+#include <wincrypt.h>
+#include <bluetoothapis.h>
+#include <winsock2.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <wctype.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Dll.h"
+
+HINSTANCE g_hinst = nullptr;
+
+static thread_local DWORD t_dwLastError = ERROR_SUCCESS;
+
+DWORD GetLastError()
+{
+    return t_dwLastError;
+}
+
+void SetLastError(DWORD dwError)
+{
+    t_dwLastError = dwError;
+}
+
+//
+// SRW locks. The lock word holds a writer-preferring pthread rwlock created on
+// first use, so SRWLOCK_INIT and InitializeSRWLock both work. Like SRW locks on
+// Windows they are never destroyed.
+//
+
+static pthread_rwlock_t *_GetRwLock(SRWLOCK *pLock)
+{
+    pthread_rwlock_t *pRwLock = static_cast<pthread_rwlock_t*>(__atomic_load_n(&pLock->Ptr, __ATOMIC_ACQUIRE));
+    if (pRwLock == nullptr)
+    {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_t *pNew = new pthread_rwlock_t;
+        pthread_rwlock_init(pNew, &attr);
+        pthread_rwlockattr_destroy(&attr);
+
+        void *pExpected = nullptr;
+        if (__atomic_compare_exchange_n(&pLock->Ptr, &pExpected, pNew, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            pRwLock = pNew;
+        }
+        else
+        {
+            pthread_rwlock_destroy(pNew);
+            delete pNew;
+            pRwLock = static_cast<pthread_rwlock_t*>(pExpected);
+        }
+    }
+    return pRwLock;
+}
+
+void InitializeSRWLock(SRWLOCK *pLock)
+{
+    pLock->Ptr = nullptr;
+}
+
+void AcquireSRWLockShared(SRWLOCK *pLock)
+{
+    pthread_rwlock_rdlock(_GetRwLock(pLock));
+}
+
+void ReleaseSRWLockShared(SRWLOCK *pLock)
+{
+    pthread_rwlock_unlock(_GetRwLock(pLock));
+}
+
+void AcquireSRWLockExclusive(SRWLOCK *pLock)
+{
+    pthread_rwlock_wrlock(_GetRwLock(pLock));
+}
+
+void ReleaseSRWLockExclusive(SRWLOCK *pLock)
+{
+    pthread_rwlock_unlock(_GetRwLock(pLock));
+}
+
+BOOL TryAcquireSRWLockExclusive(SRWLOCK *pLock)
+{
+    return pthread_rwlock_trywrlock(_GetRwLock(pLock)) == 0;
+}
+
+//
+// Interlocked singly linked lists
+//
+
+static void _LockSList(PSLIST_HEADER pHead)
+{
+    while (__atomic_exchange_n(&pHead->Lock, 1, __ATOMIC_ACQUIRE) != 0)
+    {
+        YieldProcessor();
+    }
+}
+
+static void _UnlockSList(PSLIST_HEADER pHead)
+{
+    __atomic_store_n(&pHead->Lock, 0, __ATOMIC_RELEASE);
+}
+
+void InitializeSListHead(PSLIST_HEADER pHead)
+{
+    pHead->Next = nullptr;
+    pHead->Depth = 0;
+    pHead->Lock = 0;
+}
+
+PSLIST_ENTRY InterlockedPushEntrySList(PSLIST_HEADER pHead, PSLIST_ENTRY pEntry)
+{
+    _LockSList(pHead);
+    PSLIST_ENTRY pFirst = pHead->Next;
+    pEntry->Next = pFirst;
+    pHead->Next = pEntry;
+    pHead->Depth++;
+    _UnlockSList(pHead);
+    return pFirst;
+}
+
+PSLIST_ENTRY InterlockedPopEntrySList(PSLIST_HEADER pHead)
+{
+    _LockSList(pHead);
+    PSLIST_ENTRY pFirst = pHead->Next;
+    if (pFirst != nullptr)
+    {
+        pHead->Next = pFirst->Next;
+        pHead->Depth--;
+    }
+    _UnlockSList(pHead);
+    return pFirst;
+}
+
+PSLIST_ENTRY InterlockedFlushSList(PSLIST_HEADER pHead)
+{
+    _LockSList(pHead);
+    PSLIST_ENTRY pFirst = pHead->Next;
+    pHead->Next = nullptr;
+    pHead->Depth = 0;
+    _UnlockSList(pHead);
+    return pFirst;
+}
+
+USHORT QueryDepthSList(PSLIST_HEADER pHead)
+{
+    _LockSList(pHead);
+    USHORT cDepth = pHead->Depth;
+    _UnlockSList(pHead);
+    return cDepth;
+}
+
+//
+// Time
+//
+
+static volatile LONGLONG s_llMonotonicOffset = 0;
+
+static ULONGLONG _MonotonicNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<ULONGLONG>(ts.tv_sec) * 1000000000ull + static_cast<ULONGLONG>(ts.tv_nsec) +
+        static_cast<ULONGLONG>(ReadAcquire64(&s_llMonotonicOffset));
+}
+
+void ShimAdvanceTickCount(DWORD dwMilliseconds)
+{
+    InterlockedExchangeAdd64(&s_llMonotonicOffset, static_cast<LONGLONG>(dwMilliseconds) * 1000000);
+}
+
+ULONGLONG GetTickCount64()
+{
+    return _MonotonicNanoseconds() / 1000000ull;
+}
+
+DWORD GetTickCount()
+{
+    return static_cast<DWORD>(GetTickCount64());
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *pCounter)
+{
+    pCounter->QuadPart = static_cast<LONGLONG>(_MonotonicNanoseconds());
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *pFrequency)
+{
+    pFrequency->QuadPart = 1000000000ll;
+    return TRUE;
+}
+
+void GetLocalTime(SYSTEMTIME *pst)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    struct tm tmLocal;
+    localtime_r(&ts.tv_sec, &tmLocal);
+    pst->wYear = static_cast<WORD>(tmLocal.tm_year + 1900);
+    pst->wMonth = static_cast<WORD>(tmLocal.tm_mon + 1);
+    pst->wDayOfWeek = static_cast<WORD>(tmLocal.tm_wday);
+    pst->wDay = static_cast<WORD>(tmLocal.tm_mday);
+    pst->wHour = static_cast<WORD>(tmLocal.tm_hour);
+    pst->wMinute = static_cast<WORD>(tmLocal.tm_min);
+    pst->wSecond = static_cast<WORD>(tmLocal.tm_sec);
+    pst->wMilliseconds = static_cast<WORD>(ts.tv_nsec / 1000000);
+}
+
+static volatile LONGLONG s_llSystemTimeOffset = 0;
+
+void GetSystemTimeAsFileTime(FILETIME *pft)
+{
+    // 100ns intervals since 1601-01-01
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ULONGLONG ull = (static_cast<ULONGLONG>(ts.tv_sec) + 11644473600ull) * 10000000ull + static_cast<ULONGLONG>(ts.tv_nsec) / 100;
+    ull += static_cast<ULONGLONG>(ReadAcquire64(&s_llSystemTimeOffset));
+    pft->dwLowDateTime = static_cast<DWORD>(ull);
+    pft->dwHighDateTime = static_cast<DWORD>(ull >> 32);
+}
+
+void ShimAdvanceSystemTime(ULONGLONG ull100ns)
+{
+    InterlockedExchangeAdd64(&s_llSystemTimeOffset, static_cast<LONGLONG>(ull100ns));
+}
+
+void Sleep(DWORD dwMilliseconds)
+{
+    if (dwMilliseconds == 0)
+    {
+        sched_yield();
+    }
+    else
+    {
+        usleep(static_cast<useconds_t>(dwMilliseconds) * 1000);
+    }
+}
+
+DWORD GetCurrentThreadId()
+{
+    return static_cast<DWORD>(syscall(SYS_gettid));
+}
+
+//
+// Debug output
+//
+
+static bool _IsDebugOutputEnabled()
+{
+    static const bool s_fEnabled = (getenv("WIN32SHIM_DEBUG_OUTPUT") != nullptr);
+    return s_fEnabled;
+}
+
+void OutputDebugStringW(PCWSTR psz)
+{
+    if (_IsDebugOutputEnabled())
+    {
+        fprintf(stderr, "%ls", psz);
+    }
+}
+
+void OutputDebugStringA(PCSTR psz)
+{
+    if (_IsDebugOutputEnabled())
+    {
+        fputs(psz, stderr);
+    }
+}
+
+//
+// Handles and events
+//
+
+// Base of the objects behind the handles the shim hands out.
+struct SHIM_HANDLE_OBJECT
+{
+    virtual ~SHIM_HANDLE_OBJECT() {}
+};
+
+struct SHIM_EVENT : SHIM_HANDLE_OBJECT
+{
+    std::mutex              lock;
+    std::condition_variable cvSignaled;
+    bool                    fSignaled;
+    bool                    fManualReset;
+};
+
+static std::mutex s_lockHandles;
+static std::set<SHIM_HANDLE_OBJECT*> s_handles;
+
+static HANDLE _RegisterHandle(SHIM_HANDLE_OBJECT *pObject)
+{
+    std::lock_guard<std::mutex> lock(s_lockHandles);
+    s_handles.insert(pObject);
+    return pObject;
+}
+
+template <typename TObject>
+static TObject *_LookupHandle(HANDLE h)
+{
+    std::lock_guard<std::mutex> lock(s_lockHandles);
+    auto it = s_handles.find(static_cast<SHIM_HANDLE_OBJECT*>(h));
+    return (it != s_handles.end()) ? dynamic_cast<TObject*>(*it) : nullptr;
+}
+
+BOOL CloseHandle(HANDLE h)
+{
+    SHIM_HANDLE_OBJECT *pObject = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(s_lockHandles);
+        auto it = s_handles.find(static_cast<SHIM_HANDLE_OBJECT*>(h));
+        if (it != s_handles.end())
+        {
+            pObject = *it;
+            s_handles.erase(it);
+        }
+    }
+    delete pObject;
+    return TRUE;
+}
+
+HANDLE CreateEventW(void *pEventAttributes, BOOL fManualReset, BOOL fInitialState, PCWSTR pszName)
+{
+    SHIM_EVENT *pEvent = new SHIM_EVENT();
+    pEvent->fSignaled = (fInitialState != FALSE);
+    pEvent->fManualReset = (fManualReset != FALSE);
+    return _RegisterHandle(pEvent);
+}
+
+BOOL SetEvent(HANDLE hEvent)
+{
+    SHIM_EVENT *pEvent = _LookupHandle<SHIM_EVENT>(hEvent);
+    if (pEvent == nullptr)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    std::lock_guard<std::mutex> lock(pEvent->lock);
+    pEvent->fSignaled = true;
+    pEvent->cvSignaled.notify_all();
+    return TRUE;
+}
+
+BOOL ResetEvent(HANDLE hEvent)
+{
+    SHIM_EVENT *pEvent = _LookupHandle<SHIM_EVENT>(hEvent);
+    if (pEvent == nullptr)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    std::lock_guard<std::mutex> lock(pEvent->lock);
+    pEvent->fSignaled = false;
+    return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE h, DWORD dwMilliseconds)
+{
+    SHIM_EVENT *pEvent = _LookupHandle<SHIM_EVENT>(h);
+    if (pEvent == nullptr)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return WAIT_FAILED;
+    }
+
+    std::unique_lock<std::mutex> lock(pEvent->lock);
+    auto signaled = [pEvent] { return pEvent->fSignaled; };
+    if (dwMilliseconds == INFINITE)
+    {
+        pEvent->cvSignaled.wait(lock, signaled);
+    }
+    else if (!pEvent->cvSignaled.wait_for(lock, std::chrono::milliseconds(dwMilliseconds), signaled))
+    {
+        return WAIT_TIMEOUT;
+    }
+    if (!pEvent->fManualReset)
+    {
+        pEvent->fSignaled = false;
+    }
+    return WAIT_OBJECT_0;
+}
+
+//
+// Thread pools
+//
+
+struct TP_POOL
+{
+    std::mutex                                                  lock;
+    std::condition_variable                                     cvWork;
+    std::deque<std::pair<PTP_SIMPLE_CALLBACK, PVOID>>           work;
+    std::vector<std::thread>                                    threads;    // Joined by CloseThreadpool
+    DWORD                                                       cThreads = 0;
+    DWORD                                                       cMaxThreads = 500;
+    DWORD                                                       cIdle = 0;
+    bool                                                        fClosing = false;
+};
+
+static void _ThreadpoolWorker(PTP_POOL pPool)
+{
+    std::unique_lock<std::mutex> lock(pPool->lock);
+    for (;;)
+    {
+        pPool->cIdle++;
+        pPool->cvWork.wait(lock, [pPool] { return pPool->fClosing || !pPool->work.empty(); });
+        pPool->cIdle--;
+        if (pPool->work.empty())
+        {
+            break;
+        }
+
+        std::pair<PTP_SIMPLE_CALLBACK, PVOID> item = pPool->work.front();
+        pPool->work.pop_front();
+        lock.unlock();
+        item.first(nullptr, item.second);
+        lock.lock();
+    }
+}
+
+// The pool TrySubmitThreadpoolCallback uses without an environment. It lives as
+// long as the process.
+static PTP_POOL _DefaultThreadpool()
+{
+    static PTP_POOL s_pPool = new TP_POOL();
+    return s_pPool;
+}
+
+PTP_POOL CreateThreadpool(PVOID reserved)
+{
+    return new TP_POOL();
+}
+
+void SetThreadpoolThreadMaximum(PTP_POOL pPool, DWORD cthrdMost)
+{
+    std::lock_guard<std::mutex> lock(pPool->lock);
+    pPool->cMaxThreads = (std::max)(cthrdMost, 1u);
+}
+
+BOOL SetThreadpoolThreadMinimum(PTP_POOL pPool, DWORD cthrdMic)
+{
+    return TRUE;
+}
+
+void CloseThreadpool(PTP_POOL pPool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pPool->lock);
+        pPool->fClosing = true;
+    }
+    pPool->cvWork.notify_all();
+    for (std::thread &thread : pPool->threads)
+    {
+        thread.join();
+    }
+    delete pPool;
+}
+
+void InitializeThreadpoolEnvironment(PTP_CALLBACK_ENVIRON pcbe)
+{
+    pcbe->Pool = nullptr;
+}
+
+void SetThreadpoolCallbackPool(PTP_CALLBACK_ENVIRON pcbe, PTP_POOL pPool)
+{
+    pcbe->Pool = pPool;
+}
+
+void DestroyThreadpoolEnvironment(PTP_CALLBACK_ENVIRON pcbe)
+{
+}
+
+BOOL TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv, PTP_CALLBACK_ENVIRON pcbe)
+{
+    PTP_POOL pPool = (pcbe != nullptr && pcbe->Pool != nullptr) ? pcbe->Pool : _DefaultThreadpool();
+    std::lock_guard<std::mutex> lock(pPool->lock);
+    pPool->work.emplace_back(pfns, pv);
+    if (pPool->cIdle < pPool->work.size() && pPool->cThreads < pPool->cMaxThreads)
+    {
+        pPool->cThreads++;
+        std::thread thread(_ThreadpoolWorker, pPool);
+        if (pPool == _DefaultThreadpool())
+        {
+            thread.detach();
+        }
+        else
+        {
+            pPool->threads.push_back(std::move(thread));
+        }
+    }
+    pPool->cvWork.notify_one();
+    return TRUE;
+}
+
+//
+// Files and file mappings. Sharing modes are not enforced.
+//
+
+struct SHIM_FILE : SHIM_HANDLE_OBJECT
+{
+    int fd = -1;
+
+    ~SHIM_FILE()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+};
+
+struct SHIM_FILE_MAPPING : SHIM_HANDLE_OBJECT
+{
+    int     fd = -1;    // Duplicated, so the mapping outlives the file handle
+    size_t  cb = 0;
+    bool    fWritable = false;
+
+    ~SHIM_FILE_MAPPING()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+};
+
+static std::mutex s_lockViews;
+static std::map<LPCVOID, size_t> s_views;
+
+static DWORD _Win32ErrorFromErrno(int error)
+{
+    switch (error)
+    {
+    case ENOENT:
+        return ERROR_FILE_NOT_FOUND;
+    case EEXIST:
+        return ERROR_ALREADY_EXISTS;
+    case EACCES:
+    case EPERM:
+        return ERROR_ACCESS_DENIED;
+    case ENOMEM:
+        return ERROR_NOT_ENOUGH_MEMORY;
+    default:
+        return ERROR_INVALID_PARAMETER;
+    }
+}
+
+BOOL CreateDirectoryW(PCWSTR pszPath, SECURITY_ATTRIBUTES *pSecurityAttributes)
+{
+    if (mkdir(ShimNarrowPath(pszPath).c_str(), 0700) != 0)
+    {
+        SetLastError(_Win32ErrorFromErrno(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+HANDLE CreateFileW(PCWSTR pszPath, DWORD dwDesiredAccess, DWORD dwShareMode, SECURITY_ATTRIBUTES *pSecurityAttributes,
+                   DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile)
+{
+    int flags = ((dwDesiredAccess & GENERIC_READ) && (dwDesiredAccess & GENERIC_WRITE)) ? O_RDWR :
+                (dwDesiredAccess & GENERIC_WRITE) ? O_WRONLY : O_RDONLY;
+    switch (dwCreationDisposition)
+    {
+    case CREATE_NEW:
+        flags |= O_CREAT | O_EXCL;
+        break;
+    case CREATE_ALWAYS:
+        flags |= O_CREAT | O_TRUNC;
+        break;
+    case OPEN_ALWAYS:
+        flags |= O_CREAT;
+        break;
+    case TRUNCATE_EXISTING:
+        flags |= O_TRUNC;
+        break;
+    }
+
+    int fd = open(ShimNarrowPath(pszPath).c_str(), flags | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        SetLastError(_Win32ErrorFromErrno(errno));
+        return INVALID_HANDLE_VALUE;
+    }
+    SHIM_FILE *pFile = new SHIM_FILE();
+    pFile->fd = fd;
+    return _RegisterHandle(pFile);
+}
+
+BOOL GetFileSizeEx(HANDLE hFile, LARGE_INTEGER *pliFileSize)
+{
+    SHIM_FILE *pFile = _LookupHandle<SHIM_FILE>(hFile);
+    struct stat st;
+    if (pFile == nullptr || fstat(pFile->fd, &st) != 0)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    pliFileSize->QuadPart = st.st_size;
+    return TRUE;
+}
+
+BOOL ReadFile(HANDLE hFile, LPVOID pvBuffer, DWORD cbToRead, LPDWORD pcbRead, void *pOverlapped)
+{
+    SHIM_FILE *pFile = _LookupHandle<SHIM_FILE>(hFile);
+    ssize_t cb = (pFile != nullptr) ? read(pFile->fd, pvBuffer, cbToRead) : -1;
+    if (cb < 0)
+    {
+        SetLastError((pFile != nullptr) ? _Win32ErrorFromErrno(errno) : ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    *pcbRead = static_cast<DWORD>(cb);
+    return TRUE;
+}
+
+BOOL WriteFile(HANDLE hFile, LPCVOID pvBuffer, DWORD cbToWrite, LPDWORD pcbWritten, void *pOverlapped)
+{
+    SHIM_FILE *pFile = _LookupHandle<SHIM_FILE>(hFile);
+    ssize_t cb = (pFile != nullptr) ? write(pFile->fd, pvBuffer, cbToWrite) : -1;
+    if (cb < 0)
+    {
+        SetLastError((pFile != nullptr) ? _Win32ErrorFromErrno(errno) : ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    *pcbWritten = static_cast<DWORD>(cb);
+    return TRUE;
+}
+
+BOOL DeleteFileW(PCWSTR pszPath)
+{
+    if (unlink(ShimNarrowPath(pszPath).c_str()) != 0)
+    {
+        SetLastError(_Win32ErrorFromErrno(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// A writable mapping larger than the file extends it with zeros, as on Windows.
+HANDLE CreateFileMappingW(HANDLE hFile, SECURITY_ATTRIBUTES *pAttributes, DWORD flProtect, DWORD dwMaximumSizeHigh,
+                          DWORD dwMaximumSizeLow, PCWSTR pszName)
+{
+    SHIM_FILE *pFile = _LookupHandle<SHIM_FILE>(hFile);
+    struct stat st;
+    if (pFile == nullptr || fstat(pFile->fd, &st) != 0)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return nullptr;
+    }
+
+    size_t cb = (static_cast<size_t>(dwMaximumSizeHigh) << 32) | dwMaximumSizeLow;
+    bool fWritable = (flProtect == PAGE_READWRITE);
+    if (cb == 0)
+    {
+        cb = static_cast<size_t>(st.st_size);
+    }
+    else if (cb > static_cast<size_t>(st.st_size))
+    {
+        if (!fWritable || ftruncate(pFile->fd, static_cast<off_t>(cb)) != 0)
+        {
+            SetLastError(ERROR_ACCESS_DENIED);
+            return nullptr;
+        }
+    }
+    if (cb == 0)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return nullptr;
+    }
+
+    SHIM_FILE_MAPPING *pMapping = new SHIM_FILE_MAPPING();
+    pMapping->fd = dup(pFile->fd);
+    pMapping->cb = cb;
+    pMapping->fWritable = fWritable;
+    return _RegisterHandle(pMapping);
+}
+
+LPVOID MapViewOfFile(HANDLE hMapping, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh, DWORD dwFileOffsetLow, SIZE_T cbToMap)
+{
+    SHIM_FILE_MAPPING *pMapping = _LookupHandle<SHIM_FILE_MAPPING>(hMapping);
+    if (pMapping == nullptr)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return nullptr;
+    }
+
+    off_t offset = static_cast<off_t>((static_cast<ULONGLONG>(dwFileOffsetHigh) << 32) | dwFileOffsetLow);
+    size_t cb = (cbToMap != 0) ? cbToMap : pMapping->cb - static_cast<size_t>(offset);
+    bool fWrite = (dwDesiredAccess & FILE_MAP_WRITE) != 0;
+    if (fWrite && !pMapping->fWritable)
+    {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return nullptr;
+    }
+
+    void *pv = mmap(nullptr, cb, PROT_READ | (fWrite ? PROT_WRITE : 0), MAP_SHARED, pMapping->fd, offset);
+    if (pv == MAP_FAILED)
+    {
+        SetLastError(_Win32ErrorFromErrno(errno));
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(s_lockViews);
+    s_views[pv] = cb;
+    return pv;
+}
+
+BOOL UnmapViewOfFile(LPCVOID pvBaseAddress)
+{
+    size_t cb = 0;
+    {
+        std::lock_guard<std::mutex> lock(s_lockViews);
+        auto it = s_views.find(pvBaseAddress);
+        if (it == s_views.end())
+        {
+            SetLastError(ERROR_INVALID_PARAMETER);
+            return FALSE;
+        }
+        cb = it->second;
+        s_views.erase(it);
+    }
+    munmap(const_cast<void*>(pvBaseAddress), cb);
+    return TRUE;
+}
+
+//
+// Memory
+//
+
+HANDLE GetProcessHeap()
+{
+    return reinterpret_cast<HANDLE>(1);
+}
+
+// Sizes of the heap blocks in use, so the free hook can be shown a whole block.
+static std::mutex s_lockHeap;
+static std::unordered_map<PVOID, SIZE_T> s_mapHeapBlocks;
+static PFN_SHIM_HEAP_FREE_HOOK s_pfnHeapFreeHook = nullptr;
+
+void ShimSetHeapFreeHook(PFN_SHIM_HEAP_FREE_HOOK pfnHook)
+{
+    std::lock_guard<std::mutex> lock(s_lockHeap);
+    s_pfnHeapFreeHook = pfnHook;
+}
+
+PVOID HeapAlloc(HANDLE hHeap, DWORD dwFlags, SIZE_T cb)
+{
+    PVOID pv = (dwFlags & HEAP_ZERO_MEMORY) ? calloc(1, cb ? cb : 1) : malloc(cb ? cb : 1);
+    if (pv != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(s_lockHeap);
+        s_mapHeapBlocks[pv] = cb;
+    }
+    return pv;
+}
+
+BOOL HeapFree(HANDLE hHeap, DWORD dwFlags, PVOID pv)
+{
+    if (pv != nullptr)
+    {
+        PFN_SHIM_HEAP_FREE_HOOK pfnHook = nullptr;
+        SIZE_T cb = 0;
+        {
+            std::lock_guard<std::mutex> lock(s_lockHeap);
+            auto it = s_mapHeapBlocks.find(pv);
+            if (it != s_mapHeapBlocks.end())
+            {
+                cb = it->second;
+                s_mapHeapBlocks.erase(it);
+            }
+            pfnHook = s_pfnHeapFreeHook;
+        }
+        if (pfnHook != nullptr)
+        {
+            pfnHook(pv, cb);
+        }
+    }
+    free(pv);
+    return TRUE;
+}
+
+static std::atomic<ULONGLONG> s_cCoTaskMemAllocations(0);
+static std::atomic<ULONGLONG> s_cCoTaskMemBlocks(0);
+static std::atomic<ULONGLONG> s_cbCoTaskMemInUse(0);
+
+void ShimGetCoTaskMemStats(_Out_ SHIM_COTASKMEM_STATS *pStats)
+{
+    pStats->cAllocations = s_cCoTaskMemAllocations;
+    pStats->cBlocksInUse = s_cCoTaskMemBlocks;
+    pStats->cbInUse = s_cbCoTaskMemInUse;
+}
+
+PVOID CoTaskMemAlloc(SIZE_T cb)
+{
+    PVOID pv = malloc(cb ? cb : 1);
+    if (pv != nullptr)
+    {
+        s_cCoTaskMemAllocations++;
+        s_cCoTaskMemBlocks++;
+        s_cbCoTaskMemInUse += malloc_usable_size(pv);
+    }
+    return pv;
+}
+
+PVOID CoTaskMemRealloc(PVOID pv, SIZE_T cb)
+{
+    if (pv == nullptr)
+    {
+        return CoTaskMemAlloc(cb);
+    }
+    size_t cbOld = malloc_usable_size(pv);
+    PVOID pvNew = realloc(pv, cb ? cb : 1);
+    if (pvNew != nullptr)
+    {
+        s_cCoTaskMemAllocations++;
+        s_cbCoTaskMemInUse += malloc_usable_size(pvNew);
+        s_cbCoTaskMemInUse -= cbOld;
+    }
+    return pvNew;
+}
+
+HLOCAL LocalAlloc(UINT uFlags, SIZE_T cb)
+{
+    return calloc(1, cb ? cb : 1);
+}
+
+HLOCAL LocalFree(HLOCAL hMem)
+{
+    free(hMem);
+    return nullptr;
+}
+
+void CoTaskMemFree(PVOID pv)
+{
+    if (pv != nullptr)
+    {
+        s_cCoTaskMemBlocks--;
+        s_cbCoTaskMemInUse -= malloc_usable_size(pv);
+    }
+    free(pv);
+}
+
+static std::mutex s_lockRegions;
+static std::map<LPVOID, size_t> s_regions;
+
+static int _PosixProtection(DWORD flProtect)
+{
+    switch (flProtect)
+    {
+    case PAGE_NOACCESS:
+        return PROT_NONE;
+    case PAGE_READONLY:
+        return PROT_READ;
+    default:
+        return PROT_READ | PROT_WRITE;
+    }
+}
+
+void GetSystemInfo(SYSTEM_INFO *psi)
+{
+    psi->dwPageSize = static_cast<DWORD>(sysconf(_SC_PAGESIZE));
+    psi->dwNumberOfProcessors = static_cast<DWORD>(sysconf(_SC_NPROCESSORS_ONLN));
+    psi->dwAllocationGranularity = 64 * 1024;
+}
+
+LPVOID VirtualAlloc(LPVOID pvAddress, SIZE_T cb, DWORD flAllocationType, DWORD flProtect)
+{
+    if (pvAddress != nullptr || cb == 0)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return nullptr;
+    }
+    void *pv = mmap(nullptr, cb, _PosixProtection(flProtect), MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pv == MAP_FAILED)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(s_lockRegions);
+    s_regions[pv] = cb;
+    return pv;
+}
+
+BOOL VirtualFree(LPVOID pvAddress, SIZE_T cb, DWORD dwFreeType)
+{
+    size_t cbRegion = 0;
+    {
+        std::lock_guard<std::mutex> lock(s_lockRegions);
+        auto it = s_regions.find(pvAddress);
+        if (dwFreeType != MEM_RELEASE || cb != 0 || it == s_regions.end())
+        {
+            SetLastError(ERROR_INVALID_PARAMETER);
+            return FALSE;
+        }
+        cbRegion = it->second;
+        s_regions.erase(it);
+    }
+    munmap(pvAddress, cbRegion);
+    return TRUE;
+}
+
+BOOL VirtualProtect(LPVOID pvAddress, SIZE_T cb, DWORD flNewProtect, PDWORD pflOldProtect)
+{
+    *pflOldProtect = PAGE_READWRITE;
+    if (mprotect(pvAddress, cb, _PosixProtection(flNewProtect)) != 0)
+    {
+        SetLastError(_Win32ErrorFromErrno(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL VirtualLock(LPVOID pvAddress, SIZE_T cb)
+{
+    if (mlock(pvAddress, cb) != 0)
+    {
+        SetLastError(_Win32ErrorFromErrno(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL VirtualUnlock(LPVOID pvAddress, SIZE_T cb)
+{
+    return munlock(pvAddress, cb) == 0;
+}
+
+void __fastfail(unsigned int uCode)
+{
+    fprintf(stderr, "__fastfail(%u)\n", uCode);
+    fflush(stderr);
+    abort();
+}
+
+//
+// Registry. Values are kept by the upper-cased full path of the key and the value
+// name; keys exist implicitly once a value has been written under them.
+//
+
+struct SHIM_REGISTRY_VALUE
+{
+    DWORD dwType;
+    std::vector<BYTE> data;
+};
+
+static std::mutex s_lockRegistry;
+static std::map<std::wstring, SHIM_REGISTRY_VALUE> s_registry;
+
+static std::wstring _RegistryPath(HKEY hKey, PCWSTR pszSubKey)
+{
+    std::wstring strPath;
+    if (hKey == HKEY_LOCAL_MACHINE)
+    {
+        strPath = L"HKLM";
+    }
+    else if (hKey == HKEY_CURRENT_USER)
+    {
+        strPath = L"HKCU";
+    }
+    else
+    {
+        strPath = *reinterpret_cast<const std::wstring*>(hKey);
+    }
+    if (pszSubKey != nullptr && pszSubKey[0] != L'\0')
+    {
+        strPath += L'\\';
+        strPath += pszSubKey;
+    }
+    for (wchar_t &ch : strPath)
+    {
+        ch = towupper(ch);
+    }
+    return strPath;
+}
+
+static std::wstring _RegistryValuePath(const std::wstring &strKey, PCWSTR pszValue)
+{
+    std::wstring strValue = strKey + L'|';
+    if (pszValue != nullptr)
+    {
+        for (const wchar_t *pch = pszValue; *pch != L'\0'; pch++)
+        {
+            strValue += static_cast<wchar_t>(towupper(*pch));
+        }
+    }
+    return strValue;
+}
+
+static DWORD _RegistryTypeFlag(DWORD dwType)
+{
+    switch (dwType)
+    {
+    case REG_SZ: return RRF_RT_REG_SZ;
+    case REG_BINARY: return RRF_RT_REG_BINARY;
+    case REG_DWORD: return RRF_RT_REG_DWORD;
+    case REG_QWORD: return RRF_RT_REG_QWORD;
+    default: return 0;
+    }
+}
+
+LSTATUS RegGetValueW(HKEY hKey, PCWSTR pszSubKey, PCWSTR pszValue, DWORD dwFlags, PDWORD pdwType, PVOID pvData, PDWORD pcbData)
+{
+    std::lock_guard<std::mutex> lock(s_lockRegistry);
+    auto it = s_registry.find(_RegistryValuePath(_RegistryPath(hKey, pszSubKey), pszValue));
+    if (it == s_registry.end())
+    {
+        return ERROR_FILE_NOT_FOUND;
+    }
+    if ((_RegistryTypeFlag(it->second.dwType) & dwFlags) == 0)
+    {
+        return ERROR_NOT_SUPPORTED;
+    }
+    if (pdwType != nullptr)
+    {
+        *pdwType = it->second.dwType;
+    }
+
+    DWORD cbValue = static_cast<DWORD>(it->second.data.size());
+    LSTATUS ls = ERROR_SUCCESS;
+    if (pvData != nullptr)
+    {
+        if (pcbData == nullptr || *pcbData < cbValue)
+        {
+            ls = ERROR_MORE_DATA;
+        }
+        else
+        {
+            memcpy(pvData, it->second.data.data(), cbValue);
+        }
+    }
+    if (pcbData != nullptr)
+    {
+        *pcbData = cbValue;
+    }
+    return ls;
+}
+
+LSTATUS RegCreateKeyExW(HKEY hKey, PCWSTR pszSubKey, DWORD dwReserved, PWSTR pszClass, DWORD dwOptions, REGSAM samDesired,
+                        void *pSecurityAttributes, PHKEY phkResult, PDWORD pdwDisposition)
+{
+    *phkResult = reinterpret_cast<HKEY>(new std::wstring(_RegistryPath(hKey, pszSubKey)));
+    return ERROR_SUCCESS;
+}
+
+LSTATUS RegSetValueExW(HKEY hKey, PCWSTR pszValue, DWORD dwReserved, DWORD dwType, const BYTE *pbData, DWORD cbData)
+{
+    std::lock_guard<std::mutex> lock(s_lockRegistry);
+    SHIM_REGISTRY_VALUE &value = s_registry[_RegistryValuePath(_RegistryPath(hKey, nullptr), pszValue)];
+    value.dwType = dwType;
+    value.data.assign(pbData, pbData + cbData);
+    return ERROR_SUCCESS;
+}
+
+LSTATUS RegCloseKey(HKEY hKey)
+{
+    if (hKey != HKEY_LOCAL_MACHINE && hKey != HKEY_CURRENT_USER)
+    {
+        delete reinterpret_cast<std::wstring*>(hKey);
+    }
+    return ERROR_SUCCESS;
+}
+
+void ShimResetRegistry()
+{
+    std::lock_guard<std::mutex> lock(s_lockRegistry);
+    s_registry.clear();
+}
+
+//
+// Safe string functions
+//
+
+HRESULT StringCchCopyNW(PWSTR pszDest, size_t cchDest, PCWSTR pszSrc, size_t cchToCopy)
+{
+    if (cchDest == 0)
+    {
+        return E_INVALIDARG;
+    }
+    size_t cch = 0;
+    while (cch < cchToCopy && pszSrc[cch] != L'\0' && cch + 1 < cchDest)
+    {
+        pszDest[cch] = pszSrc[cch];
+        cch++;
+    }
+    pszDest[cch] = L'\0';
+    return (cch < cchToCopy && pszSrc[cch] != L'\0') ? STRSAFE_E_INSUFFICIENT_BUFFER : S_OK;
+}
+
+HRESULT StringCchCopyW(PWSTR pszDest, size_t cchDest, PCWSTR pszSrc)
+{
+    return StringCchCopyNW(pszDest, cchDest, pszSrc, STRSAFE_MAX_CCH);
+}
+
+HRESULT StringCchCatW(PWSTR pszDest, size_t cchDest, PCWSTR pszSrc)
+{
+    size_t cchCurrent = wcsnlen(pszDest, cchDest);
+    if (cchCurrent == cchDest)
+    {
+        return E_INVALIDARG;
+    }
+    return StringCchCopyW(pszDest + cchCurrent, cchDest - cchCurrent, pszSrc);
+}
+
+HRESULT StringCchLengthW(PCWSTR psz, size_t cchMax, size_t *pcch)
+{
+    size_t cch = wcsnlen(psz, cchMax);
+    if (pcch != nullptr)
+    {
+        *pcch = cch;
+    }
+    return (cch < cchMax) ? S_OK : E_INVALIDARG;
+}
+
+// Rewrites an MSVC wide format string for glibc: %s and %c take wide arguments
+// unless they have an h size prefix, and I64 is spelled ll.
+static std::wstring _TranslateFormat(PCWSTR pszFormat)
+{
+    std::wstring strFormat;
+    for (PCWSTR pch = pszFormat; *pch != L'\0'; pch++)
+    {
+        strFormat += *pch;
+        if (*pch != L'%')
+        {
+            continue;
+        }
+        pch++;
+        if (*pch == L'%')
+        {
+            strFormat += *pch;
+            continue;
+        }
+        while (*pch != L'\0' && wcschr(L"-+ #0123456789.*", *pch) != nullptr)
+        {
+            strFormat += *pch++;
+        }
+        bool fNarrow = false;
+        bool fWide = false;
+        if (wcsncmp(pch, L"I64", 3) == 0)
+        {
+            strFormat += L"ll";
+            pch += 3;
+        }
+        else if (wcsncmp(pch, L"I32", 3) == 0)
+        {
+            pch += 3;
+        }
+        else if (*pch == L'h' && (pch[1] == L's' || pch[1] == L'c'))
+        {
+            fNarrow = true;
+            pch++;
+        }
+        else if (*pch == L'l' && (pch[1] == L's' || pch[1] == L'c'))
+        {
+            fWide = true;
+            pch++;
+        }
+        while (*pch != L'\0' && wcschr(L"hlLzjt", *pch) != nullptr)
+        {
+            strFormat += *pch++;
+        }
+        if (*pch == L'\0')
+        {
+            break;
+        }
+        if (*pch == L's' || *pch == L'c')
+        {
+            if (!fNarrow || fWide)
+            {
+                strFormat += L'l';
+            }
+        }
+        else if (*pch == L'S' || *pch == L'C')
+        {
+            strFormat += static_cast<wchar_t>(towlower(*pch));
+            continue;
+        }
+        strFormat += *pch;
+    }
+    return strFormat;
+}
+
+HRESULT StringCchVPrintfW(PWSTR pszDest, size_t cchDest, PCWSTR pszFormat, va_list args)
+{
+    if (cchDest == 0)
+    {
+        return E_INVALIDARG;
+    }
+    std::wstring strFormat = _TranslateFormat(pszFormat);
+    std::vector<wchar_t> buffer(cchDest + 64);
+    for (;;)
+    {
+        va_list argsCopy;
+        va_copy(argsCopy, args);
+        int cch = vswprintf(buffer.data(), buffer.size(), strFormat.c_str(), argsCopy);
+        va_end(argsCopy);
+        if (cch >= 0)
+        {
+            return StringCchCopyNW(pszDest, cchDest, buffer.data(), static_cast<size_t>(cch));
+        }
+        if (buffer.size() > (1u << 20))
+        {
+            pszDest[0] = L'\0';
+            return E_INVALIDARG;
+        }
+        buffer.resize(buffer.size() * 2);
+    }
+}
+
+HRESULT StringCchPrintfW(PWSTR pszDest, size_t cchDest, PCWSTR pszFormat, ...)
+{
+    va_list args;
+    va_start(args, pszFormat);
+    HRESULT hr = StringCchVPrintfW(pszDest, cchDest, pszFormat, args);
+    va_end(args);
+    return hr;
+}
+
+//
+// Known folders and security descriptors
+//
+
+static std::mutex s_lockProgramData;
+static std::wstring s_strProgramData = L"/tmp";
+
+void ShimSetProgramDataPath(PCWSTR pszPath)
+{
+    std::lock_guard<std::mutex> lock(s_lockProgramData);
+    s_strProgramData = pszPath;
+}
+
+HRESULT SHGetKnownFolderPath(REFKNOWNFOLDERID rfid, DWORD dwFlags, HANDLE hToken, PWSTR *ppszPath)
+{
+    *ppszPath = nullptr;
+    if (!(rfid == FOLDERID_ProgramData))
+    {
+        return E_INVALIDARG;
+    }
+
+    std::lock_guard<std::mutex> lock(s_lockProgramData);
+    size_t cb = (s_strProgramData.size() + 1) * sizeof(WCHAR);
+    *ppszPath = static_cast<PWSTR>(CoTaskMemAlloc(cb));
+    if (*ppszPath == nullptr)
+    {
+        return E_OUTOFMEMORY;
+    }
+    memcpy(*ppszPath, s_strProgramData.c_str(), cb);
+    return S_OK;
+}
+
+// Security descriptors are not enforced; the string is only checked for a DACL.
+BOOL ConvertStringSecurityDescriptorToSecurityDescriptorW(PCWSTR pszSecurityDescriptor, DWORD dwRevision,
+                                                          PSECURITY_DESCRIPTOR *ppSecurityDescriptor, PULONG pcbSecurityDescriptor)
+{
+    if (dwRevision != SDDL_REVISION_1 || wcsncmp(pszSecurityDescriptor, L"D:", 2) != 0)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    *ppSecurityDescriptor = LocalAlloc(0, 20);
+    if (pcbSecurityDescriptor != nullptr)
+    {
+        *pcbSecurityDescriptor = 20;
+    }
+    return TRUE;
+}
+
+std::string ShimNarrowPath(PCWSTR pszPath)
+{
+    std::string strPath;
+    for (PCWSTR pch = pszPath; *pch != L'\0'; pch++)
+    {
+        char szUtf8[8];
+        mbstate_t state = {};
+        size_t cb = wcrtomb(szUtf8, (*pch == L'\\') ? L'/' : *pch, &state);
+        if (cb != static_cast<size_t>(-1))
+        {
+            strPath.append(szUtf8, cb);
+        }
+    }
+    return strPath;
+}
+
+//
+// DPAPI and random numbers
+//
+
+static const BYTE c_rgbSealMarker[] = { 'D', 'P', 'A', 'P' };
+
+BOOL CryptProtectData(DATA_BLOB *pDataIn, PCWSTR pszDataDescr, DATA_BLOB *pOptionalEntropy, PVOID pvReserved,
+                      PVOID pPromptStruct, DWORD dwFlags, DATA_BLOB *pDataOut)
+{
+    pDataOut->cbData = sizeof(c_rgbSealMarker) + pDataIn->cbData;
+    pDataOut->pbData = static_cast<BYTE*>(LocalAlloc(0, pDataOut->cbData));
+    memcpy(pDataOut->pbData, c_rgbSealMarker, sizeof(c_rgbSealMarker));
+    memcpy(pDataOut->pbData + sizeof(c_rgbSealMarker), pDataIn->pbData, pDataIn->cbData);
+    return TRUE;
+}
+
+BOOL CryptUnprotectData(DATA_BLOB *pDataIn, PWSTR *ppszDataDescr, DATA_BLOB *pOptionalEntropy, PVOID pvReserved,
+                        PVOID pPromptStruct, DWORD dwFlags, DATA_BLOB *pDataOut)
+{
+    if (pDataIn->cbData < sizeof(c_rgbSealMarker) || memcmp(pDataIn->pbData, c_rgbSealMarker, sizeof(c_rgbSealMarker)) != 0)
+    {
+        SetLastError(ERROR_INVALID_DATA);
+        return FALSE;
+    }
+    pDataOut->cbData = pDataIn->cbData - sizeof(c_rgbSealMarker);
+    pDataOut->pbData = static_cast<BYTE*>(LocalAlloc(0, pDataOut->cbData + 1));
+    memcpy(pDataOut->pbData, pDataIn->pbData + sizeof(c_rgbSealMarker), pDataOut->cbData);
+    return TRUE;
+}
+
+NTSTATUS BCryptGenRandom(PVOID hAlgorithm, PUCHAR pbBuffer, ULONG cbBuffer, ULONG dwFlags)
+{
+    while (cbBuffer > 0)
+    {
+        ssize_t cb = getrandom(pbBuffer, cbBuffer, 0);
+        if (cb < 0)
+        {
+            return static_cast<NTSTATUS>(0xC0000001);  // STATUS_UNSUCCESSFUL
+        }
+        pbBuffer += cb;
+        cbBuffer -= static_cast<ULONG>(cb);
+    }
+    return 0;
+}
+
+//
+// Bluetooth: there are no radios.
+//
+
+HBLUETOOTH_RADIO_FIND BluetoothFindFirstRadio(const BLUETOOTH_FIND_RADIO_PARAMS *pbtfrp, HANDLE *phRadio)
+{
+    SetLastError(ERROR_NOT_FOUND);
+    return nullptr;
+}
+
+BOOL BluetoothFindNextRadio(HBLUETOOTH_RADIO_FIND hFind, HANDLE *phRadio)
+{
+    return FALSE;
+}
+
+BOOL BluetoothFindRadioClose(HBLUETOOTH_RADIO_FIND hFind)
+{
+    return TRUE;
+}
+
+DWORD BluetoothGetRadioInfo(HANDLE hRadio, BLUETOOTH_RADIO_INFO *pRadioInfo)
+{
+    return ERROR_INVALID_HANDLE;
+}
+
+HBLUETOOTH_DEVICE_FIND BluetoothFindFirstDevice(const BLUETOOTH_DEVICE_SEARCH_PARAMS *pbtsp, BLUETOOTH_DEVICE_INFO *pbtdi)
+{
+    SetLastError(ERROR_INVALID_HANDLE);
+    return nullptr;
+}
+
+BOOL BluetoothFindNextDevice(HBLUETOOTH_DEVICE_FIND hFind, BLUETOOTH_DEVICE_INFO *pbtdi)
+{
+    return FALSE;
+}
+
+BOOL BluetoothFindDeviceClose(HBLUETOOTH_DEVICE_FIND hFind)
+{
+    return TRUE;
+}
+
+//
+// Sockets: each one is a queue of the blocks a test expects to arrive.
+//
+
+static std::mutex s_lockSockets;
+static std::map<SOCKET, std::deque<std::string>> s_mapSocketReceives;
+
+int recv(SOCKET s, char *buf, int len, int flags)
+{
+    std::lock_guard<std::mutex> lock(s_lockSockets);
+    std::deque<std::string> &blocks = s_mapSocketReceives[s];
+    if (blocks.empty())
+    {
+        return 0;
+    }
+    int cb = (std::min)(len, static_cast<int>(blocks.front().size()));
+    memcpy(buf, blocks.front().data(), cb);
+    blocks.front().erase(0, cb);
+    if (blocks.front().empty())
+    {
+        blocks.pop_front();
+    }
+    return cb;
+}
+
+int setsockopt(SOCKET s, int level, int optname, const char *optval, int optlen)
+{
+    return 0;
+}
+
+int WSAGetLastError()
+{
+    return WSAETIMEDOUT;
+}
+
+void ShimQueueReceive(SOCKET s, const std::string &strBlock)
+{
+    if (!strBlock.empty())
+    {
+        std::lock_guard<std::mutex> lock(s_lockSockets);
+        s_mapSocketReceives[s].push_back(strBlock);
+    }
+}
+
+size_t ShimClearReceives(SOCKET s)
+{
+    std::lock_guard<std::mutex> lock(s_lockSockets);
+    size_t cb = 0;
+    for (const std::string &strBlock : s_mapSocketReceives[s])
+    {
+        cb += strBlock.size();
+    }
+    s_mapSocketReceives.erase(s);
+    return cb;
+}
+
+//
+// The DLL reference count, which Dll.cpp keeps in the provider
+//
+
+static volatile LONG s_cDllRefs = 0;
+
+void DllAddRef()
+{
+    InterlockedIncrement(&s_cDllRefs);
+}
+
+void DllRelease()
+{
+    InterlockedDecrement(&s_cDllRefs);
+}
+
+LONG ShimDllRefCount()
+{
+    return ReadAcquire(&s_cDllRefs);
+}
+
+//
+// COM
+//
+
+static volatile LONG s_cMarshalStreams = 0;
+
+// Holds the marshaled interface until it is unmarshaled.
+class CShimMarshalStream final : public IStream
+{
+public:
+    explicit CShimMarshalStream(IUnknown *pUnk) :
+        _cRef(1),
+        _pUnk(pUnk)
+    {
+        InterlockedIncrement(&s_cMarshalStreams);
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppv)
+    {
+        if (riid == __uuidof(IUnknown) || riid == __uuidof(IStream))
+        {
+            *ppv = static_cast<IStream*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef()
+    {
+        return InterlockedIncrement(&_cRef);
+    }
+
+    ULONG STDMETHODCALLTYPE Release()
+    {
+        LONG cRef = InterlockedDecrement(&_cRef);
+        if (cRef == 0)
+        {
+            _pUnk->Release();
+            InterlockedDecrement(&s_cMarshalStreams);
+            delete this;
+        }
+        return cRef;
+    }
+
+    IUnknown *Interface() const
+    {
+        return _pUnk;
+    }
+
+private:
+    volatile LONG   _cRef;
+    IUnknown        *_pUnk;
+};
+
+HRESULT CoInitializeEx(LPVOID pvReserved, DWORD dwCoInit)
+{
+    return S_OK;
+}
+
+void CoUninitialize()
+{
+}
+
+HRESULT CoMarshalInterThreadInterfaceInStream(REFIID riid, LPUNKNOWN pUnk, LPSTREAM *ppStm)
+{
+    *ppStm = nullptr;
+    IUnknown *pInterface = nullptr;
+    HRESULT hr = pUnk->QueryInterface(riid, reinterpret_cast<void**>(&pInterface));
+    if (SUCCEEDED(hr))
+    {
+        *ppStm = new CShimMarshalStream(pInterface);
+    }
+    return hr;
+}
+
+HRESULT CoGetInterfaceAndReleaseStream(LPSTREAM pStm, REFIID iid, LPVOID *ppv)
+{
+    HRESULT hr = static_cast<CShimMarshalStream*>(pStm)->Interface()->QueryInterface(iid, ppv);
+    pStm->Release();
+    return hr;
+}
+
+HRESULT CoWaitForMultipleHandles(DWORD dwFlags, DWORD dwTimeout, ULONG cHandles, HANDLE *pHandles, LPDWORD lpdwindex)
+{
+    // Polls when there is more than one handle; the callers here wait on one.
+    ULONGLONG ullDeadline = GetTickCount64() + dwTimeout;
+    for (;;)
+    {
+        for (ULONG i = 0; i < cHandles; i++)
+        {
+            if (WaitForSingleObject(pHandles[i], (cHandles == 1) ? dwTimeout : 0) == WAIT_OBJECT_0)
+            {
+                *lpdwindex = i;
+                return S_OK;
+            }
+        }
+        if (cHandles == 1 || (dwTimeout != INFINITE && GetTickCount64() >= ullDeadline))
+        {
+            return RPC_S_CALLPENDING;
+        }
+        Sleep(1);
+    }
+}
+
+LONG ShimOutstandingMarshalStreams()
+{
+    return ReadAcquire(&s_cMarshalStreams);
+}
@@ -0,0 +1,440 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// The part of the Win32 API the portable pieces of the provider use, implemented
+// on POSIX so that they can be tested and benchmarked on Linux. Only what the
+// tested translation units call is here; wchar_t stays 32 bits, so the units that
+// assume a 16-bit WCHAR are not built against it.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <wchar.h>
+#include <string>
+
+// SAL annotations
+#define _In_
+#define _In_opt_
+#define _In_z_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _Outptr_
+#define _Outptr_opt_
+#define _COM_Outptr_
+#define _Outptr_result_maybenull_
+#define _Outptr_result_nullonfailure_
+#define _Outptr_result_buffer_(x)
+#define _Outptr_result_bytebuffer_(x)
+#define _In_reads_(x)
+#define _In_reads_opt_(x)
+#define _In_reads_bytes_(x)
+#define _Out_writes_(x)
+#define _Out_writes_opt_(x)
+#define _Out_writes_bytes_(x)
+#define _Out_writes_bytes_to_(x, y)
+#define _Inout_updates_(x)
+#define _Inout_updates_bytes_(x)
+#define _Deref_out_range_(a, b)
+#define _Ret_maybenull_
+#define _Success_(x)
+#define _Field_size_(x)
+#define _Field_size_bytes_(x)
+#define _Printf_format_string_
+#define WINAPI
+#define CALLBACK
+#define STDMETHODCALLTYPE
+#define __stdcall
+#define __cdecl
+
+typedef int32_t             BOOL;
+typedef uint8_t             BYTE;
+typedef uint8_t             UCHAR, *PUCHAR;
+typedef uint16_t            WORD;
+typedef uint16_t            USHORT;
+typedef uint32_t            DWORD;
+typedef uint32_t            UINT;
+typedef uint32_t            ULONG;
+typedef int32_t             LONG;
+typedef long long           LONGLONG;
+typedef unsigned long long  ULONGLONG;
+typedef LONGLONG            LONG64;
+typedef ULONGLONG           DWORD64;
+typedef size_t              SIZE_T;
+typedef uintptr_t           ULONG_PTR;
+typedef uintptr_t           UINT_PTR;
+typedef intptr_t            LONG_PTR;
+typedef int32_t             HRESULT;
+typedef LONG                LSTATUS;
+typedef LONG                NTSTATUS;
+typedef wchar_t             WCHAR;
+typedef WCHAR               *PWSTR, *LPWSTR;
+typedef const WCHAR         *PCWSTR, *LPCWSTR;
+typedef char                CHAR;
+typedef const char          *PCSTR, *LPCSTR;
+typedef void                *PVOID, *LPVOID, *HANDLE;
+typedef const void          *LPCVOID;
+typedef BYTE                *PBYTE;
+typedef DWORD               *PDWORD, *LPDWORD;
+typedef ULONG               *PULONG;
+typedef LONG                *PLONG;
+typedef struct HINSTANCE__  *HINSTANCE, *HMODULE;
+typedef struct HKEY__       *HKEY;
+typedef HKEY                *PHKEY;
+typedef struct HBITMAP__    *HBITMAP;
+typedef DWORD               REGSAM;
+
+#define TRUE                1
+#define FALSE               0
+#define MAX_PATH            260
+#define INFINITE            0xFFFFFFFF
+#define INVALID_HANDLE_VALUE (reinterpret_cast<HANDLE>(static_cast<intptr_t>(-1)))
+
+#define ARRAYSIZE(a)        (sizeof(a) / sizeof((a)[0]))
+#define ZeroMemory(p, cb)   memset((p), 0, (cb))
+#define CopyMemory(d, s, cb) memcpy((d), (s), (cb))
+#define MoveMemory(d, s, cb) memmove((d), (s), (cb))
+#define FillMemory(p, cb, b) memset((p), (b), (cb))
+
+inline void *SecureZeroMemory(void *pv, size_t cb)
+{
+    volatile BYTE *pb = static_cast<volatile BYTE*>(pv);
+    while (cb--)
+    {
+        *pb++ = 0;
+    }
+    return pv;
+}
+
+// HRESULTs and Win32 error codes
+#define SUCCEEDED(hr)       (static_cast<HRESULT>(hr) >= 0)
+#define FAILED(hr)          (static_cast<HRESULT>(hr) < 0)
+#define S_OK                (static_cast<HRESULT>(0))
+#define S_FALSE             (static_cast<HRESULT>(1))
+#define E_FAIL              (static_cast<HRESULT>(0x80004005))
+#define E_UNEXPECTED        (static_cast<HRESULT>(0x8000FFFF))
+#define E_NOTIMPL           (static_cast<HRESULT>(0x80004001))
+#define E_NOINTERFACE       (static_cast<HRESULT>(0x80004002))
+#define E_POINTER           (static_cast<HRESULT>(0x80004003))
+#define E_OUTOFMEMORY       (static_cast<HRESULT>(0x8007000E))
+#define E_INVALIDARG        (static_cast<HRESULT>(0x80070057))
+#define E_ACCESSDENIED      (static_cast<HRESULT>(0x80070005))
+#define E_CHANGED_STATE     (static_cast<HRESULT>(0x8000000C))
+#define E_PENDING           (static_cast<HRESULT>(0x8000000A))
+#define E_NOT_SUFFICIENT_BUFFER (static_cast<HRESULT>(0x8007007A))
+#define STRSAFE_E_INSUFFICIENT_BUFFER (static_cast<HRESULT>(0x8007007A))
+
+#define ERROR_SUCCESS               0L
+#define ERROR_FILE_NOT_FOUND        2L
+#define ERROR_ACCESS_DENIED         5L
+#define ERROR_INVALID_HANDLE        6L
+#define ERROR_NOT_ENOUGH_MEMORY     8L
+#define ERROR_INVALID_DATA          13L
+#define ERROR_OUTOFMEMORY           14L
+#define ERROR_HANDLE_EOF            38L
+#define ERROR_NOT_SUPPORTED         50L
+#define ERROR_INVALID_PARAMETER     87L
+#define ERROR_INSUFFICIENT_BUFFER   122L
+#define ERROR_ALREADY_EXISTS        183L
+#define ERROR_MORE_DATA             234L
+#define ERROR_ARITHMETIC_OVERFLOW   534L
+#define ERROR_NOT_FOUND             1168L
+#define ERROR_NOT_AUTHENTICATED     1244L
+
+inline HRESULT HRESULT_FROM_WIN32(LONG x)
+{
+    return (x <= 0) ? static_cast<HRESULT>(x) : static_cast<HRESULT>((static_cast<ULONG>(x) & 0x0000FFFF) | 0x80070000);
+}
+
+#define HRESULT_FROM_NT(x)  (static_cast<HRESULT>(static_cast<ULONG>(x) | 0x10000000))
+
+DWORD GetLastError();
+void SetLastError(DWORD dwError);
+
+// Interlocked operations, sequentially consistent like their Win32 counterparts
+inline LONG InterlockedIncrement(volatile LONG *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedDecrement(volatile LONG *p) { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchange(volatile LONG *p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchangeAdd(volatile LONG *p, LONG v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedCompareExchange(volatile LONG *p, LONG v, LONG c)
+{
+    __atomic_compare_exchange_n(p, &c, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return c;
+}
+inline LONGLONG InterlockedIncrement64(volatile LONGLONG *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedDecrement64(volatile LONGLONG *p) { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchange64(volatile LONGLONG *p, LONGLONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG *p, LONGLONG v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG *p, LONGLONG v, LONGLONG c)
+{
+    __atomic_compare_exchange_n(p, &c, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return c;
+}
+inline PVOID InterlockedExchangePointer(PVOID volatile *p, PVOID v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile *p, PVOID v, PVOID c)
+{
+    __atomic_compare_exchange_n(p, &c, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return c;
+}
+inline LONG ReadAcquire(const volatile LONG *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline LONG ReadNoFence(const volatile LONG *p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+inline LONGLONG ReadAcquire64(const volatile LONGLONG *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline LONGLONG ReadNoFence64(const volatile LONGLONG *p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+inline PVOID ReadPointerAcquire(PVOID const volatile *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline void WriteRelease(volatile LONG *p, LONG v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+inline void WriteNoFence(volatile LONG *p, LONG v) { __atomic_store_n(p, v, __ATOMIC_RELAXED); }
+inline void WritePointerRelease(PVOID volatile *p, PVOID v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+inline void MemoryBarrier() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+#if defined(__x86_64__) || defined(__i386__)
+inline void YieldProcessor() { __builtin_ia32_pause(); }
+#else
+inline void YieldProcessor() { __asm__ __volatile__("" ::: "memory"); }
+#endif
+
+// Slim reader/writer locks
+struct SRWLOCK
+{
+    void *Ptr;
+};
+#define SRWLOCK_INIT { nullptr }
+void InitializeSRWLock(SRWLOCK *pLock);
+void AcquireSRWLockShared(SRWLOCK *pLock);
+void ReleaseSRWLockShared(SRWLOCK *pLock);
+void AcquireSRWLockExclusive(SRWLOCK *pLock);
+void ReleaseSRWLockExclusive(SRWLOCK *pLock);
+BOOL TryAcquireSRWLockExclusive(SRWLOCK *pLock);
+
+// Interlocked singly linked lists. The shim guards the list with a spin lock
+// rather than a double-width compare-exchange; callers only see the same API.
+#define MEMORY_ALLOCATION_ALIGNMENT 16
+struct alignas(MEMORY_ALLOCATION_ALIGNMENT) SLIST_ENTRY
+{
+    SLIST_ENTRY *Next;
+};
+typedef SLIST_ENTRY *PSLIST_ENTRY;
+struct alignas(MEMORY_ALLOCATION_ALIGNMENT) SLIST_HEADER
+{
+    SLIST_ENTRY *Next;
+    WORD Depth;
+    volatile LONG Lock;
+};
+typedef SLIST_HEADER *PSLIST_HEADER;
+void InitializeSListHead(PSLIST_HEADER pHead);
+PSLIST_ENTRY InterlockedPushEntrySList(PSLIST_HEADER pHead, PSLIST_ENTRY pEntry);
+PSLIST_ENTRY InterlockedPopEntrySList(PSLIST_HEADER pHead);
+PSLIST_ENTRY InterlockedFlushSList(PSLIST_HEADER pHead);
+USHORT QueryDepthSList(PSLIST_HEADER pHead);
+
+// Time
+struct SYSTEMTIME
+{
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+};
+union LARGE_INTEGER
+{
+    struct
+    {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+};
+struct FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+};
+ULONGLONG GetTickCount64();
+DWORD GetTickCount();
+BOOL QueryPerformanceCounter(LARGE_INTEGER *pCounter);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *pFrequency);
+void GetLocalTime(SYSTEMTIME *pst);
+void GetSystemTimeAsFileTime(FILETIME *pft);
+// Moves the clock GetSystemTimeAsFileTime reads forward by ull100ns.
+void ShimAdvanceSystemTime(ULONGLONG ull100ns);
+// Moves the tick count and the performance counter forward by dwMilliseconds.
+void ShimAdvanceTickCount(DWORD dwMilliseconds);
+void Sleep(DWORD dwMilliseconds);
+DWORD GetCurrentThreadId();
+
+// Debug output goes to stderr when WIN32SHIM_DEBUG_OUTPUT is set.
+void OutputDebugStringW(PCWSTR psz);
+void OutputDebugStringA(PCSTR psz);
+#define OutputDebugString OutputDebugStringW
+
+// Handles and events. Handles the shim creates are closed by CloseHandle; any
+// other value is accepted and ignored.
+#define WAIT_OBJECT_0               0x00000000L
+#define WAIT_TIMEOUT                0x00000102L
+#define WAIT_FAILED                 0xFFFFFFFF
+BOOL CloseHandle(HANDLE h);
+HANDLE CreateEventW(void *pEventAttributes, BOOL fManualReset, BOOL fInitialState, PCWSTR pszName);
+BOOL SetEvent(HANDLE hEvent);
+BOOL ResetEvent(HANDLE hEvent);
+DWORD WaitForSingleObject(HANDLE h, DWORD dwMilliseconds);
+
+// Thread pools. Each pool starts threads as work arrives, up to its maximum;
+// CloseThreadpool waits for the work already submitted to finish.
+typedef struct TP_POOL *PTP_POOL;
+typedef struct TP_CALLBACK_INSTANCE *PTP_CALLBACK_INSTANCE;
+typedef void (CALLBACK *PTP_SIMPLE_CALLBACK)(PTP_CALLBACK_INSTANCE Instance, PVOID Context);
+struct TP_CALLBACK_ENVIRON
+{
+    PTP_POOL Pool;
+};
+typedef TP_CALLBACK_ENVIRON *PTP_CALLBACK_ENVIRON;
+PTP_POOL CreateThreadpool(PVOID reserved);
+void SetThreadpoolThreadMaximum(PTP_POOL pPool, DWORD cthrdMost);
+BOOL SetThreadpoolThreadMinimum(PTP_POOL pPool, DWORD cthrdMic);
+void CloseThreadpool(PTP_POOL pPool);
+void InitializeThreadpoolEnvironment(PTP_CALLBACK_ENVIRON pcbe);
+void SetThreadpoolCallbackPool(PTP_CALLBACK_ENVIRON pcbe, PTP_POOL pPool);
+void DestroyThreadpoolEnvironment(PTP_CALLBACK_ENVIRON pcbe);
+BOOL TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv, PTP_CALLBACK_ENVIRON pcbe);
+
+// Files and file mappings
+struct SECURITY_ATTRIBUTES
+{
+    DWORD nLength;
+    LPVOID lpSecurityDescriptor;
+    BOOL bInheritHandle;
+};
+typedef void *PSECURITY_DESCRIPTOR;
+#define GENERIC_READ                0x80000000
+#define GENERIC_WRITE               0x40000000
+#define FILE_SHARE_READ             0x00000001
+#define FILE_SHARE_WRITE            0x00000002
+#define FILE_SHARE_DELETE           0x00000004
+#define CREATE_NEW                  1
+#define CREATE_ALWAYS               2
+#define OPEN_EXISTING               3
+#define OPEN_ALWAYS                 4
+#define TRUNCATE_EXISTING           5
+#define FILE_ATTRIBUTE_NORMAL       0x00000080
+#define PAGE_READONLY               0x02
+#define PAGE_READWRITE              0x04
+#define FILE_MAP_WRITE              0x0002
+#define FILE_MAP_READ               0x0004
+BOOL CreateDirectoryW(PCWSTR pszPath, SECURITY_ATTRIBUTES *pSecurityAttributes);
+HANDLE CreateFileW(PCWSTR pszPath, DWORD dwDesiredAccess, DWORD dwShareMode, SECURITY_ATTRIBUTES *pSecurityAttributes,
+                   DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile);
+BOOL GetFileSizeEx(HANDLE hFile, LARGE_INTEGER *pliFileSize);
+BOOL ReadFile(HANDLE hFile, LPVOID pvBuffer, DWORD cbToRead, LPDWORD pcbRead, void *pOverlapped);
+BOOL WriteFile(HANDLE hFile, LPCVOID pvBuffer, DWORD cbToWrite, LPDWORD pcbWritten, void *pOverlapped);
+BOOL DeleteFileW(PCWSTR pszPath);
+HANDLE CreateFileMappingW(HANDLE hFile, SECURITY_ATTRIBUTES *pAttributes, DWORD flProtect, DWORD dwMaximumSizeHigh,
+                          DWORD dwMaximumSizeLow, PCWSTR pszName);
+LPVOID MapViewOfFile(HANDLE hMapping, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh, DWORD dwFileOffsetLow, SIZE_T cbToMap);
+BOOL UnmapViewOfFile(LPCVOID pvBaseAddress);
+
+// Memory
+#define HEAP_ZERO_MEMORY            0x00000008
+HANDLE GetProcessHeap();
+PVOID HeapAlloc(HANDLE hHeap, DWORD dwFlags, SIZE_T cb);
+BOOL HeapFree(HANDLE hHeap, DWORD dwFlags, PVOID pv);
+PVOID CoTaskMemAlloc(SIZE_T cb);
+PVOID CoTaskMemRealloc(PVOID pv, SIZE_T cb);
+void CoTaskMemFree(PVOID pv);
+typedef void *HLOCAL;
+HLOCAL LocalAlloc(UINT uFlags, SIZE_T cb);
+HLOCAL LocalFree(HLOCAL hMem);
+#define MEM_COMMIT                  0x00001000
+#define MEM_RESERVE                 0x00002000
+#define MEM_RELEASE                 0x00008000
+#define PAGE_NOACCESS               0x01
+struct SYSTEM_INFO
+{
+    DWORD dwPageSize;
+    DWORD dwNumberOfProcessors;
+    DWORD dwAllocationGranularity;
+};
+void GetSystemInfo(SYSTEM_INFO *psi);
+// Virtual memory is mapped with mmap; VirtualFree only releases whole regions.
+LPVOID VirtualAlloc(LPVOID pvAddress, SIZE_T cb, DWORD flAllocationType, DWORD flProtect);
+BOOL VirtualFree(LPVOID pvAddress, SIZE_T cb, DWORD dwFreeType);
+BOOL VirtualProtect(LPVOID pvAddress, SIZE_T cb, DWORD flNewProtect, PDWORD pflOldProtect);
+BOOL VirtualLock(LPVOID pvAddress, SIZE_T cb);
+BOOL VirtualUnlock(LPVOID pvAddress, SIZE_T cb);
+
+// Ends the process at once with SIGABRT, without unwinding, as the intrinsic does.
+#define FAST_FAIL_INVALID_ARG       5
+[[noreturn]] void __fastfail(unsigned int uCode);
+
+// Registry, kept in memory for the life of the process
+#define HKEY_LOCAL_MACHINE          (reinterpret_cast<HKEY>(static_cast<uintptr_t>(0x80000002)))
+#define HKEY_CURRENT_USER           (reinterpret_cast<HKEY>(static_cast<uintptr_t>(0x80000001)))
+#define REG_NONE                    0
+#define REG_SZ                      1
+#define REG_BINARY                  3
+#define REG_DWORD                   4
+#define REG_QWORD                   11
+#define RRF_RT_REG_SZ               0x00000002
+#define RRF_RT_REG_BINARY           0x00000008
+#define RRF_RT_REG_DWORD            0x00000010
+#define RRF_RT_REG_QWORD            0x00000040
+#define RRF_RT_ANY                  0x0000FFFF
+#define REG_OPTION_NON_VOLATILE     0
+#define KEY_QUERY_VALUE             0x0001
+#define KEY_SET_VALUE               0x0002
+#define KEY_READ                    0x20019
+#define KEY_WRITE                   0x20006
+LSTATUS RegGetValueW(HKEY hKey, PCWSTR pszSubKey, PCWSTR pszValue, DWORD dwFlags, PDWORD pdwType, PVOID pvData, PDWORD pcbData);
+LSTATUS RegCreateKeyExW(HKEY hKey, PCWSTR pszSubKey, DWORD dwReserved, PWSTR pszClass, DWORD dwOptions, REGSAM samDesired,
+                        void *pSecurityAttributes, PHKEY phkResult, PDWORD pdwDisposition);
+LSTATUS RegSetValueExW(HKEY hKey, PCWSTR pszValue, DWORD dwReserved, DWORD dwType, const BYTE *pbData, DWORD cbData);
+LSTATUS RegCloseKey(HKEY hKey);
+
+// Strings
+inline int _wcsicmp(PCWSTR psz1, PCWSTR psz2)
+{
+    return wcscasecmp(psz1, psz2);
+}
+
+inline unsigned long long _strtoui64(const char *psz, char **ppszEnd, int iBase)
+{
+    return strtoull(psz, ppszEnd, iBase);
+}
+
+// Clears every value written to the shim registry, so tests do not see each other's.
+void ShimResetRegistry();
+
+// Number of DllAddRef calls not yet matched by DllRelease.
+LONG ShimDllRefCount();
+
+// Called with each heap block just before HeapFree frees it, so a test can check
+// what was left in it. Pass nullptr to stop.
+typedef void (*PFN_SHIM_HEAP_FREE_HOOK)(PVOID pv, SIZE_T cb);
+void ShimSetHeapFreeHook(PFN_SHIM_HEAP_FREE_HOOK pfnHook);
+
+// CoTaskMem blocks allocated since the process started, and the blocks and bytes
+// still in use, counting each block at the size malloc actually gave it.
+struct SHIM_COTASKMEM_STATS
+{
+    ULONGLONG   cAllocations;
+    ULONGLONG   cBlocksInUse;
+    ULONGLONG   cbInUse;
+};
+void ShimGetCoTaskMemStats(_Out_ SHIM_COTASKMEM_STATS *pStats);
+
+// Sets the directory SHGetKnownFolderPath returns for FOLDERID_ProgramData.
+void ShimSetProgramDataPath(PCWSTR pszPath);
+
+// Converts a path to the UTF-8 the POSIX file calls take.
+std::string ShimNarrowPath(PCWSTR pszPath);
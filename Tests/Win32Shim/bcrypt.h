@@ -0,0 +1,8 @@
+// Linux stand-in for the SDK header: the system random number generator.
+#pragma once
+#include "Win32Shim.h"
+
+#define BCRYPT_USE_SYSTEM_PREFERRED_RNG 0x00000002
+#define BCRYPT_SUCCESS(Status)          (static_cast<NTSTATUS>(Status) >= 0)
+
+NTSTATUS BCryptGenRandom(PVOID hAlgorithm, PUCHAR pbBuffer, ULONG cbBuffer, ULONG dwFlags);
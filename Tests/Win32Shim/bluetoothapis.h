@@ -0,0 +1,63 @@
+// Linux stand-in for the SDK header. There are no radios; tests scan simulated
+// ones through IBluetoothRadioSource.
+#pragma once
+#include "Win32Shim.h"
+
+#define BLUETOOTH_MAX_NAME_SIZE 248
+
+union BLUETOOTH_ADDRESS
+{
+    ULONGLONG ullLong;
+    BYTE rgBytes[6];
+};
+
+struct BLUETOOTH_DEVICE_INFO
+{
+    DWORD dwSize;
+    BLUETOOTH_ADDRESS Address;
+    ULONG ulClassofDevice;
+    BOOL fConnected;
+    BOOL fRemembered;
+    BOOL fAuthenticated;
+    SYSTEMTIME stLastSeen;
+    SYSTEMTIME stLastUsed;
+    WCHAR szName[BLUETOOTH_MAX_NAME_SIZE];
+};
+
+struct BLUETOOTH_RADIO_INFO
+{
+    DWORD dwSize;
+    BLUETOOTH_ADDRESS address;
+    WCHAR szName[BLUETOOTH_MAX_NAME_SIZE];
+    ULONG ulClassofDevice;
+    USHORT lmpSubversion;
+    USHORT manufacturer;
+};
+
+struct BLUETOOTH_FIND_RADIO_PARAMS
+{
+    DWORD dwSize;
+};
+
+struct BLUETOOTH_DEVICE_SEARCH_PARAMS
+{
+    DWORD dwSize;
+    BOOL fReturnAuthenticated;
+    BOOL fReturnRemembered;
+    BOOL fReturnUnknown;
+    BOOL fReturnConnected;
+    BOOL fIssueInquiry;
+    UCHAR cTimeoutMultiplier;
+    HANDLE hRadio;
+};
+
+typedef HANDLE HBLUETOOTH_RADIO_FIND;
+typedef HANDLE HBLUETOOTH_DEVICE_FIND;
+
+HBLUETOOTH_RADIO_FIND BluetoothFindFirstRadio(const BLUETOOTH_FIND_RADIO_PARAMS *pbtfrp, HANDLE *phRadio);
+BOOL BluetoothFindNextRadio(HBLUETOOTH_RADIO_FIND hFind, HANDLE *phRadio);
+BOOL BluetoothFindRadioClose(HBLUETOOTH_RADIO_FIND hFind);
+DWORD BluetoothGetRadioInfo(HANDLE hRadio, BLUETOOTH_RADIO_INFO *pRadioInfo);
+HBLUETOOTH_DEVICE_FIND BluetoothFindFirstDevice(const BLUETOOTH_DEVICE_SEARCH_PARAMS *pbtsp, BLUETOOTH_DEVICE_INFO *pbtdi);
+BOOL BluetoothFindNextDevice(HBLUETOOTH_DEVICE_FIND hFind, BLUETOOTH_DEVICE_INFO *pbtdi);
+BOOL BluetoothFindDeviceClose(HBLUETOOTH_DEVICE_FIND hFind);
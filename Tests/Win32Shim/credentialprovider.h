@@ -0,0 +1,104 @@
+// Linux stand-in for the SDK header: the usage scenarios, the field
+// descriptors, the user interfaces the provider reads identity properties
+// through and the provider and credential events callbacks. Only the methods
+// the tested units call are declared.
+#pragma once
+#include "unknwn.h"
+#include "propkey.h"
+
+enum CREDENTIAL_PROVIDER_USAGE_SCENARIO
+{
+    CPUS_INVALID = 0,
+    CPUS_LOGON,
+    CPUS_UNLOCK_WORKSTATION,
+    CPUS_CHANGE_PASSWORD,
+    CPUS_CREDUI,
+    CPUS_PLAP,
+};
+
+#define CREDENTIAL_PROVIDER_NO_DEFAULT ((DWORD)-1)
+
+enum CREDENTIAL_PROVIDER_FIELD_TYPE
+{
+    CPFT_INVALID = 0,
+    CPFT_LARGE_TEXT,
+    CPFT_SMALL_TEXT,
+    CPFT_COMMAND_LINK,
+    CPFT_EDIT_TEXT,
+    CPFT_PASSWORD_TEXT,
+    CPFT_TILE_IMAGE,
+    CPFT_CHECKBOX,
+    CPFT_COMBOBOX,
+    CPFT_SUBMIT_BUTTON,
+};
+
+enum CREDENTIAL_PROVIDER_FIELD_STATE
+{
+    CPFS_HIDDEN = 0,
+    CPFS_DISPLAY_IN_SELECTED_TILE,
+    CPFS_DISPLAY_IN_DESELECTED_TILE,
+    CPFS_DISPLAY_IN_BOTH,
+};
+
+enum CREDENTIAL_PROVIDER_FIELD_INTERACTIVE_STATE
+{
+    CPFIS_NONE = 0,
+    CPFIS_READONLY,
+    CPFIS_DISABLED,
+    CPFIS_FOCUSED,
+};
+
+struct CREDENTIAL_PROVIDER_FIELD_DESCRIPTOR
+{
+    DWORD                           dwFieldID;
+    CREDENTIAL_PROVIDER_FIELD_TYPE  cpft;
+    PWSTR                           pszLabel;
+    GUID                            guidFieldType;
+};
+
+struct CREDENTIAL_PROVIDER_CREDENTIAL_SERIALIZATION
+{
+    ULONG   ulAuthenticationPackage;
+    GUID    clsidCredentialProvider;
+    ULONG   cbSerialization;
+    BYTE    *rgbSerialization;
+};
+
+SHIM_DECLARE_INTERFACE_IID(ICredentialProviderUser, 0x13793285, 0x3ea6, 0x40fd, 0xb4, 0x20, 0x15, 0xf4, 0x7d, 0xa4, 0x1f, 0xbb);
+SHIM_DECLARE_INTERFACE_IID(ICredentialProviderUserArray, 0x90c119ae, 0x0f18, 0x4520, 0xa1, 0xf1, 0x11, 0x43, 0x66, 0xa4, 0x0f, 0xe8);
+SHIM_DECLARE_INTERFACE_IID(ICredentialProviderEvents, 0x34201e5a, 0xa787, 0x41a3, 0xa5, 0xa4, 0xbd, 0x6d, 0xcf, 0x2a, 0x85, 0x4e);
+SHIM_DECLARE_INTERFACE_IID(ICredentialProviderCredential, 0x63913a93, 0x40c1, 0x481a, 0x81, 0x8d, 0x40, 0x72, 0xff, 0x8c, 0x70, 0xcc);
+SHIM_DECLARE_INTERFACE_IID(ICredentialProviderCredentialEvents, 0xfa6fa76b, 0x66b7, 0x4b11, 0x95, 0xf1, 0x86, 0x17, 0x11, 0x18, 0xe8, 0x16);
+SHIM_DECLARE_INTERFACE_IID(ICredentialProviderCredentialEvents2, 0xb53c00b6, 0x9922, 0x4b78, 0xb1, 0xf4, 0xdd, 0xfe, 0x77, 0x4d, 0xc3, 0x9b);
+
+struct ICredentialProviderUser : IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE GetSid(_Outptr_result_nullonfailure_ PWSTR *ppszSid) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetStringValue(_In_ REFPROPERTYKEY key, _Outptr_result_nullonfailure_ PWSTR *ppszStringValue) = 0;
+};
+
+struct ICredentialProviderUserArray : IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE GetCount(_Out_ DWORD *pdwUserCount) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetAt(DWORD dwIndex, _COM_Outptr_ ICredentialProviderUser **ppUser) = 0;
+};
+
+struct ICredentialProviderEvents : IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE CredentialsChanged(UINT_PTR upAdviseContext) = 0;
+};
+
+struct ICredentialProviderCredential : IUnknown
+{
+};
+
+struct ICredentialProviderCredentialEvents : IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE SetFieldString(_In_ ICredentialProviderCredential *pcpc, DWORD dwFieldID, _In_opt_ PCWSTR psz) = 0;
+};
+
+struct ICredentialProviderCredentialEvents2 : ICredentialProviderCredentialEvents
+{
+    virtual HRESULT STDMETHODCALLTYPE BeginFieldUpdates() = 0;
+    virtual HRESULT STDMETHODCALLTYPE EndFieldUpdates() = 0;
+};
@@ -0,0 +1,29 @@
+// Linux stand-in for the SDK header: apartments and cross-thread marshaling.
+// There is one apartment in the shim, so a marshaled interface is the same
+// object again, which is what free-threaded objects get on Windows.
+#pragma once
+#include "Win32Shim.h"
+#include "unknwn.h"
+
+SHIM_DECLARE_INTERFACE_IID(IStream, 0x0000000C, 0x0000, 0x0000, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46);
+
+struct IStream : IUnknown
+{
+};
+typedef IStream *LPSTREAM;
+typedef IUnknown *LPUNKNOWN;
+
+#define COINIT_APARTMENTTHREADED    0x2
+#define COINIT_MULTITHREADED        0x0
+#define COWAIT_DEFAULT              0x0
+#define RPC_E_CHANGED_MODE          (static_cast<HRESULT>(0x80010106))
+#define RPC_S_CALLPENDING           (static_cast<HRESULT>(0x80010115))
+
+HRESULT CoInitializeEx(LPVOID pvReserved, DWORD dwCoInit);
+void CoUninitialize();
+HRESULT CoMarshalInterThreadInterfaceInStream(REFIID riid, LPUNKNOWN pUnk, LPSTREAM *ppStm);
+HRESULT CoGetInterfaceAndReleaseStream(LPSTREAM pStm, REFIID iid, LPVOID *ppv);
+HRESULT CoWaitForMultipleHandles(DWORD dwFlags, DWORD dwTimeout, ULONG cHandles, HANDLE *pHandles, LPDWORD lpdwindex);
+
+// Marshal streams not yet unmarshaled, to check that none are leaked.
+LONG ShimOutstandingMarshalStreams();
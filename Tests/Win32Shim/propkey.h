@@ -0,0 +1,22 @@
+// Linux stand-in for the SDK header: the identity property keys.
+#pragma once
+#include "unknwn.h"
+
+struct PROPERTYKEY
+{
+    GUID    fmtid;
+    DWORD   pid;
+};
+typedef const PROPERTYKEY &REFPROPERTYKEY;
+
+inline bool operator==(REFPROPERTYKEY a, REFPROPERTYKEY b)
+{
+    return a.fmtid == b.fmtid && a.pid == b.pid;
+}
+
+// {C4322503-78CA-49C6-9ACC-A68E2AFD7B6B}
+#define SHIM_IDENTITY_FMTID { 0xC4322503, 0x78CA, 0x49C6, { 0x9A, 0xCC, 0xA6, 0x8E, 0x2A, 0xFD, 0x7B, 0x6B } }
+static const PROPERTYKEY PKEY_Identity_UserName = { SHIM_IDENTITY_FMTID, 100 };
+static const PROPERTYKEY PKEY_Identity_DisplayName = { { 0x7D683FC9, 0xD155, 0x45A8, { 0xBB, 0x1F, 0x89, 0xD1, 0x9B, 0xCB, 0x79, 0x2F } }, 100 };
+static const PROPERTYKEY PKEY_Identity_LogonStatusString = { { 0xF18DEDF3, 0x337F, 0x42C0, { 0x9E, 0x03, 0xCE, 0xE0, 0x87, 0x08, 0xA8, 0xC3 } }, 100 };
+static const PROPERTYKEY PKEY_Identity_QualifiedUserName = { { 0xDA520E51, 0xF4E9, 0x4739, { 0xAC, 0x82, 0x02, 0xE0, 0xA9, 0x5C, 0x90, 0x30 } }, 100 };
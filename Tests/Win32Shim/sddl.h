@@ -0,0 +1,9 @@
+// Linux stand-in for the SDK header. The shim does not enforce security
+// descriptors; see Win32Shim.cpp.
+#pragma once
+#include "Win32Shim.h"
+
+#define SDDL_REVISION_1 1
+
+BOOL ConvertStringSecurityDescriptorToSecurityDescriptorW(PCWSTR pszSecurityDescriptor, DWORD dwRevision,
+                                                          PSECURITY_DESCRIPTOR *ppSecurityDescriptor, PULONG pcbSecurityDescriptor);
@@ -0,0 +1,13 @@
+// Linux stand-in for the SDK header: the known folders the provider keeps its
+// files under. See ShimSetProgramDataPath.
+#pragma once
+#include "Win32Shim.h"
+#include "unknwn.h"
+
+typedef GUID KNOWNFOLDERID;
+typedef const KNOWNFOLDERID &REFKNOWNFOLDERID;
+
+// {62AB5D82-FDC1-4DC3-A9DD-070D1D495D97}
+static const KNOWNFOLDERID FOLDERID_ProgramData = { 0x62AB5D82, 0xFDC1, 0x4DC3, { 0xA9, 0xDD, 0x07, 0x0D, 0x1D, 0x49, 0x5D, 0x97 } };
+
+HRESULT SHGetKnownFolderPath(REFKNOWNFOLDERID rfid, DWORD dwFlags, HANDLE hToken, PWSTR *ppszPath);
@@ -0,0 +1,17 @@
+// Linux stand-in for the SDK header. The format strings are MSVC's, where %s
+// takes a wide string in a wide printf, so they are translated for glibc.
+#pragma once
+#include "Win32Shim.h"
+
+#define STRSAFE_MAX_CCH 2147483647
+
+HRESULT StringCchCopyW(_Out_writes_(cchDest) PWSTR pszDest, size_t cchDest, _In_ PCWSTR pszSrc);
+HRESULT StringCchCopyNW(_Out_writes_(cchDest) PWSTR pszDest, size_t cchDest, _In_ PCWSTR pszSrc, size_t cchToCopy);
+HRESULT StringCchCatW(_Inout_updates_(cchDest) PWSTR pszDest, size_t cchDest, _In_ PCWSTR pszSrc);
+HRESULT StringCchLengthW(_In_ PCWSTR psz, size_t cchMax, _Out_opt_ size_t *pcch);
+HRESULT StringCchVPrintfW(_Out_writes_(cchDest) PWSTR pszDest, size_t cchDest, _In_ PCWSTR pszFormat, va_list args);
+HRESULT StringCchPrintfW(_Out_writes_(cchDest) PWSTR pszDest, size_t cchDest, _In_ PCWSTR pszFormat, ...);
+
+#define StringCchCopy StringCchCopyW
+#define StringCchCat StringCchCatW
+#define StringCchPrintf StringCchPrintfW
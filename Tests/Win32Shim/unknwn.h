@@ -0,0 +1,55 @@
+// Linux stand-in for the SDK header: GUIDs, IUnknown and __uuidof. Interfaces
+// declare their IID with SHIM_DECLARE_INTERFACE_IID.
+#pragma once
+#include "Win32Shim.h"
+#include <type_traits>
+
+struct GUID
+{
+    DWORD   Data1;
+    WORD    Data2;
+    WORD    Data3;
+    BYTE    Data4[8];
+};
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const GUID &REFGUID;
+typedef const IID &REFIID;
+typedef const CLSID &REFCLSID;
+
+inline bool operator==(REFGUID a, REFGUID b)
+{
+    return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+inline bool IsEqualIID(REFIID a, REFIID b)
+{
+    return a == b;
+}
+
+template <typename TInterface>
+struct ShimInterfaceIid;
+
+#define SHIM_DECLARE_INTERFACE_IID(I, d1, d2, d3, b0, b1, b2, b3, b4, b5, b6, b7) \
+    struct I; \
+    template <> \
+    struct ShimInterfaceIid<I> \
+    { \
+        static const IID &Get() \
+        { \
+            static const IID iid = { d1, d2, d3, { b0, b1, b2, b3, b4, b5, b6, b7 } }; \
+            return iid; \
+        } \
+    }
+
+#define __uuidof(I) ShimInterfaceIid<typename std::remove_cv<typename std::remove_reference<I>::type>::type>::Get()
+#define IID_PPV_ARGS(ppv) __uuidof(decltype(**(ppv))), reinterpret_cast<void**>(ppv)
+
+SHIM_DECLARE_INTERFACE_IID(IUnknown, 0x00000000, 0x0000, 0x0000, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46);
+
+struct IUnknown
+{
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppv) = 0;
+    virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+    virtual ULONG STDMETHODCALLTYPE Release() = 0;
+};
@@ -0,0 +1,19 @@
+// Linux stand-in for the SDK header. DPAPI sealing is only simulated, see
+// Win32Shim.cpp: a sealed blob is the data behind a marker, so unsealing
+// something that was never sealed still fails.
+#pragma once
+#include "Win32Shim.h"
+
+#define CRYPTPROTECT_UI_FORBIDDEN   0x1
+#define CRYPTPROTECT_LOCAL_MACHINE  0x4
+
+typedef struct _CRYPTOAPI_BLOB
+{
+    DWORD   cbData;
+    BYTE    *pbData;
+} DATA_BLOB;
+
+BOOL CryptProtectData(DATA_BLOB *pDataIn, PCWSTR pszDataDescr, DATA_BLOB *pOptionalEntropy, PVOID pvReserved,
+                      PVOID pPromptStruct, DWORD dwFlags, DATA_BLOB *pDataOut);
+BOOL CryptUnprotectData(DATA_BLOB *pDataIn, PWSTR *ppszDataDescr, DATA_BLOB *pOptionalEntropy, PVOID pvReserved,
+                        PVOID pPromptStruct, DWORD dwFlags, DATA_BLOB *pDataOut);
@@ -0,0 +1,4 @@
+// Linux stand-in for the SDK header; see Win32Shim.h.
+#pragma once
+#include "Win32Shim.h"
+#include "objbase.h"
@@ -0,0 +1,23 @@
+// Linux stand-in for the SDK header. There is no network; recv hands out the
+// blocks a test queued for the socket with ShimQueueReceive.
+#pragma once
+#include "Win32Shim.h"
+
+typedef ULONG_PTR SOCKET;
+
+#define INVALID_SOCKET      (static_cast<SOCKET>(~0))
+#define SOCKET_ERROR        (-1)
+#define SOL_SOCKET          0xffff
+#define SO_RCVTIMEO         0x1006
+#define WSAETIMEDOUT        10060L
+
+int recv(SOCKET s, char *buf, int len, int flags);
+int setsockopt(SOCKET s, int level, int optname, const char *optval, int optlen);
+int WSAGetLastError();
+
+// Queues a block for recv on s to return, at most len bytes of it per call. Once
+// the queue is empty recv returns 0, as for a closed connection.
+void ShimQueueReceive(SOCKET s, const std::string &strBlock);
+
+// Drops whatever is still queued for s and returns how many bytes that was.
+size_t ShimClearReceives(SOCKET s);
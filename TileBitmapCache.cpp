@@ -0,0 +1,295 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Windows side of the tile image pipeline: resource and account picture loading,
+// the per-user LRU cache and DIB section creation. Decoding and scaling are in
+// BitmapCore.cpp.
+
+#include <windows.h>
+#include <strsafe.h>
+#include <wincodec.h>
+#include "Dll.h"
+#include "resource.h"
+#include "TileBitmapCache.h"
+
+#pragma comment(lib, "Windowscodecs.lib")
+
+// Cap on the pixel memory held for per-user images, about 64 tiles.
+static const size_t c_cbMaxUserImages = 4 * 1024 * 1024;
+
+// Where Windows records the account picture files of each user.
+static const WCHAR c_szAccountPictureKey[] = L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\AccountPicture\\Users\\";
+static const WCHAR c_szAccountPictureValue[] = L"Image192";
+
+// SIDs are compared case-insensitively, so the cache is keyed by the upper-case form.
+static std::wstring _MakeKey(_In_ PCWSTR pszSid)
+{
+    std::wstring strKey(pszSid);
+    for (WCHAR &ch : strKey)
+    {
+        if (ch >= L'a' && ch <= L'z')
+        {
+            ch = static_cast<WCHAR>(ch - L'a' + L'A');
+        }
+    }
+    return strKey;
+}
+
+CTileBitmapCache &CTileBitmapCache::Instance()
+{
+    static CTileBitmapCache s_cache;
+    return s_cache;
+}
+
+CTileBitmapCache::CTileBitmapCache() :
+    _cbUserImages(0)
+{
+    InitializeSRWLock(&_lock);
+    _defaultImage.cx = 0;
+    _defaultImage.cy = 0;
+}
+
+HRESULT CTileBitmapCache::GetTileBitmap(_In_opt_ PCWSTR pszSid, _Outptr_result_nullonfailure_ HBITMAP *phbmp)
+{
+    *phbmp = nullptr;
+    HRESULT hr = S_FALSE;
+
+    if (pszSid != nullptr)
+    {
+        std::wstring strKey = _MakeKey(pszSid);
+        bool fKnown = false;
+
+        AcquireSRWLockExclusive(&_lock);
+        auto it = _mapUserImages.find(strKey);
+        if (it != _mapUserImages.end())
+        {
+            fKnown = true;
+            _lruUserImages.splice(_lruUserImages.begin(), _lruUserImages, it->second);
+            if (it->second->image.cx != 0)
+            {
+                hr = _CreateBitmap(it->second->image, phbmp);
+            }
+        }
+        ReleaseSRWLockExclusive(&_lock);
+
+        if (!fKnown)
+        {
+            // Decode the account picture without holding the lock. A user without one
+            // is remembered with an empty image so we don't look again.
+            BITMAP_IMAGE picture;
+            BITMAP_IMAGE scaled;
+            scaled.cx = 0;
+            scaled.cy = 0;
+            if (SUCCEEDED(_LoadAccountPicture(pszSid, &picture)) &&
+                !ImageScale(picture, c_cxTileImage, c_cyTileImage, &scaled))
+            {
+                scaled.cx = 0;
+                scaled.cy = 0;
+                scaled.pixels.clear();
+            }
+
+            AcquireSRWLockExclusive(&_lock);
+            if (scaled.cx != 0)
+            {
+                hr = _CreateBitmap(scaled, phbmp);
+            }
+            _InsertUserImage(strKey, scaled);
+            ReleaseSRWLockExclusive(&_lock);
+        }
+    }
+
+    // S_FALSE means the user has no image of their own.
+    if (hr == S_FALSE)
+    {
+        AcquireSRWLockExclusive(&_lock);
+        hr = _EnsureDefaultImage();
+        if (SUCCEEDED(hr))
+        {
+            hr = _CreateBitmap(_defaultImage, phbmp);
+        }
+        ReleaseSRWLockExclusive(&_lock);
+    }
+    return hr;
+}
+
+HRESULT CTileBitmapCache::SetUserImage(_In_ PCWSTR pszSid, const BITMAP_IMAGE &image)
+{
+    // Uploads from the phone are scaled while they are decoded, so only copy those.
+    BITMAP_IMAGE scaled;
+    if (image.cx == c_cxTileImage && image.cy == c_cyTileImage &&
+        image.pixels.size() == static_cast<size_t>(c_cxTileImage) * c_cyTileImage * 4)
+    {
+        scaled = image;
+    }
+    else if (!ImageScale(image, c_cxTileImage, c_cyTileImage, &scaled))
+    {
+        return E_INVALIDARG;
+    }
+
+    std::wstring strKey = _MakeKey(pszSid);
+    AcquireSRWLockExclusive(&_lock);
+    _InsertUserImage(strKey, scaled);
+    ReleaseSRWLockExclusive(&_lock);
+    return S_OK;
+}
+
+// Decodes the tile image resource the first time it is needed. _lock must be held.
+HRESULT CTileBitmapCache::_EnsureDefaultImage()
+{
+    HRESULT hr = S_OK;
+    if (_defaultImage.cx == 0)
+    {
+        hr = E_FAIL;
+        HRSRC hrsrc = FindResourceW(HINST_THISDLL, MAKEINTRESOURCEW(IDB_TILE_IMAGE), RT_BITMAP);
+        HGLOBAL hglobal = (hrsrc != nullptr) ? LoadResource(HINST_THISDLL, hrsrc) : nullptr;
+        const BYTE *pb = (hglobal != nullptr) ? static_cast<const BYTE*>(LockResource(hglobal)) : nullptr;
+        if (pb == nullptr)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        else if (BmpDecode(pb, SizeofResource(HINST_THISDLL, hrsrc), &_defaultImage))
+        {
+            hr = S_OK;
+        }
+    }
+    return hr;
+}
+
+// Makes strKey the most recently used entry, taking the pixels of image, then evicts
+// the least recently used entries until the cache is within its cap. _lock must be held.
+void CTileBitmapCache::_InsertUserImage(const std::wstring &strKey, BITMAP_IMAGE &image)
+{
+    auto it = _mapUserImages.find(strKey);
+    if (it != _mapUserImages.end())
+    {
+        _cbUserImages -= it->second->image.pixels.size();
+        _lruUserImages.erase(it->second);
+        _mapUserImages.erase(it);
+    }
+
+    USER_IMAGE entry;
+    entry.strSid = strKey;
+    entry.image.cx = image.cx;
+    entry.image.cy = image.cy;
+    entry.image.pixels.swap(image.pixels);
+    _cbUserImages += entry.image.pixels.size();
+    _lruUserImages.push_front(std::move(entry));
+    _mapUserImages[strKey] = _lruUserImages.begin();
+
+    _TrimUserImages();
+}
+
+void CTileBitmapCache::_TrimUserImages()
+{
+    while (_cbUserImages > c_cbMaxUserImages && _lruUserImages.size() > 1)
+    {
+        USER_IMAGE &oldest = _lruUserImages.back();
+        _cbUserImages -= oldest.image.pixels.size();
+        _mapUserImages.erase(oldest.strSid);
+        _lruUserImages.pop_back();
+    }
+}
+
+// Reads the account picture Windows keeps for the user through WIC, which handles
+// the JPEG and PNG files account pictures are stored as.
+HRESULT CTileBitmapCache::_LoadAccountPicture(_In_ PCWSTR pszSid, _Out_ BITMAP_IMAGE *pImage)
+{
+    WCHAR szKey[256];
+    WCHAR szPath[MAX_PATH];
+    HRESULT hr = StringCchPrintfW(szKey, ARRAYSIZE(szKey), L"%s%s", c_szAccountPictureKey, pszSid);
+    if (SUCCEEDED(hr))
+    {
+        DWORD cbPath = sizeof(szPath);
+        hr = HRESULT_FROM_WIN32(RegGetValueW(HKEY_LOCAL_MACHINE, szKey, c_szAccountPictureValue, RRF_RT_REG_SZ, nullptr, szPath, &cbPath));
+    }
+
+    IWICImagingFactory *pFactory = nullptr;
+    IWICBitmapDecoder *pDecoder = nullptr;
+    IWICBitmapFrameDecode *pFrame = nullptr;
+    IWICBitmapSource *pConverted = nullptr;
+    if (SUCCEEDED(hr))
+    {
+        hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&pFactory));
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pFactory->CreateDecoderFromFilename(szPath, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &pDecoder);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pDecoder->GetFrame(0, &pFrame);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = WICConvertBitmapSource(GUID_WICPixelFormat32bppBGRA, pFrame, &pConverted);
+    }
+
+    UINT cx = 0;
+    UINT cy = 0;
+    if (SUCCEEDED(hr))
+    {
+        hr = pConverted->GetSize(&cx, &cy);
+    }
+    if (SUCCEEDED(hr))
+    {
+        if (cx == 0 || cy == 0 || cx > c_cMaxImageDimension || cy > c_cMaxImageDimension)
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+    if (SUCCEEDED(hr))
+    {
+        pImage->cx = cx;
+        pImage->cy = cy;
+        pImage->pixels.resize(static_cast<size_t>(cx) * cy * 4);
+        hr = pConverted->CopyPixels(nullptr, cx * 4, static_cast<UINT>(pImage->pixels.size()), pImage->pixels.data());
+    }
+
+    if (pConverted != nullptr)
+    {
+        pConverted->Release();
+    }
+    if (pFrame != nullptr)
+    {
+        pFrame->Release();
+    }
+    if (pDecoder != nullptr)
+    {
+        pDecoder->Release();
+    }
+    if (pFactory != nullptr)
+    {
+        pFactory->Release();
+    }
+    return hr;
+}
+
+// Creates a top-down 32bpp DIB section holding a copy of the image.
+HRESULT CTileBitmapCache::_CreateBitmap(const BITMAP_IMAGE &image, _Outptr_result_nullonfailure_ HBITMAP *phbmp)
+{
+    *phbmp = nullptr;
+
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = static_cast<LONG>(image.cx);
+    bmi.bmiHeader.biHeight = -static_cast<LONG>(image.cy);
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void *pvBits = nullptr;
+    HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &pvBits, nullptr, 0);
+    HRESULT hr = E_OUTOFMEMORY;
+    if (hbmp != nullptr)
+    {
+        CopyMemory(pvBits, image.pixels.data(), image.pixels.size());
+        *phbmp = hbmp;
+        hr = S_OK;
+    }
+    return hr;
+}
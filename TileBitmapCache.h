@@ -0,0 +1,62 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// CTileBitmapCache holds decoded tile images for the whole process: the default
+// tile image from our resources, decoded once, and per-user images from account
+// pictures or from the phone app, kept in an LRU list with a cap on memory.
+// LogonUI takes ownership of the bitmap GetBitmapValue returns, so every call
+// gets a new DIB section filled from the cached pixels.
+
+#pragma once
+
+#include <windows.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "BitmapCore.h"
+
+// Size per-user images are scaled to, matching tileimage.bmp.
+static const uint32_t c_cxTileImage = 128;
+static const uint32_t c_cyTileImage = 128;
+
+class CTileBitmapCache
+{
+public:
+    static CTileBitmapCache &Instance();
+
+    // Creates a bitmap with the user's image, or the default tile image if the user
+    // has none. Looks up the user's account picture the first time it is asked for.
+    HRESULT GetTileBitmap(_In_opt_ PCWSTR pszSid, _Outptr_result_nullonfailure_ HBITMAP *phbmp);
+
+    // Stores an image for the user, scaled to the tile size, replacing any previous one.
+    HRESULT SetUserImage(_In_ PCWSTR pszSid, const BITMAP_IMAGE &image);
+
+private:
+    CTileBitmapCache();
+    CTileBitmapCache(const CTileBitmapCache &);
+    CTileBitmapCache &operator=(const CTileBitmapCache &);
+
+    // A user's image. An empty image records that the user has no account picture.
+    struct USER_IMAGE
+    {
+        std::wstring    strSid;
+        BITMAP_IMAGE    image;
+    };
+
+    HRESULT _EnsureDefaultImage();
+    void _InsertUserImage(const std::wstring &strKey, BITMAP_IMAGE &image);
+    void _TrimUserImages();
+    static HRESULT _LoadAccountPicture(_In_ PCWSTR pszSid, _Out_ BITMAP_IMAGE *pImage);
+    static HRESULT _CreateBitmap(const BITMAP_IMAGE &image, _Outptr_result_nullonfailure_ HBITMAP *phbmp);
+
+    SRWLOCK                                                             _lock;
+    BITMAP_IMAGE                                                        _defaultImage;      // Decoded IDB_TILE_IMAGE, empty until first use
+    std::list<USER_IMAGE>                                               _lruUserImages;     // Most recently used first
+    std::unordered_map<std::wstring, std::list<USER_IMAGE>::iterator>   _mapUserImages;     // Upper-case SID to entry in _lruUserImages
+    size_t                                                              _cbUserImages;      // Pixel bytes held by _lruUserImages
+};
@@ -0,0 +1,204 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Identity property reads, serial and batched.
+
+#include <windows.h>
+#include <propkey.h>
+#include "UserPropertyPrefetch.h"
+
+// Shared by the work items of one UserPropertiesPrefetch call.
+struct PREFETCH_BATCH
+{
+    IStream                 **rgpStreams;       // Marshaled user per index, nullptr if marshaling failed
+    USER_PROPERTIES         *rgProperties;
+    HRESULT                 *rghrResults;
+    DWORD                   cUsers;
+    volatile LONG           iNextUser;          // Next index to be claimed by a work item
+    volatile LONG           cRemaining;         // Work items that have not finished yet
+    HANDLE                  hDone;              // Set when cRemaining reaches zero
+};
+
+// Reads every property of the user. Only the qualified user name is required, since
+// it is what the credential is serialized with.
+HRESULT UserPropertiesFetch(
+    _In_ ICredentialProviderUser *pcpUser,
+    _Out_ USER_PROPERTIES *pProperties
+    )
+{
+    ZeroMemory(pProperties, sizeof(*pProperties));
+
+    HRESULT hr = pcpUser->GetStringValue(PKEY_Identity_QualifiedUserName, &pProperties->pszQualifiedUserName);
+    if (SUCCEEDED(hr))
+    {
+        pcpUser->GetStringValue(PKEY_Identity_UserName, &pProperties->pszUserName);
+        pcpUser->GetStringValue(PKEY_Identity_DisplayName, &pProperties->pszDisplayName);
+        pcpUser->GetStringValue(PKEY_Identity_LogonStatusString, &pProperties->pszLogonStatus);
+    }
+    return hr;
+}
+
+void UserPropertiesFree(
+    _Inout_ USER_PROPERTIES *pProperties
+    )
+{
+    CoTaskMemFree(pProperties->pszQualifiedUserName);
+    CoTaskMemFree(pProperties->pszUserName);
+    CoTaskMemFree(pProperties->pszDisplayName);
+    CoTaskMemFree(pProperties->pszLogonStatus);
+    ZeroMemory(pProperties, sizeof(*pProperties));
+}
+
+// Thread pool callback. Each work item claims the next user, unmarshals it into
+// this thread's MTA and reads its properties.
+static void CALLBACK _PrefetchUserProperties(PTP_CALLBACK_INSTANCE, PVOID pvContext)
+{
+    PREFETCH_BATCH *pBatch = static_cast<PREFETCH_BATCH*>(pvContext);
+    DWORD iUser = static_cast<DWORD>(InterlockedIncrement(&pBatch->iNextUser) - 1);
+
+    if (pBatch->rgpStreams[iUser] != nullptr)
+    {
+        HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+        if (SUCCEEDED(hr))
+        {
+            ICredentialProviderUser *pcpUser = nullptr;
+            hr = CoGetInterfaceAndReleaseStream(pBatch->rgpStreams[iUser], IID_PPV_ARGS(&pcpUser));
+            pBatch->rgpStreams[iUser] = nullptr;
+            if (SUCCEEDED(hr))
+            {
+                hr = UserPropertiesFetch(pcpUser, &pBatch->rgProperties[iUser]);
+                pcpUser->Release();
+            }
+            CoUninitialize();
+        }
+        pBatch->rghrResults[iUser] = hr;
+    }
+
+    if (InterlockedDecrement(&pBatch->cRemaining) == 0)
+    {
+        SetEvent(pBatch->hDone);
+    }
+}
+
+HRESULT UserPropertiesPrefetch(
+    _In_reads_(cUsers) ICredentialProviderUser * const *rgpUsers,
+    DWORD cUsers,
+    DWORD cMaxWorkers,
+    _Out_writes_(cUsers) USER_PROPERTIES *rgProperties,
+    _Out_writes_(cUsers) HRESULT *rghrResults
+    )
+{
+    ZeroMemory(rgProperties, cUsers * sizeof(*rgProperties));
+    for (DWORD i = 0; i < cUsers; i++)
+    {
+        rghrResults[i] = E_PENDING;
+    }
+
+    HRESULT hr = S_OK;
+    if (cUsers == 0)
+    {
+        return hr;
+    }
+
+    IStream **rgpStreams = static_cast<IStream**>(CoTaskMemAlloc(cUsers * sizeof(*rgpStreams)));
+    HANDLE hDone = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    PTP_POOL pPool = CreateThreadpool(nullptr);
+    if (rgpStreams != nullptr && hDone != nullptr && pPool != nullptr)
+    {
+        // The users belong to the calling thread's apartment, so each one is marshaled
+        // before a pool thread can use it.
+        for (DWORD i = 0; i < cUsers; i++)
+        {
+            rghrResults[i] = CoMarshalInterThreadInterfaceInStream(__uuidof(ICredentialProviderUser), rgpUsers[i], &rgpStreams[i]);
+            if (FAILED(rghrResults[i]))
+            {
+                rgpStreams[i] = nullptr;
+            }
+        }
+
+        SetThreadpoolThreadMaximum(pPool, cMaxWorkers);
+        SetThreadpoolThreadMinimum(pPool, 1);
+
+        TP_CALLBACK_ENVIRON environment;
+        InitializeThreadpoolEnvironment(&environment);
+        SetThreadpoolCallbackPool(&environment, pPool);
+
+        PREFETCH_BATCH batch;
+        batch.rgpStreams = rgpStreams;
+        batch.rgProperties = rgProperties;
+        batch.rghrResults = rghrResults;
+        batch.cUsers = cUsers;
+        batch.iNextUser = 0;
+        batch.cRemaining = static_cast<LONG>(cUsers);
+        batch.hDone = hDone;
+
+        // Submit one work item per user. Each item claims the next unclaimed index, so
+        // if submission fails part way the trailing users are the ones left out.
+        DWORD cSubmitted = 0;
+        for (; cSubmitted < cUsers; cSubmitted++)
+        {
+            if (!TrySubmitThreadpoolCallback(_PrefetchUserProperties, &batch, &environment))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                break;
+            }
+        }
+
+        if (cSubmitted < cUsers)
+        {
+            // Give up on the users no work item will claim; their streams are released below.
+            for (DWORD i = cSubmitted; i < cUsers; i++)
+            {
+                rghrResults[i] = hr;
+            }
+            LONG cUnsubmitted = static_cast<LONG>(cUsers - cSubmitted);
+            if (InterlockedExchangeAdd(&batch.cRemaining, -cUnsubmitted) == cUnsubmitted)
+            {
+                SetEvent(hDone);
+            }
+        }
+
+        if (cSubmitted > 0)
+        {
+            // Pump COM while waiting, in case a user's calls have to come back to this apartment.
+            DWORD dwIndex;
+            CoWaitForMultipleHandles(COWAIT_DEFAULT, INFINITE, 1, &hDone, &dwIndex);
+        }
+
+        DestroyThreadpoolEnvironment(&environment);
+
+        // Unmarshaling the users that were left out releases their marshal data.
+        for (DWORD i = cSubmitted; i < cUsers; i++)
+        {
+            if (rgpStreams[i] != nullptr)
+            {
+                ICredentialProviderUser *pcpUser;
+                if (SUCCEEDED(CoGetInterfaceAndReleaseStream(rgpStreams[i], IID_PPV_ARGS(&pcpUser))))
+                {
+                    pcpUser->Release();
+                }
+            }
+        }
+    }
+    else
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    if (pPool != nullptr)
+    {
+        CloseThreadpool(pPool);
+    }
+    if (hDone != nullptr)
+    {
+        CloseHandle(hDone);
+    }
+    CoTaskMemFree(rgpStreams);
+
+    return hr;
+}
@@ -0,0 +1,48 @@
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Reads the identity properties a tile displays from ICredentialProviderUser,
+// either for one user or for a whole batch of users in parallel.
+
+#pragma once
+
+#include <windows.h>
+#include <credentialprovider.h>
+
+// The identity properties of one user, as returned by ICredentialProviderUser.
+// The qualified user name is always set; the others are nullptr if the user does
+// not have the property. All strings are allocated with CoTaskMemAlloc.
+struct USER_PROPERTIES
+{
+    PWSTR   pszQualifiedUserName;
+    PWSTR   pszUserName;
+    PWSTR   pszDisplayName;
+    PWSTR   pszLogonStatus;
+};
+
+HRESULT UserPropertiesFetch(
+    _In_ ICredentialProviderUser *pcpUser,
+    _Out_ USER_PROPERTIES *pProperties
+    );
+
+void UserPropertiesFree(
+    _Inout_ USER_PROPERTIES *pProperties
+    );
+
+// Fetches the properties of every user on a private thread pool of at most
+// cMaxWorkers threads and returns once all reads have finished. The users are
+// marshaled to the pool's MTA threads, and the calling thread keeps pumping COM
+// while it waits, so this may be called from LogonUI's STA. rghrResults receives
+// the outcome for each user; rgProperties is only filled in where it succeeded.
+HRESULT UserPropertiesPrefetch(
+    _In_reads_(cUsers) ICredentialProviderUser * const *rgpUsers,
+    DWORD cUsers,
+    DWORD cMaxWorkers,
+    _Out_writes_(cUsers) USER_PROPERTIES *rgProperties,
+    _Out_writes_(cUsers) HRESULT *rghrResults
+    );
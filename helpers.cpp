@@ -11,8 +11,84 @@
 
 
 #include "helpers.h"
+#include "KerbPackedLayout.h"
+#include "AuthPackageResolver.h"
+#include "ProtectedSecretCache.h"
 #include <intsafe.h>
 
+// The packing itself is done by the portable core in KerbPackedLayout; the functions
+// here adapt the Windows types to it. wchar_t is UTF-16 on Windows, so strings are
+// handed over as they are.
+static_assert(sizeof(wchar_t) == sizeof(char16_t), "wchar_t holds UTF-16");
+
+#ifdef _WIN64
+static const KERB_PACKED_LAYOUT c_layoutNative = KERB_PACKED_LAYOUT_64;
+#else
+static const KERB_PACKED_LAYOUT c_layoutNative = KERB_PACKED_LAYOUT_32;
+#endif
+
+static KERB_STRING_VIEW _StringView(const UNICODE_STRING &rus)
+{
+    KERB_STRING_VIEW view = { reinterpret_cast<const char16_t*>(rus.Buffer), rus.Length / sizeof(wchar_t) };
+    return view;
+}
+
+static KERB_STRING_VIEW _StringView(_In_ PCWSTR pwz)
+{
+    KERB_STRING_VIEW view = { reinterpret_cast<const char16_t*>(pwz), wcslen(pwz) };
+    return view;
+}
+
+// The view must come from a string we were given, so its length already fits.
+static void _UnicodeStringFromView(const KERB_STRING_VIEW &view, _Out_ UNICODE_STRING *pus)
+{
+    pus->Length = static_cast<USHORT>(view.cch * sizeof(wchar_t));
+    pus->MaximumLength = pus->Length;
+    pus->Buffer = const_cast<PWSTR>(reinterpret_cast<PCWSTR>(view.pch));
+}
+
+static KERB_UNLOCK_LOGON_VIEW _LogonView(_In_ const KERB_INTERACTIVE_UNLOCK_LOGON &rkiul)
+{
+    KERB_UNLOCK_LOGON_VIEW logon;
+    logon.ulMessageType = static_cast<uint32_t>(rkiul.Logon.MessageType);
+    logon.ullLogonId = static_cast<uint64_t>(rkiul.LogonId.LowPart) | (static_cast<uint64_t>(static_cast<ULONG>(rkiul.LogonId.HighPart)) << 32);
+    logon.domain = _StringView(rkiul.Logon.LogonDomainName);
+    logon.userName = _StringView(rkiul.Logon.UserName);
+    logon.password = _StringView(rkiul.Logon.Password);
+    return logon;
+}
+
+//
+// Picks the MessageType for the usage scenario. CredPackAuthenticationBuffer could
+// pack the buffer too, but its MessageType is always KerbInteractiveLogon, which is
+// wrong for CPUS_UNLOCK_WORKSTATION, and casting its undocumented output to change
+// the MessageType would be unsupported.
+//
+static HRESULT _MessageTypeForScenario(_In_ CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus, _Out_ KERB_LOGON_SUBMIT_TYPE *pMessageType)
+{
+    HRESULT hr = S_OK;
+    switch (cpus)
+    {
+    case CPUS_UNLOCK_WORKSTATION:
+        *pMessageType = KerbWorkstationUnlockLogon;
+        break;
+
+    case CPUS_LOGON:
+        *pMessageType = KerbInteractiveLogon;
+        break;
+
+    case CPUS_CREDUI:
+        *pMessageType = (KERB_LOGON_SUBMIT_TYPE)0; // MessageType does not apply to CredUI
+        break;
+
+    default:
+        *pMessageType = (KERB_LOGON_SUBMIT_TYPE)0;
+        hr = E_FAIL;
+        break;
+    }
+    return hr;
+}
+
 //
 // Copies the field descriptor pointed to by rcpfd into a buffer allocated
 // using CoTaskMemAlloc. Returns that buffer in ppcpfd.
@@ -107,57 +183,36 @@ HRESULT UnicodeStringInitWithString(
     _Out_ UNICODE_STRING *pus
     )
 {
-    HRESULT hr;
-    if (pwz)
-    {
-        size_t lenString = wcslen(pwz);
-        USHORT usCharCount;
-        hr = SizeTToUShort(lenString, &usCharCount);
-        if (SUCCEEDED(hr))
-        {
-            USHORT usSize;
-            hr = SizeTToUShort(sizeof(wchar_t), &usSize);
-            if (SUCCEEDED(hr))
-            {
-                hr = UShortMult(usCharCount, usSize, &(pus->Length)); // Explicitly NOT including NULL terminator
-                if (SUCCEEDED(hr))
-                {
-                    pus->MaximumLength = pus->Length;
-                    pus->Buffer = pwz;
-                    hr = S_OK;
-                }
-                else
-                {
-                    hr = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
-                }
-            }
-        }
-    }
-    else
-    {
-        hr = E_INVALIDARG;
-    }
-    return hr;
+    return pwz ? UnicodeStringInitWithChars(pwz, wcslen(pwz), pus) : E_INVALIDARG;
 }
 
 //
-// The following function is intended to be used ONLY with the Kerb*Pack functions.  It does
-// no bounds-checking because its callers have precise requirements and are written to respect
-// its limitations.
-// You can read more about the UNICODE_STRING type at:
-// http://msdn.microsoft.com/library/default.asp?url=/library/en-us/secauthn/security/unicode_string.asp
+// Like UnicodeStringInitWithString, but for a run of characters inside a longer
+// string, such as the user name part of DOMAIN\user. Again, no storage is allocated.
 //
-static void _UnicodeStringPackedUnicodeStringCopy(
-    __in const UNICODE_STRING& rus,
-    __in PWSTR pwzBuffer,
-    __out UNICODE_STRING *pus
+HRESULT UnicodeStringInitWithChars(
+    _In_reads_(cch) PCWSTR pwch,
+    _In_ size_t cch,
+    _Out_ UNICODE_STRING *pus
     )
 {
-    pus->Length = rus.Length;
-    pus->MaximumLength = rus.Length;
-    pus->Buffer = pwzBuffer;
-
-    CopyMemory(pus->Buffer, rus.Buffer, pus->Length);
+    // Length is in bytes and has to fit a USHORT.
+    USHORT usCharCount;
+    HRESULT hr = SizeTToUShort(cch, &usCharCount);
+    if (SUCCEEDED(hr))
+    {
+        hr = UShortMult(usCharCount, sizeof(wchar_t), &(pus->Length));
+        if (SUCCEEDED(hr))
+        {
+            pus->MaximumLength = pus->Length;
+            pus->Buffer = const_cast<PWSTR>(pwch);
+        }
+        else
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+        }
+    }
+    return hr;
 }
 
 //
@@ -165,10 +220,6 @@ static void _UnicodeStringPackedUnicodeStringCopy(
 // passed-in strings.  This is useful if you will later use KerbInteractiveUnlockLogonPack
 // to serialize the structure.
 //
-// The password is stored in encrypted form for CPUS_LOGON and CPUS_UNLOCK_WORKSTATION
-// because the system can accept encrypted credentials.  It is not encrypted in CPUS_CREDUI
-// because we cannot know whether our caller can accept encrypted credentials.
-//
 HRESULT KerbInteractiveUnlockLogonInit(
     _In_ PWSTR pwzDomain,
     _In_ PWSTR pwzUsername,
@@ -182,18 +233,6 @@ HRESULT KerbInteractiveUnlockLogonInit(
 
     KERB_INTERACTIVE_LOGON *pkil = &kiul.Logon;
 
-    // Note: this method uses custom logic to pack a KERB_INTERACTIVE_UNLOCK_LOGON with a
-    // serialized credential.  We could replace the calls to UnicodeStringInitWithString
-    // and KerbInteractiveUnlockLogonPack with a single cal to CredPackAuthenticationBuffer,
-    // but that API has a drawback: it returns a KERB_INTERACTIVE_UNLOCK_LOGON whose
-    // MessageType is always KerbInteractiveLogon.
-    //
-    // If we only handled CPUS_LOGON, this drawback would not be a problem.  For
-    // CPUS_UNLOCK_WORKSTATION, we could cast the output buffer of CredPackAuthenticationBuffer
-    // to KERB_INTERACTIVE_UNLOCK_LOGON and modify the MessageType to KerbWorkstationUnlockLogon,
-    // but such a cast would be unsupported -- the output format of CredPackAuthenticationBuffer
-    // is not officially documented.
-
     // Initialize the UNICODE_STRINGS to share our username and password strings.
     HRESULT hr = UnicodeStringInitWithString(pwzDomain, &pkil->LogonDomainName);
     if (SUCCEEDED(hr))
@@ -204,29 +243,7 @@ HRESULT KerbInteractiveUnlockLogonInit(
             hr = UnicodeStringInitWithString(pwzPassword, &pkil->Password);
             if (SUCCEEDED(hr))
             {
-                // Set a MessageType based on the usage scenario.
-                switch (cpus)
-                {
-                case CPUS_UNLOCK_WORKSTATION:
-                    pkil->MessageType = KerbWorkstationUnlockLogon;
-                    hr = S_OK;
-                    break;
-
-                case CPUS_LOGON:
-                    pkil->MessageType = KerbInteractiveLogon;
-                    hr = S_OK;
-                    break;
-
-                case CPUS_CREDUI:
-                    pkil->MessageType = (KERB_LOGON_SUBMIT_TYPE)0; // MessageType does not apply to CredUI
-                    hr = S_OK;
-                    break;
-
-                default:
-                    hr = E_FAIL;
-                    break;
-                }
-
+                hr = _MessageTypeForScenario(cpus, &pkil->MessageType);
                 if (SUCCEEDED(hr))
                 {
                     // KERB_INTERACTIVE_UNLOCK_LOGON is just a series of structures.  A
@@ -265,56 +282,89 @@ HRESULT KerbInteractiveUnlockLogonPack(
     )
 {
     HRESULT hr;
+    *prgb = nullptr;
+    *pcb = 0;
 
-    const KERB_INTERACTIVE_LOGON *pkilIn = &rkiulIn.Logon;
-
-    // alloc space for struct plus extra for the three strings
-    DWORD cb = sizeof(rkiulIn) +
-        pkilIn->LogonDomainName.Length +
-        pkilIn->UserName.Length +
-        pkilIn->Password.Length;
-
-    KERB_INTERACTIVE_UNLOCK_LOGON *pkiulOut = (KERB_INTERACTIVE_UNLOCK_LOGON*)CoTaskMemAlloc(cb);
-    if (pkiulOut)
+    KERB_UNLOCK_LOGON_VIEW logon = _LogonView(rkiulIn);
+    size_t cb = KerbPackedUnlockLogonSize(c_layoutNative, logon);
+    if (cb != 0 && cb <= MAXDWORD)
     {
-        ZeroMemory(&pkiulOut->LogonId, sizeof(pkiulOut->LogonId));
-
-        //
-        // point pbBuffer at the beginning of the extra space
-        //
-        BYTE *pbBuffer = (BYTE*)pkiulOut + sizeof(*pkiulOut);
-
-        //
-        // set up the Logon structure within the KERB_INTERACTIVE_UNLOCK_LOGON
-        //
-        KERB_INTERACTIVE_LOGON *pkilOut = &pkiulOut->Logon;
-
-        pkilOut->MessageType = pkilIn->MessageType;
-
-        //
-        // copy each string,
-        // fix up appropriate buffer pointer to be offset,
-        // advance buffer pointer over copied characters in extra space
-        //
-        _UnicodeStringPackedUnicodeStringCopy(pkilIn->LogonDomainName, (PWSTR)pbBuffer, &pkilOut->LogonDomainName);
-        pkilOut->LogonDomainName.Buffer = (PWSTR)(pbBuffer - (BYTE*)pkiulOut);
-        pbBuffer += pkilOut->LogonDomainName.Length;
-
-        _UnicodeStringPackedUnicodeStringCopy(pkilIn->UserName, (PWSTR)pbBuffer, &pkilOut->UserName);
-        pkilOut->UserName.Buffer = (PWSTR)(pbBuffer - (BYTE*)pkiulOut);
-        pbBuffer += pkilOut->UserName.Length;
-
-        _UnicodeStringPackedUnicodeStringCopy(pkilIn->Password, (PWSTR)pbBuffer, &pkilOut->Password);
-        pkilOut->Password.Buffer = (PWSTR)(pbBuffer - (BYTE*)pkiulOut);
+        BYTE *pb = (BYTE*)CoTaskMemAlloc(cb);
+        if (pb)
+        {
+            KerbPackedUnlockLogonPack(c_layoutNative, logon, pb, cb);
+            *prgb = pb;
+            *pcb = static_cast<DWORD>(cb);
+            hr = S_OK;
+        }
+        else
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+    else
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+    }
 
-        *prgb = (BYTE*)pkiulOut;
-        *pcb = cb;
+    return hr;
+}
 
-        hr = S_OK;
+//
+// Computes the size KerbInteractiveUnlockLogonPackInto needs for the three strings:
+// the structure followed by the characters of each, without terminators.
+//
+HRESULT KerbInteractiveUnlockLogonGetPackedSize(
+    _In_ const UNICODE_STRING &rusDomain,
+    _In_ const UNICODE_STRING &rusUsername,
+    _In_ const UNICODE_STRING &rusPassword,
+    _Out_ DWORD *pcb
+    )
+{
+    KERB_UNLOCK_LOGON_VIEW logon = {};
+    logon.domain = _StringView(rusDomain);
+    logon.userName = _StringView(rusUsername);
+    logon.password = _StringView(rusPassword);
+
+    // A string longer than a UNICODE_STRING can describe has no packed size.
+    size_t cb = KerbPackedUnlockLogonSize(c_layoutNative, logon);
+    if (cb == 0 || cb > MAXDWORD)
+    {
+        *pcb = 0;
+        return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
     }
-    else
+    *pcb = static_cast<DWORD>(cb);
+    return S_OK;
+}
+
+//
+// Writes the packed form directly from the three strings, without building an
+// unpacked structure first. pb must hold exactly the size from
+// KerbInteractiveUnlockLogonGetPackedSize, so the caller can allocate the buffer
+// LogonUI takes ownership of and have it filled in one pass.
+//
+HRESULT KerbInteractiveUnlockLogonPackInto(
+    _In_ const UNICODE_STRING &rusDomain,
+    _In_ const UNICODE_STRING &rusUsername,
+    _In_ const UNICODE_STRING &rusPassword,
+    _In_ CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    _Out_writes_bytes_(cb) BYTE *pb,
+    _In_ DWORD cb
+    )
+{
+    KERB_LOGON_SUBMIT_TYPE messageType;
+    HRESULT hr = _MessageTypeForScenario(cpus, &messageType);
+    if (SUCCEEDED(hr))
     {
-        hr = E_OUTOFMEMORY;
+        KERB_UNLOCK_LOGON_VIEW logon = {};
+        logon.ulMessageType = static_cast<uint32_t>(messageType);
+        logon.domain = _StringView(rusDomain);
+        logon.userName = _StringView(rusUsername);
+        logon.password = _StringView(rusPassword);
+        if (!KerbPackedUnlockLogonPack(c_layoutNative, logon, pb, cb))
+        {
+            hr = E_INVALIDARG;
+        }
     }
 
     return hr;
@@ -380,78 +430,8 @@ HRESULT RetrieveNegotiateAuthPackage(_Out_ ULONG *pulAuthPackage)
 }
 
 //
-// Return a copy of pwzToProtect encrypted with the CredProtect API.
-//
-// pwzToProtect must not be NULL or the empty string.
-//
-static HRESULT _ProtectAndCopyString(
-    _In_ PCWSTR pwzToProtect,
-    _Outptr_result_nullonfailure_ PWSTR *ppwzProtected
-    )
-{
-    *ppwzProtected = nullptr;
-
-    // pwzToProtect is const, but CredProtect takes a non-const string.
-    // So, make a copy that we know isn't const.
-    PWSTR pwzToProtectCopy;
-    HRESULT hr = SHStrDupW(pwzToProtect, &pwzToProtectCopy);
-    if (SUCCEEDED(hr))
-    {
-        // The first call to CredProtect determines the length of the encrypted string.
-        // Because we pass a NULL output buffer, we expect the call to fail.
-        //
-        // Note that the third parameter to CredProtect, the number of characters of pwzToProtectCopy
-        // to encrypt, must include the NULL terminator!
-        DWORD cchProtected = 0;
-        if (!CredProtectW(FALSE, pwzToProtectCopy, (DWORD)wcslen(pwzToProtectCopy)+1, nullptr, &cchProtected, nullptr))
-        {
-            DWORD dwErr = GetLastError();
-
-            if ((ERROR_INSUFFICIENT_BUFFER == dwErr) && (0 < cchProtected))
-            {
-                // Allocate a buffer long enough for the encrypted string.
-                PWSTR pwzProtected = (PWSTR)CoTaskMemAlloc(cchProtected * sizeof(wchar_t));
-                if (pwzProtected)
-                {
-                    // The second call to CredProtect actually encrypts the string.
-                    if (CredProtectW(FALSE, pwzToProtectCopy, (DWORD)wcslen(pwzToProtectCopy)+1, pwzProtected, &cchProtected, nullptr))
-                    {
-                        *ppwzProtected = pwzProtected;
-                        hr = S_OK;
-                    }
-                    else
-                    {
-                        CoTaskMemFree(pwzProtected);
-
-                        dwErr = GetLastError();
-                        hr = HRESULT_FROM_WIN32(dwErr);
-                    }
-                }
-                else
-                {
-                    hr = E_OUTOFMEMORY;
-                }
-            }
-            else
-            {
-                hr = HRESULT_FROM_WIN32(dwErr);
-            }
-        }
-        else
-        {
-            hr = E_UNEXPECTED;
-        }
-
-        CoTaskMemFree(pwzToProtectCopy);
-    }
-
-    return hr;
-}
-
-//
-// If pwzPassword should be encrypted, return a copy encrypted with CredProtect.
-//
-// If not, just return a copy.
+// If pwzPassword should be encrypted, return an arena slot holding it encrypted with
+// CredProtect. If not, just return a slot holding a copy.
 //
 HRESULT ProtectIfNecessaryAndCopyPassword(
     _In_ PCWSTR pwzPassword,
@@ -461,49 +441,29 @@ HRESULT ProtectIfNecessaryAndCopyPassword(
 {
     *ppwzProtectedPassword = nullptr;
 
-    HRESULT hr;
-
-    // ProtectAndCopyString is intended for non-empty strings only.  Empty passwords
-    // do not need to be encrypted.
-    if (pwzPassword && *pwzPassword)
+    // pwzPassword is const, but CredIsProtected and CredProtect take a non-const
+    // string, so copy it into a slot first.
+    CSecretArena &arena = CSecretArena::Instance();
+    PWSTR pwzPasswordCopy = nullptr;
+    HRESULT hr = arena.Allocate(&pwzPasswordCopy);
+    if (SUCCEEDED(hr) && pwzPassword)
     {
-        // pwzPassword is const, but CredIsProtected takes a non-const string.
-        // So, ake a copy that we know isn't const.
-        PWSTR pwzPasswordCopy;
-        hr = SHStrDupW(pwzPassword, &pwzPasswordCopy);
-        if (SUCCEEDED(hr))
-        {
-            bool bCredAlreadyEncrypted = false;
-            CRED_PROTECTION_TYPE protectionType;
-
-            // If the password is already encrypted, we should not encrypt it again.
-            // An encrypted password may be received through SetSerialization in the
-            // CPUS_LOGON scenario during a Terminal Services connection, for instance.
-            if (CredIsProtectedW(pwzPasswordCopy, &protectionType))
-            {
-                if (CredUnprotected != protectionType)
-                {
-                    bCredAlreadyEncrypted = true;
-                }
-            }
+        hr = arena.CopyInto(pwzPasswordCopy, pwzPassword);
+    }
 
-            // Passwords should not be encrypted in the CPUS_CREDUI scenario.  We
-            // cannot know if our caller expects or can handle an encryped password.
-            if (CPUS_CREDUI == cpus || bCredAlreadyEncrypted)
-            {
-                hr = SHStrDupW(pwzPasswordCopy, ppwzProtectedPassword);
-            }
-            else
-            {
-                hr = _ProtectAndCopyString(pwzPasswordCopy, ppwzProtectedPassword);
-            }
+    // Without a user SID the protected form is not cached.
+    if (SUCCEEDED(hr))
+    {
+        hr = CProtectedSecretCache::Instance().Protect(nullptr, cpus, 0, pwzPasswordCopy);
+    }
 
-            CoTaskMemFree(pwzPasswordCopy);
-        }
+    if (SUCCEEDED(hr))
+    {
+        *ppwzProtectedPassword = pwzPasswordCopy;
     }
     else
     {
-        hr = SHStrDupW(L"", ppwzProtectedPassword);
+        arena.Free(pwzPasswordCopy);
     }
 
     return hr;
@@ -519,34 +479,22 @@ void KerbInteractiveUnlockLogonUnpackInPlace(
     DWORD cb
     )
 {
-    if (sizeof(*pkiul) <= cb)
+    // Only a buffer whose offsets all fall within cb is taken to be a packed credential.
+    KERB_UNLOCK_LOGON_VIEW logon;
+    if (KerbPackedUnlockLogonUnpack(c_layoutNative, (const BYTE*)pkiul, cb, &logon))
     {
         KERB_INTERACTIVE_LOGON *pkil = &pkiul->Logon;
-
-        // Sanity check: if the range described by each (Buffer + MaximumSize) falls within the total bytecount,
-        // we can be pretty confident that the Buffers are actually offsets and that this is a packed credential.
-        if (((ULONG_PTR)pkil->LogonDomainName.Buffer + pkil->LogonDomainName.MaximumLength <= cb) &&
-            ((ULONG_PTR)pkil->UserName.Buffer + pkil->UserName.MaximumLength <= cb) &&
-            ((ULONG_PTR)pkil->Password.Buffer + pkil->Password.MaximumLength <= cb))
-        {
-            pkil->LogonDomainName.Buffer = pkil->LogonDomainName.Buffer
-                ? (PWSTR)((BYTE*)pkiul + (ULONG_PTR)pkil->LogonDomainName.Buffer)
-                : nullptr;
-
-            pkil->UserName.Buffer = pkil->UserName.Buffer
-                ? (PWSTR)((BYTE*)pkiul + (ULONG_PTR)pkil->UserName.Buffer)
-                : nullptr;
-
-            pkil->Password.Buffer = pkil->Password.Buffer
-                ? (PWSTR)((BYTE*)pkiul + (ULONG_PTR)pkil->Password.Buffer)
-                : nullptr;
-        }
+        _UnicodeStringFromView(logon.domain, &pkil->LogonDomainName);
+        _UnicodeStringFromView(logon.userName, &pkil->UserName);
+        _UnicodeStringFromView(logon.password, &pkil->Password);
     }
 }
 
 //
-// Use the CredPackAuthenticationBuffer and CredUnpackAuthenticationBuffer to convert a 32 bit WOW
-// cred blob into a 64 bit native blob by unpacking it and immediately repacking it.
+// Convert a 32 bit WOW cred blob into a 64 bit native blob. The layouts differ only in
+// the size of the string pointers, so the structure is converted field by field and the
+// strings copied into one LocalAlloc, without unpacking and repacking through CredUI.
+// The message type and logon id are kept.
 //
 HRESULT KerbInteractiveUnlockLogonRepackNative(
     _In_reads_bytes_(cbWow) BYTE *rgbWow,
@@ -555,64 +503,37 @@ HRESULT KerbInteractiveUnlockLogonRepackNative(
     _Out_ DWORD *pcbNative
     )
 {
-    HRESULT hr = E_OUTOFMEMORY;
-    PWSTR pszDomainUsername = nullptr;
-    DWORD cchDomainUsername = 0;
-    PWSTR pszPassword = nullptr;
-    DWORD cchPassword = 0;
+#ifdef _WIN64
+    static_assert(sizeof(KERB_INTERACTIVE_UNLOCK_LOGON) == sizeof(KERB_PACKED_UNLOCK_LOGON64), "native packed logon layout");
+#endif
 
+    HRESULT hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
     *prgbNative = nullptr;
     *pcbNative = 0;
 
-    // Unpack the 32 bit KERB structure
-    CredUnPackAuthenticationBufferW(CRED_PACK_WOW_BUFFER, rgbWow, cbWow, pszDomainUsername, &cchDomainUsername, nullptr, nullptr, pszPassword, &cchPassword);
-    if (ERROR_INSUFFICIENT_BUFFER == GetLastError())
+    size_t cbNative = KerbPackedUnlockLogonWowToNativeSize(rgbWow, cbWow);
+    if (cbNative != 0)
     {
-        pszDomainUsername = (PWSTR) LocalAlloc(0, cchDomainUsername * sizeof(wchar_t));
-        if (pszDomainUsername)
+        BYTE *pbNative = (BYTE*) LocalAlloc(0, cbNative);
+        if (pbNative)
         {
-            pszPassword = (PWSTR) LocalAlloc(0, cchPassword * sizeof(wchar_t));
-            if (pszPassword)
+            // The size came from the same validation, so this only fails on a bug.
+            if (KerbPackedUnlockLogonWowToNative(rgbWow, cbWow, pbNative, cbNative))
             {
-                if (CredUnPackAuthenticationBufferW(CRED_PACK_WOW_BUFFER, rgbWow, cbWow, pszDomainUsername, &cchDomainUsername, nullptr, nullptr, pszPassword, &cchPassword))
-                {
-                    hr = S_OK;
-                }
-                else
-                {
-                    hr = GetLastError();
-                }
+                *prgbNative = pbNative;
+                *pcbNative = static_cast<DWORD>(cbNative);
+                hr = S_OK;
             }
-        }
-    }
-
-    // Repack native
-    if (SUCCEEDED(hr))
-    {
-        hr = E_OUTOFMEMORY;
-        CredPackAuthenticationBufferW(0, pszDomainUsername, pszPassword, *prgbNative, pcbNative);
-        if (ERROR_INSUFFICIENT_BUFFER == GetLastError())
-        {
-            *prgbNative = (BYTE*) LocalAlloc(LMEM_ZEROINIT, *pcbNative);
-            if (*prgbNative)
+            else
             {
-                if (CredPackAuthenticationBufferW(0, pszDomainUsername, pszPassword, *prgbNative, pcbNative))
-                {
-                    hr = S_OK;
-                }
-                else
-                {
-                    LocalFree(*prgbNative);
-                }
+                LocalFree(pbNative);
+                hr = E_UNEXPECTED;
             }
         }
-    }
-
-    LocalFree(pszDomainUsername);
-    if (pszPassword)
-    {
-        SecureZeroMemory(pszPassword, cchPassword * sizeof(wchar_t));
-        LocalFree(pszPassword);
+        else
+        {
+            hr = E_OUTOFMEMORY;
+        }
     }
     return hr;
 }
@@ -626,22 +547,16 @@ HRESULT DomainUsernameStringAlloc(
 {
     HRESULT hr;
     *ppwszDomainUsername = nullptr;
-    size_t cchDomain = wcslen(pwszDomain);
-    size_t cchUsername = wcslen(pwszUsername);
+    KERB_STRING_VIEW domain = _StringView(pwszDomain);
+    KERB_STRING_VIEW userName = _StringView(pwszUsername);
     // Length of domain, 1 character for '\', length of Username, plus null terminator.
-    size_t cbLen = sizeof(wchar_t) * (cchDomain + 1 + cchUsername +1);
-    PWSTR pwszDest = (PWSTR)HeapAlloc(GetProcessHeap(), 0, cbLen);
+    size_t cchLen = KerbJoinQualifiedUserName(domain, userName, nullptr, 0);
+    PWSTR pwszDest = (PWSTR)HeapAlloc(GetProcessHeap(), 0, cchLen * sizeof(wchar_t));
     if (pwszDest)
     {
-        hr = StringCbPrintfW(pwszDest, cbLen, L"%s\\%s", pwszDomain, pwszUsername);
-        if (SUCCEEDED(hr))
-        {
-            *ppwszDomainUsername = pwszDest;
-        }
-        else
-        {
-            HeapFree(GetProcessHeap(), 0, pwszDest);
-        }
+        KerbJoinQualifiedUserName(domain, userName, reinterpret_cast<char16_t*>(pwszDest), cchLen);
+        *ppwszDomainUsername = pwszDest;
+        hr = S_OK;
     }
     else
     {
@@ -656,55 +571,75 @@ HRESULT SplitDomainAndUsername(_In_ PCWSTR pszQualifiedUserName, _Outptr_result_
     HRESULT hr = E_UNEXPECTED;
     *ppszDomain = nullptr;
     *ppszUsername = nullptr;
-    PWSTR pszDomain;
-    PWSTR pszUsername;
-    const wchar_t *pchWhack = wcschr(pszQualifiedUserName, L'\\');
-    const wchar_t *pchEnd = pszQualifiedUserName + wcslen(pszQualifiedUserName) - 1;
 
-    if (pchWhack != nullptr)
+    KERB_STRING_VIEW domain;
+    KERB_STRING_VIEW userName;
+    if (KerbSplitQualifiedUserName(_StringView(pszQualifiedUserName), &domain, &userName))
     {
-        const wchar_t *pchDomainBegin = pszQualifiedUserName;
-        const wchar_t *pchDomainEnd = pchWhack - 1;
-        const wchar_t *pchUsernameBegin = pchWhack + 1;
-        const wchar_t *pchUsernameEnd = pchEnd;
-
-        size_t lenDomain = pchDomainEnd - pchDomainBegin + 1; // number of actual chars, NOT INCLUDING null terminated string
-        pszDomain = static_cast<PWSTR>(CoTaskMemAlloc(sizeof(wchar_t) * (lenDomain + 1)));
-        if (pszDomain != nullptr)
+        PWSTR pszDomain = static_cast<PWSTR>(CoTaskMemAlloc(sizeof(wchar_t) * (domain.cch + 1)));
+        PWSTR pszUsername = static_cast<PWSTR>(CoTaskMemAlloc(sizeof(wchar_t) * (userName.cch + 1)));
+        if (pszDomain != nullptr && pszUsername != nullptr)
         {
-            hr = StringCchCopyN(pszDomain, lenDomain + 1, pchDomainBegin, lenDomain);
-            if (SUCCEEDED(hr))
-            {
-                size_t lenUsername = pchUsernameEnd - pchUsernameBegin + 1; // number of actual chars, NOT INCLUDING null terminated string
-                pszUsername = static_cast<PWSTR>(CoTaskMemAlloc(sizeof(wchar_t) * (lenUsername + 1)));
-                if (pszUsername != nullptr)
-                {
-                    hr = StringCchCopyN(pszUsername, lenUsername + 1, pchUsernameBegin, lenUsername);
-                    if (SUCCEEDED(hr))
-                    {
-                        *ppszDomain = pszDomain;
-                        *ppszUsername = pszUsername;
-                    }
-                    else
-                    {
-                        CoTaskMemFree(pszUsername);
-                    }
-                }
-                else
-                {
-                    hr = E_OUTOFMEMORY;
-                }
-            }
-
-            if (FAILED(hr))
-            {
-                CoTaskMemFree(pszDomain);
-            }
+            StringCchCopyN(pszDomain, domain.cch + 1, reinterpret_cast<PCWSTR>(domain.pch), domain.cch);
+            StringCchCopyN(pszUsername, userName.cch + 1, reinterpret_cast<PCWSTR>(userName.pch), userName.cch);
+            *ppszDomain = pszDomain;
+            *ppszUsername = pszUsername;
+            hr = S_OK;
         }
         else
         {
+            CoTaskMemFree(pszDomain);
+            CoTaskMemFree(pszUsername);
             hr = E_OUTOFMEMORY;
         }
     }
     return hr;
-}
\ No newline at end of file
+}
+
+//
+// Splits DOMAIN\user into weak references to its two parts. Nothing is allocated;
+// the results are only valid while pszQualifiedUserName is.
+//
+HRESULT SplitDomainAndUsernameInPlace(_In_ PCWSTR pszQualifiedUserName, _Out_ UNICODE_STRING *pusDomain, _Out_ UNICODE_STRING *pusUsername)
+{
+    HRESULT hr = E_UNEXPECTED;
+    ZeroMemory(pusDomain, sizeof(*pusDomain));
+    ZeroMemory(pusUsername, sizeof(*pusUsername));
+
+    KERB_STRING_VIEW domain;
+    KERB_STRING_VIEW userName;
+    if (KerbSplitQualifiedUserName(_StringView(pszQualifiedUserName), &domain, &userName))
+    {
+        hr = UnicodeStringInitWithChars(reinterpret_cast<PCWSTR>(domain.pch), domain.cch, pusDomain);
+        if (SUCCEEDED(hr))
+        {
+            hr = UnicodeStringInitWithChars(reinterpret_cast<PCWSTR>(userName.pch), userName.cch, pusUsername);
+        }
+    }
+    return hr;
+}
+
+HRESULT CLsaAuthPackageSource::LookupNegotiatePackage(_Out_ ULONG *pulAuthPackage)
+{
+    return RetrieveNegotiateAuthPackage(pulAuthPackage);
+}
+
+HRESULT CCredProtectSecretProtector::IsProtected(_In_ PWSTR pszSecret, _Out_ bool *pfProtected)
+{
+    // A secret CredIsProtected cannot classify is treated as plain text.
+    CRED_PROTECTION_TYPE protectionType;
+    *pfProtected = CredIsProtectedW(pszSecret, &protectionType) && (CredUnprotected != protectionType);
+    return S_OK;
+}
+
+HRESULT CCredProtectSecretProtector::Protect(_In_ PWSTR pszSecret, _Out_writes_(c_cchSecretSlot) PWSTR pszProtected)
+{
+    // The protected form is several times longer than the password, so a long
+    // password may not fit in the slot; CredProtect then fails with
+    // ERROR_INSUFFICIENT_BUFFER and the cache falls back to the plain password.
+    // Note that the third parameter to CredProtect, the number of characters of
+    // pszSecret to encrypt, must include the NULL terminator!
+    DWORD cchProtected = c_cchSecretSlot;
+    return CredProtectW(FALSE, pszSecret, (DWORD)wcslen(pszSecret)+1, pszProtected, &cchProtected, nullptr) ?
+        S_OK : HRESULT_FROM_WIN32(GetLastError());
+}
@@ -52,6 +52,13 @@ HRESULT UnicodeStringInitWithString(
     _Out_ UNICODE_STRING *pus
     );
 
+//creates a UNICODE_STRING that refers to cch characters at pwch, which need not be NULL-terminated
+HRESULT UnicodeStringInitWithChars(
+    _In_reads_(cch) PCWSTR pwch,
+    _In_ size_t cch,
+    _Out_ UNICODE_STRING *pus
+    );
+
 //initializes a KERB_INTERACTIVE_UNLOCK_LOGON with weak references to the provided credentials
 HRESULT KerbInteractiveUnlockLogonInit(
     _In_ PWSTR pwzDomain,
@@ -68,12 +75,31 @@ HRESULT KerbInteractiveUnlockLogonPack(
     _Out_ DWORD *pcb
     );
 
+//computes the exact size of the packed KERB_INTERACTIVE_UNLOCK_LOGON for the given strings
+HRESULT KerbInteractiveUnlockLogonGetPackedSize(
+    _In_ const UNICODE_STRING &rusDomain,
+    _In_ const UNICODE_STRING &rusUsername,
+    _In_ const UNICODE_STRING &rusPassword,
+    _Out_ DWORD *pcb
+    );
+
+//packs the credentials in one pass into a caller-provided buffer of the size computed above
+HRESULT KerbInteractiveUnlockLogonPackInto(
+    _In_ const UNICODE_STRING &rusDomain,
+    _In_ const UNICODE_STRING &rusUsername,
+    _In_ const UNICODE_STRING &rusPassword,
+    _In_ CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
+    _Out_writes_bytes_(cb) BYTE *pb,
+    _In_ DWORD cb
+    );
+
 //get the authentication package that will be used for our logon attempt
 HRESULT RetrieveNegotiateAuthPackage(
     _Out_ ULONG *pulAuthPackage
     );
 
-//encrypt a password (if necessary) and copy it; if not, just copy it
+//encrypt a password (if necessary) into a secret arena slot; if not, just copy it there.
+//free the result with CSecretArena::Free
 HRESULT ProtectIfNecessaryAndCopyPassword(
     _In_ PCWSTR pwzPassword,
     _In_ CREDENTIAL_PROVIDER_USAGE_SCENARIO cpus,
@@ -98,4 +124,7 @@ HRESULT DomainUsernameStringAlloc(
     _Outptr_result_nullonfailure_ PWSTR *ppwszDomainUsername
     );
 
-HRESULT SplitDomainAndUsername(_In_ PCWSTR pszQualifiedUserName, _Outptr_result_nullonfailure_ PWSTR *ppszDomain, _Outptr_result_nullonfailure_ PWSTR *ppszUsername);
\ No newline at end of file
+HRESULT SplitDomainAndUsername(_In_ PCWSTR pszQualifiedUserName, _Outptr_result_nullonfailure_ PWSTR *ppszDomain, _Outptr_result_nullonfailure_ PWSTR *ppszUsername);
+
+//like SplitDomainAndUsername, but returns weak references into pszQualifiedUserName instead of copies
+HRESULT SplitDomainAndUsernameInPlace(_In_ PCWSTR pszQualifiedUserName, _Out_ UNICODE_STRING *pusDomain, _Out_ UNICODE_STRING *pusUsername);